@@ -1,6 +1,6 @@
 #pragma once
 #include "KObject.h"
-#include "khandle.h"
+#include "KHandle.h"
 class KFRAMEWORK_API KEvent :
 	public KObject, public KHandle
 {
@@ -0,0 +1,148 @@
+#pragma once
+#include <assert.h>
+#include <string.h>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <thread>
+
+// Lock-free queue of frame buffers between one producer thread (the emulation)
+// and one consumer thread (the presenter). Header only and free of Win32 so
+// it builds wherever the emulator core does.
+//
+// The producer never waits: a full queue rejects the frame. The consumer
+// spins briefly, then yields, then sleeps on a condition variable that the
+// producer only touches while the consumer is asleep.
+class KFrameQueue
+{
+public:
+	KFrameQueue(const size_t frameSize,const int count):
+		m_nFrameSize(frameSize),m_nSlots(count+1),m_head(0),m_tail(0),m_fSleeping(false),m_fCancelled(false)
+	{
+		assert(frameSize>0 && count>=1);
+		m_pFrames=new unsigned char[m_nFrameSize*m_nSlots];
+	}
+	~KFrameQueue()
+	{
+		delete[] m_pFrames;
+	}
+
+	size_t getFrameSize() const {return m_nFrameSize;}
+	int getCapacity() const {return m_nSlots-1;}
+
+	// either side
+	bool empty() const {return m_head.load(std::memory_order_acquire)==m_tail.load(std::memory_order_acquire);}
+	int size() const
+	{
+		const int n=(int)m_tail.load(std::memory_order_acquire)-(int)m_head.load(std::memory_order_acquire);
+		return (n<0)?n+m_nSlots:n;
+	}
+
+	/* Producer */
+
+	// the slot to fill next, NULL when the queue is full
+	unsigned char* back()
+	{
+		const unsigned tail=m_tail.load(std::memory_order_relaxed);
+		if (next(tail)==m_head.load(std::memory_order_acquire)) return NULL;
+		return slot(tail);
+	}
+
+	// publishes the slot returned by back()
+	void commit()
+	{
+		const unsigned tail=m_tail.load(std::memory_order_relaxed);
+		assert(next(tail)!=m_head.load(std::memory_order_acquire));
+		m_tail.store(next(tail),std::memory_order_seq_cst);
+		notify();
+	}
+
+	// copies a frame, false when the queue is full
+	bool push(const void* frame)
+	{
+		unsigned char* p=back();
+		if (p==NULL) return false;
+		memcpy(p,frame,m_nFrameSize);
+		commit();
+		return true;
+	}
+
+	/* Consumer */
+
+	// the oldest frame, NULL when the queue is empty
+	const unsigned char* front() const
+	{
+		const unsigned head=m_head.load(std::memory_order_relaxed);
+		if (head==m_tail.load(std::memory_order_acquire)) return NULL;
+		return slot(head);
+	}
+
+	// releases the frame returned by front()
+	void pop()
+	{
+		const unsigned head=m_head.load(std::memory_order_relaxed);
+		assert(head!=m_tail.load(std::memory_order_acquire));
+		m_head.store(next(head),std::memory_order_release);
+	}
+
+	// waits until a frame is queued, false on timeout or after cancel()
+	bool wait(const unsigned milliseconds)
+	{
+		for (int i=0;i<SPIN_COUNT;i++)
+		{
+			if (m_fCancelled.load()) return false;
+			if (!empty()) return true;
+			if (i>=SPIN_COUNT/2) std::this_thread::yield();
+		}
+
+		std::unique_lock<std::mutex> lock(m_mtx);
+		m_fSleeping.store(true,std::memory_order_seq_cst);
+		// the producer checks m_fSleeping after publishing, so a frame queued
+		// from here on always notifies
+		const bool ready=m_cv.wait_for(lock,std::chrono::milliseconds(milliseconds),[this]{return m_tail.load()!=m_head.load() || m_fCancelled.load();});
+		m_fSleeping.store(false,std::memory_order_relaxed);
+		return ready && !m_fCancelled.load() && !empty();
+	}
+
+	// wakes up the consumer for good, e.g. on shutdown
+	void cancel()
+	{
+		m_fCancelled.store(true);
+		std::lock_guard<std::mutex> lock(m_mtx);
+		m_cv.notify_all();
+	}
+	bool cancelled() const {return m_fCancelled.load();}
+
+private:
+	enum {SPIN_COUNT=64};
+
+	const size_t m_nFrameSize;
+	const int m_nSlots; // one stays free to tell a full queue from an empty one
+	unsigned char* m_pFrames;
+
+	// each index is written by one side only, keep them on separate cache lines
+	std::atomic<unsigned> m_head;
+	char m_padding[64];
+	std::atomic<unsigned> m_tail;
+
+	std::atomic<bool> m_fSleeping;
+	std::atomic<bool> m_fCancelled;
+	std::mutex m_mtx;
+	std::condition_variable m_cv;
+
+	unsigned next(const unsigned idx) const {return (idx+1)%m_nSlots;}
+	unsigned char* slot(const unsigned idx) const {return m_pFrames+idx*m_nFrameSize;}
+
+	void notify()
+	{
+		if (m_fSleeping.load(std::memory_order_seq_cst))
+		{
+			std::lock_guard<std::mutex> lock(m_mtx);
+			m_cv.notify_one();
+		}
+	}
+
+	KFrameQueue(const KFrameQueue&);
+	KFrameQueue& operator=(const KFrameQueue&);
+};
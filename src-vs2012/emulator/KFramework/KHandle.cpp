@@ -26,7 +26,7 @@ KHandle::~KHandle(void)
 		if (CloseHandle(m_Handle))
 			InterlockedDecrement(&g_cntHandles);
 	}
-	const_cast<HANDLE>(m_Handle)=NULL;
+	const_cast<HANDLE&>(m_Handle)=NULL;
 }
 
 void KHandle::hdl_atExit(void)
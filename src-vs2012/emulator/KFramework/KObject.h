@@ -25,6 +25,9 @@ private:
 	const clock_t m_timeCreation;
 };
 
+// the emulator core has its own, whichever comes first wins
+#ifndef HAVE_SAFE_DELETE
+#define HAVE_SAFE_DELETE
 template <class T>
 void SAFE_DELETE(T* &p)
 {
@@ -32,6 +35,7 @@ void SAFE_DELETE(T* &p)
 	delete p;
 	p=NULL;
 }
+#endif
 
 
 #ifndef SAFE_RELEASE
@@ -0,0 +1,285 @@
+#include "stdafx.h"
+#include "KFramework.h"
+
+#ifndef _WIN32
+
+#include <errno.h>
+#include <atomic>
+#include <thread>
+#include <chrono>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+// blocks while *word==expected, up to the timeout. may return spuriously.
+static void futexWait(int* word, const int expected, const DWORD milliseconds)
+{
+#ifdef __linux__
+	timespec ts;
+	timespec* timeout=NULL;
+	if (milliseconds!=INFINITE)
+	{
+		ts.tv_sec=milliseconds/1000;
+		ts.tv_nsec=(long)(milliseconds%1000)*1000000;
+		timeout=&ts;
+	}
+	syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, expected, timeout, NULL, 0);
+#else
+	// no futex, poll
+	if (__atomic_load_n(word, __ATOMIC_ACQUIRE)==expected)
+		std::this_thread::sleep_for(std::chrono::milliseconds(milliseconds==0?0:1));
+#endif
+}
+
+static void futexWake(int* word, const int count)
+{
+#ifdef __linux__
+	syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+#endif
+}
+
+static long long nowMs()
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* Critical sections */
+
+void InitializeCriticalSection(CRITICAL_SECTION* cs)
+{
+	cs->state=0;
+	cs->owner=0;
+	cs->recursion=0;
+}
+
+void DeleteCriticalSection(CRITICAL_SECTION* cs)
+{
+	assert(cs->state==0);
+}
+
+BOOL TryEnterCriticalSection(CRITICAL_SECTION* cs)
+{
+	const DWORD self=GetCurrentThreadId();
+	if (__atomic_load_n(&cs->owner, __ATOMIC_RELAXED)==self)
+	{
+		cs->recursion++;
+		return TRUE;
+	}
+	int expected=0;
+	if (!__atomic_compare_exchange_n(&cs->state, &expected, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) return FALSE;
+	__atomic_store_n(&cs->owner, self, __ATOMIC_RELAXED);
+	cs->recursion=1;
+	return TRUE;
+}
+
+void EnterCriticalSection(CRITICAL_SECTION* cs)
+{
+	if (TryEnterCriticalSection(cs)) return;
+
+	// mark the lock contended and sleep until the owner leaves
+	while (__atomic_exchange_n(&cs->state, 2, __ATOMIC_ACQUIRE)!=0)
+	{
+		futexWait(&cs->state, 2, INFINITE);
+	}
+	__atomic_store_n(&cs->owner, GetCurrentThreadId(), __ATOMIC_RELAXED);
+	cs->recursion=1;
+}
+
+void LeaveCriticalSection(CRITICAL_SECTION* cs)
+{
+	assert(cs->owner==GetCurrentThreadId() && cs->recursion>0);
+	if (--cs->recursion>0) return;
+	__atomic_store_n(&cs->owner, 0, __ATOMIC_RELAXED);
+	if (__atomic_exchange_n(&cs->state, 0, __ATOMIC_RELEASE)==2)
+		futexWake(&cs->state, 1);
+}
+
+/* Handles */
+
+struct KWaitObject
+{
+	virtual ~KWaitObject() {}
+	virtual bool wait(const DWORD milliseconds)=0;
+};
+
+struct KEventObject : public KWaitObject
+{
+	const bool manualReset;
+	int signaled;
+	int pulses; // futex word, changes on every set and pulse
+
+	KEventObject(const bool manual, const bool initial): manualReset(manual), signaled(initial?1:0), pulses(0) {}
+
+	bool consume()
+	{
+		if (manualReset) return __atomic_load_n(&signaled, __ATOMIC_ACQUIRE)!=0;
+		int expected=1;
+		return __atomic_compare_exchange_n(&signaled, &expected, 0, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+	}
+
+	virtual bool wait(const DWORD milliseconds)
+	{
+		const long long deadline=(milliseconds==INFINITE)?0:nowMs()+milliseconds;
+		for (;;)
+		{
+			const int seen=__atomic_load_n(&pulses, __ATOMIC_ACQUIRE);
+			if (consume()) return true;
+
+			DWORD remaining=INFINITE;
+			if (milliseconds!=INFINITE)
+			{
+				const long long left=deadline-nowMs();
+				if (left<=0) return false;
+				remaining=(DWORD)left;
+			}
+			futexWait(&pulses, seen, remaining);
+
+			// a pulse releases the waiters without leaving the event set
+			if (__atomic_load_n(&pulses, __ATOMIC_ACQUIRE)-seen>=2 && !__atomic_load_n(&signaled, __ATOMIC_ACQUIRE)) return true;
+		}
+	}
+
+	void set()
+	{
+		__atomic_store_n(&signaled, 1, __ATOMIC_RELEASE);
+		__atomic_add_fetch(&pulses, 1, __ATOMIC_RELEASE);
+		futexWake(&pulses, manualReset?0x7FFFFFFF:1);
+	}
+
+	void reset()
+	{
+		__atomic_store_n(&signaled, 0, __ATOMIC_RELEASE);
+	}
+
+	void pulse()
+	{
+		// set and reset in one step, counted twice so waiters can tell it from a set
+		__atomic_add_fetch(&pulses, 2, __ATOMIC_RELEASE);
+		futexWake(&pulses, manualReset?0x7FFFFFFF:1);
+	}
+};
+
+static __thread DWORD currentThreadId;
+static std::atomic<DWORD> lastThreadId(0);
+
+struct KThreadObject : public KWaitObject
+{
+	std::thread thread;
+	KEventObject started;
+	KEventObject finished;
+	const DWORD id;
+	bool suspended;
+	bool cancelled; // terminated before it was resumed
+	DWORD exitCode;
+
+	KThreadObject(const bool suspend): started(true, !suspend), finished(true, false), id(++lastThreadId), suspended(suspend), cancelled(false), exitCode(0) {}
+
+	virtual ~KThreadObject()
+	{
+		if (!thread.joinable()) return;
+		if (thread.get_id()==std::this_thread::get_id())
+			thread.detach();
+		else
+			thread.join();
+	}
+
+	virtual bool wait(const DWORD milliseconds)
+	{
+		return finished.wait(milliseconds);
+	}
+
+	static void entry(KThreadObject* self, LPTHREAD_START_ROUTINE routine, LPVOID parameter)
+	{
+		currentThreadId=self->id;
+		self->started.wait(INFINITE);
+		if (!self->cancelled) self->exitCode=routine(parameter);
+		self->finished.set();
+	}
+};
+
+HANDLE CreateEvent(void* attributes, BOOL manualReset, BOOL initialState, LPCTSTR name)
+{
+	assert(name==NULL);
+	return new KEventObject(manualReset!=FALSE, initialState!=FALSE);
+}
+
+BOOL SetEvent(HANDLE event)
+{
+	static_cast<KEventObject*>(event)->set();
+	return TRUE;
+}
+
+BOOL ResetEvent(HANDLE event)
+{
+	static_cast<KEventObject*>(event)->reset();
+	return TRUE;
+}
+
+BOOL PulseEvent(HANDLE event)
+{
+	static_cast<KEventObject*>(event)->pulse();
+	return TRUE;
+}
+
+HANDLE CreateThread(void* attributes, size_t stackSize, LPTHREAD_START_ROUTINE routine, LPVOID parameter, DWORD flags, DWORD* threadId)
+{
+	KThreadObject* t=new KThreadObject((flags&CREATE_SUSPENDED)!=0);
+	if (threadId) *threadId=t->id;
+	t->thread=std::thread(KThreadObject::entry, t, routine, parameter);
+	return t;
+}
+
+DWORD ResumeThread(HANDLE thread)
+{
+	KThreadObject* t=static_cast<KThreadObject*>(thread);
+	if (!t->suspended) return 0;
+	t->suspended=false;
+	t->started.set();
+	return 1;
+}
+
+DWORD SuspendThread(HANDLE thread)
+{
+	return (DWORD)-1;
+}
+
+BOOL TerminateThread(HANDLE thread, DWORD exitCode)
+{
+	// only a thread that never ran can be stopped
+	KThreadObject* t=static_cast<KThreadObject*>(thread);
+	if (!t->suspended) return FALSE;
+	t->cancelled=true;
+	t->exitCode=exitCode;
+	ResumeThread(thread);
+	return TRUE;
+}
+
+DWORD GetCurrentThreadId()
+{
+	// threads not created by CreateThread get an id on first use
+	if (currentThreadId==0) currentThreadId=++lastThreadId;
+	return currentThreadId;
+}
+
+DWORD WaitForSingleObject(HANDLE handle, DWORD milliseconds)
+{
+	if (handle==NULL || handle==INVALID_HANDLE_VALUE) return WAIT_FAILED;
+	return handle->wait(milliseconds)?WAIT_OBJECT_0:WAIT_TIMEOUT;
+}
+
+BOOL CloseHandle(HANDLE handle)
+{
+	if (handle==NULL || handle==INVALID_HANDLE_VALUE) return FALSE;
+	delete handle;
+	return TRUE;
+}
+
+void Sleep(DWORD milliseconds)
+{
+	std::this_thread::sleep_for(std::chrono::milliseconds(milliseconds));
+}
+
+#endif
@@ -0,0 +1,95 @@
+#pragma once
+// Win32 subset behind the KFramework objects.
+//
+// On Windows this is windows.h itself. Elsewhere the handful of types and
+// calls used by KHandle, KEvent, KMutex and KThread are implemented in
+// KPlatform.cpp on std::thread and futexes, so the objects keep one API and
+// one implementation on every platform.
+//
+// Differences from Win32:
+// - threads can't be killed. TerminateThread() and SuspendThread() fail, so
+//   terminate() waits for the thread routine to return.
+// - event and thread handles can't be named or shared between processes.
+
+#ifdef _WIN32
+
+#ifndef _WINDOWS_
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+#define KTHREAD_LOCAL __declspec(thread)
+
+#else
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+typedef int BOOL;
+typedef uint32_t DWORD;
+typedef long LONG;
+typedef unsigned long ULONG;
+typedef void* LPVOID;
+typedef char TCHAR;
+typedef const char* LPCTSTR;
+
+#ifndef TRUE
+#define TRUE 1
+#define FALSE 0
+#endif
+
+#define _TEXT(x) x
+#define WINAPI
+#define KTHREAD_LOCAL __thread
+
+// every handle is an object that can be waited for
+struct KWaitObject;
+typedef KWaitObject* HANDLE;
+#define INVALID_HANDLE_VALUE ((HANDLE)-1)
+
+#define INFINITE 0xFFFFFFFF
+#define WAIT_OBJECT_0 0
+#define WAIT_TIMEOUT 258
+#define WAIT_FAILED 0xFFFFFFFF
+
+typedef DWORD (WINAPI *LPTHREAD_START_ROUTINE)(LPVOID parameter);
+#define CREATE_SUSPENDED 0x4
+
+// recursive mutex, laid out as plain data like its Win32 counterpart
+struct CRITICAL_SECTION
+{
+	int state; // 0 free, 1 locked, 2 locked with waiters
+	DWORD owner;
+	int recursion;
+};
+
+void InitializeCriticalSection(CRITICAL_SECTION* cs);
+void DeleteCriticalSection(CRITICAL_SECTION* cs);
+void EnterCriticalSection(CRITICAL_SECTION* cs);
+BOOL TryEnterCriticalSection(CRITICAL_SECTION* cs);
+void LeaveCriticalSection(CRITICAL_SECTION* cs);
+
+HANDLE CreateEvent(void* attributes, BOOL manualReset, BOOL initialState, LPCTSTR name);
+BOOL SetEvent(HANDLE event);
+BOOL ResetEvent(HANDLE event);
+BOOL PulseEvent(HANDLE event);
+
+HANDLE CreateThread(void* attributes, size_t stackSize, LPTHREAD_START_ROUTINE routine, LPVOID parameter, DWORD flags, DWORD* threadId);
+DWORD ResumeThread(HANDLE thread);
+DWORD SuspendThread(HANDLE thread);
+BOOL TerminateThread(HANDLE thread, DWORD exitCode);
+DWORD GetCurrentThreadId();
+
+DWORD WaitForSingleObject(HANDLE handle, DWORD milliseconds);
+BOOL CloseHandle(HANDLE handle);
+
+void Sleep(DWORD milliseconds);
+
+inline LONG InterlockedIncrement(volatile LONG* p) {return __sync_add_and_fetch(p, 1);}
+inline LONG InterlockedDecrement(volatile LONG* p) {return __sync_sub_and_fetch(p, 1);}
+inline ULONG InterlockedIncrement(volatile ULONG* p) {return __sync_add_and_fetch(p, 1);}
+inline ULONG InterlockedDecrement(volatile ULONG* p) {return __sync_sub_and_fetch(p, 1);}
+
+#endif
@@ -0,0 +1,166 @@
+#include "stdafx.h"
+#include "KFramework.h"
+#include "KThreadPool.h"
+#include <thread>
+
+class KThreadPool::Worker :
+	public IRunnable
+{
+public:
+	virtual const TCHAR* toString(void) const {return _TEXT("Thread Pool Worker Object");}
+
+	Worker(KThreadPool& pool):IRunnable(true),m_pool(pool) {}
+
+	KThreadPool& m_pool;
+	KMutex m_mtx;
+	std::deque<TASK> m_tasks;
+
+	void push(const TASK& task)
+	{
+		AUTO_LOCK(m_mtx);
+		m_tasks.push_back(task);
+	}
+
+	// own tasks newest first
+	bool popNewest(TASK& task)
+	{
+		AUTO_LOCK(m_mtx);
+		if (m_tasks.empty()) return false;
+		task=m_tasks.back();
+		m_tasks.pop_back();
+		return true;
+	}
+
+	// someone else's tasks oldest first
+	bool popOldest(TASK& task)
+	{
+		AUTO_LOCK(m_mtx);
+		if (m_tasks.empty()) return false;
+		task=m_tasks.front();
+		m_tasks.pop_front();
+		return true;
+	}
+
+private:
+	virtual DWORD _run(void);
+};
+
+
+// the worker running on this thread, if any
+static KTHREAD_LOCAL void* g_pCurrentWorker=NULL;
+
+
+KThreadPool::Worker* KThreadPool::_current(void) const
+{
+	Worker* w=(Worker*)g_pCurrentWorker;
+	return (w!=NULL && &w->m_pool==this)?w:NULL;
+}
+
+
+DWORD KThreadPool::Worker::_run(void)
+{
+	g_pCurrentWorker=this;
+	TASK task;
+	for (;;)
+	{
+		if (m_pool._take(this,task))
+		{
+			m_pool._execute(task);
+			continue;
+		}
+		if (m_pool.m_fStopping) break;
+		m_pool.m_evtWork.wait();
+	}
+	// pass the stop on to the next worker
+	m_pool.m_evtWork.set();
+	g_pCurrentWorker=NULL;
+	return exit(0);
+}
+
+
+KThreadPool::KThreadPool(const int threads):
+	m_nNext(0),m_nQueued(0),m_nPending(0),m_fStopping(false)
+{
+	const int n=(threads>0)?threads:getHardwareThreads();
+	for (int i=0;i<n;i++)
+		m_workers.push_back(new Worker(*this));
+	// start them once the vector is complete, they steal from each other
+	for (int i=0;i<n;i++)
+		m_workers[i]->resume();
+}
+
+
+KThreadPool::~KThreadPool(void)
+{
+	wait();
+	m_fStopping=true;
+	m_evtWork.set();
+	// the last ones may still look into the queues of the first ones
+	for (size_t i=0;i<m_workers.size();i++)
+		m_workers[i]->wait();
+	for (size_t i=0;i<m_workers.size();i++)
+		delete m_workers[i];
+}
+
+
+int KThreadPool::getHardwareThreads(void)
+{
+	const int n=(int)std::thread::hardware_concurrency();
+	return (n>0)?n:1;
+}
+
+
+void KThreadPool::submit(const TASK& task)
+{
+	assert(!m_fStopping);
+	Worker* target=_current();
+	if (target==NULL)
+		target=m_workers[(ULONG)InterlockedIncrement(&m_nNext)%m_workers.size()];
+	InterlockedIncrement(&m_nPending);
+	InterlockedIncrement(&m_nQueued);
+	target->push(task);
+	m_evtWork.set();
+}
+
+
+bool KThreadPool::_take(Worker* self,TASK& task)
+{
+	if (m_nQueued==0) return false;
+	if (self!=NULL && self->popNewest(task)) return true;
+
+	// steal, starting after ourselves so the victims are spread out
+	size_t start=0;
+	for (size_t i=0;i<m_workers.size();i++)
+		if (m_workers[i]==self) start=i+1;
+	for (size_t i=0;i<m_workers.size();i++)
+	{
+		Worker* victim=m_workers[(start+i)%m_workers.size()];
+		if (victim!=self && victim->popOldest(task)) return true;
+	}
+	return false;
+}
+
+
+void KThreadPool::_execute(TASK& task)
+{
+	// more work left, wake another worker
+	if (InterlockedDecrement(&m_nQueued)>0) m_evtWork.set();
+	task();
+	task=TASK();
+	if (InterlockedDecrement(&m_nPending)==0) m_evtIdle.set();
+}
+
+
+void KThreadPool::wait(void)
+{
+	// a worker would wait for its own task
+	assert(_current()==NULL);
+	TASK task;
+	while (m_nPending>0)
+	{
+		if (_take(NULL,task))
+			_execute(task);
+		else
+			m_evtIdle.wait();
+	}
+}
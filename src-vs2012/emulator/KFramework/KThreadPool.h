@@ -0,0 +1,58 @@
+#pragma once
+#include "KPlatform.h"
+#include "KFramework.h"
+#include "KObject.h"
+#include "KHandle.h"
+#include "KMutex.h"
+#include "KEvent.h"
+#include "KThread.h"
+#include <deque>
+#include <vector>
+#include <functional>
+
+// Fixed set of worker threads, each with its own task queue.
+//
+// A worker runs its newest task first and steals the oldest task of another
+// worker when its own queue is empty. Tasks submitted from a worker go to its
+// own queue, others are dealt out in turn. Idle workers sleep on an event.
+class KFRAMEWORK_API KThreadPool :
+	public KObject
+{
+public:
+	typedef std::function<void()> TASK;
+
+	virtual const TCHAR* toString(void) const {return _TEXT("Thread Pool Object");}
+
+	// no threads: one per hardware thread
+	explicit KThreadPool(const int threads=0);
+	~KThreadPool(void);
+
+	int getThreadCount() const {return (int)m_workers.size();}
+
+	// any thread
+	void submit(const TASK& task);
+
+	// runs queued tasks on the calling thread until every task has finished.
+	// not for use inside a task.
+	void wait(void);
+
+	static int getHardwareThreads(void);
+
+private:
+	class Worker;
+
+	std::vector<Worker*> m_workers;
+	volatile LONG m_nNext; // round robin for outside submissions
+	volatile LONG m_nQueued; // submitted, not yet started
+	volatile LONG m_nPending; // submitted, not yet finished
+	volatile bool m_fStopping;
+	KEvent m_evtWork; // auto-reset, wakes one worker
+	KEvent m_evtIdle; // auto-reset, the last task has finished
+
+	Worker* _current(void) const;
+	bool _take(Worker* self,TASK& task);
+	void _execute(TASK& task);
+
+	KThreadPool(const KThreadPool&);
+	KThreadPool& operator=(const KThreadPool&);
+};
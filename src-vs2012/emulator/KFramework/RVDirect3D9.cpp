@@ -8,6 +8,7 @@
 
 // Constants
 static const TCHAR g_szClassName[]=_TEXT("VRWindowClass");
+static const unsigned PRESENT_WAIT=2; // ms, window messages wait at most this long
 
 // Global variables
 void* RVDirect3D9::g_pD3D=NULL;
@@ -19,6 +20,7 @@ RVDirect3D9::RVDirect3D9(const UINT width, const UINT height,
 						 const bool autorender):
 	m_pd3dDevice(NULL), m_hWnd(NULL), m_iWidth(width), m_iHeight(height), m_nBuffers(numBuffers),
 	m_iFormat(format), m_iBitCount(bitCount), m_evtActive(FALSE, TRUE),
+	m_queue(width*height*bitCount/8,numBuffers),
 	m_strTitle(title),m_fAutoRender(autorender), \
 	IRunnable(true)
 {
@@ -29,11 +31,13 @@ RVDirect3D9::RVDirect3D9(const UINT width, const UINT height,
 	m_fDeviceLost=m_fDeviceError=false;
 	m_fActive=true;
 	m_fInsideMainloop=false;
-	m_head=m_tail=0;
-	memset(m_pd3dImageSurface,0,sizeof(void*)*5);
+	m_nFrames=m_nDropped=0;
+	m_pd3dImageSurface=NULL;
 	memset(m_bKeyDown,0,sizeof(m_bKeyDown));
 	memset(m_bKeyUp,0,sizeof(m_bKeyUp));
 	memset(m_bKeyPressed,0,sizeof(m_bKeyPressed));
+	m_pfnKeyCallback=NULL;
+	m_pKeyContext=NULL;
 	// START WORKER THREAD
 	resume();
 	// WAIT UNTIL DEVICE IS CREATED
@@ -83,24 +87,21 @@ void RVDirect3D9::_messageloop(const bool autorender)
 	assert(m_hWnd!=NULL);
 	MSG msg;
 	m_fInsideMainloop=true;
-	if (!autorender)
+	msg.message=WM_NULL;PeekMessage(&msg,NULL,0,0,PM_NOREMOVE);
+	while (msg.message!=WM_QUIT)
 	{
-		while (GetMessage(&msg,NULL,0,0))
+		if (PeekMessage(&msg,NULL,0,0,PM_REMOVE))
 		{
 			TranslateMessage(&msg);
 			DispatchMessage(&msg);
-		}
-	}else
-	{
-		msg.message=WM_NULL;PeekMessage(&msg,NULL,0,0,PM_NOREMOVE);
-		while (msg.message!=WM_QUIT)
+		}else if (m_queue.wait(PRESENT_WAIT))
 		{
-			if (PeekMessage(&msg,NULL,0,0,PM_REMOVE))
-			{
-				TranslateMessage(&msg);
-				DispatchMessage(&msg);
-			}else _render();
-		}
+			_flip();
+		}else if (m_queue.cancelled())
+		{
+			// closing, only messages are left to process
+			WaitMessage();
+		}else if (autorender) _render();
 	}
 	m_fInsideMainloop=false;
 }
@@ -161,8 +162,7 @@ void RVDirect3D9::_onLostDevice(void) // It's called when the device is lost or
 
 	IDirect3DDevice9& device=*(IDirect3DDevice9*)m_pd3dDevice;
 	// Destroy objects in default pool
-	for (int i=0;i<m_nBuffers;i++)
-		if (m_pd3dImageSurface[i]!=NULL) SAFE_RELEASE_T<IDirect3DSurface9>(m_pd3dImageSurface[i]);
+	if (m_pd3dImageSurface!=NULL) SAFE_RELEASE_T<IDirect3DSurface9>(m_pd3dImageSurface);
 }
 
 
@@ -185,15 +185,11 @@ bool RVDirect3D9::_onResetDevice(void)
 		fmt=(D3DFORMAT)m_iFormat;
 		break;
 	}
-	for (int i=0;i<m_nBuffers;i++)
-	{
-		IDirect3DSurface9* tmp;
-		hr=device.CreateOffscreenPlainSurface(m_iWidth,m_iHeight,fmt,D3DPOOL_DEFAULT,&tmp,NULL);
-		if (!SUCCEEDED(hr)) break;
-		m_pd3dImageSurface[i]=tmp;
-	}
+	IDirect3DSurface9* tmp;
+	hr=device.CreateOffscreenPlainSurface(m_iWidth,m_iHeight,fmt,D3DPOOL_DEFAULT,&tmp,NULL);
 	if (SUCCEEDED(hr))
 	{
+		m_pd3dImageSurface=tmp;
 		m_evtRestored.set();
 		return true;
 	}else
@@ -216,61 +212,50 @@ bool RVDirect3D9::_move(void)
 
 /*
 	push() will fail if
-	1. the queue is full
-	2. the device is lost (by default we will wait until the device is ready again)
-	3. internal error
+	1. the queue is full, the window thread is behind and the frame is dropped
+	2. internal error
 */
-bool RVDirect3D9::push(const unsigned char* buf,const bool fwait)
+bool RVDirect3D9::push(const unsigned char* buf)
 {
-	volatile ULONG m_cur;
-	AUTO_LOCK(m_mtx_push);
-	m_cur=(m_tail+1)%m_nBuffers;
-	if (m_cur==m_head) // full
-	{
-		if (fwait) 
-			m_evtBufferFree.wait();
-		else 
-			return false;
-	}
-	assert(m_cur!=m_head);
-	if (write(buf,m_cur))
+	if (m_fDeviceError) return false;
+	if (!m_queue.push(buf))
 	{
-		m_tail=m_cur;
-		return true;
-	}else
+		++m_nDropped;
 		return false;
+	}
+	return true;
 }
 
 
-bool RVDirect3D9::flip(void)
+// runs on the window thread
+bool RVDirect3D9::_flip(void)
 {
-	volatile ULONG m_cur;
-	AUTO_LOCK(m_mtx_flip);
-	if (empty()) return false;
-
-	// next buffer
-	m_cur=(m_head+1)%m_nBuffers;
-	assert(m_cur!=m_head);
-	if (_render())
+	const unsigned char* frame=m_queue.front();
+	if (frame==NULL) return false;
+
+	// only the newest frame is worth presenting
+	while (m_queue.size()>1)
 	{
-		m_head=m_cur;
-		if (m_head==m_tail) m_evtBufferFree.pulse();
-		return true;
-	}else return false;
+		m_queue.pop();
+		frame=m_queue.front();
+	}
+	const bool written=_write(frame);
+	m_queue.pop();
+
+	// a lost device is restored by _render()
+	return _render() && written;
 }
 
 
-bool RVDirect3D9::write(const unsigned char* buf,const int idx,const bool fwait)
+bool RVDirect3D9::_write(const unsigned char* buf)
 {
-	assert(idx>=0 && idx<m_nBuffers && m_pd3dDevice!=NULL);
-	if (m_fDeviceError) return false;
-	if ((m_pd3dImageSurface[idx]==NULL || m_fDeviceLost) && fwait) m_evtRestored.wait(); // The device hasn't been reset.
+	assert(m_pd3dDevice!=NULL);
+	if (m_fDeviceError || m_fDeviceLost) return false;
 	{
 		LOCK_OBJECT();
-		assert(m_pd3dImageSurface[idx]!=NULL);
-		if (m_pd3dImageSurface[idx]==NULL) return false;
+		if (m_pd3dImageSurface==NULL) return false;
 		IDirect3DDevice9& device=*(IDirect3DDevice9*)m_pd3dDevice;
-		IDirect3DSurface9& surface=*(IDirect3DSurface9*)m_pd3dImageSurface[idx];
+		IDirect3DSurface9& surface=*(IDirect3DSurface9*)m_pd3dImageSurface;
 		HRESULT hr;
 		D3DLOCKED_RECT rc;
 		hr=surface.LockRect(&rc,NULL,0);
@@ -327,7 +312,7 @@ bool RVDirect3D9::_draw(void)
 	IDirect3DSurface9 *rt;
 	if (SUCCEEDED(device.GetRenderTarget(0,&rt)))
 	{
-		if (m_pd3dImageSurface[m_head]!=NULL) device.StretchRect((IDirect3DSurface9*)m_pd3dImageSurface[m_head],NULL,rt,NULL,D3DTEXF_LINEAR);
+		if (m_pd3dImageSurface!=NULL) device.StretchRect((IDirect3DSurface9*)m_pd3dImageSurface,NULL,rt,NULL,D3DTEXF_LINEAR);
 		rt->Release();
 	}
 
@@ -395,6 +380,8 @@ bool RVDirect3D9::_render(void)
 
 RVDirect3D9::~RVDirect3D9(void)
 {
+	// STOP PRESENTING, THE WINDOW THREAD MUST NOT WAIT FOR THE LOCK BELOW
+	m_queue.cancel();
 	// BLOCK EXTERNAL CALLING
 	EnterCriticalSection(&(getMutexObject()));
 	// KILL WINDOW
@@ -521,11 +508,15 @@ LRESULT RVDirect3D9::_wndproc( HWND hWnd, UINT uMsg, WPARAM wParam, LPARAM lPara
 	case WM_KEYDOWN:
 		m_bKeyDown[wParam&0xFF]=true;
 		if (!(lParam & 0x40000000))
+		{
 			m_bKeyPressed[wParam&0xFF]=true;
+			if (m_pfnKeyCallback) m_pfnKeyCallback(m_pKeyContext,wParam&0xFF,true);
+		}
 		break;
 	case WM_KEYUP:
 		m_bKeyUp[wParam&0xFF]=true;
 		m_bKeyDown[wParam&0xFF]=false;
+		if (m_pfnKeyCallback) m_pfnKeyCallback(m_pKeyContext,wParam&0xFF,false);
 		break;
 	}
 	return DefWindowProc(hWnd,uMsg,wParam,lParam);
@@ -2,6 +2,7 @@
 #include "KThread.h"
 #include "kEvent.h"
 #include "KMutex.h"
+#include "KFrameQueue.h"
 
 class KFRAMEWORK_API RVDirect3D9 :
 	public IRunnable, private IObjectMutex
@@ -17,11 +18,10 @@ public:
 	RVDirect3D9(const UINT width,const UINT height,const DWORD format,const int bitCount,const int numBuffers,const TCHAR* title,const bool autorender=false);
 	~RVDirect3D9();
 
-	// queue state & operation
-	bool empty() const {return m_head==m_tail;}
-	bool write(const unsigned char* buf,const int idx,const bool fwait=true);
-	bool push(const unsigned char* buf,const bool fwait=true);
-	bool flip();
+	// queue state & operation.
+	// frames are presented on the window thread, push() never waits for it.
+	bool empty() const {return m_queue.empty();}
+	bool push(const unsigned char* buf);
 
 	bool hasError() const {return m_fDeviceError;}
 	bool isPaused() const {return m_fPaused;}
@@ -31,6 +31,7 @@ public:
 	void waitUntilActive() {if (!m_fActive) m_evtActive.wait();}
 
 	__int64 getFrameCount() const {return m_nFrames;}
+	__int64 getDroppedFrames() const {return m_nDropped;}
 
 	UINT getWidth() const {return m_iWidth;}
 	UINT getHeight() const {return m_iHeight;}
@@ -42,6 +43,10 @@ public:
 	bool isKeyUp(int key) {key&=0xFF;bool ret=m_bKeyUp[key];m_bKeyUp[key]=false;return ret;}
 	bool isKeyDown(int key) const {return m_bKeyDown[key&0xFF];}
 
+	// called on the window thread for every key pressed or released
+	typedef void (*KEYCALLBACK)(void* context,int key,bool down);
+	void setKeyCallback(KEYCALLBACK callback,void* context) {m_pKeyContext=context;m_pfnKeyCallback=callback;}
+
 	// don't call the following functions outside
 	friend LRESULT CALLBACK _wndentry(HWND hWnd,UINT uMsg,WPARAM wParam,LPARAM lParam);
 	
@@ -50,7 +55,7 @@ private:
 	
 	/* D3D Objects*/
 	void* m_pd3dDevice;
-	void* m_pd3dImageSurface[5];
+	void* m_pd3dImageSurface;
 
 	HWND m_hWnd;
 	void* m_d3dpp;
@@ -63,19 +68,21 @@ private:
 	bool m_fInsideMainloop;
 
 	/* Queue control */
-	volatile ULONG m_head, m_tail;
-	KMutex m_mtx_push,m_mtx_flip;
+	KFrameQueue m_queue;
 
 	/* Behaviour */
 	const bool m_fAutoRender;
 
 	/* Statistics */
 	__int64 m_nFrames;
+	__int64 m_nDropped; // rejected by a full queue
 
 	/* Misc */
 	bool m_bKeyPressed[256];
 	bool m_bKeyUp[256];
 	bool m_bKeyDown[256];
+	KEYCALLBACK volatile m_pfnKeyCallback;
+	void* volatile m_pKeyContext;
 
 	const UINT m_iWidth,m_iHeight;
 	const DWORD m_iFormat;
@@ -85,11 +92,12 @@ private:
 
 	KEvent m_evtCreation;
 	KEvent m_evtRestored;
-	KEvent m_evtBufferFree;
 	KEvent m_evtActive;
 
 	virtual DWORD _run(void);
 	bool _create(void);
+	bool _write(const unsigned char* buf);
+	bool _flip(void);
 	void _messageloop(const bool autorender=false);
 	bool _onResetDevice(void);
 	void _onLostDevice(void);
@@ -5,14 +5,16 @@
 
 #pragma once
 
-#include "targetver.h"
-
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
-#include <tchar.h>
 #include <assert.h>
+
+#ifdef _WIN32
+#include "targetver.h"
+
+#include <tchar.h>
 #include <malloc.h>
 
 #define WIN32_LEAN_AND_MEAN             // Exclude rarely-used stuff from Windows headers
@@ -21,4 +23,8 @@
 
 // Direct3D Header Files:
 #include <d3d9.h>
-#include <d3dx9.h>
\ No newline at end of file
+#include <d3dx9.h>
+#else
+// the threading objects build on other platforms, the renderer doesn't
+#include "KPlatform.h"
+#endif
\ No newline at end of file
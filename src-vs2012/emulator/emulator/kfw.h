@@ -6,6 +6,7 @@ namespace dx9render
 	void create(const int width, const int height);
 	void destroy();
 	
+	// false when the frame was dropped because the window thread is behind
 	bool draw32(const void* buffer);
 
 	void setTitle(const TCHAR* title);
@@ -20,4 +21,7 @@ namespace dx9render
 	bool keyPressed(int key);
 	bool keyUp(int key);
 	bool keyDown(int key);
+
+	// called on the window thread whenever a key goes down or up
+	void setKeyCallback(void (*callback)(void* context, int key, bool down), void* context);
 }
\ No newline at end of file
@@ -39,19 +39,9 @@ namespace dx9render
 	bool draw32(const void* buffer)
 	{
 		assert(!renderer->hasError());
-		if (!renderer->push((const unsigned char*)buffer, false))
-		{
-			// maybe queue full or paused
-			while (!renderer->flip());
-			// push again
-			if (!renderer->push((const unsigned char*)buffer, false))
-			{
-				assert(0);
-				return false;
-			}
-		}
-		while (renderer->flip());
-		return true;
+		// the window thread presents the frame. when it falls behind, e.g.
+		// while paused, the frame is dropped rather than waited for.
+		return renderer->push((const unsigned char*)buffer);
 	}
 
 	void setTitle(const TCHAR* title)
@@ -98,4 +88,9 @@ namespace dx9render
 	{
 		return renderer->isKeyPressed(k);
 	}
+
+	void setKeyCallback(void (*callback)(void* context, int key, bool down), void* context)
+	{
+		renderer->setKeyCallback(callback, context);
+	}
 }
\ No newline at end of file
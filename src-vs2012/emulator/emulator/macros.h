@@ -10,6 +10,21 @@
 // static assertion
 #define STATIC_ASSERT(expr) sizeof(int[(bool)(expr)?1:-1])
 
+// pastes the tokens after expanding them, e.g. CONCAT(scope, __LINE__) is scope42
+#define CONCAT(a, b) CONCAT_EXPANDED(a, b)
+#define CONCAT_EXPANDED(a, b) a##b
+
+// branch hints, and functions kept out of the hot code
+#ifdef __GNUC__
+	#define LIKELY(e) __builtin_expect(!!(e), 1)
+	#define UNLIKELY(e) __builtin_expect(!!(e), 0)
+	#define COLD __attribute__((cold, noinline))
+#else
+	#define LIKELY(e) (e)
+	#define UNLIKELY(e) (e)
+	#define COLD __declspec(noinline)
+#endif
+
 // verbose assertion
 #ifdef VERBOSE
     #define vassert(e) assert(e)
@@ -73,12 +88,15 @@ inline destType& safe_cast(srcType& source)
     #define fast_constcast(VAR,TP) ((const TP&)*(const TP*)(&(VAR)))
 #endif
 
+#ifndef HAVE_SAFE_DELETE
+#define HAVE_SAFE_DELETE
 template <typename T>
 void SAFE_DELETE(T*& mem)
 {
 	delete mem;
 	mem = nullptr;
 }
+#endif
 
 template <typename T>
 inline T min(const T& x,const T& y) {return x<y?x:y;}
@@ -89,4 +107,4 @@ inline T max(const T& x,const T& y) {return x>y?x:y;}
 template <typename T1, typename T2>
 inline size_t ptr_diff(const T1* x, const T2* y) {return reinterpret_cast<const volatile char*>(x)-reinterpret_cast<const volatile char*>(y);}
 
-#define CASE_ENUM_RETURN_STRING(ENUM) case ENUM: return L#ENUM
+#define CASE_ENUM_RETURN_STRING(ENUM) case ENUM: return L"" #ENUM
@@ -10,7 +10,28 @@
 
 #include "nes/internals.h"
 #include "nes/debug.h"
+#include "nes/dirty.h"
+#include "nes/state.h"
+#include "nes/ppu.h"
+#include "nes/mmc.h"
 #include "nes/emu.h"
+#include "nes/options.h"
+#include "nes/apu.h"
+#include "nes/audio.h"
+#include "nes/input.h"
+#include "nes/pacer.h"
+#include "nes/server.h"
+#include "nes/trace.h"
+#include "nes/telemetry.h"
+#include "nes/opcodes.h"
+#include "nes/cpu.h"
+#include "nes/profiler.h"
+#include "nes/perf.h"
+#include "nes/rom.h"
+#include "nes/hash.h"
+#include "nes/scan.h"
+#include "nes/movie.h"
+#include "nes/golden.h"
 
 #include "ui.h"
 
@@ -19,20 +40,189 @@ static void welcome()
 	puts("Portable NES Emulator 1.0"); 
 }
 
+// emulates frames as fast as possible, without pacing and presentation
+static void bench(const _TCHAR* file, const int frames)
+{
+	emu::reset();
+	if (!emu::load(file) || !emu::setup())
+	{
+		puts("[X] Unable to emulate the rom.");
+		return;
+	}
+	ppu::enableOutput(false);
+	// warm up the caches first
+	int done=0;
+	for (; done<60 && emu::nextFrame(); done++);
+	perf::clearStatistics();
+	const long long start=pacer::now();
+	for (done=0; done<frames && emu::nextFrame(); done++);
+	const long long elapsed=pacer::now()-start;
+	printf("[-] %d frames, %.1f us/frame\n", done, done>0?elapsed/1000.0/done:0.0);
+	if (perf::AVAILABLE) perf::exportStatistics(stdout);
+}
+
+// calls the checked memory accessors of the CPU core in a tight loop, to
+// compare the cost of their error checks between builds, see nes/debug.h
+static void benchChecks(const int millions)
+{
+	const long long count=millions*1000000LL;
+	uint32_t sum=0;
+	const long long start=pacer::now();
+	for (long long i=0; i<count; i++)
+	{
+		maddr_t pc(0x8000+(int)(i&0x7FF0));
+		sum+=mmc::fetchOpcode(pc);
+		sum+=valueOf(mmc::fetchByteOperand(pc));
+		sum+=valueOf(mmc::fetchWordOperand(pc));
+		sum+=mmc::loadZPWord(maddr8_t((int)(i&0x7F)));
+	}
+	const long long elapsed=pacer::now()-start;
+	printf("[-] %lld iterations, %.2f ns each (%X)\n", count, count>0?(double)elapsed/count:0.0, sum);
+}
+
+// prints the hashes of a rom and its database line, see nes/romdb.h
+static bool identify(const _TCHAR* file)
+{
+	if (!rom::load(file)) return false;
+	char sha1[hash::SHA1_SIZE*2+1];
+	hash::toHex(rom::sha1(), sha1);
+	printf("crc32 %08X\nsha1 %s\nmapper %d\nmirroring %d\nbattery %d\nin database %d\n",
+		rom::crc32(), sha1, rom::mapperType(), (int)rom::mirrorMode(), rom::hasBattery()?1:0, rom::correctedHeader()?1:0);
+	printf("\t\t{0x%08X, 0x%.8s, %d, %d, %d, 0}, // ", rom::crc32(), sha1, rom::mapperType(), (int)rom::mirrorMode(), rom::hasBattery()?1:0);
+	_tprintf(_T("%s\n"), file);
+	rom::unload();
+	return true;
+}
+
+// plays a movie back from power-on and reports the first frame that differs
+static void play(const _TCHAR* file, const _TCHAR* movieFile)
+{
+	emu::reset();
+	if (!emu::load(file) || !emu::setup())
+	{
+		puts("[X] Unable to emulate the rom.");
+		return;
+	}
+	movie::RESULT result;
+	if (!movie::play(movieFile, result))
+	{
+		puts("[X] Unable to play the movie, or it was recorded with another rom.");
+		return;
+	}
+	printf("[-] %lld frames, %lld hashes compared, %.1f fps\n", result.frames, result.hashes, result.fps);
+	if (result.divergence<0)
+		puts("[-] The movie plays back identically.");
+	else
+		printf("[X] Diverged at frame %lld: %s.\n", result.divergence, result.inputDiverged?"the game latched the joypads differently":"the machine state differs");
+}
+
 static void usage(_TCHAR* self_path)
 {
 	// _tprintf(_T("%s <nes file path>\n"), self_path);
+	// _tprintf(_T("%s <nes file path> [--run-ahead <frames>] [--input <script>] [--frame-stats <csv file>] [--wav <file>] [--trace <file>] [--options <list>] [--telemetry <file>] [--profile <report>] [--profile-stacks <folded stacks>] [--perf <csv file>] [--perf-trace <json file>] [--record <movie>] [--frames <count>] [--fast-forward]\n"), self_path);
+	// _tprintf(_T("%s --server <socket path> <nes file path> [checkpoint frame]\n"), self_path);
+	// _tprintf(_T("%s --trace-text <trace file> [text file]\n"), self_path);
+	// _tprintf(_T("%s --bench <nes file path> [frames]\n"), self_path);
+	// _tprintf(_T("%s --bench-checks [million iterations]\n"), self_path);
+	// _tprintf(_T("%s --identify <nes file path>\n"), self_path);
+	// _tprintf(_T("%s --play <nes file path> <movie>\n"), self_path);
+	// _tprintf(_T("%s --self-test [--filter <name part>] [--jobs <threads>] [--results <csv or json file>]\n"), self_path);
+	// _tprintf(_T("%s --ci [golden case list] [--filter <name part>] [--jobs <threads>] [--results <csv or json file>]\n"), self_path);
+	// _tprintf(_T("%s --golden-update <golden case list> [processes]\n"), self_path);
+	// _tprintf(_T("%s --scan <directory> <csv or json report> [frames] [processes]\n"), self_path);
 }
 
 
+// runs the unit tests, see TestFramework::runSelected()
+static int selfTest(const int argc, _TCHAR* argv[], const bool ci)
+{
+	std::string filter;
+	int jobs=0;
+	const _TCHAR* resultsFile=nullptr;
+	for (int i=2; i<argc; i++)
+	{
+		if (i+1<argc && _tcscmp(argv[i], _T("--filter"))==0)
+		{
+			filter=scan::narrow(argv[++i]);
+		}else if (i+1<argc && _tcscmp(argv[i], _T("--jobs"))==0)
+		{
+			jobs=_tstoi(argv[++i]);
+		}else if (i+1<argc && _tcscmp(argv[i], _T("--results"))==0)
+		{
+			resultsFile=argv[++i];
+		}else if (ci && i==2)
+		{
+			golden::setCaseList(argv[0], argv[i]);
+		}
+	}
+	std::vector<TestRecord> records;
+	const bool ok=TestFramework::instance().runSelected(filter.empty()?nullptr:filter.c_str(), ci, jobs, records);
+	if (resultsFile && !TestFramework::writeResults(resultsFile, records))
+		puts("[!] Unable to write the test results.");
+	TestFramework::destroy();
+	return ok?0:1;
+}
+
 int _cdecl _tmain(int argc, _TCHAR* argv[])
 {
-	welcome();
-	usage(argv[0]);
-	TestFramework::instance().runAll();
+	// the tests only run when asked
+	if (argc>=2 && (_tcscmp(argv[1], _T("--self-test"))==0 || _tcscmp(argv[1], _T("--ci"))==0))
+		return selfTest(argc, argv, _tcscmp(argv[1], _T("--ci"))==0);
+
+	// the scanner starts a probe per rom and the golden suite a process per
+	// case, they print nothing else
+	const bool probing=(argc>=3 && _tcscmp(argv[1], _T("--probe"))==0);
+	const bool goldenCase=(argc>=5 && _tcscmp(argv[1], _T("--golden-case"))==0);
+	if (!probing && !goldenCase)
+	{
+		welcome();
+		usage(argv[0]);
+	}
 	ui::init();
 	emu::init();
-	if (argc>=2)
+	if (probing || goldenCase)
+	{
+		const int code=probing?scan::probe(argv[2], (argc>=4)?_tstoi(argv[3]):scan::DEFAULT_FRAMES)
+			:golden::runCase(argv[2], argv[3], _tstoi(argv[4]), argc>=6 && _tcscmp(argv[5], _T("--record"))==0);
+		emu::deinit();
+		ui::deinit();
+		TestFramework::destroy();
+		return code;
+	}else if (argc>=3 && _tcscmp(argv[1], _T("--golden-update"))==0)
+	{
+		golden::run(argv[0], argv[2], true, (argc>=4)?_tstoi(argv[3]):0);
+	}else if (argc>=4 && _tcscmp(argv[1], _T("--scan"))==0)
+	{
+		if (!scan::run(argv[0], argv[2], argv[3], (argc>=5)?_tstoi(argv[4]):scan::DEFAULT_FRAMES, (argc>=6)?_tstoi(argv[5]):0))
+			puts("[X] Unable to write the report.");
+	}else if (argc>=4 && _tcscmp(argv[1], _T("--server"))==0)
+	{
+		const long long checkpoint=(argc>=5)?_tstoi(argv[4]):0;
+		server::run(argv[2], argv[3], checkpoint);
+	}else if (argc>=3 && _tcscmp(argv[1], _T("--trace-text"))==0)
+	{
+		FILE* in=nullptr;
+		FILE* out=stdout;
+		_tfopen_s(&in, argv[2], _T("rb"));
+		if (argc>=4) _tfopen_s(&out, argv[3], _T("wt"));
+		if (in==nullptr || out==nullptr || !trace::convert(in, out))
+			puts("[X] Unable to convert the trace.");
+		if (in) fclose(in);
+		if (out && out!=stdout) fclose(out);
+	}else if (argc>=3 && _tcscmp(argv[1], _T("--bench"))==0)
+	{
+		bench(argv[2], (argc>=4)?_tstoi(argv[3]):600);
+	}else if (argc>=2 && _tcscmp(argv[1], _T("--bench-checks"))==0)
+	{
+		benchChecks((argc>=3)?_tstoi(argv[2]):100);
+	}else if (argc>=3 && _tcscmp(argv[1], _T("--identify"))==0)
+	{
+		if (!identify(argv[2]))
+			puts("[X] Unable to load the rom.");
+	}else if (argc>=4 && _tcscmp(argv[1], _T("--play"))==0)
+	{
+		play(argv[2], argv[3]);
+	}else if (argc>=2)
 	{
 		// reset emulator
 		emu::reset();
@@ -41,15 +231,149 @@ int _cdecl _tmain(int argc, _TCHAR* argv[])
 			// setup emulator
 			if (emu::setup())
 			{
+				input::ScriptProvider script;
+				const _TCHAR* statsFile=nullptr;
+				audio::WavSink wav;
+				int selected=emu::options();
+				bool traced=false;
+				const _TCHAR* profileFile=nullptr;
+				const _TCHAR* stacksFile=nullptr;
+				const _TCHAR* perfFile=nullptr;
+				const _TCHAR* movieFile=nullptr;
+				long long frames=0;
+				for (int i=2; i<argc; i++)
+				{
+					if (_tcscmp(argv[i], _T("--fast-forward"))==0)
+					{
+						emu::setFastForward(true);
+					}else if (i+1>=argc)
+					{
+						// options below take a value
+						break;
+					}else if (_tcscmp(argv[i], _T("--run-ahead"))==0)
+					{
+						emu::setRunAhead(_tstoi(argv[++i]));
+					}else if (_tcscmp(argv[i], _T("--input"))==0)
+					{
+						// scripted input replaces the keyboard
+						if (script.load(argv[++i]))
+							input::setProvider(&script);
+						else
+							puts("[!] Unable to load the input script.");
+					}else if (_tcscmp(argv[i], _T("--frame-stats"))==0)
+					{
+						statsFile=argv[++i];
+					}else if (_tcscmp(argv[i], _T("--wav"))==0)
+					{
+						if (wav.open(argv[++i], apu::SAMPLE_RATE))
+							audio::attach(&wav);
+						else
+							puts("[!] Unable to create the wav file.");
+					}else if (_tcscmp(argv[i], _T("--trace"))==0)
+					{
+						if (trace::start(argv[++i]))
+							traced=true;
+						else
+							puts("[!] Unable to create the trace file.");
+					}else if (_tcscmp(argv[i], _T("--telemetry"))==0)
+					{
+						if (!telemetry::start(argv[++i]))
+							puts("[!] Unable to create the telemetry file.");
+					}else if (_tcscmp(argv[i], _T("--profile"))==0)
+					{
+						profileFile=argv[++i];
+					}else if (_tcscmp(argv[i], _T("--profile-stacks"))==0)
+					{
+						stacksFile=argv[++i];
+					}else if (_tcscmp(argv[i], _T("--perf"))==0)
+					{
+						perfFile=argv[++i];
+						if (!perf::AVAILABLE) puts("[!] Built without WANT_PERF_SCOPES, nothing is timed.");
+					}else if (_tcscmp(argv[i], _T("--perf-trace"))==0)
+					{
+						if (!perf::AVAILABLE)
+							puts("[!] Built without WANT_PERF_SCOPES, nothing is timed.");
+						if (!perf::startTrace(argv[++i]))
+							puts("[!] Unable to create the timeline file.");
+					}else if (_tcscmp(argv[i], _T("--record"))==0)
+					{
+						movieFile=argv[++i];
+					}else if (_tcscmp(argv[i], _T("--frames"))==0)
+					{
+						frames=_tstoi(argv[++i]);
+					}else if (_tcscmp(argv[i], _T("--options"))==0)
+					{
+						// replaces the options selected by the build flags
+						const int parsed=options::parse(argv[++i]);
+						if (parsed>=0)
+							selected=parsed;
+						else
+							puts("[!] Unknown option in the list.");
+					}
+				}
+				// a trace records instructions and scanlines whatever else is selected
+				if (traced) selected|=options::WATCH_CPU|options::WATCH_RENDERING;
+				if (profileFile || stacksFile)
+				{
+					selected|=options::PROFILE;
+					profiler::reset();
+				}
+				emu::setOptions(selected);
+				// records whatever provider was chosen above
+				if (movieFile) movie::startRecording();
+
 				// create log file
 				FILE *fp = fopen("m:\\log.txt", "wt");
 				debug::setOutputFile(fp);
 
 				// start execution
 				ui::onGameStart();
-				emu::run();
+				pacer::clearStatistics();
+				perf::clearStatistics();
+				emu::run(frames);
+				if (movieFile && !movie::stopRecording(movieFile))
+					puts("[!] Unable to write the movie.");
+				trace::stop();
+				telemetry::stop();
+				perf::stopTrace();
+				if (profileFile)
+				{
+					FILE* report=nullptr;
+					_tfopen_s(&report, profileFile, _T("wt"));
+					if (report) profiler::writeReport(report);
+					else puts("[!] Unable to write the profile.");
+					if (report) fclose(report);
+				}
+				if (stacksFile)
+				{
+					FILE* stacks=nullptr;
+					_tfopen_s(&stacks, stacksFile, _T("wt"));
+					if (stacks) profiler::writeFolded(stacks);
+					else puts("[!] Unable to write the call stacks.");
+					if (stacks) fclose(stacks);
+				}
+				if (perfFile)
+				{
+					FILE* perfStats=nullptr;
+					_tfopen_s(&perfStats, perfFile, _T("wt"));
+					if (perfStats==nullptr || !perf::exportStatistics(perfStats))
+						puts("[!] Unable to write the timing statistics.");
+					if (perfStats) fclose(perfStats);
+				}
+				if (statsFile)
+				{
+					FILE* stats=nullptr;
+					_tfopen_s(&stats, statsFile, _T("wt"));
+					if (stats==nullptr || !pacer::exportStatistics(stats))
+						puts("[!] Unable to write the frame statistics.");
+					if (stats) fclose(stats);
+				}
 
 				ui::onGameEnd();
+				input::setProvider(nullptr);
+				audio::detach();
+				if (wav.samples()>0 && !wav.close())
+					puts("[!] Unable to write the wav file.");
 
 				fclose(fp);
 			}else
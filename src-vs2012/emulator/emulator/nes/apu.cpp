@@ -0,0 +1,911 @@
+#include "../stdafx.h"
+
+// local header files
+#include "../macros.h"
+#include "../types/types.h"
+#include "../unittest/framework.h"
+
+#include "internals.h"
+#include "debug.h"
+#include "dirty.h"
+#include "state.h"
+#include "mmc.h"
+#include "cpu.h"
+#include "apu.h"
+#include "audio.h"
+#include "perf.h"
+
+#include <math.h>
+
+// band-limited step synthesis
+//
+// A change of level at a fractional sample position is added as a windowed
+// sinc impulse to a buffer of differences, and the buffer is integrated when
+// the samples are read. The impulse is looked up from a table of PHASES
+// fractional positions. Steps appear TAPS/2 samples late.
+namespace blip
+{
+	static const int PHASE_BITS=5;
+	static const int PHASES=1<<PHASE_BITS;
+	static const int TAPS=16;
+	static const int KERNEL_BITS=12; // each phase sums to 1<<KERNEL_BITS
+
+	// a frame is about 800 samples
+	static const int BUFFER_SIZE=4096;
+
+	static int kernel[PHASES][TAPS];
+	static int32_t buffer[BUFFER_SIZE+TAPS];
+
+	static uint64_t factor; // samples per cpu cycle, 32.32 fixed point
+	static uint64_t offset; // fraction of a sample at the start of the frame
+	static int32_t level; // integrator
+	static int32_t dc; // high-pass filter, 16.16 fixed point
+
+	static void init()
+	{
+		const double PI=3.14159265358979323846;
+		const double CUTOFF=0.9; // of the nyquist frequency
+		for (int p=0; p<PHASES; p++)
+		{
+			double taps[TAPS];
+			double sum=0;
+			for (int i=0; i<TAPS; i++)
+			{
+				const double x=i-TAPS/2-(double)p/PHASES;
+				const double w=x/(TAPS/2+1);
+				const double window=0.42+0.5*cos(PI*w)+0.08*cos(2*PI*w);
+				const double sinc=(x==0)?1.0:sin(PI*CUTOFF*x)/(PI*CUTOFF*x);
+				taps[i]=window*sinc;
+				sum+=taps[i];
+			}
+
+			// every phase adds exactly one step
+			int total=0, peak=0;
+			for (int i=0; i<TAPS; i++)
+			{
+				kernel[p][i]=(int)floor(taps[i]/sum*(1<<KERNEL_BITS)+0.5);
+				total+=kernel[p][i];
+				if (kernel[p][i]>kernel[p][peak]) peak=i;
+			}
+			kernel[p][peak]+=(1<<KERNEL_BITS)-total;
+		}
+		factor=(uint64_t)((double)apu::SAMPLE_RATE/apu::CPU_CLOCK_RATE*4294967296.0);
+	}
+
+	static void clear()
+	{
+		memset(buffer, 0, sizeof(buffer));
+		offset=0;
+		level=0;
+		dc=0;
+	}
+
+	// time in cpu cycles since the start of the frame
+	static void addDelta(const long long time, const int delta)
+	{
+		const uint64_t pos=offset+(uint64_t)time*factor;
+		const size_t index=(size_t)(pos>>32);
+		if (index>=BUFFER_SIZE) return; // frame far too long
+		const int* k=kernel[(pos>>(32-PHASE_BITS))&(PHASES-1)];
+		int32_t* out=buffer+index;
+		for (int i=0; i<TAPS; i++)
+		{
+			out[i]+=k[i]*delta;
+		}
+	}
+
+	// reads the samples before the given time
+	static int readSamples(const long long time, int16_t samples[])
+	{
+		const uint64_t end=offset+(uint64_t)time*factor;
+		const int count=(int)min(end>>32, (uint64_t)BUFFER_SIZE);
+		for (int i=0; i<count; i++)
+		{
+			level+=buffer[i];
+
+			// remove the dc offset, the 2A03 output is never negative
+			const int s=(level>>KERNEL_BITS)-(dc>>16);
+			dc+=s<<(16-KERNEL_BITS);
+			samples[i]=(int16_t)max(-32768, min(s, 32767));
+		}
+		memmove(buffer, buffer+count, (BUFFER_SIZE+TAPS-count)*sizeof(buffer[0]));
+		memset(buffer+BUFFER_SIZE+TAPS-count, 0, count*sizeof(buffer[0]));
+		offset=end&0xFFFFFFFF;
+		return count;
+	}
+}
+
+namespace apu
+{
+	static const long long NEVER=0x7FFFFFFFFFFFFFFFLL;
+
+	static const uint8_t lengthTable[32]={
+		10,254,20,2,40,4,80,6,160,8,60,10,14,12,26,14,
+		12,16,24,18,48,20,96,22,192,24,72,26,16,28,32,30
+	};
+
+	static const uint8_t dutyTable[4][8]={
+		{0,1,0,0,0,0,0,0},
+		{0,1,1,0,0,0,0,0},
+		{0,1,1,1,1,0,0,0},
+		{1,0,0,1,1,1,1,1}
+	};
+
+	static const uint8_t triangleTable[32]={
+		15,14,13,12,11,10,9,8,7,6,5,4,3,2,1,0,
+		0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15
+	};
+
+	// in cpu cycles
+	static const uint16_t noisePeriods[16]={4,8,16,32,64,96,128,160,202,254,380,508,762,1016,2034,4068};
+	static const uint16_t dmcPeriods[16]={428,380,340,320,286,254,226,214,190,160,142,128,106,84,72,54};
+
+	// frame counter steps in cpu cycles, every step clocks the envelopes and
+	// the linear counter, steps 1 and 3 also the length counters and sweeps
+	static const int frameSteps[2][4]={{7457,14913,22371,29829},{7457,14913,22371,37281}};
+	static const int framePeriods[2]={29830,37282};
+
+	// mixer output for 0-30 and 0-202, full scale is about AMPLITUDE
+	static const int AMPLITUDE=28000;
+	static int pulseTable[31];
+	static int tndTable[203];
+
+	struct ENVELOPE
+	{
+		bool start;
+		bool loop; // also halts the length counter
+		bool constant;
+		int period; // or constant volume
+		int divider;
+		int decay;
+
+		int volume() const
+		{
+			return constant?period:decay;
+		}
+
+		void clock()
+		{
+			if (start)
+			{
+				start=false;
+				decay=15;
+				divider=period;
+			}else if (divider>0)
+			{
+				divider--;
+			}else
+			{
+				divider=period;
+				if (decay>0)
+					decay--;
+				else if (loop)
+					decay=15;
+			}
+		}
+	};
+
+	struct PULSE
+	{
+		ENVELOPE envelope;
+		int duty;
+		int phase;
+		int timer; // 11-bit period
+		int length;
+		bool sweepEnabled;
+		bool sweepNegate;
+		bool sweepReload;
+		int sweepPeriod;
+		int sweepShift;
+		int sweepDivider;
+		long long next;
+	};
+
+	struct TRIANGLE
+	{
+		bool control; // also halts the length counter
+		bool linearReload;
+		int linearPeriod;
+		int linear;
+		int timer;
+		int length;
+		int phase;
+		long long next;
+	};
+
+	struct NOISE
+	{
+		ENVELOPE envelope;
+		bool mode;
+		int period;
+		int shift; // 15-bit feedback shift register
+		int length;
+		long long next;
+	};
+
+	struct DMC
+	{
+		bool irqEnabled;
+		bool loop;
+		int period;
+		int level; // 7-bit output
+		int sampleAddress;
+		int sampleLength;
+		int address;
+		int remaining; // bytes
+		bool bufferFull;
+		int buffer;
+		int shift;
+		int bits;
+		bool silence;
+		long long next;
+	};
+
+	static PULSE pulse[2];
+	static TRIANGLE triangle;
+	static NOISE noise;
+	static DMC dmc;
+	static bool enabled[4]; // $4015 bits 0-3
+
+	static bool fiveStep;
+	static bool frameIrqInhibit;
+	static bool frameIrq;
+	static bool dmcIrq;
+	static int frameStep;
+	static long long frameStart; // of the frame counter sequence
+	static long long frameEvent;
+
+	static long long time; // cpu cycles, same clock as cpu::cycles()
+	static long long sampleStart; // start of the audio frame
+	static bool outputEnabled=true;
+	static bool audible; // samples are going somewhere
+	static int emitted; // mix level last added to the buffer
+
+	void init()
+	{
+		pulseTable[0]=0;
+		for (size_t n=1; n<_countof(pulseTable); n++)
+		{
+			pulseTable[n]=(int)(95.52/(8128.0/n+100)*AMPLITUDE);
+		}
+		tndTable[0]=0;
+		for (size_t n=1; n<_countof(tndTable); n++)
+		{
+			tndTable[n]=(int)(163.67/(24329.0/n+100)*AMPLITUDE);
+		}
+		blip::init();
+		blip::clear();
+	}
+
+	static int sweepTarget(const int channel)
+	{
+		const PULSE& p=pulse[channel];
+		const int change=p.timer>>p.sweepShift;
+		if (!p.sweepNegate) return p.timer+change;
+		// pulse 1 adds the ones' complement
+		return p.timer-change-(channel==0?1:0);
+	}
+
+	static bool muted(const int channel)
+	{
+		return pulse[channel].timer<8 || sweepTarget(channel)>0x7FF;
+	}
+
+	static int pulseOutput(const int channel)
+	{
+		const PULSE& p=pulse[channel];
+		if (p.length==0 || !dutyTable[p.duty][p.phase] || muted(channel)) return 0;
+		return p.envelope.volume();
+	}
+
+	static int noiseOutput()
+	{
+		if (noise.length==0 || (noise.shift&1)) return 0;
+		return noise.envelope.volume();
+	}
+
+	static int mix()
+	{
+		return pulseTable[pulseOutput(0)+pulseOutput(1)]
+			+tndTable[3*triangleTable[triangle.phase]+2*noiseOutput()+dmc.level];
+	}
+
+	static void emit()
+	{
+		if (!audible) return;
+		const int level=mix();
+		if (level!=emitted)
+		{
+			blip::addDelta(time-sampleStart, level-emitted);
+			emitted=level;
+		}
+	}
+
+	// the timer of a channel whose output can't change is stopped
+	static void schedule(long long& next, const bool running, const int period)
+	{
+		if (!running)
+			next=NEVER;
+		else if (next==NEVER)
+			next=time+period;
+	}
+
+	static void scheduleAll()
+	{
+		for (int i=0; i<2; i++)
+		{
+			const PULSE& p=pulse[i];
+			schedule(pulse[i].next, p.length>0 && p.envelope.volume()>0 && !muted(i), (p.timer+1)*2);
+		}
+		// periods below 2 are ultrasonic, the output is held instead
+		schedule(triangle.next, triangle.length>0 && triangle.linear>0 && triangle.timer>=2, triangle.timer+1);
+		schedule(noise.next, noise.length>0 && noise.envelope.volume()>0, noise.period);
+		schedule(dmc.next, !dmc.silence || dmc.bufferFull || dmc.remaining>0, dmc.period);
+	}
+
+	static void fetchSample()
+	{
+		if (dmc.bufferFull || dmc.remaining==0) return;
+
+		// dma cycles stolen from the cpu are not emulated
+		dmc.buffer=mmc::read(maddr_t(dmc.address));
+		dmc.bufferFull=true;
+		dmc.address=(dmc.address==0xFFFF)?0x8000:dmc.address+1;
+		if (--dmc.remaining==0)
+		{
+			if (dmc.loop)
+			{
+				dmc.address=dmc.sampleAddress;
+				dmc.remaining=dmc.sampleLength;
+			}else if (dmc.irqEnabled)
+			{
+				dmcIrq=true;
+			}
+		}
+	}
+
+	static void clockPulse(PULSE& p)
+	{
+		p.phase=(p.phase+1)&7;
+		p.next+=(p.timer+1)*2;
+	}
+
+	static void clockTriangle()
+	{
+		triangle.phase=(triangle.phase+1)&31;
+		triangle.next+=triangle.timer+1;
+	}
+
+	static void clockNoise()
+	{
+		const int feedback=(noise.shift^(noise.shift>>(noise.mode?6:1)))&1;
+		noise.shift=(noise.shift>>1)|(feedback<<14);
+		noise.next+=noise.period;
+	}
+
+	static void clockDmc()
+	{
+		if (!dmc.silence)
+		{
+			if (dmc.shift&1)
+			{
+				if (dmc.level<=125) dmc.level+=2;
+			}else
+			{
+				if (dmc.level>=2) dmc.level-=2;
+			}
+		}
+		dmc.shift>>=1;
+		if (--dmc.bits==0)
+		{
+			dmc.bits=8;
+			dmc.silence=!dmc.bufferFull;
+			if (dmc.bufferFull)
+			{
+				dmc.shift=dmc.buffer;
+				dmc.bufferFull=false;
+				fetchSample();
+			}
+		}
+		dmc.next+=dmc.period;
+	}
+
+	static void clockQuarterFrame()
+	{
+		pulse[0].envelope.clock();
+		pulse[1].envelope.clock();
+		noise.envelope.clock();
+
+		if (triangle.linearReload)
+			triangle.linear=triangle.linearPeriod;
+		else if (triangle.linear>0)
+			triangle.linear--;
+		if (!triangle.control) triangle.linearReload=false;
+	}
+
+	static void clockHalfFrame()
+	{
+		for (int i=0; i<2; i++)
+		{
+			PULSE& p=pulse[i];
+			if (p.length>0 && !p.envelope.loop) p.length--;
+
+			if (p.sweepDivider==0 && p.sweepEnabled && p.sweepShift>0 && !muted(i))
+				p.timer=sweepTarget(i);
+			if (p.sweepDivider==0 || p.sweepReload)
+			{
+				p.sweepDivider=p.sweepPeriod;
+				p.sweepReload=false;
+			}else
+			{
+				p.sweepDivider--;
+			}
+		}
+		if (triangle.length>0 && !triangle.control) triangle.length--;
+		if (noise.length>0 && !noise.envelope.loop) noise.length--;
+	}
+
+	static void clockFrameCounter()
+	{
+		clockQuarterFrame();
+		if (frameStep&1) clockHalfFrame();
+		if (frameStep==3 && !fiveStep && !frameIrqInhibit) frameIrq=true;
+
+		if (++frameStep==4)
+		{
+			frameStep=0;
+			frameStart+=framePeriods[fiveStep];
+		}
+		frameEvent=frameStart+frameSteps[fiveStep][frameStep];
+		scheduleAll();
+	}
+
+	static void restartFrameCounter()
+	{
+		frameStep=0;
+		frameStart=time;
+		frameEvent=frameStart+frameSteps[fiveStep][0];
+	}
+
+	// jumps from one timer clock to the next
+	static void runUntil(const long long target)
+	{
+		while (time<target)
+		{
+			long long t=min(target, frameEvent);
+			t=min(t, min(pulse[0].next, pulse[1].next));
+			t=min(t, min(triangle.next, min(noise.next, dmc.next)));
+			time=t;
+
+			if (pulse[0].next==t) clockPulse(pulse[0]);
+			if (pulse[1].next==t) clockPulse(pulse[1]);
+			if (triangle.next==t) clockTriangle();
+			if (noise.next==t) clockNoise();
+			if (dmc.next==t) clockDmc();
+			if (frameEvent==t) clockFrameCounter();
+			emit();
+		}
+	}
+
+	// the line is shared with the mappers, only the apu's own request changes
+	static void updateIrq()
+	{
+		if (frameIrq || dmcIrq)
+			cpu::raiseIrq(IRQSOURCE::APU);
+		else
+			cpu::lowerIrq(IRQSOURCE::APU);
+	}
+
+	void reset()
+	{
+		memset(pulse, 0, sizeof(pulse));
+		memset(&triangle, 0, sizeof(triangle));
+		memset(&noise, 0, sizeof(noise));
+		memset(&dmc, 0, sizeof(dmc));
+		memset(enabled, 0, sizeof(enabled));
+		noise.shift=1;
+		noise.period=noisePeriods[0];
+		dmc.period=dmcPeriods[0];
+		dmc.bits=8;
+		dmc.silence=true;
+
+		fiveStep=false;
+		frameIrqInhibit=false;
+		frameIrq=false;
+		dmcIrq=false;
+
+		time=cpu::cycles();
+		sampleStart=time;
+		restartFrameCounter();
+		scheduleAll();
+		emit();
+	}
+
+	void run()
+	{
+		PERF_SCOPE(APU);
+		runUntil(cpu::cycles());
+		updateIrq();
+	}
+
+	void endFrame()
+	{
+		runUntil(cpu::cycles());
+
+		int16_t samples[blip::BUFFER_SIZE];
+		const int count=blip::readSamples(time-sampleStart, samples);
+		if (audible) audio::write(samples, count);
+		sampleStart=time;
+
+		// a sink may have been attached or detached
+		audible=outputEnabled && audio::active();
+	}
+
+	void enableOutput(const bool enabled)
+	{
+		outputEnabled=enabled;
+		audible=outputEnabled && audio::active();
+	}
+
+	byte_t readStatus()
+	{
+		run();
+		byte_t status=0;
+		if (pulse[0].length>0) status|=0x01;
+		if (pulse[1].length>0) status|=0x02;
+		if (triangle.length>0) status|=0x04;
+		if (noise.length>0) status|=0x08;
+		if (dmc.remaining>0) status|=0x10;
+		if (frameIrq) status|=0x40;
+		if (dmcIrq) status|=0x80;
+
+		frameIrq=false;
+		updateIrq();
+		return status;
+	}
+
+	static void writePulse(const int channel, const int reg, const byte_t value)
+	{
+		PULSE& p=pulse[channel];
+		switch (reg)
+		{
+		case 0:
+			p.duty=value>>6;
+			p.envelope.loop=(value&0x20)!=0;
+			p.envelope.constant=(value&0x10)!=0;
+			p.envelope.period=value&0x0F;
+			break;
+		case 1:
+			p.sweepEnabled=(value&0x80)!=0;
+			p.sweepPeriod=(value>>4)&7;
+			p.sweepNegate=(value&0x08)!=0;
+			p.sweepShift=value&7;
+			p.sweepReload=true;
+			break;
+		case 2:
+			p.timer=(p.timer&0x700)|value;
+			break;
+		case 3:
+			p.timer=(p.timer&0xFF)|((value&7)<<8);
+			if (enabled[channel]) p.length=lengthTable[value>>3];
+			p.phase=0;
+			p.envelope.start=true;
+			break;
+		}
+	}
+
+	void write(const int addr, const byte_t value)
+	{
+		runUntil(cpu::cycles());
+		switch (addr)
+		{
+		case 0x4000: case 0x4001: case 0x4002: case 0x4003:
+			writePulse(0, addr&3, value);
+			break;
+		case 0x4004: case 0x4005: case 0x4006: case 0x4007:
+			writePulse(1, addr&3, value);
+			break;
+
+		case 0x4008:
+			triangle.control=(value&0x80)!=0;
+			triangle.linearPeriod=value&0x7F;
+			break;
+		case 0x400A:
+			triangle.timer=(triangle.timer&0x700)|value;
+			break;
+		case 0x400B:
+			triangle.timer=(triangle.timer&0xFF)|((value&7)<<8);
+			if (enabled[2]) triangle.length=lengthTable[value>>3];
+			triangle.linearReload=true;
+			break;
+
+		case 0x400C:
+			noise.envelope.loop=(value&0x20)!=0;
+			noise.envelope.constant=(value&0x10)!=0;
+			noise.envelope.period=value&0x0F;
+			break;
+		case 0x400E:
+			noise.mode=(value&0x80)!=0;
+			noise.period=noisePeriods[value&0x0F];
+			break;
+		case 0x400F:
+			if (enabled[3]) noise.length=lengthTable[value>>3];
+			noise.envelope.start=true;
+			break;
+
+		case 0x4010:
+			dmc.irqEnabled=(value&0x80)!=0;
+			dmc.loop=(value&0x40)!=0;
+			dmc.period=dmcPeriods[value&0x0F];
+			if (!dmc.irqEnabled) dmcIrq=false;
+			break;
+		case 0x4011:
+			dmc.level=value&0x7F;
+			break;
+		case 0x4012:
+			dmc.sampleAddress=0xC000|(value<<6);
+			break;
+		case 0x4013:
+			dmc.sampleLength=(value<<4)|1;
+			break;
+
+		case 0x4015:
+			for (int i=0; i<4; i++)
+			{
+				enabled[i]=(value&(1<<i))!=0;
+			}
+			if (!enabled[0]) pulse[0].length=0;
+			if (!enabled[1]) pulse[1].length=0;
+			if (!enabled[2]) triangle.length=0;
+			if (!enabled[3]) noise.length=0;
+			if (!(value&0x10))
+			{
+				dmc.remaining=0;
+			}else if (dmc.remaining==0)
+			{
+				dmc.address=dmc.sampleAddress;
+				dmc.remaining=dmc.sampleLength;
+				fetchSample();
+			}
+			dmcIrq=false;
+			break;
+
+		case 0x4017:
+			fiveStep=(value&0x80)!=0;
+			frameIrqInhibit=(value&0x40)!=0;
+			if (frameIrqInhibit) frameIrq=false;
+			restartFrameCounter();
+			if (fiveStep)
+			{
+				clockQuarterFrame();
+				clockHalfFrame();
+			}
+			break;
+
+		default:
+			// $4009 and $400D are unused
+			break;
+		}
+		scheduleAll();
+		emit();
+		updateIrq();
+	}
+
+	// times are saved relative to the apu clock, NEVER as 0xFFFFFFFF
+	static void saveTime(state::Writer& w, const long long t)
+	{
+		w.u32((t==NEVER)?0xFFFFFFFF:(uint32_t)(t-time));
+	}
+
+	static long long loadTime(state::Reader& r)
+	{
+		const uint32_t t=r.u32();
+		return (t==0xFFFFFFFF)?NEVER:time+t;
+	}
+
+	static void saveEnvelope(state::Writer& w, const ENVELOPE& e)
+	{
+		w.u8(e.start|(e.loop<<1)|(e.constant<<2));
+		w.u8(e.period);
+		w.u8(e.divider);
+		w.u8(e.decay);
+	}
+
+	static void loadEnvelope(state::Reader& r, ENVELOPE& e)
+	{
+		const uint32_t flags=r.u8();
+		e.start=(flags&1)!=0;
+		e.loop=(flags&2)!=0;
+		e.constant=(flags&4)!=0;
+		e.period=r.u8();
+		e.divider=r.u8();
+		e.decay=r.u8();
+	}
+
+	void save(state::Writer& w)
+	{
+		w.beginChunk(state::CHUNK_APU);
+
+		// cycles the cpu has run ahead
+		w.u32((uint32_t)(cpu::cycles()-time));
+
+		for (int i=0; i<2; i++)
+		{
+			const PULSE& p=pulse[i];
+			saveEnvelope(w, p.envelope);
+			w.u8(p.duty);
+			w.u8(p.phase);
+			w.u16(p.timer);
+			w.u8(p.length);
+			w.u8(p.sweepEnabled|(p.sweepNegate<<1)|(p.sweepReload<<2));
+			w.u8(p.sweepPeriod);
+			w.u8(p.sweepShift);
+			w.u8(p.sweepDivider);
+			saveTime(w, p.next);
+		}
+
+		w.u8(triangle.control|(triangle.linearReload<<1));
+		w.u8(triangle.linearPeriod);
+		w.u8(triangle.linear);
+		w.u16(triangle.timer);
+		w.u8(triangle.length);
+		w.u8(triangle.phase);
+		saveTime(w, triangle.next);
+
+		saveEnvelope(w, noise.envelope);
+		w.u8(noise.mode);
+		w.u16(noise.period);
+		w.u16(noise.shift);
+		w.u8(noise.length);
+		saveTime(w, noise.next);
+
+		w.u8(dmc.irqEnabled|(dmc.loop<<1)|(dmc.bufferFull<<2)|(dmc.silence<<3));
+		w.u16(dmc.period);
+		w.u8(dmc.level);
+		w.u16(dmc.sampleAddress);
+		w.u16(dmc.sampleLength);
+		w.u16(dmc.address);
+		w.u16(dmc.remaining);
+		w.u8(dmc.buffer);
+		w.u8(dmc.shift);
+		w.u8(dmc.bits);
+		saveTime(w, dmc.next);
+
+		w.u8(enabled[0]|(enabled[1]<<1)|(enabled[2]<<2)|(enabled[3]<<3));
+		w.u8(fiveStep|(frameIrqInhibit<<1)|(frameIrq<<2)|(dmcIrq<<3));
+		w.u8(frameStep);
+		w.u32((uint32_t)(time-frameStart));
+
+		w.endChunk();
+	}
+
+	bool load(const state::Reader& image)
+	{
+		state::Reader r;
+		if (!image.findChunk(state::CHUNK_APU, r))
+		{
+			// older images, silent apu
+			reset();
+			return true;
+		}
+
+		time=cpu::cycles()-r.u32();
+		sampleStart=time;
+
+		for (int i=0; i<2; i++)
+		{
+			PULSE& p=pulse[i];
+			loadEnvelope(r, p.envelope);
+			p.duty=r.u8()&3;
+			p.phase=r.u8()&7;
+			p.timer=r.u16()&0x7FF;
+			p.length=r.u8();
+			const uint32_t flags=r.u8();
+			p.sweepEnabled=(flags&1)!=0;
+			p.sweepNegate=(flags&2)!=0;
+			p.sweepReload=(flags&4)!=0;
+			p.sweepPeriod=r.u8();
+			p.sweepShift=r.u8()&7;
+			p.sweepDivider=r.u8();
+			p.next=loadTime(r);
+		}
+
+		uint32_t flags=r.u8();
+		triangle.control=(flags&1)!=0;
+		triangle.linearReload=(flags&2)!=0;
+		triangle.linearPeriod=r.u8();
+		triangle.linear=r.u8();
+		triangle.timer=r.u16()&0x7FF;
+		triangle.length=r.u8();
+		triangle.phase=r.u8()&31;
+		triangle.next=loadTime(r);
+
+		loadEnvelope(r, noise.envelope);
+		noise.mode=r.u8()!=0;
+		noise.period=max(r.u16(), 1u);
+		noise.shift=r.u16()&0x7FFF;
+		noise.length=r.u8();
+		noise.next=loadTime(r);
+
+		flags=r.u8();
+		dmc.irqEnabled=(flags&1)!=0;
+		dmc.loop=(flags&2)!=0;
+		dmc.bufferFull=(flags&4)!=0;
+		dmc.silence=(flags&8)!=0;
+		dmc.period=max(r.u16(), 1u);
+		dmc.level=r.u8()&0x7F;
+		dmc.sampleAddress=r.u16();
+		dmc.sampleLength=r.u16();
+		dmc.address=r.u16();
+		dmc.remaining=r.u16();
+		dmc.buffer=r.u8();
+		dmc.shift=r.u8();
+		dmc.bits=max(r.u8(), 1u);
+		dmc.next=loadTime(r);
+
+		flags=r.u8();
+		for (int i=0; i<4; i++)
+		{
+			enabled[i]=(flags&(1<<i))!=0;
+		}
+		flags=r.u8();
+		fiveStep=(flags&1)!=0;
+		frameIrqInhibit=(flags&2)!=0;
+		frameIrq=(flags&4)!=0;
+		dmcIrq=(flags&8)!=0;
+		frameStep=r.u8()&3;
+		frameStart=time-r.u32();
+		frameEvent=frameStart+frameSteps[fiveStep][frameStep];
+		return r.ok();
+	}
+}
+
+// unit tests
+class ApuTest : public TestCase
+{
+public:
+	virtual const char* name()
+	{
+		return "APU Test";
+	}
+
+	virtual TestResult run()
+	{
+		apu::init();
+		apu::reset();
+		apu::enableOutput(false);
+
+		puts("checking length counters...");
+		apu::write(0x4015, 0x01);
+		apu::write(0x4000, 0x3F); // halted, constant volume 15
+		apu::write(0x4002, 0xFD);
+		apu::write(0x4003, 0x08); // length 254
+		tassert((apu::readStatus()&0x1F)==0x01);
+		apu::write(0x4015, 0x00);
+		tassert((apu::readStatus()&0x1F)==0x00);
+		apu::write(0x4003, 0x08); // ignored while disabled
+		tassert((apu::readStatus()&0x1F)==0x00);
+
+		puts("checking the mixer...");
+		tassert(apu::pulseTable[30]<apu::AMPLITUDE/3);
+		tassert(apu::tndTable[202]<apu::AMPLITUDE);
+		tassert(apu::pulseTable[30]+apu::tndTable[202]>apu::AMPLITUDE*9/10);
+
+		puts("checking the band-limited steps...");
+		for (int p=0; p<blip::PHASES; p++)
+		{
+			int sum=0;
+			for (int i=0; i<blip::TAPS; i++)
+			{
+				sum+=blip::kernel[p][i];
+			}
+			tassert(sum==(1<<blip::KERNEL_BITS));
+		}
+
+		apu::reset();
+		apu::enableOutput(true);
+		return SUCCESS;
+	}
+};
+
+registerTestCase(ApuTest);
@@ -0,0 +1,41 @@
+// 2A03 audio processing unit
+//
+// Two pulse channels, a triangle, a noise generator and the delta modulation
+// channel, sequenced by the frame counter. The APU is not stepped every CPU
+// cycle. It runs lazily up to cpu::cycles() when a register is accessed and
+// once per scanline, and jumps from one timer clock to the next. Output only
+// costs work when the mixed level changes. Each change is added to a
+// band-limited step buffer that is read at SAMPLE_RATE at the end of the frame.
+//
+// Samples go to the audio ring (see audio.h) only while output is enabled and
+// a sink is attached. Without one, the channels are still run so that length
+// counters, $4015 and the IRQs stay exact.
+
+namespace apu
+{
+	const int SAMPLE_RATE=48000;
+
+	// NTSC 2A03
+	const int CPU_CLOCK_RATE=1789773;
+
+	void init();
+	void reset();
+
+	// catches up to the cpu and raises or withdraws the IRQ line
+	void run();
+
+	// flushes the samples of the frame
+	void endFrame();
+
+	// output is turned off for frames nobody hears, e.g. run-ahead
+	void enableOutput(const bool enabled);
+
+	// $4015, clears the frame interrupt
+	byte_t readStatus();
+
+	// $4000-$4013, $4015 and $4017
+	void write(const int addr, const byte_t value);
+
+	void save(state::Writer& w);
+	bool load(const state::Reader& image);
+}
@@ -0,0 +1,219 @@
+#include "../stdafx.h"
+
+// local header files
+#include "../macros.h"
+#include "../types/types.h"
+#include "../types/endian.h"
+#include "../types/spsc.h"
+#include "../unittest/framework.h"
+
+#include "internals.h"
+#include "debug.h"
+#include "audio.h"
+
+#include <thread>
+#include <chrono>
+
+namespace audio
+{
+	// about 0.7 second at 48 kHz
+	static const int RING_SIZE=1<<15;
+
+	// samples handed to the sink at once
+	static const int CHUNK_SIZE=2048;
+
+	static spsc_queue<int16_t,RING_SIZE> ring;
+	static Sink* current=nullptr;
+	static std::thread consumer;
+	static std::atomic<bool> stopping(false);
+	static long long droppedSamples=0;
+
+	WavSink::WavSink(): _fp(nullptr), _rate(0), _samples(0), _failed(false)
+	{
+	}
+
+	WavSink::~WavSink()
+	{
+		close();
+	}
+
+	bool WavSink::open(const _TCHAR* file, const int rate)
+	{
+		close();
+		_tfopen_s(&_fp, file, _T("wb"));
+		if (_fp==nullptr)
+		{
+			_tprintf(_T("Couldn't open %s (error code %d)\n"), file, errno);
+			return false;
+		}
+		_rate=rate;
+		_samples=0;
+		_failed=false;
+
+		// the sizes are filled in by close()
+		uint8_t header[44]={0};
+		_failed|=fwrite(header, sizeof(header), 1, _fp)!=1;
+		return !_failed;
+	}
+
+	bool WavSink::close()
+	{
+		if (_fp==nullptr) return false;
+
+		const uint32_t dataSize=_samples*2;
+		uint8_t header[44];
+		memcpy(header, "RIFF", 4);
+		endian::store32(header+4, 36+dataSize);
+		memcpy(header+8, "WAVEfmt ", 8);
+		endian::store32(header+16, 16);
+		endian::store16(header+20, 1); // PCM
+		endian::store16(header+22, 1); // mono
+		endian::store32(header+24, _rate);
+		endian::store32(header+28, _rate*2); // bytes per second
+		endian::store16(header+32, 2); // block align
+		endian::store16(header+34, 16); // bits per sample
+		memcpy(header+36, "data", 4);
+		endian::store32(header+40, dataSize);
+
+		_failed|=fseek(_fp, 0, SEEK_SET)!=0;
+		_failed|=fwrite(header, sizeof(header), 1, _fp)!=1;
+		_failed|=fclose(_fp)!=0;
+		_fp=nullptr;
+		return !_failed;
+	}
+
+	void WavSink::consume(const int16_t samples[], const size_t count)
+	{
+		if (_fp==nullptr) return;
+		uint8_t data[CHUNK_SIZE*2];
+		for (size_t done=0; done<count;)
+		{
+			const size_t n=min(count-done, (size_t)CHUNK_SIZE);
+			for (size_t i=0; i<n; i++)
+			{
+				endian::store16(data+i*2, (uint16_t)samples[done+i]);
+			}
+			_failed|=fwrite(data, n*2, 1, _fp)!=1;
+			done+=n;
+		}
+		_samples+=(uint32_t)count;
+	}
+
+	static void consumeAll()
+	{
+		int16_t samples[CHUNK_SIZE];
+		for (;;)
+		{
+			const size_t count=ring.pop(samples, CHUNK_SIZE);
+			if (count==0)
+			{
+				// everything written before detach() is visible by now
+				if (stopping.load() && ring.empty()) break;
+				std::this_thread::sleep_for(std::chrono::milliseconds(2));
+				continue;
+			}
+			current->consume(samples, count);
+		}
+	}
+
+	void attach(Sink* sink)
+	{
+		detach();
+		if (sink==nullptr) return;
+
+		int16_t discard[CHUNK_SIZE];
+		while (ring.pop(discard, CHUNK_SIZE)>0);
+
+		current=sink;
+		stopping=false;
+		consumer=std::thread(consumeAll);
+	}
+
+	void detach()
+	{
+		if (current==nullptr) return;
+		stopping=true;
+		consumer.join();
+		current=nullptr;
+	}
+
+	bool active()
+	{
+		return current!=nullptr;
+	}
+
+	void write(const int16_t samples[], const size_t count)
+	{
+		if (current==nullptr) return;
+
+		size_t done=ring.push(samples, count);
+		if (current->lossless())
+		{
+			while (done<count)
+			{
+				std::this_thread::yield();
+				done+=ring.push(samples+done, count-done);
+			}
+		}
+		droppedSamples+=count-done;
+	}
+
+	long long dropped()
+	{
+		return droppedSamples;
+	}
+}
+
+// unit tests
+class AudioTest : public TestCase
+{
+public:
+	virtual const char* name()
+	{
+		return "Audio Output Test";
+	}
+
+	virtual TestResult run()
+	{
+		class Counter : public audio::Sink
+		{
+		public:
+			Counter(): count(0), sum(0) {}
+			virtual void consume(const int16_t samples[], const size_t n)
+			{
+				for (size_t i=0; i<n; i++)
+				{
+					sum+=samples[i];
+				}
+				count+=n;
+			}
+			virtual bool lossless() const {return true;}
+
+			size_t count;
+			long long sum;
+		};
+
+		puts("checking the consumer thread...");
+		Counter counter;
+		audio::attach(&counter);
+		tassert(audio::active());
+		int16_t samples[1000];
+		long long sum=0;
+		for (size_t i=0; i<_countof(samples); i++)
+		{
+			samples[i]=(int16_t)((int)i*37-16000);
+			sum+=samples[i];
+		}
+		for (int i=0; i<100; i++)
+		{
+			audio::write(samples, _countof(samples));
+		}
+		audio::detach();
+		tassert(!audio::active());
+		tassert(counter.count==100*_countof(samples));
+		tassert(counter.sum==100*sum);
+		return SUCCESS;
+	}
+};
+
+registerTestCase(AudioTest);
@@ -0,0 +1,58 @@
+// audio output
+//
+// The emulation thread writes 16-bit mono samples into a lock-free ring and a
+// consumer thread hands them to the attached Sink. Samples are dropped when
+// the ring is full, unless the sink is lossless, e.g. a file. Then the
+// emulation waits for the consumer.
+
+namespace audio
+{
+	class Sink
+	{
+	public:
+		virtual ~Sink() {}
+
+		// called on the consumer thread
+		virtual void consume(const int16_t samples[], const size_t count)=0;
+
+		virtual bool lossless() const {return false;}
+	};
+
+	// RIFF/WAVE file, 16-bit PCM mono
+	class WavSink : public Sink
+	{
+	public:
+		WavSink();
+		virtual ~WavSink();
+
+		bool open(const _TCHAR* file, const int rate);
+
+		// completes the header
+		bool close();
+
+		virtual void consume(const int16_t samples[], const size_t count);
+		virtual bool lossless() const {return true;}
+
+		uint32_t samples() const {return _samples;}
+
+	private:
+		FILE* _fp;
+		int _rate;
+		uint32_t _samples;
+		bool _failed;
+	};
+
+	// starts the consumer thread
+	void attach(Sink* sink);
+
+	// hands over the remaining samples and stops the consumer thread
+	void detach();
+
+	bool active();
+
+	// emulation thread
+	void write(const int16_t samples[], const size_t count);
+
+	// samples lost to a full ring
+	long long dropped();
+}
@@ -0,0 +1,154 @@
+#include "../stdafx.h"
+
+// local header files
+#include "../macros.h"
+#include "../types/types.h"
+#include "../unittest/framework.h"
+
+#include "internals.h"
+#include "debug.h"
+#include "dirty.h"
+#include "state.h"
+#include "mmc.h"
+#include "emu.h"
+#include "clone.h"
+
+namespace clone
+{
+	struct Console::IMAGE
+	{
+		int refs;
+		size_t capacity;
+		size_t size;
+		uint8_t* data;
+
+		explicit IMAGE(const size_t capacity):
+			refs(1), capacity(capacity), size(0), data(new uint8_t[capacity])
+		{
+		}
+
+		~IMAGE()
+		{
+			delete[] data;
+		}
+	};
+
+	Console::Console(): _image(nullptr), _epoch(0)
+	{
+	}
+
+	Console::Console(const Console& other): _image(other._image), _epoch(other._epoch)
+	{
+		if (_image) _image->refs++;
+	}
+
+	Console& Console::operator=(const Console& other)
+	{
+		if (other._image) other._image->refs++;
+		release();
+		_image=other._image;
+		_epoch=other._epoch;
+		return *this;
+	}
+
+	Console::~Console()
+	{
+		release();
+	}
+
+	void Console::release()
+	{
+		if (_image && --_image->refs==0)
+		{
+			delete _image;
+		}
+		_image=nullptr;
+	}
+
+	bool Console::capture()
+	{
+		const size_t required=emu::stateSize();
+		if (_image==nullptr || _image->capacity<required)
+		{
+			release();
+			_image=new IMAGE(required);
+			_epoch=0;
+		}else if (_image->refs>1)
+		{
+			// copy on write. the copy is still a valid base for an incremental update.
+			IMAGE* copy=new IMAGE(_image->capacity);
+			memcpy(copy->data, _image->data, _image->size);
+			copy->size=_image->size;
+			release();
+			_image=copy;
+		}
+
+		_image->size=emu::saveState(_image->data, _image->capacity, _epoch);
+		return _image->size>0;
+	}
+
+	bool Console::restore()
+	{
+		if (_image==nullptr || _image->size==0) return false;
+		return emu::loadState(_image->data, _image->size, _epoch);
+	}
+
+	size_t Console::size() const
+	{
+		return _image?_image->size:0;
+	}
+
+	bool Console::shared() const
+	{
+		return _image && _image->refs>1;
+	}
+}
+
+// unit tests
+class CloneTest : public TestCase
+{
+public:
+	virtual const char* name()
+	{
+		return "Console Clone Test";
+	}
+
+	virtual TestResult run()
+	{
+		// a machine without rom, cleared again before anything is loaded
+		emu::reset();
+		const maddr_t addr1(0x10), addr2(0x7FF); // first and last page of RAM
+
+		puts("checking capture and restore...");
+		mmc::write(addr1, 1);
+		clone::Console a;
+		tassert(a.empty() && !a.restore());
+		tassert(a.capture() && a.size()>0);
+
+		mmc::write(addr1, 2);
+		clone::Console b(a);
+		tassert(a.shared() && b.shared());
+		tassert(b.capture());
+		tassert(!a.shared() && !b.shared());
+
+		tassert(a.restore());
+		tassert(mmc::read(addr1)==1);
+		tassert(b.restore());
+		tassert(mmc::read(addr1)==2);
+
+		puts("checking copies...");
+		clone::Console c;
+		c=a;
+		tassert(c.shared());
+		mmc::write(addr1, 3);
+		mmc::write(addr2, 3);
+		tassert(c.restore());
+		tassert(mmc::read(addr1)==1);
+		tassert(mmc::read(addr2)==0);
+
+		emu::reset();
+		return SUCCESS;
+	}
+};
+
+registerTestCase(CloneTest);
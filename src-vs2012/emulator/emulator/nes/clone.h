@@ -0,0 +1,41 @@
+// console cloning for tree searches
+//
+// A Console holds the mutable state of the machine: registers, RAM, SRAM,
+// name tables, palette, OAM, mapper registers and CHR-RAM. ROM and CHR-ROM
+// are never copied, restoring only replays the bank-switching state and banks
+// that already match are skipped. Each clone remembers when it last matched
+// the running machine, so capture and restore only copy the pages written
+// since (see dirty.h).
+//
+// Copying a Console shares its image; the image is duplicated on the first
+// capture into a shared copy. Clones are not thread-safe, like the machine.
+
+namespace clone
+{
+	class Console
+	{
+	public:
+		Console();
+		Console(const Console& other);
+		Console& operator=(const Console& other);
+		~Console();
+
+		// copies the running machine into this clone
+		bool capture();
+
+		// makes this clone the running machine
+		bool restore();
+
+		bool empty() const {return _image==nullptr;}
+		size_t size() const;
+		bool shared() const;
+
+	private:
+		struct IMAGE;
+
+		void release();
+
+		IMAGE* _image;
+		uint64_t _epoch;
+	};
+}
@@ -0,0 +1,223 @@
+#include "../stdafx.h"
+
+// local header files
+#include "../macros.h"
+#include "../types/types.h"
+#include "../unittest/framework.h"
+
+#include "internals.h"
+#include "codec.h"
+
+namespace codec
+{
+	const size_t MAX_LITERAL=0x80;
+	const size_t RUN_LENGTH_EXTENDED=0x7F;
+
+	struct OUTPUT
+	{
+		uint8_t* data;
+		size_t capacity;
+		size_t size;
+
+		bool put(const uint8_t byte)
+		{
+			if (size>=capacity) return false;
+			data[size++]=byte;
+			return true;
+		}
+	};
+
+	static inline uint8_t at(const uint8_t* data, const uint8_t* ref, const size_t i)
+	{
+		return ref?(uint8_t)(data[i]^ref[i]):data[i];
+	}
+
+	// length of the run of value v starting at i
+	static size_t runLength(const uint8_t* data, const uint8_t* ref, const size_t i, const size_t size, const uint8_t v)
+	{
+		size_t j=i+1;
+
+		// compare a word at a time, long runs are the common case
+		const uint64_t pattern=0x0101010101010101ULL*v;
+		while (j+8<=size)
+		{
+			uint64_t a;
+			memcpy(&a, data+j, 8);
+			if (ref)
+			{
+				uint64_t b;
+				memcpy(&b, ref+j, 8);
+				a^=b;
+			}
+			if (a!=pattern) break;
+			j+=8;
+		}
+		while (j<size && at(data, ref, j)==v) j++;
+		return j-i;
+	}
+
+	static bool putLiterals(OUTPUT& out, const uint8_t* data, const uint8_t* ref, size_t from, const size_t to)
+	{
+		while (from<to)
+		{
+			const size_t n=min(to-from, MAX_LITERAL);
+			if (out.size+1+n>out.capacity) return false;
+			out.data[out.size++]=(uint8_t)(n-1);
+			for (size_t k=0; k<n; k++)
+			{
+				out.data[out.size++]=at(data, ref, from+k);
+			}
+			from+=n;
+		}
+		return true;
+	}
+
+	static bool putRun(OUTPUT& out, const uint8_t v, const size_t length)
+	{
+		assert(length>=MIN_RUN);
+		size_t excess=length-MIN_RUN;
+		if (excess<RUN_LENGTH_EXTENDED)
+		{
+			if (!out.put((uint8_t)(0x80|excess))) return false;
+		}else
+		{
+			if (!out.put((uint8_t)(0x80|RUN_LENGTH_EXTENDED))) return false;
+			excess-=RUN_LENGTH_EXTENDED;
+			do
+			{
+				const uint8_t byte=(uint8_t)(excess&0x7F);
+				excess>>=7;
+				if (!out.put(excess?(byte|0x80):byte)) return false;
+			}while (excess);
+		}
+		return out.put(v);
+	}
+
+	size_t bound(const size_t size)
+	{
+		// one token per literal block plus the trailing token
+		return size+size/MAX_LITERAL+16;
+	}
+
+	size_t encode(const uint8_t* data, const uint8_t* ref, const size_t size, uint8_t* out, const size_t capacity)
+	{
+		OUTPUT o={out, capacity, 0};
+		size_t literal=0;
+		for (size_t i=0; i<size;)
+		{
+			const uint8_t v=at(data, ref, i);
+			const size_t run=runLength(data, ref, i, size, v);
+			if (run>=MIN_RUN)
+			{
+				if (!putLiterals(o, data, ref, literal, i)) return 0;
+				if (!putRun(o, v, run)) return 0;
+				literal=i+run;
+			}
+			i+=run;
+		}
+		if (!putLiterals(o, data, ref, literal, size)) return 0;
+		return o.size;
+	}
+
+	bool decode(const uint8_t* in, const size_t inSize, uint8_t* dest, const uint8_t* ref, const size_t size)
+	{
+		size_t i=0, o=0;
+		while (i<inSize)
+		{
+			const uint8_t token=in[i++];
+			if (token<0x80)
+			{
+				// literal
+				const size_t n=token+1;
+				if (n>inSize-i || n>size-o) return false;
+				for (size_t k=0; k<n; k++)
+				{
+					dest[o+k]=ref?(uint8_t)(in[i+k]^ref[o+k]):in[i+k];
+				}
+				i+=n;
+				o+=n;
+			}else
+			{
+				// run
+				size_t n=(token&0x7F)+MIN_RUN;
+				if ((token&0x7F)==RUN_LENGTH_EXTENDED)
+				{
+					size_t excess=0;
+					for (int shift=0;; shift+=7)
+					{
+						if (i>=inSize || shift>=(int)SIZE_IN_BITS(size_t)) return false;
+						const uint8_t byte=in[i++];
+						excess|=(size_t)(byte&0x7F)<<shift;
+						if (!(byte&0x80)) break;
+					}
+					n+=excess;
+				}
+				if (i>=inSize || n>size-o) return false;
+				const uint8_t v=in[i++];
+				if (ref==nullptr)
+				{
+					memset(dest+o, v, n);
+				}else if (ref!=dest || v!=0)
+				{
+					for (size_t k=0; k<n; k++)
+					{
+						dest[o+k]=ref[o+k]^v;
+					}
+				}
+				o+=n;
+			}
+		}
+		return o==size;
+	}
+}
+
+// unit tests
+class CodecTest : public TestCase
+{
+public:
+	virtual const char* name()
+	{
+		return "RLE Codec Test";
+	}
+
+	virtual bool parallel()
+	{
+		return true;
+	}
+
+	virtual TestResult run()
+	{
+		static uint8_t data[5000], ref[5000], packed[5200], unpacked[5000];
+
+		message("checking plain blocks...\n");
+		for (size_t i=0; i<sizeof(data); i++)
+		{
+			// literals, short runs and a long run
+			data[i]=(i<1000)?(uint8_t)(i*7):(i<1100)?(uint8_t)(i/2):(i<4000)?0x24:(uint8_t)(i^(i>>3));
+		}
+		size_t n=codec::encode(data, nullptr, sizeof(data), packed, sizeof(packed));
+		tassert(n>0 && n<=codec::bound(sizeof(data)));
+		tassert(codec::decode(packed, n, unpacked, nullptr, sizeof(unpacked)));
+		tassert(memcmp(data, unpacked, sizeof(data))==0);
+
+		message("checking deltas...\n");
+		memcpy(ref, data, sizeof(ref));
+		ref[10]^=1;
+		ref[2500]^=0xFF;
+		ref[4999]^=0x80;
+		n=codec::encode(data, ref, sizeof(data), packed, sizeof(packed));
+		tassert(n>0 && n<32);
+		// in-place
+		memcpy(unpacked, ref, sizeof(unpacked));
+		tassert(codec::decode(packed, n, unpacked, unpacked, sizeof(unpacked)));
+		tassert(memcmp(data, unpacked, sizeof(data))==0);
+
+		message("checking corrupted input...\n");
+		tassert(!codec::decode(packed, n-1, unpacked, ref, sizeof(unpacked)));
+		tassert(!codec::decode(packed, n, unpacked, ref, sizeof(unpacked)-1));
+		tassert(codec::encode(data, nullptr, sizeof(data), packed, 16)==0);
+		return SUCCESS;
+	}
+};
+
+registerTestCase(CodecTest);
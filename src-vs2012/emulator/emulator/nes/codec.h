@@ -0,0 +1,23 @@
+// byte-oriented run-length codec for state images
+//
+// Encoded data is a sequence of tokens:
+//   0x00-0x7F  literal, followed by (token+1) bytes
+//   0x80-0xFF  run of one byte value, length (token&0x7F)+MIN_RUN; a length
+//              field of 0x7F is followed by a varint holding the excess.
+//              The repeated byte value comes last.
+// When a reference block is given, the codec works on data^ref, which turns
+// the unchanged parts of two consecutive snapshots into long zero runs.
+
+namespace codec
+{
+	const size_t MIN_RUN=3;
+
+	// worst case size of an encoded block
+	size_t bound(const size_t size);
+
+	// returns the encoded size, or 0 if the output buffer is too small
+	size_t encode(const uint8_t* data, const uint8_t* ref, const size_t size, uint8_t* out, const size_t capacity);
+
+	// writes decoded^ref to dest, ref may be nullptr or equal to dest
+	bool decode(const uint8_t* in, const size_t inSize, uint8_t* dest, const uint8_t* ref, const size_t size);
+}
@@ -7,9 +7,16 @@
 
 #include "internals.h"
 #include "debug.h"
+#include "dirty.h"
+#include "state.h"
 #include "mmc.h"
 #include "opcodes.h"
 #include "cpu.h"
+#include "options.h"
+#include "trace.h"
+#include "telemetry.h"
+#include "profiler.h"
+#include "perf.h"
 
 // Register file
 __declspec(align(32)) // try to make registers fit into a cache line of host CPU
@@ -35,34 +42,30 @@ typedef bit_field<_reg8_t, 8> reg_bit_field_t;
 
 // Interrupts
 static flag_set<_reg8_t, IRQTYPE, 8> pendingIRQs;
+static flag_set<_reg8_t, IRQSOURCE, 8> irqLines;
 
 // Run-time statistics
 static long remainingCycles;
-#ifdef WANT_STATISTICS
-	static long long totInstructions;
-	static long long totCycles;
-	static long long totInterrupts;
-	static long long numInstructionsPerOpcode[(int)_INS_MAX];
-	static long long numInstructionsPerAdrMode[(int)_ADR_MAX];
-	#define STAT_ADD(VAR, INC) VAR += INC
-#else
-	#define STAT_ADD(VAR, INC) (void)0
-#endif
+static long long elapsedCycles;
+// instructions, cycles and interrupts are counted in telemetry::counters
+static long long numInstructionsPerOpcode[(int)_INS_MAX];
+static long long numInstructionsPerAdrMode[(int)_ADR_MAX];
+// counts in the checked instantiation of the loop only
+#define STAT_ADD(VAR, INC) ((DIAGNOSTICS && options::enabled(options::STATISTICS))?(void)(VAR += INC):(void)0)
 
 // Crazy debugging
-#ifdef WANT_RUN_HIT
-	static bool instructionHit[0x8000];
-#endif
+static bool instructionHit[0x8000];
 
 namespace stack
 {
+	template <bool DIAGNOSTICS>
 	static inline void pushByte(const byte_t byte)
 	{
-#ifdef MONITOR_STACK
-		printf("[S] Push 0x%02X to $%02X\n",byte,valueOf(SP));
-#endif
+		if (DIAGNOSTICS && options::enabled(options::WATCH_STACK))
+			printf("[S] Push 0x%02X to $%02X\n",byte,valueOf(SP));
 
 		ramSt[SP]=byte;
+		dirty::mark(dirty::CPU_RAM, 0x100);
 
 		dec(SP);
 #ifndef ALLOW_ADDRESS_WRAP
@@ -70,20 +73,22 @@ namespace stack
 #endif
 	}
 
+	template <bool DIAGNOSTICS>
 	static inline void pushReg(const reg_bit_field_t& reg)
 	{
-		pushByte(reg);
+		pushByte<DIAGNOSTICS>(reg);
 	}
 
+	template <bool DIAGNOSTICS>
 	static inline void pushWord(const word_t word)
 	{
 		dec(SP);
-#ifdef MONITOR_STACK
-		printf("[S] Push 0x%04X to $%02X\n",word,valueOf(SP));
-#endif
+		if (DIAGNOSTICS && options::enabled(options::WATCH_STACK))
+			printf("[S] Push 0x%04X to $%02X\n",word,valueOf(SP));
 		FATAL_ERROR_IF(SP.reachMax(), INVALID_MEMORY_ACCESS, ILLEGAL_ADDRESS_WARP);
 
 		*(uint16_t*)&(ramSt[SP])=(word);
+		dirty::mark(dirty::CPU_RAM, 0x100);
 
 		dec(SP);
 #ifndef ALLOW_ADDRESS_WRAP
@@ -91,9 +96,10 @@ namespace stack
 #endif
 	}
 
+	template <bool DIAGNOSTICS>
 	static inline void pushPC()
 	{
-		pushWord(PC);
+		pushWord<DIAGNOSTICS>(PC);
 	}
 
 	static inline byte_t popByte()
@@ -163,6 +169,7 @@ namespace interrupt
 	static void clearAll()
 	{
 		pendingIRQs.clearAll();
+		irqLines.clearAll();
 	}
 
 	static void clear(IRQTYPE type)
@@ -177,7 +184,6 @@ namespace interrupt
 		ERROR_IF(pendingIRQs[type], ILLEGAL_OPERATION, IRQ_ALREADY_PENDING);
 
 		pendingIRQs.set(type);
-		STAT_ADD(totInterrupts, 1);
 	}
 
 	// get address of interrupt handler
@@ -201,13 +207,7 @@ namespace interrupt
 
 	static bool pending()
 	{
-		return pendingIRQs.any();
-	}
-
-	static bool pending(const IRQTYPE type)
-	{
-		vassert(type != IRQTYPE::NONE);
-		return pendingIRQs[type];
+		return pendingIRQs.any() || irqLines.any();
 	}
 
 	// return the highest-priority IRQ that is currently pending
@@ -215,11 +215,12 @@ namespace interrupt
 	{
 		if (pendingIRQs[IRQTYPE::RST]) return IRQTYPE::RST;
 		if (pendingIRQs[IRQTYPE::NMI]) return IRQTYPE::NMI;
-		if (pendingIRQs[IRQTYPE::IRQ]) return IRQTYPE::IRQ;
+		if (irqLines.any()) return IRQTYPE::IRQ;
 		if (pendingIRQs[IRQTYPE::BRK]) return IRQTYPE::BRK;
 		return IRQTYPE::NONE;
 	}
 
+	template <bool DIAGNOSTICS>
 	static void poll()
 	{
 		if (pending())
@@ -228,7 +229,7 @@ namespace interrupt
 			if (irq != IRQTYPE::IRQ || !P[F_INTERRUPT_OFF])
 			{
 				// process IRQ
-				stack::pushPC();
+				stack::pushPC<DIAGNOSTICS>();
 				if (irq != IRQTYPE::RST)
 				{
 					// set or clear Break flag depending on irq type
@@ -237,13 +238,20 @@ namespace interrupt
 					else
 						P-=F_BREAK;
 					// push status
-					stack::pushReg(P);
+					stack::pushReg<DIAGNOSTICS>(P);
 					// disable other interrupts
 					P|=F_INTERRUPT_OFF;
 				}
+				if (irq == IRQTYPE::NMI)
+					telemetry::counters.nmis++;
+				else if (irq == IRQTYPE::IRQ)
+					telemetry::counters.irqs++;
 				// jump to interrupt handler
 				PC = handler(irq);
-				clear(irq);
+				if (DIAGNOSTICS && options::enabled(options::PROFILE))
+					profiler::interrupt(irq, PC, valueOf(SP));
+				// the irq line stays held until its sources release it
+				if (irq != IRQTYPE::IRQ) clear(irq);
 			}
 		}
 	}
@@ -372,69 +380,98 @@ namespace cpu
 
 		remainingCycles = 0;
 		// others
-#ifdef WANT_RUN_HIT
-		for (int i=0;i<0x8000;i++)
-			instructionHit[i]=false;
-#endif
+		memset(instructionHit, 0, sizeof(instructionHit));
 	}
 
-	void save(FILE *fp)
+	void save(state::Writer& w)
 	{
+		w.beginChunk(state::CHUNK_CPU);
+
 		// registers
-		fwrite(&A, sizeof(A), 1, fp);
-		fwrite(&X, sizeof(X), 1, fp);
-		fwrite(&Y, sizeof(Y), 1, fp);
-		fwrite(&SP, sizeof(SP), 1, fp);
-		fwrite(&P, sizeof(P), 1, fp);
-		fwrite(&PC, sizeof(PC), 1, fp);
-		fwrite(&pendingIRQs, sizeof(pendingIRQs), 1, fp);
+		w.u8(A);
+		w.u8(X);
+		w.u8(Y);
+		w.u8(valueOf(SP));
+		w.u8(valueOf(P));
+		w.u16(valueOf(PC));
+
+		// interrupts and timing
+		w.u8(valueOf(pendingIRQs));
+		w.u8(valueOf(irqLines));
+		w.u32((uint32_t)remainingCycles);
+
+		w.endChunk();
 	}
 	
-	void load(FILE *fp)
+	bool load(const state::Reader& image)
 	{
+		state::Reader r;
+		if (!image.findChunk(state::CHUNK_CPU, r)) return false;
+
 		// registers
-		fread(&A, sizeof(A), 1, fp);
-		fread(&X, sizeof(X), 1, fp);
-		fread(&Y, sizeof(Y), 1, fp);
-		fread(&SP, sizeof(SP), 1, fp);
-		fread(&P, sizeof(P), 1, fp);
-		fread(&PC, sizeof(PC), 1, fp);
-		fread(&pendingIRQs, sizeof(pendingIRQs), 1, fp);
+		A=r.u8();
+		X=r.u8();
+		Y=r.u8();
+		SP=r.u8();
+		P.asBitField()=r.u8();
+		PC=r.u16();
+
+		// interrupts and timing
+		pendingIRQs.asBitField()=r.u8();
+		irqLines.asBitField()=r.u8();
+		remainingCycles=(int32_t)r.u32();
+
+		return r.ok();
 	}
 
 	void dump()
 	{
-#ifdef WANT_RUN_HIT
-		FILE *fp=fopen("RUNHIT.log","wt");
-		for (int i=0;i<0x8000;i++)
+		if (options::enabled(options::STATISTICS))
 		{
-			if (instructionHit[i])
+			printf("[C] %lld instructions, %lld cycles, %lld NMIs, %lld IRQs\n", (long long)telemetry::counters.instructions, (long long)telemetry::counters.cycles,
+				(long long)telemetry::counters.nmis, (long long)telemetry::counters.irqs);
+			for (int i=0;i<(int)_INS_MAX;i++)
 			{
-				fprintf(fp, "%X\n", i|0x8000);
+				if (numInstructionsPerOpcode[i]>0)
+					printf("[C] %s %lld\n", opcode::instName((M6502_INST)i), numInstructionsPerOpcode[i]);
 			}
 		}
-		fclose(fp);
-#endif
-	}
-
-	// emulate at most n instructions within specified cycles
-	bool run(int n, long cycles)
-	{
-		remainingCycles+=cycles;
-		while ((n<0 || n--) && remainingCycles>0)
+		if (options::enabled(options::RUN_HIT))
 		{
-			int cyc;
-			cyc=nextInstruction();
-			if (cyc<0) return false; // execution terminated
+			FILE *fp=fopen("RUNHIT.log","wt");
+			if (fp==nullptr) return;
+			for (int i=0;i<0x8000;i++)
+			{
+				if (instructionHit[i])
+				{
+					fprintf(fp, "%X\n", i|0x8000);
+				}
+			}
+			fclose(fp);
 		}
-		return true;
 	}
 
 	void irq(const IRQTYPE type)
 	{
+		vassert(type != IRQTYPE::IRQ);
 		interrupt::request(type);
 	}
 
+	void raiseIrq(const IRQSOURCE source)
+	{
+		irqLines.set(source);
+	}
+
+	void lowerIrq(const IRQSOURCE source)
+	{
+		irqLines.clear(source);
+	}
+
+	long long cycles()
+	{
+		return elapsedCycles;
+	}
+
 	static int readEffectiveAddress(const opcode_t code, const M6502_OPCODE op, bool forWriteOnly = false)
 	{
 		int cycles=0;
@@ -540,6 +577,7 @@ namespace cpu
 		return cycles;
 	}
 
+	template <bool DIAGNOSTICS>
 	static bool execute(const M6502_OPCODE op, bool& writeBack, int& cycles)
 	{
 		switch (op.inst)
@@ -641,7 +679,7 @@ namespace cpu
 
 		case INS_JSR: // Jump to new location, saving return address. Push return address on stack
 			dec(PC);
-			stack::pushPC();
+			stack::pushPC<DIAGNOSTICS>();
 			PC=addr;
 			break;
 		
@@ -769,11 +807,11 @@ jBranch:
 
 		// stack
 		case INS_PHA: // Push accumulator on stack
-			stack::pushReg(regA);
+			stack::pushReg<DIAGNOSTICS>(regA);
 			break;
 
 		case INS_PHP: // Push processor status on stack
-			stack::pushReg(P);
+			stack::pushReg<DIAGNOSTICS>(P);
 			break;
 
 		case INS_PLA: // Pull accumulator from stack
@@ -823,11 +861,12 @@ jBranch:
 		return true;
 	}
 
-	int nextInstruction()
+	template <bool DIAGNOSTICS>
+	static int step()
 	{
 		int cycles = 0;
 		// handle interrupt request
-		interrupt::poll();
+		interrupt::poll<DIAGNOSTICS>();
 
 		// step1: fetch instruction
 		if (PC.zero())
@@ -837,9 +876,8 @@ jBranch:
 			return -1;
 		}
 
-#ifdef WANT_RUN_HIT
-		instructionHit[PC&0x7FFF]=true;
-#endif
+		if (DIAGNOSTICS && options::enabled(options::RUN_HIT))
+			instructionHit[PC&0x7FFF]=true;
 
 		const maddr_t opaddr = PC;
 		const opcode_t opcode = mmc::fetchOpcode(PC);
@@ -852,13 +890,13 @@ jBranch:
 		cycles += readEffectiveAddress(opcode, op, (op.inst==INS_STA || op.inst==INS_STX || op.inst==INS_STY));
 		assert((valueOf(PC)-valueOf(opaddr)) == op.size);
 
-#ifdef WANT_DISASSEMBLY
-		debug::printDisassembly(opaddr, opcode, X, Y, EA, M);
-#endif
+		trace::Record traced;
+		if (DIAGNOSTICS && options::enabled(options::WATCH_CPU))
+			trace::fetch(traced, opaddr, opcode, EA, M);
 
 		// step4: execute
 		bool writeBack = false;
-		if (!execute(op, writeBack, cycles))
+		if (!execute<DIAGNOSTICS>(op, writeBack, cycles))
 		{
 			// execution failed
 			FATAL_ERROR(INVALID_INSTRUCTION, INVALID_OPCODE, "opaddr", valueOf(opaddr), "opcode", opcode, "instruction", op.inst);
@@ -876,18 +914,57 @@ jBranch:
 		// end of instruction pipeline
 
 		assert(P[F_RESERVED]);
-#ifdef MONITOR_CPU
-		debug::printCPUState(PC, A, X ,Y, valueOf(P), SP, cycles);
-#endif
+		if (DIAGNOSTICS && options::enabled(options::WATCH_CPU))
+			trace::retire(traced, PC, A, X ,Y, valueOf(P), SP, cycles);
 
 		// update statistics
-		STAT_ADD(totInstructions, 1);
+		telemetry::counters.instructions++;
+		telemetry::counters.cycles+=cycles;
 		STAT_ADD(numInstructionsPerOpcode[(int)op.inst], 1);
 		STAT_ADD(numInstructionsPerAdrMode[(int)op.addrmode], 1);
-		STAT_ADD(totCycles, cycles);
+		if (DIAGNOSTICS && options::enabled(options::PROFILE))
+			profiler::instruction(opaddr, op.inst, PC, valueOf(SP), cycles);
 		remainingCycles -= cycles;
+		elapsedCycles += cycles;
 		return cycles;
 	}
+
+	// emulate at most n instructions within specified cycles
+	template <bool DIAGNOSTICS>
+	static bool runLoop(int n, long cycles)
+	{
+		remainingCycles+=cycles;
+		while ((n<0 || n--) && remainingCycles>0)
+		{
+			int cyc;
+			cyc=step<DIAGNOSTICS>();
+			if (cyc<0) return false; // execution terminated
+		}
+		return true;
+	}
+
+	static bool (*runner)(int, long)=runLoop<false>;
+
+	void configure()
+	{
+		runner=(options::selected&options::CPU_CHECKS)?runLoop<true>:runLoop<false>;
+	}
+
+	bool run(int n, long cycles)
+	{
+		PERF_SCOPE(CPU);
+		return runner(n, cycles);
+	}
+
+	maddr_t pc()
+	{
+		return PC;
+	}
+
+	int nextInstruction()
+	{
+		return (runner==runLoop<true>)?step<true>():step<false>();
+	}
 }
 
 // unit tests
@@ -960,10 +1037,10 @@ public:
 		tassert(Y==3);
 
 		SP.selfSetMax();
-		stack::pushReg(regY);
+		stack::pushReg<false>(regY);
 
 		PC=0xFFAA;
-		stack::pushPC();
+		stack::pushPC<false>();
 
 		byte_t tmp;
 		tmp=stack::popByte();
@@ -975,8 +1052,8 @@ public:
 		tmp=stack::popByte();
 		tassert(tmp==0x03);
 
-		stack::pushPC();
-		stack::pushReg(regY);
+		stack::pushPC<false>();
+		stack::pushReg<false>(regY);
 
 		word_t tmp16;
 		tmp16=stack::popWord();
@@ -985,6 +1062,15 @@ public:
 		tmp=stack::popByte();
 		tassert(tmp==0xFF);
 
+		// a source releasing the line leaves the other requests pending
+		interrupt::clearAll();
+		cpu::raiseIrq(IRQSOURCE::APU);
+		cpu::raiseIrq(IRQSOURCE::MAPPER);
+		cpu::lowerIrq(IRQSOURCE::APU);
+		tassert(interrupt::current()==IRQTYPE::IRQ);
+		cpu::lowerIrq(IRQSOURCE::MAPPER);
+		tassert(!interrupt::pending());
+
 		printf("[ ] Register memory from %p to %p\n", &A, &temp+1);
 
 		return SUCCESS;
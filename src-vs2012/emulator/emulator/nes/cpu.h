@@ -24,6 +24,13 @@ enum class IRQTYPE
 	RST=0x8
 };
 
+// devices sharing the level-triggered irq line
+enum class IRQSOURCE
+{
+	APU=0x1,
+	MAPPER=0x2
+};
+
 namespace cpu
 {
 	// global functions
@@ -31,13 +38,26 @@ namespace cpu
 
 	void irq(const IRQTYPE type);
 
+	// the irq line is held while any source asserts it, every source
+	// releases its own request once the program acknowledged it
+	void raiseIrq(const IRQSOURCE source);
+	void lowerIrq(const IRQSOURCE source);
+
+	// cycles executed since power-on, for devices that catch up lazily.
+	// not part of the saved state, devices save their distance to it.
+	long long cycles();
+
 	int nextInstruction();
 	bool run(int n, long cycles);
 
+	// picks the run loop for the selected options
+	void configure();
+
 	// debug
 	void dump();
+	maddr_t pc();
 	
 	// save state
-	void save(FILE *fp);
-	void load(FILE *fp);
+	void save(state::Writer& w);
+	bool load(const state::Reader& image);
 }
\ No newline at end of file
@@ -3,17 +3,26 @@
 // local header files
 #include "../macros.h"
 #include "../types/types.h"
+#include "../unittest/framework.h"
 
 #include "internals.h"
 #include "debug.h"
+#include "dirty.h"
+#include "state.h"
 #include "opcodes.h"
 #include "mmc.h"
+#include "trace.h"
 
 static FILE* foutput = stdout;
 
+// warnings and errors reported, per type and subtype
+static int reportCount[_EMUERROR_MAX][_EMUERRORSUBTYPE_MAX];
+
+static debug::ERROR_HOOK errorHook=nullptr;
+
 namespace debug
 {
-	void printDisassembly(const maddr_t pc, const opcode_t opcode, const _reg8_t rx, const _reg8_t ry, const maddr_t addr, const operand_t operand)
+	void printDisassembly(const maddr_t pc, const opcode_t opcode, const byte_t operand1, const byte_t operand2, const maddr_t addr, const operand_t operand)
 	{
 		const M6502_OPCODE op = opcode::decode(opcode);
 		switch (op.size)
@@ -22,10 +31,10 @@ namespace debug
 			fprintf(foutput, "%04X  %02X        %s", valueOf(pc), opcode, opcode::instName(op.inst));
 			break;
 		case 2:
-			fprintf(foutput, "%04X  %02X %02X     %s", valueOf(pc), opcode, ram.data(pc+1), opcode::instName(op.inst));
+			fprintf(foutput, "%04X  %02X %02X     %s", valueOf(pc), opcode, operand1, opcode::instName(op.inst));
 			break;
 		case 3:
-			fprintf(foutput, "%04X  %02X %02X %02X  %s", valueOf(pc), opcode, ram.data(pc+1), ram.data(pc+2), opcode::instName(op.inst));
+			fprintf(foutput, "%04X  %02X %02X %02X  %s", valueOf(pc), opcode, operand1, operand2, opcode::instName(op.inst));
 			break;
 		}
 		switch (op.addrmode)
@@ -62,17 +71,17 @@ namespace debug
 
 	void printPPUState(const long long frameNum, const int scanline, const bool vblank, const bool hit, const bool bgmsk, const bool sprmsk)
 	{
-		fprintf(foutput, "----- FR: %I64d SL: %3d VB:%s HIT:%s MSK:%c%c -----\n", frameNum, scanline, vblank?"True":"false", hit?"Yes":"no", 
+		fprintf(foutput, "----- FR: %lld SL: %3d VB:%s HIT:%s MSK:%c%c -----\n", frameNum, scanline, vblank?"True":"false", hit?"Yes":"no", 
 			bgmsk?'B':'_', sprmsk?'S':'_');
 	}
 
 	// a NULL at the end of argv is REQUIRED!
 	static void printToConsole(int type, const wchar_t * typestr, int stype, const wchar_t * stypestr, const wchar_t * file, const wchar_t * function_name, unsigned long line_number, va_list argv)
 	{
-		wprintf(L"Type: %s (%d)\nSub Type: %s (%d)\nProc: %s:%ld\n", typestr, type, stypestr, stype, function_name, line_number);
+		printf("Type: %ls (%d)\nSub Type: %ls (%d)\nProc: %ls:%ld\n", typestr, type, stypestr, stype, function_name, line_number);
 		if (file != nullptr)
 		{
-			wprintf(L"File: %s\n", file);
+			printf("File: %ls\n", file);
 		}
 
 		// print custom parameters
@@ -118,16 +127,50 @@ namespace debug
 			CASE_ENUM_RETURN_STRING(INVALID_ADDRESS_MODE);
 
 			CASE_ENUM_RETURN_STRING(IRQ_ALREADY_PENDING);
+			CASE_ENUM_RETURN_STRING(STATE_CORRUPTED);
 
 		default: return L"UNKNOWN";
 		}
 	}
 
+	// counts a report, false once it is over the limit
+	static bool countReport(EMUERROR type, EMUERRORSUBTYPE stype)
+	{
+		if ((unsigned)type>=_EMUERROR_MAX || (unsigned)stype>=_EMUERRORSUBTYPE_MAX) return true;
+		const int count=++reportCount[type][stype];
+		if (count==REPORT_LIMIT+1)
+			printf("[!] %ls (%ls) reported %d times, no longer printed.\n", errorTypeToString(type), errorSTypeToString(stype), REPORT_LIMIT);
+		return count<=REPORT_LIMIT;
+	}
+
+	int reports(const EMUERROR type, const EMUERRORSUBTYPE stype)
+	{
+		return reportCount[type][stype];
+	}
+
+	void clearReports()
+	{
+		memset(reportCount, 0, sizeof(reportCount));
+	}
+
+	void setErrorHook(ERROR_HOOK hook)
+	{
+		errorHook=hook;
+	}
+
+	const wchar_t* subtypeName(const EMUERRORSUBTYPE stype)
+	{
+		return errorSTypeToString(stype);
+	}
+
 	void fatalError(EMUERROR type, EMUERRORSUBTYPE stype, const wchar_t * file, const wchar_t * function_name, unsigned long line_number, ...)
 	{
+		if (errorHook) errorHook(type, stype);
 		va_list args;
 		va_start(args, line_number);
-		wprintf(L"[X] Fatal error: \n");
+		// keep the instructions that led here
+		trace::stop();
+		printf("[X] Fatal error: \n");
 		printToConsole(type, errorTypeToString(type), stype, errorSTypeToString(stype), file, function_name, line_number, args);
 		va_end(args);
 		fflush(foutput);
@@ -139,9 +182,12 @@ namespace debug
 
 	void error(EMUERROR type, EMUERRORSUBTYPE stype, const wchar_t * file, const wchar_t * function_name, unsigned long line_number, ...)
 	{
+		if (errorHook) errorHook(type, stype);
+		if (!countReport(type, stype)) return;
 		va_list args;
 		va_start(args, line_number);
-		wprintf(L"[X] Error: \n");
+		trace::flush();
+		printf("[X] Error: \n");
 		printToConsole(type, errorTypeToString(type), stype, errorSTypeToString(stype), file, function_name, line_number, args);
 		va_end(args);
 		fflush(foutput);
@@ -152,12 +198,13 @@ namespace debug
 #endif
 	}
 
-	void warn(EMUERROR type, EMUERRORSUBTYPE stype, const wchar_t * function_name, unsigned long line_number, ...)
+	void warn(EMUERROR type, EMUERRORSUBTYPE stype, const wchar_t * file, const wchar_t * function_name, unsigned long line_number, ...)
 	{
+		if (!countReport(type, stype)) return;
 		va_list args;
 		va_start(args, line_number);
-		wprintf(L"[!] Warning: \n");
-		printToConsole(type, errorTypeToString(type), stype, errorSTypeToString(stype), NULL, function_name, line_number, args);
+		printf("[!] Warning: \n");
+		printToConsole(type, errorTypeToString(type), stype, errorSTypeToString(stype), file, function_name, line_number, args);
 		va_end(args);
 	}
 
@@ -165,4 +212,32 @@ namespace debug
 	{
 		foutput = fp;
 	}
-}
\ No newline at end of file
+}
+
+// unit tests
+class ReportLimitTest : public TestCase
+{
+public:
+	virtual const char* name()
+	{
+		return "Error Report Limit Test";
+	}
+
+	virtual TestResult run()
+	{
+		debug::clearReports();
+		for (int i=0; i<debug::REPORT_LIMIT+5; i++)
+		{
+			WARN(INVALID_MEMORY_ACCESS, MEMORY_NOT_EXECUTABLE, "i", i);
+		}
+		tassert(debug::reports(INVALID_MEMORY_ACCESS, MEMORY_NOT_EXECUTABLE)==debug::REPORT_LIMIT+5);
+		tassert(debug::reports(INVALID_MEMORY_ACCESS, MEMORY_CANT_BE_READ)==0);
+		WARN_IF(false, INVALID_MEMORY_ACCESS, MEMORY_CANT_BE_READ);
+		tassert(debug::reports(INVALID_MEMORY_ACCESS, MEMORY_CANT_BE_READ)==0);
+		debug::clearReports();
+		tassert(debug::reports(INVALID_MEMORY_ACCESS, MEMORY_NOT_EXECUTABLE)==0);
+		return SUCCESS;
+	}
+};
+
+registerTestCase(ReportLimitTest);
@@ -2,23 +2,57 @@ namespace debug
 {
 	void setOutputFile(FILE *fp);
 
-	void warn(EMUERROR, EMUERRORSUBTYPE, const wchar_t *, unsigned long, ...);
+	// The reporting functions are cold: the compiler keeps them and the
+	// argument setup at their call sites away from the code around them.
+	// Only the first REPORT_LIMIT warnings and errors of each type and subtype
+	// are printed, the rest are only counted.
+	const int REPORT_LIMIT=8;
 
-	void error(EMUERROR, EMUERRORSUBTYPE, const wchar_t *, const wchar_t *, unsigned long, ...);
-	void fatalError(EMUERROR, EMUERRORSUBTYPE, const wchar_t *, const wchar_t *, unsigned long, ...);
+	COLD void warn(EMUERROR, EMUERRORSUBTYPE, const wchar_t *, const wchar_t *, unsigned long, ...);
 
-	void printDisassembly(const maddr_t pc, const opcode_t opcode, const _reg8_t rx, const _reg8_t ry, const maddr_t addr, const operand_t operand);
+	COLD void error(EMUERROR, EMUERRORSUBTYPE, const wchar_t *, const wchar_t *, unsigned long, ...);
+	COLD void fatalError(EMUERROR, EMUERRORSUBTYPE, const wchar_t *, const wchar_t *, unsigned long, ...);
+
+	// number of warnings and errors of this kind so far, printed or not
+	int reports(const EMUERROR type, const EMUERRORSUBTYPE stype);
+	void clearReports();
+
+	// called first by error() and fatalError(), e.g. to record the error and exit
+	typedef void (*ERROR_HOOK)(const EMUERROR type, const EMUERRORSUBTYPE stype);
+	void setErrorHook(ERROR_HOOK hook);
+	const wchar_t* subtypeName(const EMUERRORSUBTYPE stype);
+
+	// text of the trace records, see trace.h
+	void printDisassembly(const maddr_t pc, const opcode_t opcode, const byte_t operand1, const byte_t operand2, const maddr_t addr, const operand_t operand);
 	void printCPUState(const maddr_t pc, const _reg8_t ra, const _reg8_t rx, const _reg8_t ry, const _reg8_t rp, const _reg8_t rsp, const int cyc);
 	void printPPUState(const long long frameNum, const int scanline, const bool vblank, const bool hit, const bool bgmsk, const bool sprmsk);
 }
 
-#define WARN(TYPE, SUBTYPE, ...) debug::warn(TYPE, SUBTYPE, _CRT_WIDE(__FUNCTION__), __LINE__, __VA_ARGS__, 0)
-#define WARN_IF(E, TYPE, SUBTYPE, ...) if (E) WARN(TYPE, SUBTYPE, __VA_ARGS__)
+// REPORT_LEVEL selects the checks built in:
+//   2 (default) warnings, errors and fatal errors
+//   1 errors and fatal errors
+//   0 fatal errors only, for a checked release build
+// The conditions of the checks left out are not evaluated.
+#ifndef REPORT_LEVEL
+#define REPORT_LEVEL 2
+#endif
+
+#define WARN(TYPE, SUBTYPE, ...) debug::warn(TYPE, SUBTYPE, _CRT_WIDE(__FILE__), __FUNCTIONW__, __LINE__, ##__VA_ARGS__, 0)
+#if REPORT_LEVEL>=2
+#define WARN_IF(E, TYPE, SUBTYPE, ...) if (UNLIKELY(E)) WARN(TYPE, SUBTYPE, ##__VA_ARGS__)
+#else
+#define WARN_IF(E, TYPE, SUBTYPE, ...) (void)sizeof(!(E))
+#endif
 
-#define ERROR(TYPE, SUBTYPE, ...) debug::error(TYPE, SUBTYPE, _CRT_WIDE(__FILE__), _CRT_WIDE(__FUNCTION__), __LINE__, __VA_ARGS__, 0)
-#define ERROR_IF(E, TYPE, SUBTYPE, ...) if (E) ERROR(TYPE, SUBTYPE, __VA_ARGS__)
-#define ERROR_UNLESS(E, TYPE, SUBTYPE, ...) if (!(E)) ERROR(TYPE, SUBTYPE, __VA_ARGS__)
+#define ERROR(TYPE, SUBTYPE, ...) debug::error(TYPE, SUBTYPE, _CRT_WIDE(__FILE__), __FUNCTIONW__, __LINE__, ##__VA_ARGS__, 0)
+#if REPORT_LEVEL>=1
+#define ERROR_IF(E, TYPE, SUBTYPE, ...) if (UNLIKELY(E)) ERROR(TYPE, SUBTYPE, ##__VA_ARGS__)
+#define ERROR_UNLESS(E, TYPE, SUBTYPE, ...) if (UNLIKELY(!(E))) ERROR(TYPE, SUBTYPE, ##__VA_ARGS__)
+#else
+#define ERROR_IF(E, TYPE, SUBTYPE, ...) (void)sizeof(!(E))
+#define ERROR_UNLESS(E, TYPE, SUBTYPE, ...) (void)sizeof(!(E))
+#endif
 
-#define FATAL_ERROR(TYPE, SUBTYPE, ...) debug::fatalError(TYPE, SUBTYPE, _CRT_WIDE(__FILE__), _CRT_WIDE(__FUNCTION__), __LINE__, __VA_ARGS__, 0)
-#define FATAL_ERROR_IF(E, TYPE, SUBTYPE, ...) if (E) FATAL_ERROR(TYPE, SUBTYPE, __VA_ARGS__)
-#define FATAL_ERROR_UNLESS(E, TYPE, SUBTYPE, ...) if (!(E)) FATAL_ERROR(TYPE, SUBTYPE, __VA_ARGS__)
+#define FATAL_ERROR(TYPE, SUBTYPE, ...) debug::fatalError(TYPE, SUBTYPE, _CRT_WIDE(__FILE__), __FUNCTIONW__, __LINE__, ##__VA_ARGS__, 0)
+#define FATAL_ERROR_IF(E, TYPE, SUBTYPE, ...) if (UNLIKELY(E)) FATAL_ERROR(TYPE, SUBTYPE, ##__VA_ARGS__)
+#define FATAL_ERROR_UNLESS(E, TYPE, SUBTYPE, ...) if (UNLIKELY(!(E))) FATAL_ERROR(TYPE, SUBTYPE, ##__VA_ARGS__)
@@ -0,0 +1,111 @@
+#include "../stdafx.h"
+
+// local header files
+#include "../macros.h"
+#include "../types/types.h"
+#include "../unittest/framework.h"
+
+#include "internals.h"
+#include "dirty.h"
+#include "state.h"
+
+namespace dirty
+{
+	epoch_t stamps[PAGE_COUNT];
+
+	// epoch 0 is reserved for "no snapshot taken yet"
+	epoch_t current=1;
+
+	void markRange(const REGION region, const size_t offset, const size_t size)
+	{
+		if (size==0) return;
+		const size_t last=(offset+size-1)>>PAGE_SHIFT;
+		for (size_t page=offset>>PAGE_SHIFT; page<=last; page++)
+		{
+			assert(region+page<PAGE_COUNT);
+			stamps[region+page]=current;
+		}
+	}
+
+	void markAll()
+	{
+		for (int i=0; i<PAGE_COUNT; i++)
+		{
+			stamps[i]=current;
+		}
+	}
+
+	epoch_t advance()
+	{
+		return current++;
+	}
+}
+
+// unit tests
+class DirtyPageTest : public TestCase
+{
+public:
+	virtual const char* name()
+	{
+		return "Dirty Page Tracking Test";
+	}
+
+	virtual TestResult run()
+	{
+		puts("checking epochs...");
+		dirty::markAll();
+		const dirty::epoch_t a=dirty::advance();
+		tassert(!dirty::changedSince(dirty::CPU_RAM+1, a));
+
+		dirty::mark(dirty::CPU_RAM, 0x1FF);
+		dirty::markRange(dirty::NAMETABLES, 0x3F0, 0x20);
+		tassert(dirty::changedSince(dirty::CPU_RAM+1, a));
+		tassert(!dirty::changedSince(dirty::CPU_RAM+2, a));
+		tassert(dirty::changedSince(dirty::NAMETABLES+3, a));
+		tassert(dirty::changedSince(dirty::NAMETABLES+4, a));
+		tassert(!dirty::changedSince(dirty::NAMETABLES+5, a));
+
+		// a second consumer starting later
+		const dirty::epoch_t b=dirty::advance();
+		tassert(!dirty::changedSince(dirty::CPU_RAM+1, b));
+		tassert(dirty::changedSince(dirty::CPU_RAM+1, a));
+
+		puts("checking incremental writer...");
+		uint8_t memory[0x300], image[0x400];
+		memset(memory, 0x11, sizeof(memory));
+		memset(image, 0, sizeof(image));
+		{
+			state::Writer w(image, sizeof(image));
+			w.header();
+			w.pages(dirty::SRAM, memory, sizeof(memory));
+			tassert(w.ok() && w.finish()==state::HEADER_SIZE+sizeof(memory));
+		}
+		const dirty::epoch_t c=dirty::advance();
+
+		// only the page marked after the snapshot is copied
+		memset(memory, 0x22, sizeof(memory));
+		dirty::mark(dirty::SRAM, 0x100);
+		{
+			state::Writer w(image, sizeof(image), c);
+			w.header();
+			w.pages(dirty::SRAM, memory, sizeof(memory));
+			tassert(w.ok() && w.finish()==state::HEADER_SIZE+sizeof(memory));
+		}
+		tassert(image[state::HEADER_SIZE+0x0FF]==0x11);
+		tassert(image[state::HEADER_SIZE+0x100]==0x22);
+		tassert(image[state::HEADER_SIZE+0x1FF]==0x22);
+		tassert(image[state::HEADER_SIZE+0x200]==0x11);
+
+		// a layout change fails an incremental update
+		{
+			state::Writer w(image, sizeof(image), c);
+			w.header();
+			w.pages(dirty::SRAM, memory, 0x200);
+			w.finish();
+			tassert(!w.ok());
+		}
+		return SUCCESS;
+	}
+};
+
+registerTestCase(DirtyPageTest);
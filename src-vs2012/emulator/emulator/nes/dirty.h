@@ -0,0 +1,49 @@
+// dirty page tracking
+//
+// Every 256-byte page of the memory that goes into a save state carries the
+// epoch of its last write. A consumer remembers the epoch returned by
+// advance() after taking a snapshot; pages stamped with a later epoch have
+// been written since. Several consumers (rewind history, search tools) can
+// track the same memory independently this way.
+
+namespace dirty
+{
+	typedef uint64_t epoch_t;
+
+	const int PAGE_SHIFT=8;
+	const size_t PAGE_SIZE=1<<PAGE_SHIFT;
+
+	// first page of each tracked region
+	enum REGION
+	{
+		CPU_RAM=0, // $0000-$07FF, 8 pages
+		SRAM=CPU_RAM+8, // $6000-$7FFF, 32 pages
+		NAMETABLES=SRAM+32, // PPU $2000-$2FFF, 16 pages
+		PALETTE=NAMETABLES+16, // PPU $3F00-$3F1F, 1 page
+		OAM=PALETTE+1, // 1 page
+		PATTERN_TABLES=OAM+1, // PPU $0000-$1FFF, 32 pages
+		PAGE_COUNT=PATTERN_TABLES+32
+	};
+
+	extern epoch_t stamps[PAGE_COUNT];
+	extern epoch_t current;
+
+	inline void mark(const REGION region, const size_t offset)
+	{
+		vassert(region+(offset>>PAGE_SHIFT)<PAGE_COUNT);
+		stamps[region+(offset>>PAGE_SHIFT)]=current;
+	}
+
+	inline bool changedSince(const int page, const epoch_t since)
+	{
+		vassert(page>=0 && page<PAGE_COUNT);
+		return stamps[page]>since;
+	}
+
+	void markRange(const REGION region, const size_t offset, const size_t size);
+	void markAll();
+
+	// closes the current epoch and returns it.
+	// pages written from now on compare greater than the returned value.
+	epoch_t advance();
+}
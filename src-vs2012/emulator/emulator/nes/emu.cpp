@@ -7,24 +7,47 @@
 
 #include "internals.h"
 #include "debug.h"
+#include "dirty.h"
+#include "state.h"
 #include "rom.h"
 #include "opcodes.h"
 #include "mmc.h"
 #include "cpu.h"
 #include "ppu.h"
+#include "apu.h"
 #include "emu.h"
+#include "options.h"
+#include "history.h"
+#include "clone.h"
+#include "input.h"
+#include "pacer.h"
+#include "telemetry.h"
+#include "perf.h"
+#include "movie.h"
 #include "../ui.h"
 
 namespace emu
 {
+	// run-ahead
+	static int runAheadFrames=0;
+	static clone::Console runAheadState;
+
+	// fast-forward
+	static bool fastForwardEnabled=false;
+	static long long lastPresent; // pacer clock
+	static double skippedFrameTime; // moving average, ns
+
 	void init()
 	{
-		opcode::initTable();
+		setOptions(options::DEFAULT);
 		ppu::init();
+		apu::init();
+		history::init(history::DEFAULT_MEMORY_LIMIT, history::DEFAULT_INTERVAL, history::DEFAULT_MAX_FRAMES);
 	}
 
 	void deinit()
 	{
+		history::deinit();
 		rom::unload();
 	}
 
@@ -44,6 +67,15 @@ namespace emu
 
 		// reset ppu
 		ppu::reset();
+
+		// reset apu
+		apu::reset();
+
+		// release the joypads
+		input::reset();
+
+		// everything has changed
+		dirty::markAll();
 	}
 
 	bool setup()
@@ -53,13 +85,20 @@ namespace emu
 		return true;
 	}
 
-	bool nextFrame()
+	// TIMED measures the host time of each part for the telemetry
+	template <bool TIMED>
+	static bool emulateFrame()
 	{
+		if (TIMED) telemetry::beginFrame();
 		for (;;)
 		{
 			if (cpu::run(-1, SCANLINE_CYCLES))
 			{
-				if (!ppu::hsync())
+				apu::run();
+				if (TIMED) telemetry::lap(telemetry::PART_CPU);
+				const bool more=ppu::hsync();
+				if (TIMED) telemetry::lap(telemetry::PART_PPU);
+				if (!more)
 				{
 					// frame ends
 					break;
@@ -68,26 +107,133 @@ namespace emu
 			else
 				return false; // program stops
 		}
+		apu::endFrame();
+		if (TIMED) telemetry::lap(telemetry::PART_CPU);
+		telemetry::endFrame(ppu::currentFrame());
 		return true;
 	}
 
-	void run()
+	bool nextFrame()
 	{
-		for (;;)
+		bool ok;
+		{
+			PERF_SCOPE(FRAME);
+			ok=telemetry::active()?emulateFrame<true>():emulateFrame<false>();
+		}
+		PERF_END_FRAME(ppu::currentFrame());
+		return ok;
+	}
+
+	void setRunAhead(const int frames)
+	{
+		runAheadFrames=max(0, min(frames, MAX_RUN_AHEAD));
+	}
+
+	int runAhead()
+	{
+		return runAheadFrames;
+	}
+
+	void setOptions(const int selected)
+	{
+		options::selected=selected;
+		cpu::configure();
+		ppu::configure();
+	}
+
+	int options()
+	{
+		return options::selected;
+	}
+
+	void setFastForward(const bool enabled)
+	{
+		if (enabled && !fastForwardEnabled)
 		{
-			ui::doEvents();
+			lastPresent=pacer::now();
+			skippedFrameTime=0;
+		}
+		fastForwardEnabled=enabled;
+	}
+
+	bool fastForward()
+	{
+		return fastForwardEnabled;
+	}
+
+	// present a frame when the one after it would be late for the presentation rate
+	static bool presentNext()
+	{
+		if (!fastForwardEnabled) return true;
+		return pacer::now()-lastPresent+skippedFrameTime>=1e9/FAST_FORWARD_PRESENT_RATE;
+	}
+
+	static bool runFrame(const bool show)
+	{
+		// frames run ahead latch the joypads too, a movie can't hold them
+		if (runAheadFrames==0 || !show || movie::recording())
+		{
+			ppu::enableOutput(show);
+			const bool ok=nextFrame();
+			ppu::enableOutput(true);
+			return ok;
+		}
+
+		// the frame that counts is not shown, but heard
+		ppu::enableOutput(false);
+		bool ok=nextFrame();
+		apu::enableOutput(false);
+		if (ok && runAheadState.capture())
+		{
+			// show the frame the game would draw a few frames later given the same input
+			for (int i=0; i<runAheadFrames && ok; i++)
+			{
+				ppu::enableOutput(i==runAheadFrames-1);
+				ok=nextFrame();
+			}
+			ok&=runAheadState.restore();
+		}
+		ppu::enableOutput(true);
+		apu::enableOutput(true);
+		return ok;
+	}
+
+	void run(const long long frames)
+	{
+		for (long long done=0; frames<=0 || done<frames; done++)
+		{
+			{
+				PERF_SCOPE(UI_EVENTS);
+				ui::doEvents();
+			}
 			if (ui::forceTerminate())
 			{
 				// create state dump on force termination
 				cpu::dump();
 				break;
 			}
-			if (!nextFrame())
+			history::record();
+
+			// a recorded movie hashes the picture of some frames
+			const bool show=presentNext() || movie::wantsPicture();
+			const long long start=pacer::now();
+			if (!runFrame(show))
 			{
 				// game stops
 				break;
 			}
-			ui::limitFPS();
+			movie::endFrame();
+			const long long end=pacer::now();
+			if (show)
+				lastPresent=end;
+			else
+				skippedFrameTime=skippedFrameTime*0.875+(end-start)*0.125;
+
+			if (!fastForwardEnabled)
+			{
+				PERF_SCOPE(UI_WAIT);
+				ui::limitFPS();
+			}
 		}
 	}
 
@@ -96,36 +242,172 @@ namespace emu
 		return ppu::currentFrame();
 	}
 
+	bool rewind(const int frames)
+	{
+		return history::seek(frameCount()-frames);
+	}
+
 	void present(const uint32_t buffer[], const int width, const int height)
 	{
-		ui::blt32(buffer, width, height);
+		PERF_SCOPE(UI_BLT);
+		if (telemetry::active())
+		{
+			// presented from within the ppu
+			telemetry::lap(telemetry::PART_PPU);
+			ui::blt32(buffer, width, height);
+			telemetry::lap(telemetry::PART_PRESENT);
+		}else
+			ui::blt32(buffer, width, height);
 	}
 
 	void onFrameBegin()
 	{
+		PERF_SCOPE(UI_FRAME_HOOKS);
 		ui::onFrameBegin();
 	}
 
 	void onFrameEnd()
 	{
+		PERF_SCOPE(UI_FRAME_HOOKS);
 		ui::onFrameEnd();
 	}
 
-	void saveState(FILE *fp)
+	static size_t writeImage(state::Writer& w)
 	{
-		mmc::save(fp);
-		cpu::save(fp);
-		ppu::save(fp);
-		mapper::save(fp);
+		w.header();
+		mmc::save(w);
+		cpu::save(w);
+		ppu::save(w);
+		mapper::save(w);
+		input::save(w);
+		apu::save(w);
+		return w.finish();
 	}
 
-	void loadState(FILE *fp)
+	size_t saveState(void* buffer, size_t size)
 	{
+		PERF_SCOPE(SAVE_STATE);
+		state::Writer w(buffer, size);
+		const size_t total=writeImage(w);
+		return w.ok()?total:0;
+	}
+
+	size_t saveState(void* buffer, size_t size, uint64_t& epoch)
+	{
+		PERF_SCOPE(SAVE_STATE);
+		size_t total;
+		{
+			state::Writer w(buffer, size, epoch);
+			total=writeImage(w);
+			if (!w.ok()) total=0;
+		}
+		if (total==0 && epoch!=0)
+		{
+			// layout has changed, start over
+			state::Writer w(buffer, size);
+			total=writeImage(w);
+			if (!w.ok()) total=0;
+		}
+		epoch=(total>0)?dirty::advance():0;
+		return total;
+	}
+
+	static bool readImage(const state::Reader& image)
+	{
+		bool ok=true;
+		ok&=mmc::load(image);
+		ok&=cpu::load(image);
+		ok&=ppu::load(image);
+		ok&=mapper::load(image);
+		ok&=input::load(image);
+		ok&=apu::load(image);
+		return ok;
+	}
+
+	// the machine before the last complete load, restored if the load fails
+	static uint8_t rollbackBuffer[state::MAX_SIZE];
+
+	bool loadState(const void* buffer, size_t size)
+	{
+		state::Reader image(buffer, size);
+		if (!image.header()) return false; // machine is left untouched
+
+		// all mandatory chunks must be present
+		static const uint32_t mandatoryChunks[]={state::CHUNK_MMC, state::CHUNK_CPU, state::CHUNK_PPU, state::CHUNK_MAPPER};
+		for (size_t i=0; i<_countof(mandatoryChunks); i++)
+		{
+			state::Reader chunk;
+			if (!image.findChunk(mandatoryChunks[i], chunk)) return false;
+		}
+
+		// chunks have a fixed layout, every chunk this build writes must have
+		// the size it would write. the version is checked by header().
+		const size_t rollbackSize=saveState(rollbackBuffer, sizeof(rollbackBuffer));
+		state::Reader current(rollbackBuffer, rollbackSize);
+		if (rollbackSize>0 && current.header())
+		{
+			static const uint32_t knownChunks[]={state::CHUNK_MMC, state::CHUNK_CPU, state::CHUNK_PPU, state::CHUNK_MAPPER,
+				state::CHUNK_VRAM, state::CHUNK_INPUT, state::CHUNK_APU};
+			for (size_t i=0; i<_countof(knownChunks); i++)
+			{
+				state::Reader chunk, expected;
+				if (image.findChunk(knownChunks[i], chunk) && current.findChunk(knownChunks[i], expected) &&
+					chunk.remaining()!=expected.remaining()) return false;
+			}
+		}
+
 		reset(); // necessary
 
-		mmc::load(fp);
-		cpu::load(fp);
-		ppu::load(fp);
-		mapper::load(fp);
+		bool ok=readImage(image);
+		if (!ok && rollbackSize>0)
+		{
+			// don't leave the machine half-restored
+			reset();
+			readImage(current);
+		}
+
+		// mapper setup and bank loads don't track their writes
+		dirty::markAll();
+		return ok;
+	}
+
+	bool loadState(const void* buffer, size_t size, uint64_t& epoch)
+	{
+		bool ok;
+		if (epoch==0)
+		{
+			ok=loadState(buffer, size);
+		}else
+		{
+			// the machine descends from the image, no reset needed.
+			// bank switches only copy banks that differ.
+			state::Reader image(buffer, size, epoch);
+			ok=image.header() && readImage(image);
+		}
+		epoch=ok?dirty::advance():0;
+		return ok;
+	}
+
+	size_t stateSize()
+	{
+		// dry run without buffer
+		state::Writer w(nullptr, 0);
+		return writeImage(w);
+	}
+
+	// file i/o goes through a static buffer to avoid allocations
+	static uint8_t fileBuffer[state::MAX_SIZE];
+
+	bool saveState(FILE *fp)
+	{
+		const size_t size=saveState(fileBuffer, sizeof(fileBuffer));
+		if (size==0) return false;
+		return fwrite(fileBuffer, size, 1, fp)==1;
+	}
+
+	bool loadState(FILE *fp)
+	{
+		const size_t size=fread(fileBuffer, 1, sizeof(fileBuffer), fp);
+		return loadState(fileBuffer, size);
 	}
 }
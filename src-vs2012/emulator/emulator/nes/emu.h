@@ -9,9 +9,33 @@ namespace emu
 	bool setup();
 
 	bool nextFrame();
-	void run();
+	// until the game stops or the window closes, or for this many frames
+	void run(const long long frames=0);
+
+	// run-ahead: every frame run() also emulates this many frames into the
+	// future with the current input, shows the last one and rolls back.
+	// this hides the input lag built into games at the cost of roughly one
+	// extra frame of emulation per frame ahead.
+	const int MAX_RUN_AHEAD=4;
+	void setRunAhead(const int frames);
+	int runAhead();
+
+	// fast-forward: run() stops waiting for the frame pacer and only renders
+	// and presents frames at about this rate. the frames in between are
+	// emulated without drawing pixels, except where sprite 0 may hit.
+	const int FAST_FORWARD_PRESENT_RATE=60;
+	void setFastForward(const bool enabled);
+	bool fastForward();
+
+	// run-time diagnostics and display options, a set of options::OPTION.
+	// call before the window is created, the frame size depends on them.
+	void setOptions(const int selected);
+	int options();
 
 	long long frameCount();
+
+	// returns to an earlier frame using the rewind history
+	bool rewind(const int frames);
 	
 	// proxy functions
 	void present(const uint32_t buffer[], const int width, const int height);
@@ -19,6 +43,16 @@ namespace emu
 	void onFrameEnd();
 
 	// save state
-	void saveState(FILE *fp);
-	void loadState(FILE *fp);
+	// in-memory images use the portable format described in state.h.
+	// saveState returns the size of the image, or 0 if the buffer is too small.
+	size_t saveState(void* buffer, size_t size);
+	bool loadState(const void* buffer, size_t size);
+	// incremental variants, epoch is when the image last matched the machine
+	// (0 for never). only pages written since are copied, epoch is updated.
+	size_t saveState(void* buffer, size_t size, uint64_t& epoch);
+	bool loadState(const void* buffer, size_t size, uint64_t& epoch);
+	size_t stateSize();
+
+	bool saveState(FILE *fp);
+	bool loadState(FILE *fp);
 }
\ No newline at end of file
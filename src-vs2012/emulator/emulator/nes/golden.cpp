@@ -0,0 +1,445 @@
+#include "../stdafx.h"
+
+// local header files
+#include "../macros.h"
+#include "../types/types.h"
+#include "../unittest/framework.h"
+
+#include "internals.h"
+#include "debug.h"
+#include "dirty.h"
+#include "state.h"
+#include "cpu.h"
+#include "ppu.h"
+#include "emu.h"
+#include "movie.h"
+#include "scan.h"
+#include "golden.h"
+
+#include "../../KFramework/KThreadPool.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#endif
+
+namespace golden
+{
+	using scan::tstring;
+
+	// a line of the list, kept to write the hashes back
+	struct LINE
+	{
+		std::string text;
+		int index; // of the case, -1 for comments
+		size_t hashStart, hashEnd;
+	};
+
+	static tstring widen(const std::string& text)
+	{
+#ifdef _UNICODE
+		const int size=MultiByteToWideChar(CP_UTF8, 0, text.c_str(), -1, nullptr, 0);
+		std::wstring s(size>0?size-1:0, L'\0');
+		if (size>1) MultiByteToWideChar(CP_UTF8, 0, text.c_str(), -1, &s[0], size);
+		return s;
+#else
+		return text;
+#endif
+	}
+
+	static bool isAbsolute(const char* path)
+	{
+		return path[0]=='/' || path[0]=='\\' || (path[0]!='\0' && path[1]==':');
+	}
+
+	// false if the line is malformed, index stays -1 for blank lines
+	static bool parseLine(const tstring& dir, LINE& line, CASE& c)
+	{
+		line.index=-1;
+		std::string body=line.text.substr(0, line.text.find('#'));
+		char rom[512], movieFile[512], hash[32];
+		int frames=0, start=0, end=0;
+		const int n=sscanf(body.c_str(), " %511s %511s %d %n%31s%n", rom, movieFile, &frames, &start, hash, &end);
+		if (n<=0) return true;
+		if (n!=4 || frames<=0) return false;
+
+		c.rom=isAbsolute(rom)?widen(rom):dir+widen(rom);
+		c.movie=isAbsolute(movieFile)?widen(movieFile):dir+widen(movieFile);
+		c.frames=frames;
+		c.recorded=strcmp(hash, "-")!=0;
+		c.hash=0;
+		if (c.recorded)
+		{
+			char* stop=nullptr;
+			c.hash=strtoull(hash, &stop, 16);
+			if (*stop!='\0') return false;
+		}
+		line.index=0;
+		line.hashStart=start;
+		line.hashEnd=end;
+		return true;
+	}
+
+	static bool readList(const _TCHAR* list, std::vector<LINE>& lines, std::vector<CASE>& cases)
+	{
+		FILE* fp=nullptr;
+		_tfopen_s(&fp, list, _T("rb"));
+		if (fp==nullptr) return false;
+
+		// paths are relative to the directory of the list
+		const tstring path=list;
+		const size_t slash=path.find_last_of(_T("/\\"));
+		const tstring dir=(slash==tstring::npos)?tstring():path.substr(0, slash+1);
+
+		bool ok=true;
+		char text[1024];
+		while (ok && fgets(text, sizeof(text), fp))
+		{
+			LINE line;
+			line.text=text;
+			while (!line.text.empty() && (line.text.back()=='\n' || line.text.back()=='\r'))
+				line.text.pop_back();
+			CASE c;
+			ok=parseLine(dir, line, c);
+			if (ok && line.index==0)
+			{
+				line.index=(int)cases.size();
+				cases.push_back(c);
+			}
+			lines.push_back(line);
+		}
+		fclose(fp);
+		return ok;
+	}
+
+	bool load(const _TCHAR* list, std::vector<CASE>& cases)
+	{
+		std::vector<LINE> lines;
+		cases.clear();
+		return readList(list, lines, cases);
+	}
+
+	static void printError(const char* detail)
+	{
+		// on a line of its own, whatever was printed before
+		printf("\ngolden error %s\n", detail);
+		fflush(stdout);
+	}
+
+	static void onError(const EMUERROR type, const EMUERRORSUBTYPE stype)
+	{
+		char detail[64];
+		sprintf(detail, "%ls@%04X", debug::subtypeName(stype), valueOf(cpu::pc()));
+		printError(detail);
+		exit(1);
+	}
+
+	int runCase(const _TCHAR* rom, const _TCHAR* movieFile, const int frames, const bool record)
+	{
+		debug::setErrorHook(onError);
+		emu::reset();
+		if (!emu::load(rom) || !emu::setup())
+		{
+			printError("unable to load the rom");
+			return 1;
+		}
+
+		FILE* fp=nullptr;
+		_tfopen_s(&fp, movieFile, _T("rb"));
+		const bool exists=(fp!=nullptr);
+		if (fp) fclose(fp);
+
+		movie::RESULT played={0, 0, -1, false, 0};
+		if (exists)
+		{
+			if (!movie::play(movieFile, played, frames))
+			{
+				printError("unable to play the movie");
+				return 1;
+			}
+		}else if (record)
+		{
+			movie::startRecording(RECORD_HASH_INTERVAL);
+		}else
+		{
+			printError("no movie");
+			return 1;
+		}
+
+		// past the end of the movie no buttons are pressed
+		long long done=played.frames;
+		if (played.divergence<0)
+		{
+			for (; done<frames; done++)
+			{
+				ppu::enableOutput(movie::wantsPicture() || done+1==frames);
+				if (!emu::nextFrame()) break;
+				movie::endFrame();
+			}
+			ppu::enableOutput(true);
+		}
+		if (movie::recording() && !movie::stopRecording(movieFile))
+		{
+			printError("unable to write the movie");
+			return 1;
+		}
+		printf("\ngolden %lld %016llX %lld %d\n", done, (unsigned long long)movie::hashMachine(), played.divergence, played.inputDiverged?1:0);
+		fflush(stdout);
+		return 0;
+	}
+
+	bool parse(const char* line, RESULT& result)
+	{
+		unsigned long long hash=0;
+		int input=0;
+		if (sscanf(line, "golden %lld %llx %lld %d", &result.frames, &hash, &result.divergence, &input)==4)
+		{
+			result.ran=true;
+			result.hash=hash;
+			result.inputDiverged=(input!=0);
+			result.detail.clear();
+			return true;
+		}
+		if (strncmp(line, "golden error ", 13)==0)
+		{
+			result.ran=false;
+			result.detail=line+13;
+			while (!result.detail.empty() && (result.detail.back()=='\n' || result.detail.back()=='\r'))
+				result.detail.pop_back();
+			return true;
+		}
+		return false;
+	}
+
+	static bool exists(const tstring& file)
+	{
+		FILE* fp=nullptr;
+		_tfopen_s(&fp, file.c_str(), _T("rb"));
+		if (fp==nullptr) return false;
+		fclose(fp);
+		return true;
+	}
+
+	static void runChild(const tstring& self, const CASE& c, const bool record, RESULT& result)
+	{
+		_TCHAR count[16];
+#ifdef _UNICODE
+		swprintf(count, _countof(count), L"%d", c.frames);
+#else
+		sprintf(count, "%d", c.frames);
+#endif
+		std::vector<tstring> arguments;
+		arguments.push_back(_T("--golden-case"));
+		arguments.push_back(c.rom);
+		arguments.push_back(c.movie);
+		arguments.push_back(count);
+		if (record) arguments.push_back(_T("--record"));
+
+		result.ran=false;
+		result.available=true;
+		result.frames=0;
+		result.hash=0;
+		result.divergence=-1;
+		result.inputDiverged=false;
+
+		// roms are not in the repository, run() decides whether a case
+		// without its files is skipped
+		if (!exists(c.rom) || (!record && !exists(c.movie)))
+		{
+			result.available=false;
+			result.detail=exists(c.rom)?"no movie":"no rom";
+			return;
+		}
+
+		bool found=false;
+		std::string ended;
+		scan::runSelf(self, arguments, [&](const char* line) {
+			if (!found) found=parse(line, result);
+		}, ended);
+		if (!found) result.detail=ended;
+	}
+
+	bool run(const _TCHAR* self, const _TCHAR* list, const bool update, const int threads)
+	{
+		std::vector<LINE> lines;
+		std::vector<CASE> cases;
+		if (!readList(list, lines, cases))
+		{
+			puts("[X] Unable to read the case list.");
+			return false;
+		}
+		printf("[-] running %d golden cases...\n", (int)cases.size());
+
+		std::vector<RESULT> results(cases.size());
+		{
+			KThreadPool pool(threads);
+			for (size_t i=0; i<cases.size(); i++)
+			{
+				pool.submit([&, i]() {
+					runChild(self, cases[i], update, results[i]);
+				});
+			}
+			pool.wait();
+		}
+
+		int passed=0, failed=0, unrecorded=0;
+		for (size_t i=0; i<cases.size(); i++)
+		{
+			const CASE& c=cases[i];
+			const RESULT& r=results[i];
+			const std::string rom=scan::narrow(c.rom.c_str())+" ("+scan::narrow(c.movie.c_str())+")";
+			// a recorded case has to run, only the others may lack their files
+			if (!r.available && (!c.recorded || update))
+			{
+				printf("[!] %s: not available, %s\n", rom.c_str(), r.detail.c_str());
+				unrecorded++;
+			}else if (!r.ran)
+			{
+				printf("[X] %s: %s\n", rom.c_str(), r.detail.c_str());
+				failed++;
+			}else if (r.divergence>=0)
+			{
+				printf("[X] %s: diverged from the movie at frame %lld, %s\n", rom.c_str(), r.divergence,
+					r.inputDiverged?"the game latched the joypads differently":"the machine state differs");
+				failed++;
+			}else if (update)
+			{
+				cases[i].recorded=true;
+				cases[i].hash=r.hash;
+				passed++;
+			}else if (!c.recorded)
+			{
+				printf("[!] %s: no hash recorded, %016llX after %lld frames\n", rom.c_str(), (unsigned long long)r.hash, r.frames);
+				unrecorded++;
+			}else if (r.hash!=c.hash)
+			{
+				printf("[X] %s: hash %016llX after %lld frames, expected %016llX. The movie's hashes match, it diverged after its last one.\n",
+					rom.c_str(), (unsigned long long)r.hash, r.frames, (unsigned long long)c.hash);
+				failed++;
+			}else
+				passed++;
+		}
+		printf("[-] %d passed, %d failed, %d not recorded or not available\n", passed, failed, unrecorded);
+
+		if (update)
+		{
+			FILE* fp=nullptr;
+			_tfopen_s(&fp, list, _T("wb"));
+			if (fp==nullptr)
+			{
+				puts("[X] Unable to write the case list.");
+				return false;
+			}
+			for (size_t i=0; i<lines.size(); i++)
+			{
+				const LINE& line=lines[i];
+				if (line.index>=0 && cases[line.index].recorded)
+				{
+					char hash[17];
+					sprintf(hash, "%016llX", (unsigned long long)cases[line.index].hash);
+					fprintf(fp, "%s%s%s\n", line.text.substr(0, line.hashStart).c_str(), hash, line.text.substr(line.hashEnd).c_str());
+				}else
+					fprintf(fp, "%s\n", line.text.c_str());
+			}
+			const bool ok=!ferror(fp);
+			fclose(fp);
+			if (!ok) puts("[X] Unable to write the case list.");
+			return ok && failed==0;
+		}
+		return failed==0;
+	}
+
+	static tstring caseSelf, caseList;
+
+	void setCaseList(const _TCHAR* self, const _TCHAR* list)
+	{
+		caseSelf=self;
+		caseList=list;
+	}
+}
+
+// unit tests
+class GoldenListTest : public TestCase
+{
+public:
+	virtual const char* name()
+	{
+		return "Golden Case List Test";
+	}
+
+	virtual bool parallel()
+	{
+		return true;
+	}
+
+	virtual TestResult run()
+	{
+		const std::basic_string<_TCHAR> list=tempFile(_T("golden.txt"));
+		FILE* fp=nullptr;
+		_tfopen_s(&fp, list.c_str(), _T("wb"));
+		tassert(fp!=nullptr);
+		fputs("# rom movie frames hash\n\n", fp);
+		fputs("roms/a.nes movies/a.mov 600 -\n", fp);
+		fputs("  /abs/b.nes b.mov 120 00000000DEADBEEF # comment\r\n", fp);
+		fclose(fp);
+
+		std::vector<golden::CASE> cases;
+		const bool loaded=golden::load(list.c_str(), cases);
+		tassert(loaded && cases.size()==2);
+		// relative to the list
+		const std::basic_string<_TCHAR> dir=list.substr(0, list.find_last_of(_T("/\\"))+1);
+		tassert(cases[0].rom==dir+_T("roms/a.nes") && cases[0].movie==dir+_T("movies/a.mov"));
+		tassert(cases[0].frames==600 && !cases[0].recorded);
+		tassert(cases[1].rom==_T("/abs/b.nes") && cases[1].movie==dir+_T("b.mov"));
+		tassert(cases[1].frames==120 && cases[1].recorded && cases[1].hash==0xDEADBEEFULL);
+
+		// a missing frame count
+		_tfopen_s(&fp, list.c_str(), _T("wb"));
+		tassert(fp!=nullptr);
+		fputs("a.nes a.mov -\n", fp);
+		fclose(fp);
+		const bool malformed=!golden::load(list.c_str(), cases);
+		_tremove(list.c_str());
+		tassert(malformed);
+
+		golden::RESULT r;
+		tassert(golden::parse("golden 600 0123456789ABCDEF -1 0\n", r));
+		tassert(r.ran && r.frames==600 && r.hash==0x0123456789ABCDEFULL && r.divergence==-1 && !r.inputDiverged);
+		tassert(golden::parse("golden 240 0000000000000001 239 1", r));
+		tassert(r.divergence==239 && r.inputDiverged);
+		tassert(golden::parse("golden error INVALID_OPCODE@C123\r\n", r));
+		tassert(!r.ran && r.detail=="INVALID_OPCODE@C123");
+		tassert(!golden::parse("probe ok 0 32 8 00000001 12 0.5 -", r));
+		return SUCCESS;
+	}
+};
+
+registerTestCase(GoldenListTest);
+
+// the case list in CI, see golden::setCaseList()
+class GoldenTest : public TestCase
+{
+public:
+	virtual const char* name()
+	{
+		return "Golden Frame Hash Test";
+	}
+
+	virtual bool ciOnly()
+	{
+		return true;
+	}
+
+	virtual TestResult run()
+	{
+		if (golden::caseList.empty())
+		{
+			puts("[ ] no case list given, nothing to compare");
+			return SUCCESS;
+		}
+		return golden::run(golden::caseSelf.c_str(), golden::caseList.c_str())?SUCCESS:FAILED;
+	}
+};
+
+registerTestCase(GoldenTest);
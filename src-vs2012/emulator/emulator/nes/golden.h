@@ -0,0 +1,62 @@
+// golden frame-hash regression suite
+//
+// A case list names a rom, the input movie played on it and the number of
+// frames to run, with the hash of the machine after the last frame (see
+// movie::hashMachine()). One case per line, '#' starts a comment:
+//   <rom> <movie> <frames> <hash>
+// Paths are relative to the list and can't contain spaces. A hash of "-"
+// hasn't been recorded yet.
+//
+// The machine is global, so each case runs in a process of its own, started
+// as "<self> --golden-case <rom> <movie> <frames>", a few at a time on a
+// thread pool. The movie's own hashes tell the first frame that differs.
+// A case whose movie doesn't exist, e.g. a test rom that needs no input,
+// gets one recorded with no buttons pressed when the hashes are updated.
+// Roms are not in the repository: a case without hash whose rom or movie is
+// missing is reported as not available and doesn't fail. A case with a hash
+// fails without its files, its rom has to be there for the hash to be checked.
+
+#include <string>
+#include <vector>
+
+namespace golden
+{
+	// hash interval of the movies recorded for the cases
+	const int RECORD_HASH_INTERVAL=10;
+
+	struct CASE
+	{
+		std::basic_string<_TCHAR> rom, movie;
+		int frames;
+		bool recorded; // has a hash
+		uint64_t hash;
+	};
+
+	struct RESULT
+	{
+		bool ran; // the case printed a result
+		bool available; // the rom, and the movie unless recording, exist
+		long long frames;
+		uint64_t hash;
+		long long divergence; // -1 if none
+		bool inputDiverged;
+		std::string detail; // why the case didn't run or isn't available
+	};
+
+	// the child process, returns its exit code. record: when the movie
+	// doesn't exist, records it instead of playing it.
+	int runCase(const _TCHAR* rom, const _TCHAR* movie, const int frames, const bool record);
+	// false if the line is not a case result
+	bool parse(const char* line, RESULT& result);
+
+	// false if the list can't be read or a line is malformed
+	bool load(const _TCHAR* list, std::vector<CASE>& cases);
+
+	// runs every case of the list and prints the mismatches. update: writes
+	// the hashes found back to the list instead of comparing them.
+	// no threads: one per hardware thread
+	bool run(const _TCHAR* self, const _TCHAR* list, const bool update=false, const int threads=0);
+
+	// the list GoldenTest runs in CI
+	void setCaseList(const _TCHAR* self, const _TCHAR* list);
+}
@@ -0,0 +1,190 @@
+#include "../stdafx.h"
+
+// local header files
+#include "../macros.h"
+#include "../types/types.h"
+#include "../unittest/framework.h"
+
+#include "hash.h"
+
+namespace hash
+{
+	// tables[k][b] is the crc of byte b followed by k zero bytes
+	static uint32_t tables[8][256];
+
+	static bool initTables()
+	{
+		for (int b=0; b<256; b++)
+		{
+			uint32_t c=b;
+			for (int i=0; i<8; i++) c=(c>>1)^(0xEDB88320&(0-(c&1)));
+			tables[0][b]=c;
+		}
+		for (int b=0; b<256; b++)
+		{
+			for (int k=1; k<8; k++)
+				tables[k][b]=(tables[k-1][b]>>8)^tables[0][tables[k-1][b]&0xFF];
+		}
+		return true;
+	}
+
+	// filled before main(), so threads can share them
+	static const bool tablesReady=initTables();
+
+	uint32_t crc32(const void* data, const size_t size, const uint32_t crc)
+	{
+		const uint8_t* p=(const uint8_t*)data;
+		size_t n=size;
+		uint32_t c=~crc;
+		// little-endian loads, eight bytes per step
+		for (; n>=8; n-=8, p+=8)
+		{
+			const uint32_t lo=c^(p[0]|(p[1]<<8)|(p[2]<<16)|((uint32_t)p[3]<<24));
+			const uint32_t hi=p[4]|(p[5]<<8)|(p[6]<<16)|((uint32_t)p[7]<<24);
+			c=tables[7][lo&0xFF]^tables[6][(lo>>8)&0xFF]^tables[5][(lo>>16)&0xFF]^tables[4][lo>>24]
+				^tables[3][hi&0xFF]^tables[2][(hi>>8)&0xFF]^tables[1][(hi>>16)&0xFF]^tables[0][hi>>24];
+		}
+		for (; n>0; n--, p++) c=(c>>8)^tables[0][(c^*p)&0xFF];
+		return ~c;
+	}
+
+	uint64_t fnv1a64(const void* data, const size_t size, const uint64_t hash)
+	{
+		const uint8_t* p=(const uint8_t*)data;
+		uint64_t h=hash;
+		for (size_t i=0; i<size; i++)
+		{
+			h^=p[i];
+			h*=1099511628211ULL;
+		}
+		return h;
+	}
+
+	static inline uint32_t rol(const uint32_t x, const int n)
+	{
+		return (x<<n)|(x>>(32-n));
+	}
+
+	Sha1::Sha1():_length(0)
+	{
+		_state[0]=0x67452301;
+		_state[1]=0xEFCDAB89;
+		_state[2]=0x98BADCFE;
+		_state[3]=0x10325476;
+		_state[4]=0xC3D2E1F0;
+	}
+
+	void Sha1::block(const uint8_t* p)
+	{
+		uint32_t w[80];
+		for (int i=0; i<16; i++) w[i]=((uint32_t)p[i*4]<<24)|(p[i*4+1]<<16)|(p[i*4+2]<<8)|p[i*4+3];
+		for (int i=16; i<80; i++) w[i]=rol(w[i-3]^w[i-8]^w[i-14]^w[i-16], 1);
+
+		uint32_t a=_state[0], b=_state[1], c=_state[2], d=_state[3], e=_state[4];
+		for (int i=0; i<80; i++)
+		{
+			uint32_t f, k;
+			if (i<20) {f=(b&c)|(~b&d); k=0x5A827999;}
+			else if (i<40) {f=b^c^d; k=0x6ED9EBA1;}
+			else if (i<60) {f=(b&c)|(b&d)|(c&d); k=0x8F1BBCDC;}
+			else {f=b^c^d; k=0xCA62C1D6;}
+			const uint32_t t=rol(a, 5)+f+e+k+w[i];
+			e=d;
+			d=c;
+			c=rol(b, 30);
+			b=a;
+			a=t;
+		}
+		_state[0]+=a;
+		_state[1]+=b;
+		_state[2]+=c;
+		_state[3]+=d;
+		_state[4]+=e;
+	}
+
+	void Sha1::update(const void* data, size_t size)
+	{
+		const uint8_t* p=(const uint8_t*)data;
+		size_t used=(size_t)(_length%64);
+		_length+=size;
+		if (used>0)
+		{
+			const size_t n=min(size, 64-used);
+			memcpy(_buffer+used, p, n);
+			p+=n;
+			size-=n;
+			if (used+n<64) return;
+			block(_buffer);
+		}
+		for (; size>=64; size-=64, p+=64) block(p);
+		memcpy(_buffer, p, size);
+	}
+
+	void Sha1::finish(uint8_t digest[SHA1_SIZE])
+	{
+		const uint64_t bits=_length*8;
+		// 0x80, zeros up to 56 mod 64, then the length in bits
+		uint8_t padding[72]={0x80};
+		const size_t used=(size_t)(_length%64);
+		const size_t n=(used<56)?56-used:120-used;
+		for (int i=0; i<8; i++) padding[n+i]=(uint8_t)(bits>>(56-i*8));
+		update(padding, n+8);
+		for (int i=0; i<SHA1_SIZE; i++) digest[i]=(uint8_t)(_state[i/4]>>(24-(i%4)*8));
+	}
+
+	void toHex(const uint8_t digest[SHA1_SIZE], char text[SHA1_SIZE*2+1])
+	{
+		for (int i=0; i<SHA1_SIZE; i++) sprintf(text+i*2, "%02x", digest[i]);
+	}
+}
+
+// unit tests
+class HashTest : public TestCase
+{
+public:
+	virtual const char* name()
+	{
+		return "Checksum Test";
+	}
+
+	virtual bool parallel()
+	{
+		return true;
+	}
+
+	static bool sha1Is(const char* message, const char* expected)
+	{
+		uint8_t digest[hash::SHA1_SIZE];
+		char text[hash::SHA1_SIZE*2+1];
+		hash::Sha1 sha1;
+		// in uneven pieces, to cross the block boundaries
+		const size_t size=strlen(message);
+		for (size_t i=0; i<size; i+=7) sha1.update(message+i, min((size_t)7, size-i));
+		sha1.finish(digest);
+		hash::toHex(digest, text);
+		return strcmp(text, expected)==0;
+	}
+
+	virtual TestResult run()
+	{
+		// check values of the standard
+		tassert(hash::crc32("123456789", 9)==0xCBF43926);
+		tassert(hash::crc32("", 0)==0);
+		// the tail and the eight-byte steps agree, in any split
+		static const char text[]="The quick brown fox jumps over the lazy dog";
+		const uint32_t whole=hash::crc32(text, sizeof(text)-1);
+		tassert(whole==0x414FA339);
+		tassert(hash::crc32(text+13, sizeof(text)-14, hash::crc32(text, 13))==whole);
+
+		tassert(hash::fnv1a64("", 0)==0xCBF29CE484222325ULL);
+		tassert(hash::fnv1a64("a", 1)==0xAF63DC4C8601EC8CULL);
+		tassert(hash::fnv1a64("b", 1, hash::fnv1a64("a", 1))==hash::fnv1a64("ab", 2));
+
+		tassert(sha1Is("", "da39a3ee5e6b4b0d3255bfef95601890afd80709"));
+		tassert(sha1Is("abc", "a9993e364706816aba3e25717850c26c9cd0d89d"));
+		tassert(sha1Is("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", "84983e441c3bd26ebaae4aa1f95129e5e54670f1"));
+		return SUCCESS;
+	}
+};
+
+registerTestCase(HashTest);
@@ -0,0 +1,38 @@
+// checksums and hashes
+//
+// CRC-32 is the IEEE polynomial (as in zip and the No-Intro and GoodNES
+// lists), computed eight bytes at a time with slice-by-8 tables. SHA-1 is
+// the usual FIPS 180 digest. FNV-1a is a fast 64-bit hash for comparing
+// machine states, not for identification.
+
+namespace hash
+{
+	// continues the crc of the data before, pass 0 to start
+	uint32_t crc32(const void* data, const size_t size, const uint32_t crc=0);
+
+	// 64-bit FNV-1a, continues the hash of the data before
+	const uint64_t FNV_OFFSET=14695981039346656037ULL;
+	uint64_t fnv1a64(const void* data, const size_t size, const uint64_t hash=FNV_OFFSET);
+
+	const int SHA1_SIZE=20;
+
+	class Sha1
+	{
+	public:
+		Sha1();
+
+		void update(const void* data, size_t size);
+		// the object must not be updated afterwards
+		void finish(uint8_t digest[SHA1_SIZE]);
+
+	private:
+		void block(const uint8_t* p);
+
+		uint32_t _state[5];
+		uint64_t _length; // bytes
+		uint8_t _buffer[64];
+	};
+
+	// 40 lowercase hex digits and a terminator
+	void toHex(const uint8_t digest[SHA1_SIZE], char text[SHA1_SIZE*2+1]);
+}
@@ -0,0 +1,315 @@
+#include "../stdafx.h"
+
+// local header files
+#include "../macros.h"
+#include "../types/types.h"
+#include "../unittest/framework.h"
+
+#include "internals.h"
+#include "debug.h"
+#include "dirty.h"
+#include "state.h"
+#include "codec.h"
+#include "ppu.h"
+#include "apu.h"
+#include "emu.h"
+#include "history.h"
+#include "input.h"
+
+namespace history
+{
+	struct SNAPSHOT
+	{
+		long long frame;
+		size_t offset; // in arena
+		size_t size; // encoded size
+		size_t imageSize; // decoded size
+		bool keyframe;
+	};
+
+	static bool enabled=false;
+	static int interval;
+
+	// encoded snapshots, oldest first
+	static uint8_t* arena=nullptr;
+	static size_t arenaSize;
+	static size_t head; // end of the newest snapshot
+
+	static SNAPSHOT* snapshots=nullptr;
+	static int capacity;
+	static int first;
+	static int count;
+	static int sinceKeyframe;
+
+	// decoded image of the newest snapshot and a scratch image
+	static uint8_t* prevImage=nullptr;
+	static uint8_t* curImage=nullptr;
+	static size_t prevSize;
+
+	// epochs of the images, for incremental saves
+	static uint64_t prevEpoch;
+	static uint64_t curEpoch;
+
+	// joypad input latched during each frame
+	static uint8_t (*inputs)[2]=nullptr;
+	static int inputCapacity;
+
+	static long long expectedFrame;
+
+	static SNAPSHOT& at(const int i)
+	{
+		assert(i>=0 && i<count);
+		return snapshots[(first+i)%capacity];
+	}
+
+	static void swapImages()
+	{
+		uint8_t* tmp=prevImage;
+		prevImage=curImage;
+		curImage=tmp;
+
+		const uint64_t epoch=prevEpoch;
+		prevEpoch=curEpoch;
+		curEpoch=epoch;
+	}
+
+	bool init(const size_t memoryLimit, const int interval, const int maxFrames)
+	{
+		deinit();
+		assert(interval>0 && maxFrames>0);
+
+		history::interval=interval;
+		inputCapacity=maxFrames;
+		capacity=maxFrames/interval+1;
+
+		// bookkeeping counts against the limit as well
+		const size_t overhead=capacity*sizeof(SNAPSHOT)+inputCapacity*sizeof(inputs[0])+2*state::MAX_SIZE;
+		if (memoryLimit<overhead+codec::bound(state::MAX_SIZE))
+			return false;
+		arenaSize=memoryLimit-overhead;
+
+		arena=new uint8_t[arenaSize];
+		snapshots=new SNAPSHOT[capacity];
+		inputs=new uint8_t[inputCapacity][2];
+		prevImage=new uint8_t[state::MAX_SIZE];
+		curImage=new uint8_t[state::MAX_SIZE];
+
+		enabled=true;
+		clear();
+		return true;
+	}
+
+	void deinit()
+	{
+		enabled=false;
+		delete[] arena;
+		delete[] snapshots;
+		delete[] inputs;
+		delete[] prevImage;
+		delete[] curImage;
+		arena=nullptr;
+		snapshots=nullptr;
+		inputs=nullptr;
+		prevImage=nullptr;
+		curImage=nullptr;
+	}
+
+	void clear()
+	{
+		head=0;
+		first=0;
+		count=0;
+		sinceKeyframe=0;
+		prevSize=0;
+		prevEpoch=0;
+		curEpoch=0;
+		expectedFrame=-1;
+	}
+
+	// drop the oldest keyframe together with its deltas
+	static void evictOldest()
+	{
+		do
+		{
+			first=(first+1)%capacity;
+			count--;
+		}while (count>0 && !at(0).keyframe);
+	}
+
+	// returns the offset of a contiguous free block, evicting old snapshots as needed
+	static size_t reserve(const size_t size)
+	{
+		assert(size<=arenaSize);
+		while (count>0)
+		{
+			const SNAPSHOT& oldest=at(0);
+			const SNAPSHOT& newest=at(count-1);
+			if (newest.offset>=oldest.offset)
+			{
+				// free space behind the newest and in front of the oldest snapshot
+				if (head+size<=arenaSize) return head;
+				if (size<=oldest.offset) return 0;
+			}else
+			{
+				// wrapped around
+				if (head+size<=oldest.offset) return head;
+			}
+			evictOldest();
+		}
+		return 0;
+	}
+
+	static void capture(const long long frame)
+	{
+		if (count==capacity) evictOldest();
+
+		// snapshots are useless once the input following them is gone
+		while (count>0 && at(0).frame<=frame-inputCapacity) evictOldest();
+
+		const size_t size=emu::saveState(curImage, state::MAX_SIZE, curEpoch);
+		if (size==0) return;
+
+		const size_t bound=codec::bound(size);
+		const size_t offset=reserve(bound);
+		const bool keyframe=(count==0 || sinceKeyframe>=KEYFRAME_INTERVAL-1 || size!=prevSize);
+		const size_t encoded=codec::encode(curImage, keyframe?nullptr:prevImage, size, arena+offset, bound);
+		assert(encoded>0);
+
+		SNAPSHOT& s=snapshots[(first+count)%capacity];
+		count++;
+		s.frame=frame;
+		s.offset=offset;
+		s.size=encoded;
+		s.imageSize=size;
+		s.keyframe=keyframe;
+
+		head=offset+encoded;
+		sinceKeyframe=keyframe?0:sinceKeyframe+1;
+
+		// the new image is the reference for the next delta
+		swapImages();
+		prevSize=size;
+	}
+
+	// the buttons are known once the game has latched them
+	static void logInput(const long long frame)
+	{
+		uint8_t* input=inputs[frame%inputCapacity];
+		input[0]=(uint8_t)input::latched(0);
+		input[1]=(uint8_t)input::latched(1);
+	}
+
+	void record()
+	{
+		if (!enabled) return;
+
+		const long long frame=emu::frameCount();
+		if (frame!=expectedFrame)
+		{
+			// machine was reset or a state was loaded
+			clear();
+		}else
+		{
+			// the previous frame is complete, so is its input
+			logInput(frame-1);
+		}
+		expectedFrame=frame+1;
+
+		if (frame%interval==0)
+		{
+			capture(frame);
+		}
+	}
+
+	// decodes a snapshot into curImage, returns the distance to its keyframe
+	static int decode(const int index)
+	{
+		int k=index;
+		while (!at(k).keyframe)
+		{
+			assert(k>0);
+			k--;
+		}
+		for (int i=k; i<=index; i++)
+		{
+			const SNAPSHOT& s=at(i);
+			if (!codec::decode(arena+s.offset, s.size, curImage, s.keyframe?nullptr:curImage, s.imageSize))
+				return -1;
+		}
+		return index-k;
+	}
+
+	bool seek(long long frame)
+	{
+		if (!enabled || count==0) return false;
+		if (frame>emu::frameCount()) return false;
+		if (frame<at(0).frame) frame=at(0).frame;
+		if (expectedFrame==emu::frameCount()) logInput(expectedFrame-1);
+
+		// find the newest snapshot not after the target frame
+		int lo=0, hi=count-1;
+		while (lo<hi)
+		{
+			const int mid=(lo+hi+1)/2;
+			if (at(mid).frame<=frame)
+				lo=mid;
+			else
+				hi=mid-1;
+		}
+		const int index=lo;
+
+		const int distance=decode(index);
+		curEpoch=0;
+		if (distance<0 || !emu::loadState(curImage, at(index).imageSize))
+		{
+			ERROR(ILLEGAL_OPERATION, STATE_CORRUPTED, "frame", (int)frame);
+			clear();
+			return false;
+		}
+
+		// the timeline continues from the restored snapshot
+		count=index+1;
+		head=at(index).offset+at(index).size;
+		sinceKeyframe=distance;
+		swapImages();
+		prevSize=at(index).imageSize;
+
+		// the restored image matches the machine as of now
+		prevEpoch=dirty::advance();
+
+		// replay recorded input up to the target frame
+		input::FixedProvider replay;
+		input::Provider* live=input::provider();
+		input::setProvider(&replay);
+		ppu::enableOutput(false);
+		apu::enableOutput(false);
+		for (long long f=at(index).frame; f<frame; f++)
+		{
+			const uint8_t* input=inputs[f%inputCapacity];
+			replay.set(0, input[0]);
+			replay.set(1, input[1]);
+			if (!emu::nextFrame()) break;
+		}
+		ppu::enableOutput(true);
+		apu::enableOutput(true);
+		input::setProvider(live);
+
+		expectedFrame=emu::frameCount();
+		return true;
+	}
+
+	long long oldestFrame()
+	{
+		return count>0?at(0).frame:-1;
+	}
+
+	size_t memoryUsed()
+	{
+		size_t total=0;
+		for (int i=0; i<count; i++)
+		{
+			total+=at(i).size;
+		}
+		return total;
+	}
+}
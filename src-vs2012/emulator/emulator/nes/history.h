@@ -0,0 +1,28 @@
+// rewind history
+//
+// Snapshots are taken every few frames and kept in a fixed-size ring, encoded
+// by the codec as deltas against the previous snapshot. Every KEYFRAME_INTERVAL
+// snapshots a full image is stored so that decoding stays bounded. The joypad
+// buttons latched in every frame are logged, so any frame covered by the ring
+// can be reached by restoring the closest snapshot and replaying the input.
+
+namespace history
+{
+	const size_t DEFAULT_MEMORY_LIMIT=64<<20;
+	const int DEFAULT_INTERVAL=2;
+	const int DEFAULT_MAX_FRAMES=60*60*10; // 10 minutes
+	const int KEYFRAME_INTERVAL=64;
+
+	bool init(const size_t memoryLimit, const int interval, const int maxFrames);
+	void deinit();
+	void clear();
+
+	// called once per frame, before the frame is emulated
+	void record();
+
+	// returns to the beginning of the given frame
+	bool seek(long long frame);
+
+	long long oldestFrame();
+	size_t memoryUsed();
+}
@@ -0,0 +1,290 @@
+#include "../stdafx.h"
+
+// local header files
+#include "../macros.h"
+#include "../types/types.h"
+#include "../unittest/framework.h"
+
+#include "internals.h"
+#include "debug.h"
+#include "dirty.h"
+#include "state.h"
+#include "emu.h"
+#include "pacer.h"
+#include "input.h"
+#include "../ui.h"
+
+namespace input
+{
+	static FixedProvider idle;
+	static Provider* current=&idle;
+
+	// only the first joypad is plugged in
+	static const bool present[2]={true, false};
+	static int buttons[2];
+	static unsigned position[2];
+
+	long long now()
+	{
+		return pacer::now()/1000;
+	}
+
+	FixedProvider::FixedProvider()
+	{
+		_buttons[0]=0;
+		_buttons[1]=0;
+	}
+
+	void FixedProvider::set(const int player, const int buttons)
+	{
+		vassert(player==0 || player==1);
+		_buttons[player]=buttons;
+	}
+
+	int FixedProvider::sample(const int player)
+	{
+		return _buttons[player];
+	}
+
+	QueueProvider::QueueProvider(): _maxLatency(0)
+	{
+		_buttons[0]=0;
+		_buttons[1]=0;
+	}
+
+	bool QueueProvider::post(const int player, const int buttons)
+	{
+		vassert(player==0 || player==1);
+		EVENT e;
+		e.time=now();
+		e.player=player;
+		e.buttons=buttons;
+		return _queue.push(e);
+	}
+
+	int QueueProvider::sample(const int player)
+	{
+		EVENT e;
+		if (!_queue.empty())
+		{
+			const long long t=now();
+			while (_queue.pop(e))
+			{
+				_buttons[e.player]=e.buttons;
+				_maxLatency=max(_maxLatency, t-e.time);
+			}
+		}
+		return _buttons[player];
+	}
+
+	struct ScriptProvider::LINE
+	{
+		long long frame;
+		int buttons[2];
+	};
+
+	ScriptProvider::ScriptProvider(): _lines(nullptr), _count(0), _current(-1)
+	{
+	}
+
+	ScriptProvider::~ScriptProvider()
+	{
+		delete[] _lines;
+	}
+
+	bool ScriptProvider::load(const _TCHAR* file)
+	{
+		FILE *fp=NULL;
+		_tfopen_s(&fp, file, _T("rt"));
+		if (fp==NULL)
+		{
+			_tprintf(_T("Couldn't open %s (error code %d)\n"), file, errno);
+			return false;
+		}
+
+		delete[] _lines;
+		_lines=nullptr;
+		_count=0;
+		_current=-1;
+
+		int capacity=0;
+		int lineNumber=0;
+		char text[256];
+		bool ok=true;
+		while (fgets(text, sizeof(text), fp))
+		{
+			lineNumber++;
+			char* comment=strchr(text, '#');
+			if (comment) *comment=0;
+
+			char* p=text;
+			while (*p==' ' || *p=='\t') p++;
+			if (*p==0 || *p=='\r' || *p=='\n') continue;
+
+			LINE line;
+			char* end;
+			line.frame=strtoll(p, &end, 0);
+			line.buttons[0]=(int)strtol(end, &end, 0);
+			line.buttons[1]=(int)strtol(end, &end, 0);
+			if (end==p || line.frame<0 || (_count>0 && line.frame<_lines[_count-1].frame))
+			{
+				printf("[X] Input script line %d is invalid\n", lineNumber);
+				ok=false;
+				break;
+			}
+
+			if (_count==capacity)
+			{
+				capacity=max(capacity*2, 64);
+				LINE* lines=new LINE[capacity];
+				if (_count>0) memcpy(lines, _lines, _count*sizeof(LINE));
+				delete[] _lines;
+				_lines=lines;
+			}
+			_lines[_count++]=line;
+		}
+		fclose(fp);
+		return ok;
+	}
+
+	int ScriptProvider::sample(const int player)
+	{
+		const long long frame=emu::frameCount();
+
+		// start over after a reset or a rewind
+		if (_current>=0 && _lines[_current].frame>frame) _current=-1;
+		while (_current+1<_count && _lines[_current+1].frame<=frame) _current++;
+
+		return (_current>=0)?_lines[_current].buttons[player]:0;
+	}
+
+	long long ScriptProvider::length() const
+	{
+		return (_count>0)?_lines[_count-1].frame:0;
+	}
+
+	void setProvider(Provider* provider)
+	{
+		current=provider?provider:&idle;
+	}
+
+	Provider* provider()
+	{
+		return current;
+	}
+
+	void reset()
+	{
+		buttons[0]=0;
+		buttons[1]=0;
+		position[0]=0;
+		position[1]=0;
+	}
+
+	bool connected(const int player)
+	{
+		vassert(player==0 || player==1);
+		return present[player];
+	}
+
+	void strobe(const bool high)
+	{
+		// the shift registers reload while the strobe is high and keep the
+		// buttons of the moment it goes low
+		if (high) return;
+		for (int p=0; p<2; p++)
+		{
+			if (present[p]) buttons[p]=current->sample(p);
+			position[p]=0;
+		}
+	}
+
+	byte_t read(const int player)
+	{
+		if (!connected(player)) return 0;
+
+		// official joypads return 1 after the eighth read
+		const unsigned bit=(position[player]<BUTTON_COUNT)?(buttons[player]>>position[player]++)&1:1;
+		return 0x40|bit;
+	}
+
+	int latched(const int player)
+	{
+		vassert(player==0 || player==1);
+		return buttons[player];
+	}
+
+	void save(state::Writer& w)
+	{
+		w.beginChunk(state::CHUNK_INPUT);
+		for (int p=0; p<2; p++)
+		{
+			w.u8(buttons[p]);
+			w.u8(position[p]);
+		}
+		w.endChunk();
+	}
+
+	bool load(const state::Reader& image)
+	{
+		state::Reader r;
+		if (!image.findChunk(state::CHUNK_INPUT, r))
+		{
+			// older images, released joypads
+			reset();
+			return true;
+		}
+		for (int p=0; p<2; p++)
+		{
+			buttons[p]=r.u8();
+			position[p]=r.u8();
+		}
+		return r.ok();
+	}
+}
+
+// unit tests
+class InputTest : public TestCase
+{
+public:
+	virtual const char* name()
+	{
+		return "Input Provider Test";
+	}
+
+	virtual TestResult run()
+	{
+		input::reset();
+
+		puts("checking latch and shift...");
+		input::FixedProvider fixed;
+		fixed.set(0, (1<<BUTTON_A)|(1<<BUTTON_RIGHT));
+		input::setProvider(&fixed);
+		input::strobe(true);
+		input::strobe(false);
+		fixed.set(0, 0); // after the latch
+		for (int i=0; i<BUTTON_COUNT; i++)
+		{
+			tassert(input::read(0)==((i==BUTTON_A || i==BUTTON_RIGHT)?0x41:0x40));
+		}
+		tassert(input::read(0)==0x41);
+		tassert(input::read(1)==0);
+
+		puts("checking queued events...");
+		input::QueueProvider queue;
+		input::setProvider(&queue);
+		tassert(queue.post(0, 1<<BUTTON_START));
+		tassert(queue.post(0, 1<<BUTTON_B));
+		input::strobe(false);
+		tassert(input::latched(0)==(1<<BUTTON_B));
+		tassert(queue.maxLatency()>=0);
+		input::strobe(false);
+		tassert(input::latched(0)==(1<<BUTTON_B));
+
+		input::setProvider(nullptr);
+		input::reset();
+		return SUCCESS;
+	}
+};
+
+registerTestCase(InputTest);
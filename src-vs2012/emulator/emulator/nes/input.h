@@ -0,0 +1,112 @@
+// joypad input
+//
+// The game latches the joypads by writing 0 to $4016 and then shifts the
+// buttons out of $4016/$4017 one read at a time. The buttons are taken from
+// the current Provider at that latch, in the middle of the emulated frame,
+// instead of once per frame before it runs.
+//
+// Buttons are bit masks of BUTTON_* (see ui.h).
+
+#include "../types/spsc.h"
+
+namespace input
+{
+	// a change of joypad state, time in microseconds of now()
+	struct EVENT
+	{
+		long long time;
+		int player;
+		int buttons;
+	};
+
+	// monotonic host clock in microseconds
+	long long now();
+
+	class Provider
+	{
+	public:
+		virtual ~Provider() {}
+
+		// called on the emulation thread whenever the game latches the joypads
+		virtual int sample(const int player)=0;
+	};
+
+	// input set directly by the emulation thread, for replays and jobs
+	class FixedProvider : public Provider
+	{
+	public:
+		FixedProvider();
+
+		void set(const int player, const int buttons);
+		virtual int sample(const int player);
+
+	private:
+		int _buttons[2];
+	};
+
+	// events posted by one producer thread, e.g. the window thread.
+	// a latch applies every event posted before it, so a button pressed while
+	// the frame is running is seen by the game in the same frame.
+	class QueueProvider : public Provider
+	{
+	public:
+		QueueProvider();
+
+		// producer side, stamps the event with now(). returns false when the queue is full.
+		bool post(const int player, const int buttons);
+
+		virtual int sample(const int player);
+
+		// longest time between posting and latching an event, in microseconds
+		long long maxLatency() const {return _maxLatency;}
+
+	private:
+		spsc_queue<EVENT, 256> _queue;
+		int _buttons[2];
+		long long _maxLatency;
+	};
+
+	// replays a text file of lines "<frame> <player 1 buttons> [<player 2 buttons>]",
+	// sorted by frame. each line holds until the next one, '#' starts a comment.
+	// timed by the emulated frame counter, so runs are deterministic.
+	class ScriptProvider : public Provider
+	{
+	public:
+		ScriptProvider();
+		~ScriptProvider();
+
+		bool load(const _TCHAR* file);
+		virtual int sample(const int player);
+
+		// frame of the last line
+		long long length() const;
+
+	private:
+		struct LINE;
+
+		LINE* _lines;
+		int _count;
+		int _current;
+
+		ScriptProvider(const ScriptProvider&);
+		ScriptProvider& operator=(const ScriptProvider&);
+	};
+
+	// the emulation thread may change providers between frames only.
+	// nullptr restores the default, which has no buttons pressed.
+	void setProvider(Provider* provider);
+	Provider* provider();
+
+	// joypad ports
+	void reset();
+	bool connected(const int player);
+	void strobe(const bool high);
+	byte_t read(const int player);
+
+	// buttons taken at the last latch, used to record input
+	int latched(const int player);
+
+	// the shift registers are part of the machine, providers are not
+	void save(state::Writer& w);
+	bool load(const state::Reader& image);
+}
@@ -65,20 +65,9 @@ inline rgb32_t Rgb32(const byte_t r,const byte_t g,const byte_t b)
 }
 
 // hardware configuration
-#ifndef LEFT_CLIP
-	const int SCREEN_WIDTH=256;
-	const int SCREEN_XOFFSET=0;
-#else
-	const int SCREEN_WIDTH=248;
-	const int SCREEN_XOFFSET=8;
-#endif
-#ifdef SHOW_240_LINES
-	const int SCREEN_HEIGHT=240;
-	const int SCREEN_YOFFSET=0;
-#else
-	const int SCREEN_HEIGHT=224;
-	const int SCREEN_YOFFSET=8;
-#endif
+// largest frame, ppu::frameWidth() and ppu::frameHeight() give the presented one
+const int SCREEN_WIDTH=256;
+const int SCREEN_HEIGHT=240;
 
 const int SCANLINE_CYCLES=113;
 
@@ -87,7 +76,8 @@ enum EMUERROR {
 	INVALID_ROM=1,
 	INVALID_MEMORY_ACCESS,
 	INVALID_INSTRUCTION,
-	ILLEGAL_OPERATION
+	ILLEGAL_OPERATION,
+	_EMUERROR_MAX
 };
 
 enum EMUERRORSUBTYPE {
@@ -111,5 +101,7 @@ enum EMUERRORSUBTYPE {
 	INVALID_ADDRESS_MODE,
 
 	// ILLEGAL_OPERATION
-	IRQ_ALREADY_PENDING
+	IRQ_ALREADY_PENDING,
+	STATE_CORRUPTED,
+	_EMUERRORSUBTYPE_MAX
 };
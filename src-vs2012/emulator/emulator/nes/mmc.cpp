@@ -7,12 +7,16 @@
 
 #include "internals.h"
 #include "debug.h"
+#include "dirty.h"
+#include "state.h"
 #include "rom.h"
 #include "mmc.h"
 #include "cpu.h"
 #include "ppu.h"
-
-#include "../ui.h"
+#include "apu.h"
+#include "input.h"
+#include "telemetry.h"
+#include "perf.h"
 
 // NES main memory
 __declspec(align(0x1000))
@@ -36,6 +40,7 @@ namespace mmc
 			// perform update
 			memcpy(dest, rom::getImage()+current*0x2000, 0x2000);
 			prev=current;
+			telemetry::counters.prgSwitches++;
 		}
 	}
 
@@ -48,6 +53,18 @@ namespace mmc
 		if (regE!=INVALID) updateBank(ram.bankE, pE, regE);
 	}
 
+	int prgBank(const maddr_t addr)
+	{
+		switch (valueOf(addr)>>13)
+		{
+		case 4: return p8;
+		case 5: return pA;
+		case 6: return pC;
+		case 7: return pE;
+		}
+		return INVALID;
+	}
+
 	void setSRAMEnabled(bool v)
 	{
 		sramEnabled=v;
@@ -68,40 +85,48 @@ namespace mmc
 		memset(&ram,0,sizeof(ram));
 	}
 
-	void save(FILE *fp)
+	void save(state::Writer& w)
 	{
+		w.beginChunk(state::CHUNK_MMC);
+
 		// bank-switching state
-		fwrite(&p8, sizeof(p8), 1, fp);
-		fwrite(&pA, sizeof(pA), 1, fp);
-		fwrite(&pC, sizeof(pC), 1, fp);
-		fwrite(&pE, sizeof(pE), 1, fp);
+		w.u32(p8);
+		w.u32(pA);
+		w.u32(pC);
+		w.u32(pE);
+		w.u8(sramEnabled);
 
 		// data in memory
-		fwrite(ram.bank0, sizeof(ram.bank0), 1, fp);
-		fwrite(ram.bank6, sizeof(ram.bank6), 1, fp);
+		w.pages(dirty::CPU_RAM, ram.bank0, sizeof(ram.bank0));
+		w.pages(dirty::SRAM, ram.bank6, sizeof(ram.bank6));
 
 #ifdef SAVE_COMPLETE_MEMORY
 		// code in memory
-		fwrite(ram.code, sizeof(ram.code), 1, fp);
+		w.bytes(ram.code, sizeof(ram.code));
 #endif
+
+		w.endChunk();
 	}
 	
-	void load(FILE *fp)
+	bool load(const state::Reader& image)
 	{
+		state::Reader r;
+		if (!image.findChunk(state::CHUNK_MMC, r)) return false;
+
 		// bank-switching state
-		int r8, rA, rC, rE;
-		fread(&r8, sizeof(r8), 1, fp);
-		fread(&rA, sizeof(rA), 1, fp);
-		fread(&rC, sizeof(rC), 1, fp);
-		fread(&rE, sizeof(rE), 1, fp);
+		const int r8=(int)r.u32();
+		const int rA=(int)r.u32();
+		const int rC=(int)r.u32();
+		const int rE=(int)r.u32();
+		sramEnabled=(r.u8()!=0);
 
 		// data in memory
-		fread(ram.bank0, sizeof(ram.bank0), 1, fp);
-		fread(ram.bank6, sizeof(ram.bank6), 1, fp);
+		r.pages(dirty::CPU_RAM, ram.bank0, sizeof(ram.bank0));
+		r.pages(dirty::SRAM, ram.bank6, sizeof(ram.bank6));
 
 #ifdef SAVE_COMPLETE_MEMORY
 		// code in memory
-		fwrite(ram.code, sizeof(ram.code), 1, fp);
+		r.bytes(ram.code, sizeof(ram.code));
 		p8 = r8;
 		pA = rA;
 		pC = rC;
@@ -110,6 +135,7 @@ namespace mmc
 		// restore code
 		bankSwitch(r8, rA, rC, rE);
 #endif
+		return r.ok();
 	}
 
 	opcode_t fetchOpcode(maddr_t& pc)
@@ -183,14 +209,11 @@ namespace mmc
 		case 2: //[$4000,$6000)
 			switch (valueOf(addr))
 			{
-			case 0x4015: // APU Register
-				return 0;
+			case 0x4015: // APU Status
+				return apu::readStatus();
 			case 0x4016: // Input Registers
 			case 0x4017:
-				if (ui::hasInput((addr==0x4017)?1:0))
-					return ui::readInput((addr==0x4017)?1:0); // outputs button state
-				else
-					return 0; // joystick not connected
+				return input::read((addr==0x4017)?1:0); // outputs button state
 			}
 			break;
 		case 3:
@@ -211,12 +234,14 @@ namespace mmc
 		{
 			case 0: //[$0000,$2000) Internal RAM
 				ram.bank0[addr&0x7FF]=value;
+				dirty::mark(dirty::CPU_RAM, addr&0x7FF);
 				return;
 			case 1: //[$2000,$4000) PPU Registers
 				if (ppu::writePort(addr, value)) return;
 				break;
 			case 3: //[$6000,$8000) SRAM
 				ram.bank6[addr&0x1FFF]=value;
+				dirty::mark(dirty::SRAM, addr&0x1FFF);
 				return;
 			case 4: //[$8000,$A000)
 			case 5: //[$A000,$C000)
@@ -233,18 +258,15 @@ namespace mmc
 					ERROR_UNLESS(value<0x8, INVALID_MEMORY_ACCESS, MEMORY_CANT_BE_COPIED, "page", value);
 					ppu::dma(ramPg(value));
 					return;
-				// Input Registers 
+				// Input Strobe ($4017 writes go to the APU)
 				case 0x4016:
-				case 0x4017:
-					if (!(value&1))
-					{
-						ui::resetInput();
-					}
+					input::strobe((value&1)!=0);
 					return;
 				}
 				if (addr>=0x4000 && addr<=0x4017)
 				{
 					// APU Registers
+					apu::write(valueOf(addr), value);
 					return;
 				}
 				break;
@@ -290,34 +312,75 @@ namespace mapper
 		mmc3IRQ=false;
 	}
 
-	void load(FILE* fp)
+	// registers that may hold INVALID are stored as 16-bit values
+	static void saveReg(state::Writer& w, const ioreg_t reg)
 	{
-		fread(&mmc1Sel, sizeof(mmc1Sel), 1, fp);
-		fread(&mmc1Pos, sizeof(mmc1Pos), 1, fp);
-		fread(&mmc1Tmp, sizeof(mmc1Tmp), 1, fp);
-		fread(&mmc1Regs, sizeof(mmc1Regs), 1, fp);
+		w.u16(reg==(ioreg_t)INVALID?0xFFFF:(reg&0xFF));
+	}
+
+	static ioreg_t loadReg(state::Reader& r)
+	{
+		const uint32_t v=r.u16();
+		return (v==0xFFFF)?(ioreg_t)INVALID:(ioreg_t)v;
+	}
+
+	void save(state::Writer& w)
+	{
+		w.beginChunk(state::CHUNK_MAPPER);
+
+		// MMC1
+		saveReg(w, mmc1Sel);
+		w.u8(mmc1Pos);
+		w.u8(mmc1Tmp);
+		for (int i=0; i<4; i++)
+		{
+			w.u8(valueOf(mmc1Regs[i]));
+		}
+
+		// MMC3
+		saveReg(w, mmc3Control);
+		w.u8(mmc3Cmd);
+		w.u8(mmc3Data);
+		w.u8(mmc3Counter);
+		saveReg(w, mmc3Latch);
+		w.u8(mmc3IRQ);
 
-		fread(&mmc3Control, sizeof(mmc3Control), 1, fp);
-		fread(&mmc3Cmd, sizeof(mmc3Cmd), 1, fp);
-		fread(&mmc3Data, sizeof(mmc3Data), 1, fp);
-		fread(&mmc3Counter, sizeof(mmc3Counter), 1, fp);
-		fread(&mmc3Latch, sizeof(mmc3Latch), 1, fp);
-		fread(&mmc3IRQ, sizeof(mmc3IRQ), 1, fp);
+		// mirroring can be changed by mappers
+		w.u8((uint32_t)rom::mirrorMode());
+
+		w.endChunk();
 	}
 
-	void save(FILE* fp)
+	bool load(const state::Reader& image)
 	{
-		fwrite(&mmc1Sel, sizeof(mmc1Sel), 1, fp);
-		fwrite(&mmc1Pos, sizeof(mmc1Pos), 1, fp);
-		fwrite(&mmc1Tmp, sizeof(mmc1Tmp), 1, fp);
-		fwrite(&mmc1Regs, sizeof(mmc1Regs), 1, fp);
+		state::Reader r;
+		if (!image.findChunk(state::CHUNK_MAPPER, r)) return false;
 
-		fwrite(&mmc3Control, sizeof(mmc3Control), 1, fp);
-		fwrite(&mmc3Cmd, sizeof(mmc3Cmd), 1, fp);
-		fwrite(&mmc3Data, sizeof(mmc3Data), 1, fp);
-		fwrite(&mmc3Counter, sizeof(mmc3Counter), 1, fp);
-		fwrite(&mmc3Latch, sizeof(mmc3Latch), 1, fp);
-		fwrite(&mmc3IRQ, sizeof(mmc3IRQ), 1, fp);
+		// MMC1
+		mmc1Sel=loadReg(r);
+		mmc1Pos=r.u8();
+		mmc1Tmp=r.u8();
+		for (int i=0; i<4; i++)
+		{
+			mmc1Regs[i].asBitField()=r.u8()&(ioreg_t)MMC1REG::MASK;
+		}
+
+		// MMC3
+		mmc3Control=loadReg(r);
+		mmc3Cmd=r.u8();
+		mmc3Data=r.u8();
+		mmc3Counter=r.u8();
+		mmc3Latch=loadReg(r);
+		mmc3IRQ=(r.u8()!=0);
+
+		// mirroring
+		const uint32_t mirroring=r.u8();
+		if (mirroring<=(uint32_t)MIRRORING::MAX)
+		{
+			rom::setMirrorMode((MIRRORING)mirroring);
+		}
+
+		return r.ok();
 	}
 
 	bool setup()
@@ -411,6 +474,7 @@ invalidROMSize:
 
 	void HBlank()
 	{
+		PERF_SCOPE(MAPPER_HBLANK);
 		switch (rom::mapperType())
 		{
 			case 4: // MMC3:
@@ -607,8 +671,9 @@ invalidROMSize:
 		case 0xC001: // IRQ Latch Register
 			mmc3Latch=value;
 			return true;
-		case 0xE000: // IRQ Control Register 0
+		case 0xE000: // IRQ Control Register 0, also acknowledges a pending request
 			mmc3IRQ=false;
+			cpu::lowerIrq(IRQSOURCE::MAPPER);
 			mmc3Counter=mmc3Latch;
 			return true;
 		case 0xE001: // IRQ Control Register 1
@@ -627,10 +692,7 @@ invalidROMSize:
 			if (mmc3IRQ && render::enabled())
 			{
 				mmc3Counter=(mmc3Counter-1)&0xFF;
-				if (!mmc3Counter)
-				{
-					cpu::irq(IRQTYPE::IRQ);
-				}
+				if (!mmc3Counter) cpu::raiseIrq(IRQSOURCE::MAPPER);
 			}
 		}
 	}
@@ -65,6 +65,8 @@ namespace mmc
 	void reset();
 
 	void bankSwitch(int reg8, int regA, int regC, int regE);
+	// 8K PRG bank selected at an address in [$8000,$FFFF], INVALID below
+	int prgBank(const maddr_t addr);
 
 	extern __forceinline opcode_t fetchOpcode(maddr_t& pc);
 	extern __forceinline maddr8_t fetchByteOperand(maddr_t& pc);
@@ -76,8 +78,8 @@ namespace mmc
 	void write(const maddr_t addr, const byte_t value);
 
 	// save state
-	void save(FILE *fp);
-	void load(FILE *fp);
+	void save(state::Writer& w);
+	bool load(const state::Reader& image);
 }
 
 namespace mapper
@@ -98,8 +100,8 @@ namespace mapper
 	byte_t maskPRG(byte_t bank, const byte_t count);
 
 	// save state
-	void save(FILE *fp);
-	void load(FILE *fp);
+	void save(state::Writer& w);
+	bool load(const state::Reader& image);
 }
 
 enum class MMC1REG
@@ -0,0 +1,393 @@
+#include "../stdafx.h"
+
+// local header files
+#include "../macros.h"
+#include "../types/types.h"
+#include "../types/endian.h"
+#include "../unittest/framework.h"
+
+#include "internals.h"
+#include "debug.h"
+#include "dirty.h"
+#include "state.h"
+#include "rom.h"
+#include "ppu.h"
+#include "emu.h"
+#include "input.h"
+#include "pacer.h"
+#include "hash.h"
+#include "movie.h"
+
+#include <vector>
+
+namespace movie
+{
+	static const char SIGNATURE[8]={'N','E','S','M','O','V','I','E'};
+	static const size_t HEADER_SIZE=32;
+
+	enum
+	{
+		HEAD_VARINT=0x7F,
+		HEAD_REPEAT=0x80
+	};
+
+	struct FRAME
+	{
+		uint32_t first; // index of the first sample
+		uint32_t count;
+		uint64_t hash; // hashed frames only
+	};
+
+	struct MOVIE
+	{
+		int interval;
+		uint32_t crc;
+		std::vector<FRAME> frames;
+		std::vector<uint8_t> samples;
+	};
+
+	static bool hashed(const size_t frame, const int interval)
+	{
+		return (frame+1)%interval==0;
+	}
+
+	static bool sameSamples(const MOVIE& m, const FRAME& a, const FRAME& b)
+	{
+		return a.count==b.count && memcmp(&m.samples[a.first], &m.samples[b.first], a.count)==0;
+	}
+
+	static void encode(const MOVIE& m, std::vector<uint8_t>& out)
+	{
+		uint8_t header[HEADER_SIZE]={0}; // reserved bytes stay zero
+		memcpy(header, SIGNATURE, sizeof(SIGNATURE));
+		endian::store32(header+8, VERSION);
+		endian::store32(header+12, m.interval);
+		endian::store32(header+16, m.crc);
+		endian::store32(header+20, (uint32_t)m.frames.size());
+		out.assign(header, header+sizeof(header));
+		for (size_t i=0; i<m.frames.size(); i++)
+		{
+			const FRAME& f=m.frames[i];
+			if (i>0 && f.count>0 && sameSamples(m, f, m.frames[i-1]))
+			{
+				out.push_back(HEAD_REPEAT);
+			}else
+			{
+				if (f.count<HEAD_VARINT)
+					out.push_back((uint8_t)f.count);
+				else
+				{
+					out.push_back(HEAD_VARINT);
+					for (uint32_t n=f.count; ; n>>=7)
+					{
+						out.push_back((uint8_t)((n&0x7F)|(n>=0x80?0x80:0)));
+						if (n<0x80) break;
+					}
+				}
+				out.insert(out.end(), m.samples.begin()+f.first, m.samples.begin()+f.first+f.count);
+			}
+			if (hashed(i, m.interval))
+			{
+				uint8_t hash[8];
+				endian::store64(hash, f.hash);
+				out.insert(out.end(), hash, hash+sizeof(hash));
+			}
+		}
+	}
+
+	static bool decode(const uint8_t* data, const size_t size, MOVIE& m)
+	{
+		if (size<HEADER_SIZE || memcmp(data, SIGNATURE, sizeof(SIGNATURE))!=0) return false;
+		if (endian::load32(data+8)!=VERSION) return false;
+		m.interval=(int)endian::load32(data+12);
+		m.crc=endian::load32(data+16);
+		const uint32_t count=endian::load32(data+20);
+		if (m.interval<=0) return false;
+
+		m.frames.clear();
+		m.samples.clear();
+		size_t pos=HEADER_SIZE;
+		for (uint32_t i=0; i<count; i++)
+		{
+			if (pos>=size) return false;
+			const uint8_t head=data[pos++];
+			FRAME f;
+			f.first=(uint32_t)m.samples.size();
+			f.hash=0;
+			if (head==HEAD_REPEAT)
+			{
+				if (i==0) return false;
+				const FRAME& previous=m.frames.back();
+				f.count=previous.count;
+				for (uint32_t k=0; k<f.count; k++) m.samples.push_back(m.samples[previous.first+k]);
+			}else
+			{
+				if (head>HEAD_REPEAT) return false;
+				f.count=head;
+				if (head==HEAD_VARINT)
+				{
+					f.count=0;
+					for (int shift=0; ; shift+=7)
+					{
+						if (pos>=size || shift>28) return false;
+						const uint8_t b=data[pos++];
+						f.count|=(uint32_t)(b&0x7F)<<shift;
+						if (!(b&0x80)) break;
+					}
+				}
+				if (size-pos<f.count) return false;
+				m.samples.insert(m.samples.end(), data+pos, data+pos+f.count);
+				pos+=f.count;
+			}
+			if (hashed(i, m.interval))
+			{
+				if (size-pos<8) return false;
+				f.hash=endian::load64(data+pos);
+				pos+=8;
+			}
+			m.frames.push_back(f);
+		}
+		return pos==size;
+	}
+
+	uint64_t hashMachine()
+	{
+		static uint8_t image[state::MAX_SIZE];
+		const size_t size=emu::saveState(image, sizeof(image));
+		uint64_t h=hash::fnv1a64(image, size);
+		if (ppu::pictureCurrent())
+			h=hash::fnv1a64(ppu::frameBuffer(), ppu::frameWidth()*ppu::frameHeight()*sizeof(rgb32_t), h);
+		return h;
+	}
+
+	// recording
+	class Recorder : public input::Provider
+	{
+	public:
+		input::Provider* source;
+		std::vector<uint8_t> pending; // samples of the running frame
+
+		virtual int sample(const int player)
+		{
+			const int buttons=source->sample(player);
+			vassert(buttons>=0 && buttons<0x100);
+			pending.push_back((uint8_t)buttons);
+			return buttons;
+		}
+	};
+
+	static Recorder recorder;
+	static bool active=false;
+	static long long startFrame;
+	static MOVIE recorded;
+
+	void startRecording(const int hashInterval)
+	{
+		assert(hashInterval>0);
+		recorded.interval=hashInterval;
+		recorded.crc=rom::crc32();
+		recorded.frames.clear();
+		recorded.samples.clear();
+		recorder.pending.clear();
+		recorder.source=input::provider();
+		input::setProvider(&recorder);
+		startFrame=emu::frameCount();
+		active=true;
+	}
+
+	bool recording()
+	{
+		return active;
+	}
+
+	void endFrame()
+	{
+		if (!active) return;
+		const long long done=emu::frameCount()-startFrame;
+		if (done<=0)
+		{
+			// rewound past the start
+			recorder.pending.clear();
+			return;
+		}
+		if (done<=(long long)recorded.frames.size())
+		{
+			// a rewind, the frames after it are replaced
+			recorded.frames.resize((size_t)(done-1));
+			recorded.samples.resize(recorded.frames.empty()?0:recorded.frames.back().first+recorded.frames.back().count);
+		}
+		vassert(done==(long long)recorded.frames.size()+1);
+
+		FRAME f;
+		f.first=(uint32_t)recorded.samples.size();
+		f.count=(uint32_t)recorder.pending.size();
+		f.hash=hashed(recorded.frames.size(), recorded.interval)?hashMachine():0;
+		recorded.samples.insert(recorded.samples.end(), recorder.pending.begin(), recorder.pending.end());
+		recorder.pending.clear();
+		recorded.frames.push_back(f);
+	}
+
+	bool wantsPicture()
+	{
+		return active && hashed((size_t)(emu::frameCount()-startFrame), recorded.interval);
+	}
+
+	bool stopRecording(const _TCHAR* file)
+	{
+		if (!active) return false;
+		active=false;
+		input::setProvider(recorder.source);
+
+		std::vector<uint8_t> data;
+		encode(recorded, data);
+		FILE* fp=nullptr;
+		_tfopen_s(&fp, file, _T("wb"));
+		if (fp==nullptr) return false;
+		const bool ok=fwrite(&data[0], data.size(), 1, fp)==1;
+		fclose(fp);
+		return ok;
+	}
+
+	// playback
+	class Player : public input::Provider
+	{
+	public:
+		Player(const MOVIE& m): _movie(m), _next(0), _end(0), _overrun(false) {}
+
+		void beginFrame(const FRAME& f)
+		{
+			_next=f.first;
+			_end=f.first+f.count;
+			_overrun=false;
+		}
+
+		// the game latched as often as when recording
+		bool endFrame() const
+		{
+			return !_overrun && _next==_end;
+		}
+
+		virtual int sample(const int player)
+		{
+			if (_next<_end) return _movie.samples[_next++];
+			_overrun=true;
+			return 0;
+		}
+
+	private:
+		const MOVIE& _movie;
+		uint32_t _next, _end;
+		bool _overrun;
+
+		Player& operator=(const Player&);
+	};
+
+	bool play(const _TCHAR* file, RESULT& result, const long long frames)
+	{
+		std::vector<uint8_t> data;
+		FILE* fp=nullptr;
+		_tfopen_s(&fp, file, _T("rb"));
+		if (fp==nullptr) return false;
+		uint8_t block[0x4000];
+		for (size_t n; (n=fread(block, 1, sizeof(block), fp))>0; )
+			data.insert(data.end(), block, block+n);
+		fclose(fp);
+
+		MOVIE m;
+		if (data.empty() || !decode(&data[0], data.size(), m) || m.crc!=rom::crc32()) return false;
+
+		result.frames=0;
+		result.hashes=0;
+		result.divergence=-1;
+		result.inputDiverged=false;
+
+		Player player(m);
+		input::Provider* previous=input::provider();
+		input::setProvider(&player);
+		const size_t count=(frames>0 && frames<(long long)m.frames.size())?(size_t)frames:m.frames.size();
+		const long long start=pacer::now();
+		for (size_t i=0; i<count; i++)
+		{
+			const bool hashedFrame=hashed(i, m.interval);
+			ppu::enableOutput(hashedFrame || i+1==count);
+			player.beginFrame(m.frames[i]);
+			const bool ok=emu::nextFrame();
+			if (ok) result.frames++;
+			if (!ok || !player.endFrame())
+			{
+				result.divergence=(long long)i;
+				result.inputDiverged=true;
+				break;
+			}
+			if (hashedFrame)
+			{
+				result.hashes++;
+				if (hashMachine()!=m.frames[i].hash)
+				{
+					result.divergence=(long long)i;
+					break;
+				}
+			}
+		}
+		const long long elapsed=pacer::now()-start;
+		result.fps=(elapsed>0)?result.frames*1e9/elapsed:0;
+		ppu::enableOutput(true);
+		input::setProvider(previous);
+		return true;
+	}
+}
+
+// unit tests
+class MovieTest : public TestCase
+{
+public:
+	virtual const char* name()
+	{
+		return "Movie Format Test";
+	}
+
+	virtual bool parallel()
+	{
+		return true;
+	}
+
+	virtual TestResult run()
+	{
+		// five frames: two latches, the same again, none, 200 samples, one
+		movie::MOVIE m;
+		m.interval=2;
+		m.crc=0x12345678;
+		const uint32_t counts[5]={4, 4, 0, 200, 2};
+		for (int i=0; i<5; i++)
+		{
+			movie::FRAME f={(uint32_t)m.samples.size(), counts[i], (i%2==1)?0x0102030405060708ULL*i:0};
+			for (uint32_t k=0; k<counts[i]; k++) m.samples.push_back((uint8_t)((i==1)?k+1:k*i+1));
+			m.frames.push_back(f);
+		}
+		// frame 1 repeats frame 0
+		for (uint32_t k=0; k<4; k++) m.samples[m.frames[1].first+k]=m.samples[k];
+
+		std::vector<uint8_t> data;
+		movie::encode(m, data);
+		// header, 1+4, repeat, 8, 0, 1+2+200, 8, 1+2
+		tassert(data.size()==32+5+1+8+1+203+8+3);
+		tassert(data[32+5]==0x80 && data[32+5+1+8+1]==0x7F);
+
+		movie::MOVIE decoded;
+		tassert(movie::decode(&data[0], data.size(), decoded));
+		tassert(decoded.interval==2 && decoded.crc==0x12345678 && decoded.frames.size()==5);
+		tassert(decoded.samples==m.samples);
+		for (int i=0; i<5; i++)
+		{
+			tassert(decoded.frames[i].count==m.frames[i].count && decoded.frames[i].hash==m.frames[i].hash);
+		}
+
+		// truncated or extended files are rejected
+		tassert(!movie::decode(&data[0], data.size()-1, decoded));
+		data.push_back(0);
+		tassert(!movie::decode(&data[0], data.size(), decoded));
+		return SUCCESS;
+	}
+};
+
+registerTestCase(MovieTest);
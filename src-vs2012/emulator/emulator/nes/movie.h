@@ -0,0 +1,55 @@
+// input movies
+//
+// A movie holds what the joypads returned at every latch of every frame
+// since power-on, and a hash of the machine every few frames. Played back
+// from power-on, the same rom must latch the same way and reach the same
+// hashes; the first frame where it doesn't is where the emulator diverged.
+//
+// The hash is 64-bit FNV-1a over the saved state, followed by the picture
+// when the frame drew one (see ppu::pictureCurrent()).
+//
+// File, all fields little-endian:
+//   header  "NESMOVIE", version, hash interval, rom crc32, frames,
+//           reserved                                              (32 bytes)
+//   frames  a head byte per frame:
+//             0x00-0x7E  that many samples follow, one byte each
+//             0x7F       a varint count follows, then the samples
+//             0x80       the same samples as the frame before
+//           then the 8-byte hash after every interval-th frame
+// A sample is the buttons of one player at one latch, in the order the
+// game asked for them.
+
+namespace movie
+{
+	const int VERSION=1;
+	const int DEFAULT_HASH_INTERVAL=60;
+
+	// records the current input provider from now on, which must be power-on
+	void startRecording(const int hashInterval=DEFAULT_HASH_INTERVAL);
+	bool recording();
+	// writes the movie, and restores the input provider
+	bool stopRecording(const _TCHAR* file);
+
+	// after every frame of emu::run(). A frame emulated again after a rewind
+	// replaces the recording from there on.
+	void endFrame();
+	// the next frame will be hashed, so its picture must be drawn
+	bool wantsPicture();
+
+	struct RESULT
+	{
+		long long frames; // played
+		long long hashes; // compared
+		long long divergence; // first frame that differs, -1 if none
+		bool inputDiverged; // the game latched differently, otherwise a hash differs
+		double fps;
+	};
+
+	// plays a movie on the loaded rom from power-on, uncapped and without
+	// drawing the frames that aren't hashed, except the last one. stops after
+	// the given number of frames if there are more. false if the movie can't
+	// be read or was recorded with another rom.
+	bool play(const _TCHAR* file, RESULT& result, const long long frames=0);
+
+	uint64_t hashMachine();
+}
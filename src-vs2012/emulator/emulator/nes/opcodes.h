@@ -22,77 +22,24 @@ enum M6502_ADDRMODE : uint8_t
 	_ADR_INVALID=255
 };
 
-/* 6502 instruction set */
+/* 6502 instruction set, INS(name) for each in the order of M6502_INST */
+#define M6502_INSTRUCTIONS(INS) \
+	INS(ADC) INS(AND) INS(ASL) INS(ASLA) INS(BCC) INS(BCS) INS(BEQ) INS(BIT) \
+	INS(BMI) INS(BNE) INS(BPL) INS(BRK) INS(BVC) INS(BVS) INS(CLC) INS(CLD) \
+	INS(CLI) INS(CLV) INS(CMP) INS(CPX) INS(CPY) INS(DEC) INS(DEA) INS(DEX) \
+	INS(DEY) INS(EOR) INS(INC) INS(INX) INS(INY) INS(JMP) INS(JSR) INS(LDA) \
+	INS(LDX) INS(LDY) INS(LSR) INS(LSRA) INS(NOP) INS(ORA) INS(PHA) INS(PHP) \
+	INS(PLA) INS(PLP) INS(ROL) INS(ROLA) INS(ROR) INS(RORA) INS(RTI) INS(RTS) \
+	INS(SBC) INS(SEC) INS(SED) INS(SEI) INS(STA) INS(STX) INS(STY) INS(TAX) \
+	INS(TAY) INS(TSX) INS(TXA) INS(TXS) INS(TYA) INS(BRA) INS(INA) INS(PHX) \
+	INS(PLX) INS(PHY) INS(PLY)
+
 enum M6502_INST : uint8_t
 {
-    INS_ADC=0,
-    INS_AND,
-    INS_ASL,
-    INS_ASLA,
-    INS_BCC,
-    INS_BCS,
-    INS_BEQ,
-    INS_BIT,
-    INS_BMI,
-    INS_BNE,
-    INS_BPL,
-    INS_BRK,
-    INS_BVC,
-    INS_BVS,
-    INS_CLC,
-    INS_CLD,
-    INS_CLI,
-    INS_CLV,
-    INS_CMP,
-    INS_CPX,
-    INS_CPY,
-    INS_DEC,
-    INS_DEA,
-    INS_DEX,
-    INS_DEY,
-    INS_EOR,
-    INS_INC,
-    INS_INX,
-    INS_INY,
-    INS_JMP,
-    INS_JSR,
-    INS_LDA,
-    INS_LDX,
-    INS_LDY,
-    INS_LSR,
-    INS_LSRA,
-    INS_NOP,
-    INS_ORA,
-    INS_PHA,
-    INS_PHP,
-    INS_PLA,
-    INS_PLP,
-    INS_ROL,
-    INS_ROLA,
-    INS_ROR,
-    INS_RORA,
-    INS_RTI,
-    INS_RTS,
-    INS_SBC,
-    INS_SEC,
-    INS_SED,
-    INS_SEI,
-    INS_STA,
-    INS_STX,
-    INS_STY,
-    INS_TAX,
-    INS_TAY,
-    INS_TSX,
-    INS_TXA,
-    INS_TXS,
-    INS_TYA,
-    INS_BRA,
-    INS_INA,
-    INS_PHX,
-    INS_PLX,
-    INS_PHY,
-    INS_PLY,
-    _INS_MAX,
+#define M6502_INST_ENUM(name) INS_##name,
+	M6502_INSTRUCTIONS(M6502_INST_ENUM)
+#undef M6502_INST_ENUM
+	_INS_MAX,
 	_INS_INVALID=255
 };
 
@@ -105,14 +52,24 @@ struct M6502_OPCODE
     uint8_t size;
 };
 
-// global functions
+// global functions, on a table built at compile time
 namespace opcode
 {
-	void initTable();
+	// defined in opcodes.cpp, exposed so the cpu decodes without a call
+	extern const M6502_OPCODE opdata[256];
+	extern const bool usualOp[256];
+
+	inline M6502_OPCODE decode(const opcode_t opcode)
+	{
+		return opdata[opcode];
+	}
+
+	inline bool usual(const opcode_t opcode)
+	{
+		return usualOp[opcode];
+	}
 
-	extern __forceinline M6502_OPCODE decode(const opcode_t opcode);
 	extern __forceinline const char* instName(const M6502_INST inst);
 	extern __forceinline const char* instName(const opcode_t opcode);
 	extern __forceinline const char* explainAddrMode(const M6502_ADDRMODE adrmode);
-	extern __forceinline bool usual(const opcode_t opcode);
 }
\ No newline at end of file
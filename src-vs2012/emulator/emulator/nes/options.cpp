@@ -0,0 +1,84 @@
+#include "../stdafx.h"
+
+// local header files
+#include "../macros.h"
+#include "../types/types.h"
+#include "../unittest/framework.h"
+
+#include "internals.h"
+#include "options.h"
+
+namespace options
+{
+	int selected=DEFAULT;
+
+	static const OPTION ALL[]={STATISTICS, RUN_HIT, WATCH_STACK, WATCH_CPU, WATCH_RENDERING, LIMIT_SPRITES, CLIP_LEFT, ALL_LINES, PROFILE};
+
+	const _TCHAR* name(const OPTION option)
+	{
+		switch (option)
+		{
+		case STATISTICS: return _T("statistics");
+		case RUN_HIT: return _T("run-hit");
+		case WATCH_STACK: return _T("watch-stack");
+		case WATCH_CPU: return _T("watch-cpu");
+		case WATCH_RENDERING: return _T("watch-rendering");
+		case LIMIT_SPRITES: return _T("limit-sprites");
+		case CLIP_LEFT: return _T("clip-left");
+		case ALL_LINES: return _T("all-lines");
+		case PROFILE: return _T("profile");
+		default: return nullptr;
+		}
+	}
+
+	int parse(const _TCHAR* list)
+	{
+		int result=0;
+		while (*list)
+		{
+			const _TCHAR* end=_tcschr(list, _T(','));
+			const size_t length=end?(size_t)(end-list):_tcslen(list);
+			int option=-1;
+			for (size_t i=0; i<_countof(ALL); i++)
+			{
+				if (_tcslen(name(ALL[i]))==length && _tcsncmp(name(ALL[i]), list, length)==0)
+				{
+					option=ALL[i];
+					break;
+				}
+			}
+			if (option<0) return -1;
+			result|=option;
+			list+=length;
+			if (*list==_T(',')) list++;
+		}
+		return result;
+	}
+}
+
+// unit tests
+class OptionsTest : public TestCase
+{
+public:
+	virtual const char* name()
+	{
+		return "Run-time Options Test";
+	}
+
+	virtual bool parallel()
+	{
+		return true;
+	}
+
+	virtual TestResult run()
+	{
+		tassert(options::parse(_T(""))==0);
+		tassert(options::parse(_T("statistics"))==options::STATISTICS);
+		tassert(options::parse(_T("limit-sprites,clip-left,all-lines"))==(options::LIMIT_SPRITES|options::CLIP_LEFT|options::ALL_LINES));
+		tassert(options::parse(_T("statistics,sprite"))==-1);
+		tassert(options::parse(_T("watch-cpu,"))==options::WATCH_CPU);
+		return SUCCESS;
+	}
+};
+
+registerTestCase(OptionsTest);
@@ -0,0 +1,68 @@
+// run-time options
+//
+// These used to be build flags, each combination needing its own binary. The
+// build flags listed below still select them by default.
+//
+// The CPU run loop and the scanline renderer are instantiated twice: without
+// any of these checks, and with a test of the selected options at each one.
+// emu::setOptions() picks the instantiation once, so with no option selected
+// the emulation runs the same code as a build without the flags.
+
+namespace options
+{
+	enum OPTION
+	{
+		STATISTICS=0x1, // instruction and cycle counters, cpu::dump()
+		RUN_HIT=0x2, // executed PRG addresses, cpu::dump() writes RUNHIT.log
+		WATCH_STACK=0x4, // prints every push
+		WATCH_CPU=0x8, // an instruction record for the trace, see trace.h
+		WATCH_RENDERING=0x10, // a scanline record for the trace, sprite counts
+		LIMIT_SPRITES=0x20, // at most 8 sprites on a scanline
+		CLIP_LEFT=0x40, // hides the left 8 pixels, no sprite 0 hit there
+		ALL_LINES=0x80, // shows the 8 top and bottom lines too
+		PROFILE=0x100, // cycles per bank, address and call stack, see profiler.h
+
+		// options tested in the checked loops
+		CPU_CHECKS=STATISTICS|RUN_HIT|WATCH_STACK|WATCH_CPU|PROFILE,
+		RENDER_CHECKS=WATCH_RENDERING|LIMIT_SPRITES|CLIP_LEFT
+	};
+
+	const int DEFAULT=0
+#ifdef WANT_STATISTICS
+		|STATISTICS
+#endif
+#ifdef WANT_RUN_HIT
+		|RUN_HIT
+#endif
+#ifdef MONITOR_STACK
+		|WATCH_STACK
+#endif
+#if defined(WANT_DISASSEMBLY) || defined(MONITOR_CPU)
+		|WATCH_CPU
+#endif
+#ifdef MONITOR_RENDERING
+		|WATCH_RENDERING
+#endif
+#ifdef SPRITE_LIMIT
+		|LIMIT_SPRITES
+#endif
+#ifdef LEFT_CLIP
+		|CLIP_LEFT
+#endif
+#ifdef SHOW_240_LINES
+		|ALL_LINES
+#endif
+		;
+
+	// set by emu::setOptions()
+	extern int selected;
+
+	inline bool enabled(const OPTION option)
+	{
+		return (selected&option)!=0;
+	}
+
+	// comma-separated names as in "statistics,limit-sprites", -1 for an unknown name
+	int parse(const _TCHAR* list);
+	const _TCHAR* name(const OPTION option);
+}
@@ -0,0 +1,232 @@
+#include "../stdafx.h"
+
+// local header files
+#include "../macros.h"
+#include "../types/types.h"
+#include "../unittest/framework.h"
+
+#include "internals.h"
+#include "debug.h"
+#include "pacer.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <time.h>
+#endif
+
+namespace pacer
+{
+	// sleeps end late by up to this much, the remainder is spun.
+	// Sleep() needs timeBeginPeriod(1) to get this close.
+#ifdef _WIN32
+	static const long long SPIN_MARGIN=2000000;
+#else
+	static const long long SPIN_MARGIN=500000;
+#endif
+
+	static bool active=false;
+	static double periodNs;
+	static long long origin; // start of the schedule
+	static long long frame; // frames released since origin
+	static long long lastWake;
+
+	static unsigned frameTimes[BUCKET_COUNT];
+	static unsigned jitters[BUCKET_COUNT];
+	static long long frames;
+	static long long resyncs;
+	static long long minTime, maxTime, maxJitter;
+
+	long long now()
+	{
+#ifdef _WIN32
+		static LARGE_INTEGER frequency;
+		LARGE_INTEGER counter;
+		if (frequency.QuadPart==0) QueryPerformanceFrequency(&frequency);
+		QueryPerformanceCounter(&counter);
+		return (long long)(counter.QuadPart/frequency.QuadPart*1000000000+counter.QuadPart%frequency.QuadPart*1000000000/frequency.QuadPart);
+#else
+		timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (long long)ts.tv_sec*1000000000+ts.tv_nsec;
+#endif
+	}
+
+	static void sleepUntil(const long long deadline)
+	{
+		const long long wake=deadline-SPIN_MARGIN;
+#ifdef _WIN32
+		for (long long t=now(); t<wake; t=now())
+		{
+			Sleep((DWORD)max((wake-t)/1000000, 1LL));
+		}
+#else
+		if (now()<wake)
+		{
+			timespec ts;
+			ts.tv_sec=(time_t)(wake/1000000000);
+			ts.tv_nsec=(long)(wake%1000000000);
+			while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL)==EINTR);
+		}
+#endif
+		while (now()<deadline)
+		{
+			_mm_pause();
+		}
+	}
+
+	static unsigned bucketOf(const long long ns)
+	{
+		return (unsigned)min(ns/BUCKET_WIDTH, (long long)BUCKET_COUNT-1);
+	}
+
+	static void record(const long long frameTime)
+	{
+		const long long error=frameTime-(long long)periodNs;
+		const long long jitter=(error<0)?-error:error;
+		frameTimes[bucketOf(frameTime)]++;
+		jitters[bucketOf(jitter)]++;
+		if (frames==0 || frameTime<minTime) minTime=frameTime;
+		maxTime=max(maxTime, frameTime);
+		maxJitter=max(maxJitter, jitter);
+		frames++;
+	}
+
+	void start(const double rate)
+	{
+		assert(rate>0);
+		periodNs=1e9/rate;
+		origin=now();
+		frame=0;
+		lastWake=origin;
+		active=true;
+	}
+
+	void stop()
+	{
+		active=false;
+	}
+
+	bool running()
+	{
+		return active;
+	}
+
+	void wait()
+	{
+		if (!active) return;
+
+		frame++;
+		const long long deadline=origin+(long long)(frame*periodNs);
+		if (now()-deadline>MAX_LAG*periodNs)
+		{
+			// hopelessly behind, e.g. after a breakpoint or a window drag
+			origin=now();
+			frame=0;
+			resyncs++;
+		}else
+		{
+			sleepUntil(deadline);
+		}
+
+		const long long t=now();
+		record(t-lastWake);
+		lastWake=t;
+	}
+
+	// upper end of the bucket holding the given fraction of the samples, in us
+	static double percentile(const unsigned histogram[], const double fraction)
+	{
+		const long long target=max((long long)(fraction*frames+0.5), 1LL);
+		long long count=0;
+		for (int i=0; i<BUCKET_COUNT; i++)
+		{
+			count+=histogram[i];
+			if (count>=target) return (i+1)*(BUCKET_WIDTH/1000.0);
+		}
+		return 0;
+	}
+
+	void statistics(STATISTICS& s)
+	{
+		s.frames=frames;
+		s.resyncs=resyncs;
+		s.period=active?periodNs/1000:0;
+		s.min=minTime/1000.0;
+		s.p50=percentile(frameTimes, 0.5);
+		s.p99=percentile(frameTimes, 0.99);
+		s.max=maxTime/1000.0;
+		s.jitterP50=percentile(jitters, 0.5);
+		s.jitterP99=percentile(jitters, 0.99);
+		s.jitterMax=maxJitter/1000.0;
+	}
+
+	void clearStatistics()
+	{
+		memset(frameTimes, 0, sizeof(frameTimes));
+		memset(jitters, 0, sizeof(jitters));
+		frames=0;
+		resyncs=0;
+		minTime=0;
+		maxTime=0;
+		maxJitter=0;
+	}
+
+	bool exportStatistics(FILE* fp)
+	{
+		STATISTICS s;
+		statistics(s);
+		fprintf(fp, "frames,%lld\n", s.frames);
+		fprintf(fp, "resyncs,%lld\n", s.resyncs);
+		fprintf(fp, "period_us,%.1f\n", s.period);
+		fprintf(fp, "min_us,%.1f\np50_us,%.1f\np99_us,%.1f\nmax_us,%.1f\n", s.min, s.p50, s.p99, s.max);
+		fprintf(fp, "jitter_p50_us,%.1f\njitter_p99_us,%.1f\njitter_max_us,%.1f\n", s.jitterP50, s.jitterP99, s.jitterMax);
+		fprintf(fp, "frame_time_us,frames\n");
+		for (int i=0; i<BUCKET_COUNT; i++)
+		{
+			if (frameTimes[i]) fprintf(fp, "%d,%u\n", i*BUCKET_WIDTH/1000, frameTimes[i]);
+		}
+		return !ferror(fp);
+	}
+}
+
+// unit tests
+class PacerTest : public TestCase
+{
+public:
+	virtual const char* name()
+	{
+		return "Frame Pacer Test";
+	}
+
+	virtual TestResult run()
+	{
+		const int FRAMES=20;
+		const double RATE=1000;
+
+		puts("checking the schedule...");
+		pacer::clearStatistics();
+		const long long begin=pacer::now();
+		pacer::start(RATE);
+		for (int i=0; i<FRAMES; i++)
+		{
+			pacer::wait();
+		}
+		const long long elapsed=pacer::now()-begin;
+
+		// frames are never released early
+		pacer::STATISTICS s;
+		pacer::statistics(s);
+		tassert(s.frames==FRAMES);
+		tassert(elapsed>=(long long)(FRAMES*1e9/RATE) || s.resyncs>0);
+		tassert(s.min<=s.p50 && s.p50<=s.p99 && s.p99<=s.max+pacer::BUCKET_WIDTH/1000.0);
+
+		pacer::stop();
+		pacer::clearStatistics();
+		return SUCCESS;
+	}
+};
+
+registerTestCase(PacerTest);
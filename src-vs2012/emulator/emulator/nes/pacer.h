@@ -0,0 +1,48 @@
+// frame pacing
+//
+// Frames are released on an absolute schedule, start + n * period, so a late
+// frame is made up by the following ones instead of shifting every frame
+// after it. Waiting sleeps until shortly before the deadline and spins the
+// rest, because sleeps overshoot by up to a scheduler tick. A frame more than
+// MAX_LAG periods behind restarts the schedule rather than racing to catch up.
+//
+// Every wait records the time since the previous one. Frame times and
+// jitter (distance from the period) are kept in histograms.
+
+namespace pacer
+{
+	// NTSC: 1789772.7 CPU cycles per second / 29780.5 cycles per frame
+	const double NTSC_FRAME_RATE=60.0988;
+
+	const int MAX_LAG=4;
+
+	// histogram buckets are 10us wide, longer frames go to the last one
+	const int BUCKET_WIDTH=10000; // ns
+	const int BUCKET_COUNT=10000;
+
+	// monotonic host clock in nanoseconds
+	long long now();
+
+	void start(const double rate=NTSC_FRAME_RATE);
+	void stop();
+	bool running();
+
+	// blocks until the next frame is due
+	void wait();
+
+	// times in microseconds
+	struct STATISTICS
+	{
+		long long frames;
+		long long resyncs; // frames that fell more than MAX_LAG periods behind
+		double period;
+		double min, p50, p99, max;
+		double jitterP50, jitterP99, jitterMax;
+	};
+
+	void statistics(STATISTICS& s);
+	void clearStatistics();
+
+	// summary followed by "<frame time us>,<frames>" for every non-empty bucket
+	bool exportStatistics(FILE* fp);
+}
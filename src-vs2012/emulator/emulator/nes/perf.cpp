@@ -0,0 +1,261 @@
+#include "../stdafx.h"
+
+// local header files
+#include "../macros.h"
+#include "../types/types.h"
+#include "../unittest/framework.h"
+
+#include "internals.h"
+#include "debug.h"
+#include "pacer.h"
+#include "perf.h"
+
+#include <vector>
+
+namespace perf
+{
+	static const char* const NAMES[_SCOPE_MAX]={
+		"frame", "cpu::run", "apu::run", "mapper::HBlank",
+		"drawBackground", "evaluateSprites", "drawSprites", "render::present",
+		"emu::saveState", "ui::doEvents", "ui::blt32", "ui::limitFPS", "ui::onFrame"
+	};
+
+	struct Event
+	{
+		SCOPE scope;
+		uint64_t begin, end;
+	};
+
+	// clock at a known tick
+	static uint64_t originTick;
+	static long long originTime;
+	static double nsPerTick;
+
+	// the current frame
+	static uint64_t frameTicks[_SCOPE_MAX];
+	static long long frameCalls[_SCOPE_MAX];
+
+	static unsigned histograms[_SCOPE_MAX][BUCKET_COUNT];
+	static long long frames[_SCOPE_MAX];
+	static long long calls[_SCOPE_MAX];
+	static double totalTime[_SCOPE_MAX]; // ns
+	static long long maxTime[_SCOPE_MAX];
+	static long long slowestFrame[_SCOPE_MAX];
+
+	// timeline
+	static FILE* traceFile=nullptr;
+	static bool firstEvent;
+	static std::vector<Event> events;
+
+	static void setOrigin()
+	{
+		originTime=pacer::now();
+		originTick=__rdtsc();
+	}
+
+	static void calibrate()
+	{
+		if (originTick==0) setOrigin();
+		const long long elapsed=pacer::now()-originTime;
+		const uint64_t ticks=__rdtsc()-originTick;
+		if (elapsed>0 && ticks>0) nsPerTick=(double)elapsed/ticks;
+	}
+
+	void record(const SCOPE scope, const uint64_t begin, const uint64_t end)
+	{
+		frameTicks[scope]+=end-begin;
+		frameCalls[scope]++;
+		if (traceFile!=nullptr)
+		{
+			const Event event={scope, begin, end};
+			events.push_back(event);
+		}
+	}
+
+	static unsigned bucketOf(const long long ns)
+	{
+		return (unsigned)min(ns/BUCKET_WIDTH, (long long)BUCKET_COUNT-1);
+	}
+
+	static void writeEvents(const long long frame)
+	{
+		for (size_t i=0; i<events.size(); i++)
+		{
+			const Event& e=events[i];
+			// events before the origin are clamped to it
+			const double ts=(e.begin>originTick)?(e.begin-originTick)*nsPerTick/1000:0;
+			const double dur=(e.end-e.begin)*nsPerTick/1000;
+			fprintf(traceFile, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f", firstEvent?"":",", NAMES[e.scope], ts, dur);
+			if (e.scope==FRAME) fprintf(traceFile, ",\"args\":{\"frame\":%lld}", frame);
+			fputc('}', traceFile);
+			firstEvent=false;
+		}
+		events.clear();
+	}
+
+	void endFrame(const long long frame)
+	{
+		calibrate();
+		for (int i=0; i<_SCOPE_MAX; i++)
+		{
+			if (frameCalls[i]==0) continue;
+			const long long ns=(long long)(frameTicks[i]*nsPerTick);
+			histograms[i][bucketOf(ns)]++;
+			frames[i]++;
+			calls[i]+=frameCalls[i];
+			totalTime[i]+=ns;
+			if (ns>=maxTime[i])
+			{
+				maxTime[i]=ns;
+				slowestFrame[i]=frame;
+			}
+			frameTicks[i]=0;
+			frameCalls[i]=0;
+		}
+		if (traceFile!=nullptr) writeEvents(frame);
+	}
+
+	// upper end of the bucket holding the given fraction of the frames, in us
+	static double percentile(const SCOPE scope, const double fraction)
+	{
+		const long long target=max((long long)(fraction*frames[scope]+0.5), 1LL);
+		long long count=0;
+		for (int i=0; i<BUCKET_COUNT; i++)
+		{
+			count+=histograms[scope][i];
+			if (count>=target) return (i+1)*(BUCKET_WIDTH/1000.0);
+		}
+		return 0;
+	}
+
+	void statistics(const SCOPE scope, STATISTICS& s)
+	{
+		s.frames=frames[scope];
+		s.calls=calls[scope];
+		s.mean=frames[scope]?totalTime[scope]/frames[scope]/1000:0;
+		s.p50=percentile(scope, 0.5);
+		s.p99=percentile(scope, 0.99);
+		s.max=maxTime[scope]/1000.0;
+		s.slowestFrame=slowestFrame[scope];
+	}
+
+	void clearStatistics()
+	{
+		memset(histograms, 0, sizeof(histograms));
+		memset(frames, 0, sizeof(frames));
+		memset(calls, 0, sizeof(calls));
+		memset(totalTime, 0, sizeof(totalTime));
+		memset(maxTime, 0, sizeof(maxTime));
+		memset(slowestFrame, 0, sizeof(slowestFrame));
+		memset(frameTicks, 0, sizeof(frameTicks));
+		memset(frameCalls, 0, sizeof(frameCalls));
+		events.clear();
+		setOrigin();
+	}
+
+	const char* name(const SCOPE scope)
+	{
+		return NAMES[scope];
+	}
+
+	bool exportStatistics(FILE* fp)
+	{
+		fprintf(fp, "part,frames,calls,mean_us,p50_us,p99_us,max_us,slowest_frame\n");
+		for (int i=0; i<_SCOPE_MAX; i++)
+		{
+			STATISTICS s;
+			statistics((SCOPE)i, s);
+			if (s.frames==0) continue;
+			fprintf(fp, "%s,%lld,%lld,%.1f,%.1f,%.1f,%.1f,%lld\n", NAMES[i], s.frames, s.calls, s.mean, s.p50, s.p99, s.max, s.slowestFrame);
+		}
+		return !ferror(fp);
+	}
+
+	bool startTrace(const _TCHAR* file)
+	{
+		stopTrace();
+		_tfopen_s(&traceFile, file, _T("wt"));
+		if (traceFile==nullptr) return false;
+		if (originTick==0) setOrigin();
+		fputs("{\"traceEvents\":[", traceFile);
+		firstEvent=true;
+		events.clear();
+		events.reserve(4096);
+		return true;
+	}
+
+	void stopTrace()
+	{
+		if (traceFile==nullptr) return;
+		// scopes of an unfinished frame are dropped
+		events.clear();
+		fputs("\n]}\n", traceFile);
+		fclose(traceFile);
+		traceFile=nullptr;
+	}
+}
+
+// unit tests
+class PerfTest : public TestCase
+{
+public:
+	virtual const char* name()
+	{
+		return "Host Timing Test";
+	}
+
+	virtual TestResult run()
+	{
+		const std::basic_string<_TCHAR> file=tempFile(_T("perf.test"));
+		perf::clearStatistics();
+		tassert(perf::startTrace(file.c_str()));
+
+		// two frames, the cpu part is slow in the second one
+		for (int frame=1; frame<=2; frame++)
+		{
+			const uint64_t begin=__rdtsc();
+			const long long deadline=pacer::now()+frame*50000;
+			while (pacer::now()<deadline);
+			perf::record(perf::CPU, begin, __rdtsc());
+			perf::record(perf::PRESENT, begin, begin);
+			perf::endFrame(frame);
+		}
+		perf::stopTrace();
+
+		perf::STATISTICS s;
+		perf::statistics(perf::CPU, s);
+		tassert(s.frames==2 && s.calls==2);
+		tassert(s.slowestFrame==2 && s.max>=s.mean);
+		// preemption can only make it longer
+		tassert(s.max>=90);
+		tassert(s.p50<=s.p99 && s.p99<=s.max+perf::BUCKET_WIDTH/1000.0);
+		perf::statistics(perf::SAVE_STATE, s);
+		tassert(s.frames==0);
+
+		// four complete events
+		char text[1024]={0};
+		FILE* fp=nullptr;
+		_tfopen_s(&fp, file.c_str(), _T("rt"));
+		tassert(fp!=nullptr);
+		fread(text, 1, sizeof(text)-1, fp);
+		fclose(fp);
+		_tremove(file.c_str());
+		static const char* const FIRST="{\"traceEvents\":[\n{\"name\":\"cpu::run\",\"ph\":\"X\"";
+		tassert(strncmp(text, FIRST, strlen(FIRST))==0);
+		int count=0;
+		for (const char* p=strstr(text, "\"ph\":\"X\""); p; p=strstr(p+1, "\"ph\":\"X\"")) count++;
+		tassert(count==4);
+		tassert(strcmp(text+strlen(text)-4, "\n]}\n")==0);
+
+		// scopes can be nested in one block
+		{
+			PERF_SCOPE(SAVE_STATE);
+			PERF_SCOPE(UI_EVENTS);
+		}
+
+		perf::clearStatistics();
+		return SUCCESS;
+	}
+};
+
+registerTestCase(PerfTest);
@@ -0,0 +1,99 @@
+// host-side timing of the emulator's own parts
+//
+// PERF_SCOPE(id) times the rest of the enclosing block with the time stamp
+// counter. It only exists in builds with WANT_PERF_SCOPES; otherwise the
+// macros expand to nothing and the emulation runs the same code as before.
+//
+// The time of each part is summed over a frame and the sums go to a
+// histogram per part, so a slow frame can be traced to the part that made it
+// slow. A timeline of every scope can also be written in the Chrome trace
+// event format, which chrome://tracing and Perfetto open. It takes about
+// 100 KB per frame.
+//
+// Ticks are converted to nanoseconds with the clock time elapsed since the
+// first scope, so the timeline has the clock's origin and resolution.
+
+namespace perf
+{
+	enum SCOPE
+	{
+		FRAME, // emu::nextFrame()
+		CPU, // cpu::run()
+		APU, // apu::run()
+		MAPPER_HBLANK,
+		BACKGROUND,
+		SPRITE_EVALUATION,
+		SPRITES,
+		PRESENT, // palette lookup and the ui
+		SAVE_STATE,
+		UI_EVENTS,
+		UI_BLT,
+		UI_WAIT, // ui::limitFPS()
+		UI_FRAME_HOOKS,
+		_SCOPE_MAX
+	};
+
+#ifdef WANT_PERF_SCOPES
+	const bool AVAILABLE=true;
+#else
+	const bool AVAILABLE=false;
+#endif
+
+	// histogram buckets are 1us wide, longer frames go to the last one
+	const int BUCKET_WIDTH=1000; // ns
+	const int BUCKET_COUNT=10000;
+
+	// begin and end in time stamp counter ticks
+	void record(const SCOPE scope, const uint64_t begin, const uint64_t end);
+
+	// adds the frame's sums to the histograms and writes its timeline
+	void endFrame(const long long frame);
+
+	// times in microseconds, over the frames the part ran in
+	struct STATISTICS
+	{
+		long long frames;
+		long long calls;
+		double mean, p50, p99, max;
+		long long slowestFrame;
+	};
+
+	void statistics(const SCOPE scope, STATISTICS& s);
+	void clearStatistics();
+	const char* name(const SCOPE scope);
+
+	// a line per part: "<part>,<frames>,<calls>,<mean us>,<p50 us>,<p99 us>,<max us>,<slowest frame>"
+	bool exportStatistics(FILE* fp);
+
+	// timeline in the Chrome trace event format
+	bool startTrace(const _TCHAR* file);
+	void stopTrace();
+
+	class Scope
+	{
+	public:
+		explicit Scope(const SCOPE scope):scope(scope), begin(__rdtsc())
+		{
+		}
+
+		~Scope()
+		{
+			record(scope, begin, __rdtsc());
+		}
+
+	private:
+		const SCOPE scope;
+		const uint64_t begin;
+
+		Scope(const Scope&);
+		Scope& operator=(const Scope&);
+	};
+}
+
+#ifdef WANT_PERF_SCOPES
+	#define PERF_SCOPE(id) perf::Scope CONCAT(perfScope, __LINE__)(perf::id)
+	#define PERF_END_FRAME(frame) perf::endFrame(frame)
+#else
+	#define PERF_SCOPE(id) ((void)0)
+	#define PERF_END_FRAME(frame) ((void)0)
+#endif
@@ -7,11 +7,17 @@
 
 #include "internals.h"
 #include "debug.h"
+#include "dirty.h"
+#include "state.h"
 #include "rom.h"
 #include "cpu.h"
 #include "ppu.h"
 #include "mmc.h"
 #include "emu.h"
+#include "options.h"
+#include "trace.h"
+#include "telemetry.h"
+#include "perf.h"
 
 // PPU Memory
 __declspec(align(0x1000))
@@ -82,6 +88,7 @@ namespace mem
 		assert((dest+count)*0x400<=0x2000);
 		assert((src+count)*0x400<=(int)rom::sizeOfVROM());
 		memcpy(&vramData(dest*0x400), rom::getVROM()+src*0x400, count*0x400);
+		dirty::markRange(dirty::PATTERN_TABLES, dest*0x400, count*0x400);
 	}
 
 	void bankSwitch(const int dest, const int src, const int count)
@@ -94,6 +101,7 @@ namespace mem
 			{
 				prevBankSrc[dest+i]=src+i;
 				copyBanks(dest+i, src+i, 1);
+				telemetry::counters.chrSwitches++;
 			}
 		}
 	}
@@ -108,64 +116,73 @@ namespace mem
 #endif
 	}
 
-	static void save(FILE *fp)
+	static void save(state::Writer& w)
 	{
 		// memory
-		if (saveCompleteMemory())
-		{
-			fwrite(&vram, sizeof(vram), 1, fp);
-		}else
-		{
-			// skip vrom
-			fwrite(&vram.nameTables, sizeof(vram.nameTables), 1, fp);
-			fwrite(&vram.pal, sizeof(vram.pal), 1, fp);
-		}
-		fwrite(&oam, sizeof(oam), 1, fp);
+		w.pages(dirty::NAMETABLES, &vram.nameTables, sizeof(vram.nameTables));
+		w.pages(dirty::PALETTE, &vram.pal, sizeof(vram.pal));
+		w.pages(dirty::OAM, &oam, sizeof(oam));
 		
 		// toggle
-		fwrite(&firstWrite, sizeof(firstWrite), 1, fp);
+		w.u8(firstWrite);
 
 		// latch
-		fwrite(&latch, sizeof(latch), 1, fp);
+		w.u8(latch);
 
 		// bank-switching state
-		fwrite(prevBankSrc, sizeof(prevBankSrc), 1, fp);
+		for (int i=0;i<8;i++)
+		{
+			w.u32(prevBankSrc[i]);
+		}
 	}
 
-	static void load(FILE *fp)
+	static void saveVROM(state::Writer& w)
 	{
-		// memory
 		if (saveCompleteMemory())
 		{
-			fread(&vram, sizeof(vram), 1, fp);
-		}else
-		{
-			// skip vrom
-			fread(&vram.nameTables, sizeof(vram.nameTables), 1, fp);
-			fread(&vram.pal, sizeof(vram.pal), 1, fp);
+			w.beginChunk(state::CHUNK_VRAM);
+			w.pages(dirty::PATTERN_TABLES, &vram.vrom, sizeof(vram.vrom));
+			w.endChunk();
 		}
-		fread(&oam, sizeof(oam), 1, fp);
+	}
+
+	static bool load(state::Reader& r, const state::Reader& image)
+	{
+		// memory
+		r.pages(dirty::NAMETABLES, &vram.nameTables, sizeof(vram.nameTables));
+		r.pages(dirty::PALETTE, &vram.pal, sizeof(vram.pal));
+		r.pages(dirty::OAM, &oam, sizeof(oam));
 
 		// toggle
-		fread(&firstWrite, sizeof(firstWrite), 1, fp);
+		firstWrite=(r.u8()!=0);
 
 		// latch
-		fread(&latch, sizeof(latch), 1, fp);
+		latch=r.u8();
 
 		// bank-switching state
-		if (saveCompleteMemory())
+		int bankSrc[8];
+		STATIC_ASSERT(sizeof(bankSrc) == sizeof(prevBankSrc));
+		for (int i=0;i<8;i++)
 		{
-			fread(prevBankSrc, sizeof(prevBankSrc), 1, fp);
+			bankSrc[i]=(int)r.u32();
+		}
+
+		state::Reader vrom;
+		if (image.findChunk(state::CHUNK_VRAM, vrom))
+		{
+			vrom.pages(dirty::PATTERN_TABLES, &vram.vrom, sizeof(vram.vrom));
+			memcpy(prevBankSrc, bankSrc, sizeof(prevBankSrc));
+			if (!vrom.ok()) return false;
 		}else
 		{
-			int bankSrc[8];
-			STATIC_ASSERT(sizeof(bankSrc) == sizeof(prevBankSrc));
-			fread(bankSrc, sizeof(bankSrc), 1, fp);
+			// pattern tables come from the rom
+			if (saveCompleteMemory()) return false;
 			for (int i=0;i<8;i++)
 			{
-				bankSwitch(i, bankSrc[i], 1);
+				if (bankSrc[i]>=0) bankSwitch(i, bankSrc[i], 1);
 			}
 		}
+		return r.ok();
 	}
 
 	static vaddr_t ntMirror(vaddr_flag_t vaddr)
@@ -306,6 +323,12 @@ namespace mem
 		}
 #endif
 		vramData(addr)=data;
+		if (addr<0x2000)
+			dirty::mark(dirty::PATTERN_TABLES, addr);
+		else if (addr<0x3000)
+			dirty::mark(dirty::NAMETABLES, addr-0x2000);
+		else
+			dirty::mark(dirty::PALETTE, 0);
 		incAddress();
 	}
 }
@@ -318,12 +341,21 @@ namespace render
 	static rgb32_t pal32[64];
 	static palindex_t vBuffer[RENDER_HEIGHT][RENDER_WIDTH];
 	static rgb32_t vBuffer32[SCREEN_HEIGHT*SCREEN_WIDTH];
+	// the part of the picture presented, see options::CLIP_LEFT and options::ALL_LINES
+	static int frameWidth=SCREEN_WIDTH;
+	static int frameHeight=SCREEN_HEIGHT;
 
 	static int8_t pendingSprites[64];
 	static int pendingSpritesCount;
 	static bool solidPixel[RENDER_WIDTH];
 	static bool spritePixel[RENDER_WIDTH];
 
+	// when output is disabled only the scanlines where sprite 0 may hit the
+	// background are rendered, the rest only move the scroll registers
+	static bool outputEnabled=true;
+	// frame drawn into vBuffer32
+	static long long pictureFrame=-1;
+
 	static void setScroll(const byte_t byte)
 	{
 		if (mem::toggle())
@@ -387,17 +419,18 @@ namespace render
 		return mask[PPUMASK::BG_VISIBLE] || mask[PPUMASK::SPR_VISIBLE];
 	}
 
-	bool leftClipping()
+	template <bool DIAGNOSTICS>
+	static bool leftClipping()
 	{
-#ifdef LEFT_CLIP
-		return true;
-#else
+		if (DIAGNOSTICS && options::enabled(options::CLIP_LEFT)) return true;
 		return mask[PPUMASK::BG_CLIP8] || mask[PPUMASK::SPR_CLIP8];
-#endif
 	}
 
 	static void present()
 	{
+		if (!outputEnabled) return;
+		PERF_SCOPE(PRESENT);
+
 		if (enabled())
 		{
 			// cache palette colors
@@ -405,18 +438,20 @@ namespace render
 			for (int i=0;i<32;i++) p32[i]=pal32[colorIdx(i)];
 
 			// look up each pixel
+			const int xoffset=RENDER_WIDTH-frameWidth;
 			rgb32_t* vBuf32=vBuffer32;
-			const palindex_t* vBufIdx=&vBuffer[SCREEN_YOFFSET][0];
-			for (int i=0;i<SCREEN_HEIGHT;i++)
+			const palindex_t* vBufIdx=&vBuffer[(RENDER_HEIGHT-frameHeight)/2][0];
+			for (int i=0;i<frameHeight;i++)
 			{
-				vBufIdx+=SCREEN_XOFFSET;
-				for (int j=0;j<SCREEN_WIDTH;j++)
+				vBufIdx+=xoffset;
+				for (int j=0;j<frameWidth;j++)
 					*vBuf32++=p32[valueOf(*vBufIdx++)];
 			}
+			pictureFrame=frameNum;
 		}
 		
 		// display
-		emu::present(vBuffer32, SCREEN_WIDTH, SCREEN_HEIGHT);
+		emu::present(vBuffer32, frameWidth, frameHeight);
 	}
 
 	static void startVBlank()
@@ -475,8 +510,34 @@ namespace render
 		emu::onFrameEnd();
 	}
 
+	// set address to next scanline
+	static void nextLine()
+	{
+		if (address.inc(PPUADDR::YOFFSET)==0)
+		{
+			if (address.inc(PPUADDR::YSCROLL)==30)
+			{
+				address.update<PPUADDR::YSCROLL>(0);
+				address.flip(PPUADDR::NT_V);
+				// no need to update scroll reload
+			}
+		}
+	}
+
+	// what drawBackground does to the address, without drawing
+	static void skipBackground()
+	{
+		if (mask[PPUMASK::BG_VISIBLE])
+		{
+			reloadHorizontal();
+			address.flip(PPUADDR::NT_H);
+			nextLine();
+		}
+	}
+
 	static void drawBackground()
 	{
+		PERF_SCOPE(BACKGROUND);
 		if (mask[PPUMASK::BG_VISIBLE])
 		{
 			// determine origin
@@ -561,26 +622,17 @@ namespace render
 				}
 			}
 
-			// set address to next scanline
-			if (address.inc(PPUADDR::YOFFSET)==0)
-			{
-				if (address.inc(PPUADDR::YSCROLL)==30)
-				{
-					address.update<PPUADDR::YSCROLL>(0);
-					address.flip(PPUADDR::NT_V);
-					// no need to update scroll reload
-				}
-			}
+			nextLine();
 		}
 	}
 
-#ifdef MONITOR_RENDERING
 	static int visibleFrontSpriteCount;
 	static int visibleBackSpriteCount;
-#endif
 
+	template <bool DIAGNOSTICS>
 	static void evaluateSprites()
 	{
+		PERF_SCOPE(SPRITE_EVALUATION);
 		pendingSpritesCount=0;
 
 		if (mask[PPUMASK::SPR_VISIBLE])
@@ -594,47 +646,55 @@ namespace render
 			{
 				if (oamSprite(i).yminus1<scanline && oamSprite(i).yminus1+sprHeight>=scanline)
 				{
-#ifdef SPRITE_LIMIT
-					if (pendingSpritesCount>=8)
+					if (DIAGNOSTICS && options::enabled(options::LIMIT_SPRITES) && pendingSpritesCount>=8)
 					{
 						// more than 8 sprites appear in this scanline
 						status|=PPUSTATUS::COUNTGT8;
 						break;
 					}else
-#endif
 					{
 						pendingSprites[pendingSpritesCount++]=i;
 					}
 				}
 			}
 
-#ifdef MONITOR_RENDERING
-			// count visible sprites
-			visibleFrontSpriteCount=0;
-			visibleBackSpriteCount=0;
-			for (int i=63;i>=0;i--)
+			if (DIAGNOSTICS && options::enabled(options::WATCH_RENDERING))
 			{
-				if (oamSprite(i).yminus1<239)
+				// count visible sprites
+				visibleFrontSpriteCount=0;
+				visibleBackSpriteCount=0;
+				for (int i=63;i>=0;i--)
 				{
-					if (oamSprite(i).attrib[SPRATTR::BEHIND_BG])
-						visibleBackSpriteCount++;
-					else
-						visibleFrontSpriteCount++;
+					if (oamSprite(i).yminus1<239)
+					{
+						if (oamSprite(i).attrib[SPRATTR::BEHIND_BG])
+							visibleBackSpriteCount++;
+						else
+							visibleFrontSpriteCount++;
+					}
 				}
 			}
-#endif
-			for (int i=0;i<RENDER_WIDTH;i++)
-			{
-				solidPixel[i]=((vBuffer[scanline][i]&3)!=0); // indicate whether a background pixel is opaque
-				spritePixel[i]=false;
-			}
 		}
 	}
 
+	// sprite 0 is on this scanline and has not hit the background yet
+	static bool hitPending()
+	{
+		return pendingSpritesCount>0 && pendingSprites[0]==0 && !status[PPUSTATUS::HIT] && mask[PPUMASK::BG_VISIBLE];
+	}
+
+	template <bool DIAGNOSTICS>
 	static void drawSprites()
 	{
+		PERF_SCOPE(SPRITES);
 		if (pendingSpritesCount>0)
 		{
+			for (int i=0;i<RENDER_WIDTH;i++)
+			{
+				solidPixel[i]=((vBuffer[scanline][i]&3)!=0); // indicate whether a background pixel is opaque
+				spritePixel[i]=false;
+			}
+
 			const int sprWidth=8;
 			const int sprHeight=control[PPUCTRL::LARGE_SPRITE]?16:8;
 
@@ -682,7 +742,7 @@ namespace render
 					if (colorD0D1) // opaque sprite pixel
 					{
 						// sprite 0 hit detection (regardless priority)
-						if (sprId==0 && !status[PPUSTATUS::HIT] && solidPixel[X] && mask[PPUMASK::BG_VISIBLE] && !(leftClipping() && X<8) && X!=255)
+						if (sprId==0 && !status[PPUSTATUS::HIT] && solidPixel[X] && mask[PPUMASK::BG_VISIBLE] && !(leftClipping<DIAGNOSTICS>() && X<8) && X!=255)
 						{
 							// background is non-transparent here
 							status|=PPUSTATUS::HIT;
@@ -702,24 +762,32 @@ namespace render
 		}
 	}
 
+	template <bool DIAGNOSTICS>
 	static void renderScanline()
 	{
 		if (enabled())
 		{
 			if (scanline>=0 && scanline<=239)
 			{
-			#ifdef MONITOR_RENDERING
-				printf("[P] --- Scanline %03d --- Sprite 0: (%d, %d) %c%c%c Scroll=[%3d,%3d] %d+%d visible\n", scanline, oamSprite(0).x, oamSprite(0).yminus1+1, 
+				if (DIAGNOSTICS && options::enabled(options::WATCH_RENDERING))
+					printf("[P] --- Scanline %03d --- Sprite 0: (%d, %d) %c%c%c Scroll=[%3d,%3d] %d+%d visible\n", scanline, oamSprite(0).x, oamSprite(0).yminus1+1, 
 					(rom::mirrorMode()==MIRRORING::HORIZONTAL)?'H':'V',
 					mask[PPUMASK::SPR_VISIBLE]?'S':'-',
 					mask[PPUMASK::BG_VISIBLE]?'B':'-',
 					scroll(PPUADDR::XSCROLL)*8+xoffset,
 					scroll(PPUADDR::YSCROLL)*8+scroll(PPUADDR::YOFFSET),
 					visibleFrontSpriteCount, visibleBackSpriteCount);
-			#endif
-				drawBackground();
-				evaluateSprites();
-				drawSprites();
+				evaluateSprites<DIAGNOSTICS>();
+				if (outputEnabled || hitPending())
+				{
+					drawBackground();
+					drawSprites<DIAGNOSTICS>();
+				}else
+				{
+					// this scanline is never seen
+					skipBackground();
+					telemetry::counters.skippedScanlines++;
+				}
 			}else
 			{
 				// dummy scanline
@@ -727,6 +795,9 @@ namespace render
 		}
 	}
 
+	// chosen by ppu::configure()
+	static void (*renderLine)()=renderScanline<false>;
+
 	static bool HBlank()
 	{
 		if (scanline==-1)
@@ -736,11 +807,11 @@ namespace render
 		}else if (scanline>=0 && scanline<=239)
 		{
 			// visible scanlines
-			renderScanline();
+			renderLine();
 		}else if (scanline==240)
 		{
 			// dummy scanline
-			renderScanline();
+			renderLine();
 			postRender();
 			// enter vblank
 			startVBlank();
@@ -853,38 +924,56 @@ namespace ppu
 		mem::reset();
 	}
 
-	void save(FILE *fp)
+	void save(state::Writer& w)
 	{
+		w.beginChunk(state::CHUNK_PPU);
+
 		// registers
-		fwrite(&control, sizeof(control), 1, fp);
-		fwrite(&mask, sizeof(mask), 1, fp);
-		fwrite(&status, sizeof(status), 1, fp);
+		w.u8(valueOf(control));
+		w.u8(valueOf(mask));
+		w.u8(valueOf(status));
 
-		fwrite(&scroll, sizeof(scroll), 1, fp);
-		fwrite(&xoffset, sizeof(xoffset), 1, fp);
-		fwrite(&address, sizeof(address), 1, fp);
+		w.u16(valueOf(scroll));
+		w.u8(valueOf(xoffset));
+		w.u16(valueOf(address));
 
-		fwrite(&oamAddr, sizeof(oamAddr), 1, fp);
+		w.u8(valueOf(oamAddr));
+
+		// counters
+		w.u32((uint32_t)scanline);
+		w.u64((uint64_t)frameNum);
 
 		// memory
-		mem::save(fp);
+		mem::save(w);
+
+		w.endChunk();
+
+		// pattern tables of CHR-RAM carts
+		mem::saveVROM(w);
 	}
 
-	void load(FILE *fp)
+	bool load(const state::Reader& image)
 	{
+		state::Reader r;
+		if (!image.findChunk(state::CHUNK_PPU, r)) return false;
+
 		// registers
-		fread(&control, sizeof(control), 1, fp);
-		fread(&mask, sizeof(mask), 1, fp);
-		fread(&status, sizeof(status), 1, fp);
+		control.asBitField()=r.u8();
+		mask.asBitField()=r.u8();
+		status.asBitField()=r.u8();
+
+		scroll.asBitField()=r.u16()&0x7FFF;
+		xoffset=r.u8()&7;
+		address.asBitField()=r.u16()&0x3FFF;
 
-		fread(&scroll, sizeof(scroll), 1, fp);
-		fread(&xoffset, sizeof(xoffset), 1, fp);
-		fread(&address, sizeof(address), 1, fp);
+		oamAddr=r.u8();
 
-		fread(&oamAddr, sizeof(oamAddr), 1, fp);
+		// counters
+		scanline=(int32_t)r.u32();
+		frameNum=(long long)r.u64();
 
 		// memory
-		mem::load(fp);
+		return mem::load(r, image);
 	}
 
 	void init()
@@ -922,6 +1011,7 @@ namespace ppu
 	bool writePort(const maddr_t maddress, const byte_t data)
 	{
 		vassert(1==valueOf(maddress)>>13); // [$2000,$4000)
+		if (scanline>=0 && scanline<=239 && render::enabled()) telemetry::counters.visiblePPUWrites++;
 		switch (valueOf(maddress)&7)
 		{
 		case 0: // $2000 PPU Control Register 1
@@ -940,6 +1030,7 @@ namespace ppu
 			return true;
 		case 4: // $2004 Sprite Memory Data
 			oamData(oamAddr)=data;
+			dirty::mark(dirty::OAM, 0);
 			inc(oamAddr);
 			return true;
 		case 5: // $2005 Screen Scroll offsets
@@ -959,9 +1050,8 @@ namespace ppu
 
 	bool hsync()
 	{
-		#ifdef MONITOR_RENDERING
-			debug::printPPUState(frameNum, scanline, status[PPUSTATUS::VBLANK], status[PPUSTATUS::HIT], mask[PPUMASK::BG_VISIBLE], mask[PPUMASK::SPR_VISIBLE]);
-		#endif
+		if (options::enabled(options::WATCH_RENDERING))
+			trace::scanline(frameNum, scanline, status[PPUSTATUS::VBLANK], status[PPUSTATUS::HIT], mask[PPUMASK::BG_VISIBLE], mask[PPUMASK::SPR_VISIBLE]);
 		mapper::HBlank();
 		return render::HBlank();
 	}
@@ -970,6 +1060,40 @@ namespace ppu
 	{
 		assert(src!=nullptr);
 		memcpy(&oam, src, sizeof(oam));
+		dirty::mark(dirty::OAM, 0);
+		telemetry::counters.oamDMAs++;
+	}
+
+	void enableOutput(const bool enabled)
+	{
+		render::outputEnabled=enabled;
+	}
+
+	const rgb32_t* frameBuffer()
+	{
+		return render::vBuffer32;
+	}
+
+	bool pictureCurrent()
+	{
+		return render::pictureFrame==frameNum-1;
+	}
+
+	int frameWidth()
+	{
+		return render::frameWidth;
+	}
+
+	int frameHeight()
+	{
+		return render::frameHeight;
+	}
+
+	void configure()
+	{
+		render::renderLine=(options::selected&options::RENDER_CHECKS)?render::renderScanline<true>:render::renderScanline<false>;
+		render::frameWidth=options::enabled(options::CLIP_LEFT)?SCREEN_WIDTH-8:SCREEN_WIDTH;
+		render::frameHeight=options::enabled(options::ALL_LINES)?SCREEN_HEIGHT:SCREEN_HEIGHT-16;
 	}
 
 	int currentScanline()
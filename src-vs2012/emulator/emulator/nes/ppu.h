@@ -198,12 +198,25 @@ namespace ppu
 
 	bool hsync();
 
+	void enableOutput(const bool enabled);
+
+	// last presented frame, frameWidth()*frameHeight() pixels
+	const rgb32_t* frameBuffer();
+	int frameWidth();
+	int frameHeight();
+	// frameBuffer() holds the frame that has just ended, and not an older one
+	// because output was off or the game had rendering turned off
+	bool pictureCurrent();
+
+	// picks the scanline renderer and the frame size for the selected options
+	void configure();
+
 	int currentScanline();
 	long long currentFrame();
 
 	// save state
-	void save(FILE *fp);
-	void load(FILE *fp);
+	void save(state::Writer& w);
+	bool load(const state::Reader& image);
 }
 
 namespace pmapper
@@ -220,5 +233,4 @@ namespace pmapper
 namespace render
 {
 	bool enabled();
-	bool leftClipped();
 }
\ No newline at end of file
@@ -0,0 +1,336 @@
+#include "../stdafx.h"
+
+// local header files
+#include "../macros.h"
+#include "../types/types.h"
+#include "../unittest/framework.h"
+
+#include "internals.h"
+#include "debug.h"
+#include "dirty.h"
+#include "state.h"
+#include "rom.h"
+#include "opcodes.h"
+#include "mmc.h"
+#include "cpu.h"
+#include "profiler.h"
+
+#include <vector>
+#include <map>
+#include <algorithm>
+
+namespace profiler
+{
+	// a routine entry point: (bank+1)<<18 | entry<<16 | address, so code in RAM has bank 0
+	typedef uint32_t routine_t;
+
+	enum ENTRY
+	{
+		ENTRY_CALL=0,
+		ENTRY_NMI=1,
+		ENTRY_IRQ=2,
+		ENTRY_BRK=3
+	};
+
+	// a node of the call tree, one per distinct call stack
+	struct Node
+	{
+		int parent;
+		routine_t routine;
+		long long self; // cycles
+		long long calls;
+	};
+
+	struct Frame
+	{
+		int node;
+		int returnSP; // stack pointer once the routine has returned
+	};
+
+	static std::vector<Node> nodes;
+	static std::map<std::pair<int,routine_t>,int> children;
+	static Frame stack[MAX_DEPTH];
+	static int depth;
+	static int current; // node of the running code
+
+	// cycles per address: [$0000,$8000) then 8K per PRG bank,
+	// and the 8K window the bank was seen in at that address
+	static std::vector<long long> addressCycles;
+	static std::vector<uint8_t> addressWindow;
+	static long long totalCycles;
+
+	static routine_t routineAt(const maddr_t addr, const ENTRY entry)
+	{
+		return ((routine_t)(mmc::prgBank(addr)+1)<<18)|((routine_t)entry<<16)|valueOf(addr);
+	}
+
+	static int bankOf(const routine_t routine)
+	{
+		return (int)(routine>>18)-1;
+	}
+
+	static ENTRY entryOf(const routine_t routine)
+	{
+		return (ENTRY)((routine>>16)&3);
+	}
+
+	static int addressOf(const routine_t routine)
+	{
+		return routine&0xFFFF;
+	}
+
+	static int child(const int parent, const routine_t routine)
+	{
+		const std::pair<int,routine_t> key(parent, routine);
+		auto it=children.find(key);
+		if (it!=children.end()) return it->second;
+		const Node node={parent, routine, 0, 0};
+		nodes.push_back(node);
+		children[key]=(int)nodes.size()-1;
+		return (int)nodes.size()-1;
+	}
+
+	void reset()
+	{
+		nodes.clear();
+		children.clear();
+		const Node root={-1, 0, 0, 0};
+		nodes.push_back(root);
+		current=0;
+		depth=0;
+		addressCycles.assign(0x8000+max(rom::count8KPRG(), 0)*0x2000, 0);
+		addressWindow.assign(addressCycles.size(), 0);
+		totalCycles=0;
+	}
+
+	static void enter(const routine_t routine, const int returnSP)
+	{
+		if (nodes.empty()) reset();
+		if (depth<MAX_DEPTH)
+		{
+			current=child(current, routine);
+			nodes[current].calls++;
+			stack[depth].node=current;
+			stack[depth].returnSP=returnSP;
+			depth++;
+		}
+	}
+
+	static void leave(const int sp)
+	{
+		while (depth>0 && stack[depth-1].returnSP<=sp)
+		{
+			depth--;
+		}
+		current=(depth>0)?stack[depth-1].node:0;
+	}
+
+	void instruction(const maddr_t pc, const M6502_INST inst, const maddr_t next, const _reg8_t sp, const int cycles)
+	{
+		if (nodes.empty()) reset();
+		nodes[current].self+=cycles;
+		totalCycles+=cycles;
+
+		size_t index=valueOf(pc);
+		if (MSB(pc))
+		{
+			const int bank=mmc::prgBank(pc);
+			index=(bank>=0)?0x8000+bank*0x2000+(valueOf(pc)&0x1FFF):addressCycles.size();
+		}
+		if (index<addressCycles.size())
+		{
+			addressCycles[index]+=cycles;
+			addressWindow[index]=(uint8_t)(valueOf(pc)>>13);
+		}
+
+		switch (inst)
+		{
+		case INS_JSR:
+			// the return address is 2 bytes below
+			enter(routineAt(next, ENTRY_CALL), sp+2);
+			break;
+		case INS_RTS:
+		case INS_RTI:
+			leave(sp);
+			break;
+		default:
+			break;
+		}
+	}
+
+	void interrupt(const IRQTYPE type, const maddr_t handler, const _reg8_t sp)
+	{
+		// return address and status are 3 bytes below
+		switch (type)
+		{
+		case IRQTYPE::NMI: enter(routineAt(handler, ENTRY_NMI), sp+3); break;
+		case IRQTYPE::IRQ: enter(routineAt(handler, ENTRY_IRQ), sp+3); break;
+		case IRQTYPE::BRK: enter(routineAt(handler, ENTRY_BRK), sp+3); break;
+		default:
+			// reset starts over
+			depth=0;
+			current=0;
+			break;
+		}
+	}
+
+	long long cycles()
+	{
+		return totalCycles;
+	}
+
+	static void printRoutine(FILE* fp, const routine_t routine)
+	{
+		static const char* const PREFIX[]={"", "nmi@", "irq@", "brk@"};
+		if (routine==0)
+		{
+			fprintf(fp, "main");
+			return;
+		}
+		const int bank=bankOf(routine);
+		if (bank<0)
+			fprintf(fp, "%sRAM:%04X", PREFIX[entryOf(routine)], addressOf(routine));
+		else
+			fprintf(fp, "%s%02X:%04X", PREFIX[entryOf(routine)], bank, addressOf(routine));
+	}
+
+	struct RoutineTotals
+	{
+		long long self;
+		long long total; // with callees, recursion counted once
+		long long calls;
+	};
+
+	// subtree totals; a node's index is always above its parent's
+	static void collect(std::map<routine_t,RoutineTotals>& routines)
+	{
+		std::vector<long long> subtree(nodes.size());
+		for (size_t i=0; i<nodes.size(); i++) subtree[i]=nodes[i].self;
+		for (size_t i=nodes.size()-1; i>0; i--) subtree[nodes[i].parent]+=subtree[i];
+
+		for (size_t i=0; i<nodes.size(); i++)
+		{
+			RoutineTotals& totals=routines[nodes[i].routine];
+			totals.self+=nodes[i].self;
+			totals.calls+=nodes[i].calls;
+			// outermost activation only
+			bool nested=false;
+			for (int p=nodes[i].parent; p>=0 && !nested; p=nodes[p].parent)
+				nested=(nodes[p].routine==nodes[i].routine);
+			if (!nested) totals.total+=subtree[i];
+		}
+	}
+
+	template <typename T>
+	static bool byCycles(const std::pair<long long,T>& a, const std::pair<long long,T>& b)
+	{
+		return a.first>b.first;
+	}
+
+	void writeReport(FILE* fp, const int maxLines)
+	{
+		if (nodes.empty()) reset();
+		const double percent=(totalCycles>0)?100.0/totalCycles:0;
+		fprintf(fp, "%lld cycles profiled\n\n", totalCycles);
+
+		std::map<routine_t,RoutineTotals> routines;
+		collect(routines);
+		std::vector<std::pair<long long,routine_t> > order;
+		for (auto it=routines.begin(); it!=routines.end(); ++it)
+			order.push_back(std::make_pair(it->second.total, it->first));
+		std::sort(order.begin(), order.end(), byCycles<routine_t>);
+
+		fprintf(fp, "routine\t%7s %7s %12s %10s\n", "total%", "self%", "self cycles", "calls");
+		for (int i=0; i<(int)order.size() && i<maxLines; i++)
+		{
+			const RoutineTotals& totals=routines[order[i].second];
+			printRoutine(fp, order[i].second);
+			fprintf(fp, "\t%7.2f %7.2f %12lld %10lld\n", totals.total*percent, totals.self*percent, totals.self, totals.calls);
+		}
+
+		std::vector<std::pair<long long,size_t> > hot;
+		for (size_t i=0; i<addressCycles.size(); i++)
+		{
+			if (addressCycles[i]>0) hot.push_back(std::make_pair(addressCycles[i], i));
+		}
+		std::sort(hot.begin(), hot.end(), byCycles<size_t>);
+
+		fprintf(fp, "\naddress\t%7s %12s\n", "cycles%", "cycles");
+		for (int i=0; i<(int)hot.size() && i<maxLines; i++)
+		{
+			const size_t index=hot[i].second;
+			if (index<0x8000)
+				fprintf(fp, "RAM:%04X", (int)index);
+			else
+				fprintf(fp, "%02X:%04X", (int)((index-0x8000)/0x2000), (int)((addressWindow[index]<<13)|((index-0x8000)&0x1FFF)));
+			fprintf(fp, "\t%7.2f %12lld\n", hot[i].first*percent, hot[i].first);
+		}
+	}
+
+	static void printStack(FILE* fp, const int node)
+	{
+		if (nodes[node].parent>=0)
+		{
+			printStack(fp, nodes[node].parent);
+			fputc(';', fp);
+		}
+		printRoutine(fp, nodes[node].routine);
+	}
+
+	void writeFolded(FILE* fp)
+	{
+		for (size_t i=0; i<nodes.size(); i++)
+		{
+			if (nodes[i].self==0) continue;
+			printStack(fp, (int)i);
+			fprintf(fp, " %lld\n", nodes[i].self);
+		}
+	}
+}
+
+// unit tests
+class ProfilerTest : public TestCase
+{
+public:
+	virtual const char* name()
+	{
+		return "Guest Profiler Test";
+	}
+
+	virtual TestResult run()
+	{
+		profiler::reset();
+		// main calls $0400, which calls $0500, which drops its return address
+		// and so returns to main directly; then an nmi
+		profiler::instruction(maddr_t(0x300), INS_NOP, maddr_t(0x301), 0xFD, 2);
+		profiler::instruction(maddr_t(0x301), INS_JSR, maddr_t(0x400), 0xFB, 6);
+		profiler::instruction(maddr_t(0x400), INS_JSR, maddr_t(0x500), 0xF9, 6);
+		profiler::instruction(maddr_t(0x500), INS_PLA, maddr_t(0x501), 0xFA, 4);
+		profiler::instruction(maddr_t(0x501), INS_PLA, maddr_t(0x502), 0xFB, 4);
+		profiler::instruction(maddr_t(0x502), INS_RTS, maddr_t(0x304), 0xFD, 6);
+		profiler::instruction(maddr_t(0x304), INS_NOP, maddr_t(0x305), 0xFD, 2);
+		profiler::interrupt(IRQTYPE::NMI, maddr_t(0x600), 0xFA);
+		profiler::instruction(maddr_t(0x600), INS_RTI, maddr_t(0x305), 0xFD, 6);
+		profiler::instruction(maddr_t(0x305), INS_NOP, maddr_t(0x306), 0xFD, 2);
+		tassert(profiler::cycles()==38);
+
+		char text[1024]={0};
+		FILE* fp=tmpfile();
+		tassert(fp!=nullptr);
+		profiler::writeFolded(fp);
+		rewind(fp);
+		fread(text, 1, sizeof(text)-1, fp);
+		fclose(fp);
+		tassert(strcmp(text,
+			"main 12\n"
+			"main;RAM:0400 6\n"
+			"main;RAM:0400;RAM:0500 14\n"
+			"main;nmi@RAM:0600 6\n")==0);
+
+		profiler::reset();
+		tassert(profiler::cycles()==0);
+		return SUCCESS;
+	}
+};
+
+registerTestCase(ProfilerTest);
@@ -0,0 +1,34 @@
+// guest code profiler
+//
+// With options::PROFILE the checked CPU loop reports every instruction and
+// interrupt here. Cycles are counted per (PRG bank, address), which is what
+// WANT_RUN_HIT's table of executed addresses lacks, and per call stack.
+//
+// The call stack is a shadow of the 6502 stack: JSR and interrupts open a
+// frame for their target and remember the stack pointer to return to, RTS
+// and RTI close every frame whose return point the stack pointer has passed.
+// Games that pop return addresses themselves or jump through RTS therefore
+// don't leave stale frames behind for long.
+//
+// A routine is named after its entry point: "07:C123" for bank 7, "RAM:0300"
+// for code below $8000, with "nmi@", "irq@" or "brk@" for interrupt handlers.
+
+namespace profiler
+{
+	// shadow stack depth, deeper calls are charged to the deepest frame
+	const int MAX_DEPTH=64;
+
+	// clears the counters and the stack, sizes the tables for the loaded rom
+	void reset();
+
+	// checked CPU loop
+	void instruction(const maddr_t pc, const M6502_INST inst, const maddr_t next, const _reg8_t sp, const int cycles);
+	void interrupt(const IRQTYPE type, const maddr_t handler, const _reg8_t sp);
+
+	long long cycles();
+
+	// routines by cycles spent in them and in their callees, then the hottest addresses
+	void writeReport(FILE* fp, const int maxLines=50);
+	// one line per call stack: "frame;frame;frame cycles", for flame graph tools
+	void writeFolded(FILE* fp);
+}
@@ -25,12 +25,24 @@ enum class ROMCONTROL2 {
 // global functions
 namespace rom
 {
+	// maps the file read-only where possible, so the banks point into the
+	// page cache and processes running the same rom share them
 	bool load( const _TCHAR *romFile );
+	// copies an image that was decoded or patched in memory
+	bool load( const void *data, const size_t size );
+	// the banks are in a mapping of the file
+	bool mapped();
 	void unload();
 
+	// of PRG and CHR, see romdb.h
+	uint32_t crc32();
+	const uint8_t* sha1(); // 20 bytes
+	bool correctedHeader();
+
 	int mapperType();
 	MIRRORING mirrorMode();
 	void setMirrorMode(MIRRORING newMode);
+	bool hasBattery();
 
 	const char* getImage();
 	int count16KPRG();
@@ -0,0 +1,121 @@
+#include "../stdafx.h"
+
+// local header files
+#include "../macros.h"
+#include "../types/types.h"
+#include "../unittest/framework.h"
+
+#include "rom.h"
+#include "romdb.h"
+
+#include <algorithm>
+
+namespace romdb
+{
+	// sorted by crc32, then sha1; the last entry marks the end.
+	// {crc32, sha1, mapper, mirroring, flags, 0}, // title
+	static const ENTRY TABLE[]={
+		{0xFFFFFFFF, 0xFFFFFFFF, 0, 0, 0, 0} // end
+	};
+
+	static const int COUNT=_countof(TABLE)-1;
+
+	// the table searched, see setTable()
+	static const ENTRY* current=TABLE;
+	static int currentCount=COUNT;
+
+	enum
+	{
+		__ENTRY_SIZE_CHECK=STATIC_ASSERT(sizeof(ENTRY)==12)
+	};
+
+	static bool before(const ENTRY& a, const ENTRY& b)
+	{
+		return a.crc32<b.crc32 || (a.crc32==b.crc32 && a.sha1<b.sha1);
+	}
+
+	const ENTRY* find(const uint32_t crc32, const uint8_t sha1[])
+	{
+		ENTRY key={crc32, ((uint32_t)sha1[0]<<24)|(sha1[1]<<16)|(sha1[2]<<8)|sha1[3], 0, 0, 0, 0};
+		const ENTRY* it=std::lower_bound(current, current+currentCount, key, before);
+		if (it==current+currentCount || it->crc32!=key.crc32 || it->sha1!=key.sha1) return nullptr;
+		return it;
+	}
+
+	const ENTRY* entries()
+	{
+		return current;
+	}
+
+	int count()
+	{
+		return currentCount;
+	}
+
+	void setTable(const ENTRY* table, const int count)
+	{
+		current=table?table:TABLE;
+		currentCount=table?count:COUNT;
+	}
+}
+
+// unit tests
+class RomDatabaseTest : public TestCase
+{
+public:
+	virtual const char* name()
+	{
+		return "Rom Database Test";
+	}
+
+	virtual TestResult run()
+	{
+		puts("checking the table...");
+		const romdb::ENTRY* table=romdb::entries();
+		const int count=romdb::count();
+		// binary search needs the order, and each image once
+		for (int i=1; i<count; i++)
+		{
+			tassert(table[i-1].crc32<table[i].crc32 || (table[i-1].crc32==table[i].crc32 && table[i-1].sha1<table[i].sha1));
+		}
+		// every entry is found, and makes a valid header
+		for (int i=0; i<count; i++)
+		{
+			const uint8_t sha1[4]={(uint8_t)(table[i].sha1>>24), (uint8_t)(table[i].sha1>>16), (uint8_t)(table[i].sha1>>8), (uint8_t)table[i].sha1};
+			tassert(romdb::find(table[i].crc32, sha1)==&table[i]);
+			tassert(table[i].mirroring<=(uint8_t)MIRRORING::MAX);
+			tassert((table[i].flags&~romdb::BATTERY)==0 && table[i].reserved==0);
+		}
+		// the end marker is never matched
+		const uint8_t ones[4]={0xFF, 0xFF, 0xFF, 0xFF};
+		tassert(romdb::find(0xFFFFFFFF, ones)==nullptr);
+
+		puts("checking a header correction...");
+		// mapper 0, horizontal mirroring, no battery
+		static char image[16+0x4000+0x2000];
+		memset(image, 0, sizeof(image));
+		memcpy(image, "NES\x1A\x01\x01\x00\x00", 8);
+		image[16]=(char)0x4C;
+		image[16+0x4000]=0x18;
+		tassert(rom::load(image, sizeof(image)));
+		tassert(!rom::correctedHeader() && rom::mapperType()==0);
+		const uint8_t* sha1=rom::sha1();
+		romdb::ENTRY entries[2]={
+			{rom::crc32(), ((uint32_t)sha1[0]<<24)|(sha1[1]<<16)|(sha1[2]<<8)|sha1[3], 4, (uint8_t)MIRRORING::VERTICAL, romdb::BATTERY, 0},
+			{0xFFFFFFFF, 0xFFFFFFFF, 0, 0, 0, 0}
+		};
+		romdb::setTable(entries, 1);
+		const bool corrected=rom::load(image, sizeof(image)) && rom::correctedHeader();
+		const bool applied=rom::mapperType()==4 && rom::mirrorMode()==MIRRORING::VERTICAL && rom::hasBattery();
+		// a crc collision isn't enough
+		entries[0].sha1^=1;
+		const bool collision=rom::load(image, sizeof(image)) && rom::correctedHeader();
+		romdb::setTable(nullptr, 0);
+		rom::unload();
+		tassert(corrected && applied && !collision);
+		tassert(romdb::entries()!=entries);
+		return SUCCESS;
+	}
+};
+
+registerTestCase(RomDatabaseTest);
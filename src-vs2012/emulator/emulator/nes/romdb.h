@@ -0,0 +1,40 @@
+// header corrections for known rom images
+//
+// Many dumps in circulation carry a wrong iNES header: the wrong mapper,
+// mirroring or battery flag. rom::load() looks the image up by the CRC-32 of
+// its PRG and CHR data and, on a match, replaces those header fields before
+// the mappers are set up. The first four bytes of the SHA-1 must match too,
+// so a CRC collision can't change a header.
+//
+// The table is a sorted array in the executable, searched in place. New
+// entries come from `nes-headless --identify <rom>` on a good dump, which
+// prints the line to add.
+
+namespace romdb
+{
+	enum FLAGS
+	{
+		BATTERY=0x1
+	};
+
+	struct ENTRY
+	{
+		uint32_t crc32; // PRG and CHR
+		uint32_t sha1; // first four bytes, big-endian
+		uint8_t mapper;
+		uint8_t mirroring; // MIRRORING
+		uint8_t flags;
+		uint8_t reserved;
+	};
+
+	// nullptr if the image is not listed
+	const ENTRY* find(const uint32_t crc32, const uint8_t sha1[]);
+
+	// the table, without its end marker
+	const ENTRY* entries();
+	int count();
+
+	// replaces the table by a sorted one of count entries, e.g. in a test.
+	// nullptr restores the built-in table.
+	void setTable(const ENTRY* table, const int count);
+}
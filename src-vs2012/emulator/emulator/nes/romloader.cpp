@@ -8,50 +8,147 @@
 #include "internals.h"
 #include "debug.h"
 #include "rom.h"
+#include "hash.h"
+#include "romdb.h"
+
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
 
 static MIRRORING mirroring;
 static uint8_t mapper;
 static uint8_t prgCount, chrCount;
 static flag_set<uint8_t,ROMCONTROL1> romCtrl;
 static flag_set<uint8_t,ROMCONTROL2> romCtrl2;
-static char *trainerData;
+static const char *trainerData;
 static size_t trainerSize;
-static char *imageData;
+static const char *imageData;
 static size_t imageSize;
-static char *vromData;
+static const char *vromData;
 static size_t vromSize;
 
+// the whole file, either mapped read-only or copied into fileBuffer.
+// A mapping shares its pages with every other process that maps the file.
+static const char *fileView;
+static size_t fileViewSize;
+static std::vector<char> fileBuffer;
+
+// of PRG and CHR
+static uint32_t imageCRC;
+static uint8_t imageSHA1[hash::SHA1_SIZE];
+static bool headerCorrected;
+
 namespace rom
 {
-	bool load( const _TCHAR *romFile )
+	// maps a regular file, nullptr if that is not possible
+	static const char* map(const _TCHAR *romFile, size_t& size)
 	{
-		FILE *fp=NULL;
-		uint8_t nesMagic[4]={0};
-		uint8_t reserved[8]={0};
+#ifdef _WIN32
+		HANDLE file=CreateFile(romFile, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file==INVALID_HANDLE_VALUE) return nullptr;
+		LARGE_INTEGER fileSize;
+		void* view=nullptr;
+		if (GetFileType(file)==FILE_TYPE_DISK && GetFileSizeEx(file, &fileSize) && fileSize.QuadPart>0 && fileSize.QuadPart<=0x7FFFFFFF)
+		{
+			HANDLE mapping=CreateFileMapping(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			if (mapping)
+			{
+				view=MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+				// the view keeps the file
+				CloseHandle(mapping);
+			}
+			size=(size_t)fileSize.QuadPart;
+		}
+		CloseHandle(file);
+		return (const char*)view;
+#else
+		const int fd=open(romFile, O_RDONLY);
+		if (fd<0) return nullptr;
+		void* view=nullptr;
+		struct stat st;
+		if (fstat(fd, &st)==0 && S_ISREG(st.st_mode) && st.st_size>0)
+		{
+			size=(size_t)st.st_size;
+			view=mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+			if (view==MAP_FAILED) view=nullptr;
+		}
+		// the mapping keeps the file
+		close(fd);
+		return (const char*)view;
+#endif
+	}
 
-		// open rom file
+	static void unmap()
+	{
+		if (fileView==nullptr) return;
+#ifdef _WIN32
+		UnmapViewOfFile(fileView);
+#else
+		munmap((void*)fileView, fileViewSize);
+#endif
+		fileView=nullptr;
+	}
+
+	// reads what cannot be mapped, e.g. a pipe
+	static bool read(const _TCHAR *romFile, std::vector<char>& buffer)
+	{
+		FILE *fp=NULL;
 		_tfopen_s(&fp, romFile, _T("rb"));
-		if (fp==NULL)
+		if (fp==NULL) return false;
+		buffer.clear();
+		char block[0x4000];
+		for (size_t n; (n=fread(block, 1, sizeof(block), fp))>0; )
+			buffer.insert(buffer.end(), block, block+n);
+		fclose(fp);
+		return true;
+	}
+
+	// hashes the banks and corrects the header if the database knows them
+	static void identify()
+	{
+		imageCRC=hash::crc32(vromData, vromSize, hash::crc32(imageData, imageSize));
+		hash::Sha1 sha1;
+		sha1.update(imageData, imageSize);
+		sha1.update(vromData, vromSize);
+		sha1.finish(imageSHA1);
+		printf("[ ] CRC32 : %08X\n", imageCRC);
+
+		const romdb::ENTRY* entry=romdb::find(imageCRC, imageSHA1);
+		headerCorrected=(entry!=nullptr);
+		if (entry)
 		{
-			_tprintf(_T("Couldn't open %s (error code %d)\n"), romFile, errno);
-			return false;
+			mapper=entry->mapper;
+			mirroring=(MIRRORING)entry->mirroring;
+			romCtrl.change(ROMCONTROL1::BATTERYPACK, (entry->flags&romdb::BATTERY)!=0);
+			printf("[!] Header corrected from the database: mapper #%u, mirroring type %u, SRAM present %u\n", mapper, (unsigned)mirroring, romCtrl[ROMCONTROL1::BATTERYPACK]);
 		}
+	}
 
+	// points the rom at the banks in the image, which must outlive it
+	static bool parse(const char *data, const size_t size)
+	{
 		// check signature
-		fread(nesMagic,4,1,fp);
-		if (memcmp(nesMagic,"NES",3))
+		if (size<16 || memcmp(data,"NES",3))
 		{
 			ERROR(INVALID_ROM, INVALID_FILE_SIGNATURE);
-			goto onError;
+			return false;
 		}
 
 		puts("[-] loading...");
 
-		fread(&prgCount,1,1,fp);
-		fread(&chrCount,1,1,fp);
-		fread(&romCtrl,1,1,fp);
-		fread(&romCtrl2,1,1,fp);
-		fread(&reserved,8,1,fp);
+		prgCount=(uint8_t)data[4];
+		chrCount=(uint8_t)data[5];
+		memcpy(&romCtrl, data+6, 1);
+		memcpy(&romCtrl2, data+7, 1);
 
 		printf("[ ] %u * 16K ROM Banks\n", prgCount);
 		printf("[ ] %u * 8K CHR Banks\n", chrCount);
@@ -65,52 +162,104 @@ namespace rom
 		mirroring=romCtrl[ROMCONTROL1::VERTICALM]?MIRRORING::VERTICAL:MIRRORING::HORIZONTAL;
 		if (romCtrl[ROMCONTROL1::FOURSCREEN]) mirroring=MIRRORING::FOURSCREEN;
 
-		printf("[ ] Mirroring type : %u\n", mirroring);
+		printf("[ ] Mirroring type : %u\n", (unsigned)mirroring);
 		printf("[ ] Fourscreen mode : %u\n", romCtrl[ROMCONTROL1::FOURSCREEN]);
 		printf("[ ] Trainer data present : %u\n", romCtrl[ROMCONTROL1::TRAINER]);
 		printf("[ ] SRAM present : %u\n", romCtrl[ROMCONTROL1::BATTERYPACK]);
-    
-		// read trainer data (if present)
-		if (romCtrl[ROMCONTROL1::TRAINER])
-		{
-			trainerSize = 512;
-			trainerData = new char[trainerSize];
-			assert(trainerData != NULL);
-			if (1 != fread(trainerData, 512, 1, fp)) goto incomplete;
-		}
+
+		size_t offset=16;
+		// trainer data (if present)
+		trainerSize=romCtrl[ROMCONTROL1::TRAINER]?512:0;
+		trainerData=trainerSize?data+offset:nullptr;
+		offset+=trainerSize;
 
 		puts("[ ] reading ROM image...");
-		// read rom image
-		imageSize = prgCount*0x4000;
-		imageData = new char[imageSize];
-		assert(imageData != NULL);
-		if (prgCount != fread(imageData, 0x4000, prgCount, fp))
+		imageSize=prgCount*0x4000;
+		imageData=data+offset;
+		offset+=imageSize;
+
+		puts("[ ] reading VROM data...");
+		vromSize=chrCount*0x2000;
+		vromData=data+offset;
+		offset+=vromSize;
+
+		if (offset>size)
 		{
-	incomplete:
 			ERROR(INVALID_ROM, UNEXPECTED_END_OF_FILE);
-	onError:
-			fclose(fp);
-			return 0;
+			return false;
 		}
 
-		puts("[ ] reading VROM data...");
-		// read VROM
-		vromSize = chrCount*0x2000;
-		vromData = new char[vromSize];
-		assert(vromData != NULL);
-		if (chrCount != fread(vromData, 0x2000, chrCount, fp)) goto incomplete;
-
-		// done. close file
-		fclose(fp);
+		identify();
 		puts("[-] loaded!");
 		return true;
 	}
 
+	bool load( const _TCHAR *romFile )
+	{
+		unload();
+
+		size_t size=0;
+		fileView=map(romFile, size);
+		if (fileView)
+		{
+			fileViewSize=size;
+		}else if (!read(romFile, fileBuffer))
+		{
+			_tprintf(_T("Couldn't open %s (error code %d)\n"), romFile, errno);
+			return false;
+		}
+
+		const bool ok=fileView?parse(fileView, fileViewSize):parse(fileBuffer.data(), fileBuffer.size());
+		if (!ok) unload();
+		return ok;
+	}
+
+	bool load( const void *data, const size_t size )
+	{
+		unload();
+		fileBuffer.assign((const char*)data, (const char*)data+size);
+		const bool ok=parse(fileBuffer.data(), fileBuffer.size());
+		if (!ok) unload();
+		return ok;
+	}
+
+	bool mapped()
+	{
+		return fileView!=nullptr;
+	}
+
 	void unload()
 	{
-		SAFE_DELETE(trainerData);
-		SAFE_DELETE(imageData);
-		SAFE_DELETE(vromData);
+		unmap();
+		fileBuffer.clear();
+		trainerData=nullptr;
+		imageData=nullptr;
+		vromData=nullptr;
+		trainerSize=imageSize=vromSize=0;
+		prgCount=chrCount=0;
+		imageCRC=0;
+		memset(imageSHA1, 0, sizeof(imageSHA1));
+		headerCorrected=false;
+	}
+
+	uint32_t crc32()
+	{
+		return imageCRC;
+	}
+
+	const uint8_t* sha1()
+	{
+		return imageSHA1;
+	}
+
+	bool correctedHeader()
+	{
+		return headerCorrected;
+	}
+
+	bool hasBattery()
+	{
+		return romCtrl[ROMCONTROL1::BATTERYPACK];
 	}
 
 	int mapperType()
@@ -167,4 +316,60 @@ namespace rom
 	{
 		return chrCount*2;
 	}
-}
\ No newline at end of file
+}
+
+// unit tests
+class RomLoaderTest : public TestCase
+{
+public:
+	virtual const char* name()
+	{
+		return "Rom Loader Test";
+	}
+
+	virtual TestResult run()
+	{
+		const std::basic_string<_TCHAR> file=tempFile(_T("rom.test"));
+		// one 16K PRG bank and one 8K CHR bank, vertical mirroring, mapper 1
+		static char image[16+0x4000+0x2000];
+		memset(image, 0, sizeof(image));
+		memcpy(image, "NES\x1A\x01\x01\x11\x00", 8);
+		image[16]=(char)0xA9;
+		image[16+0x4000-1]=(char)0xC0;
+		image[16+0x4000]=0x3C;
+
+		FILE* fp=nullptr;
+		_tfopen_s(&fp, file.c_str(), _T("wb"));
+		tassert(fp!=nullptr);
+		tassert(fwrite(image, sizeof(image), 1, fp)==1);
+		fclose(fp);
+
+		// a regular file is mapped
+		tassert(rom::load(file.c_str()));
+		tassert(rom::mapped());
+		tassert(rom::mapperType()==1 && rom::mirrorMode()==MIRRORING::VERTICAL);
+		tassert(rom::count8KPRG()==2 && rom::sizeOfImage()==0x4000);
+		tassert(rom::count8KCHR()==1 && rom::sizeOfVROM()==0x2000);
+		tassert(memcmp(rom::getImage(), image+16, 0x4000)==0);
+		tassert(memcmp(rom::getVROM(), image+16+0x4000, 0x2000)==0);
+		// the header and trainer are not hashed
+		tassert(rom::crc32()==hash::crc32(image+16, sizeof(image)-16));
+		tassert(!rom::correctedHeader());
+		// Windows can't delete a mapped file
+		rom::unload();
+		tassert(!rom::mapped());
+		_tremove(file.c_str());
+
+		// an image in memory is copied
+		tassert(rom::load(image, sizeof(image)));
+		tassert(!rom::mapped());
+		image[16]=0;
+		tassert(rom::getImage()[0]==(char)0xA9 && rom::getVROM()[0]==0x3C);
+
+		rom::unload();
+		tassert(rom::getImage()==nullptr && rom::count8KPRG()==0);
+		return SUCCESS;
+	}
+};
+
+registerTestCase(RomLoaderTest);
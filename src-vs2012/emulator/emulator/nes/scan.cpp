@@ -0,0 +1,395 @@
+#include "../stdafx.h"
+
+// local header files
+#include "../macros.h"
+#include "../types/types.h"
+#include "../types/quoted.h"
+#include "../unittest/framework.h"
+
+#include "internals.h"
+#include "debug.h"
+#include "dirty.h"
+#include "state.h"
+#include "rom.h"
+#include "opcodes.h"
+#include "cpu.h"
+#include "ppu.h"
+#include "emu.h"
+#include "pacer.h"
+#include "telemetry.h"
+#include "scan.h"
+
+#include "../../KFramework/KThreadPool.h"
+
+#include <algorithm>
+#include <atomic>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#endif
+
+namespace scan
+{
+	static const char* const NAMES[_STATUS_MAX]={
+		"ok", "load-failed", "unsupported-mapper", "invalid-opcode", "memory-error",
+		"hang", "stopped", "failed", "crashed"
+	};
+
+	const char* name(const STATUS status)
+	{
+		return NAMES[status];
+	}
+
+	// the probe, for the error hook
+	static int probeFrames;
+	static long long probeStart;
+
+	static void printResult(const STATUS status, const char* detail)
+	{
+		const double seconds=(pacer::now()-probeStart)/1e9;
+		// on a line of its own, whatever was printed before
+		printf("\nprobe %s %d %d %d %08X %d %.1f %s\n", NAMES[status], rom::mapperType(),
+			(int)(rom::sizeOfImage()/1024), (int)(rom::sizeOfVROM()/1024), rom::crc32(),
+			probeFrames, (probeFrames>0 && seconds>0)?probeFrames/seconds:0.0, detail);
+		fflush(stdout);
+	}
+
+	static STATUS statusOf(const EMUERROR type, const EMUERRORSUBTYPE stype)
+	{
+		switch (type)
+		{
+		case INVALID_ROM:
+			return (stype==UNSUPPORTED_MAPPER_TYPE)?UNSUPPORTED_MAPPER:LOAD_FAILED;
+		case INVALID_MEMORY_ACCESS:
+			// mapper::setup() rejects the image size
+			return (stype==MAPPER_FAILURE)?LOAD_FAILED:MEMORY_ERROR;
+		case INVALID_INSTRUCTION:
+			return INVALID_OPCODE;
+		default:
+			return FAILED;
+		}
+	}
+
+	static void onError(const EMUERROR type, const EMUERRORSUBTYPE stype)
+	{
+		char detail[64];
+		sprintf(detail, "%ls@%04X", debug::subtypeName(stype), valueOf(cpu::pc()));
+		printResult(statusOf(type, stype), detail);
+		exit(1);
+	}
+
+	int probe(const _TCHAR* file, const int frames)
+	{
+		debug::setErrorHook(onError);
+		probeFrames=0;
+		probeStart=pacer::now();
+		emu::reset();
+		if (!emu::load(file) || !emu::setup())
+		{
+			printResult(LOAD_FAILED, "-");
+			return 1;
+		}
+		ppu::enableOutput(false);
+
+		probeStart=pacer::now();
+		uint64_t interrupts=0;
+		int quietFrames=0;
+		int low=0, high=0; // program counter at the end of the quiet frames
+		while (probeFrames<frames)
+		{
+			if (!emu::nextFrame())
+			{
+				printResult(STOPPED, "-");
+				return 1;
+			}
+			probeFrames++;
+
+			const uint64_t taken=telemetry::counters.nmis+telemetry::counters.irqs;
+			const int pc=valueOf(cpu::pc());
+			low=min(low, pc);
+			high=max(high, pc);
+			if (taken!=interrupts || high-low>=8)
+			{
+				interrupts=taken;
+				quietFrames=0;
+				low=high=pc;
+			}else if (++quietFrames>=HANG_FRAMES)
+			{
+				char detail[16];
+				sprintf(detail, "PC=%04X", pc);
+				printResult(HANG, detail);
+				return 1;
+			}
+		}
+		printResult(OK, "-");
+		return 0;
+	}
+
+	bool parse(const char* line, RESULT& result)
+	{
+		char status[32];
+		unsigned crc=0;
+		int consumed=0;
+		if (sscanf(line, "probe %31s %d %d %d %x %d %lf %n", status, &result.mapper, &result.prgSize, &result.chrSize, &crc, &result.frames, &result.fps, &consumed)<7 || consumed==0)
+			return false;
+
+		const char* const* found=std::find_if(NAMES, NAMES+_STATUS_MAX, [&](const char* n) {return strcmp(n, status)==0;});
+		if (found==NAMES+_STATUS_MAX) return false;
+		result.status=(STATUS)(found-NAMES);
+		result.crc32=crc;
+
+		result.detail=line+consumed;
+		while (!result.detail.empty() && (result.detail.back()=='\n' || result.detail.back()=='\r'))
+			result.detail.pop_back();
+		if (result.detail=="-") result.detail.clear();
+		return true;
+	}
+
+	std::string narrow(const _TCHAR* text)
+	{
+#ifdef _UNICODE
+		const int size=WideCharToMultiByte(CP_UTF8, 0, text, -1, nullptr, 0, nullptr, nullptr);
+		std::string s(size>0?size-1:0, '\0');
+		if (size>1) WideCharToMultiByte(CP_UTF8, 0, text, -1, &s[0], size, nullptr, nullptr);
+		return s;
+#else
+		return text;
+#endif
+	}
+
+	static bool isRom(const tstring& file)
+	{
+		return file.size()>4 && _tcsicmp(file.c_str()+file.size()-4, _T(".nes"))==0;
+	}
+
+	static void findRoms(const tstring& dir, std::vector<tstring>& files)
+	{
+#ifdef _WIN32
+		WIN32_FIND_DATA data;
+		HANDLE find=FindFirstFile((dir+_T("\\*")).c_str(), &data);
+		if (find==INVALID_HANDLE_VALUE) return;
+		do
+		{
+			const tstring name=data.cFileName;
+			if (name==_T(".") || name==_T("..")) continue;
+			if (data.dwFileAttributes&FILE_ATTRIBUTE_DIRECTORY)
+				findRoms(dir+_T("\\")+name, files);
+			else if (isRom(name))
+				files.push_back(dir+_T("\\")+name);
+		} while (FindNextFile(find, &data));
+		FindClose(find);
+#else
+		DIR* d=opendir(dir.c_str());
+		if (d==nullptr) return;
+		while (dirent* entry=readdir(d))
+		{
+			const tstring name=entry->d_name;
+			if (name=="." || name=="..") continue;
+			const tstring path=dir+"/"+name;
+			struct stat st;
+			if (stat(path.c_str(), &st)!=0) continue;
+			if (S_ISDIR(st.st_mode))
+				findRoms(path, files);
+			else if (isRom(name))
+				files.push_back(path);
+		}
+		closedir(d);
+#endif
+	}
+
+	// an argument for the shell popen() starts
+	static tstring quote(const tstring& arg)
+	{
+#ifdef _WIN32
+		// file names can't contain quotes
+		return _T("\"")+arg+_T("\"");
+#else
+		tstring quoted="'";
+		for (size_t i=0; i<arg.size(); i++)
+		{
+			if (arg[i]=='\'') quoted+="'\\''";
+			else quoted+=arg[i];
+		}
+		return quoted+"'";
+#endif
+	}
+
+	bool runSelf(const tstring& self, const std::vector<tstring>& arguments, const std::function<void (const char* line)>& onLine, std::string& ended)
+	{
+		tstring command=quote(self);
+		for (size_t i=0; i<arguments.size(); i++) command+=_T(" ")+quote(arguments[i]);
+		command+=_T(" 2>&1");
+#ifdef _WIN32
+		// cmd.exe drops the outer quotes
+		command=_T("\"")+command+_T("\"");
+#endif
+
+		FILE* pipe=_tpopen(command.c_str(), _T("r"));
+		if (pipe==nullptr)
+		{
+			ended="unable to start";
+			return false;
+		}
+		char line[1024];
+		while (fgets(line, sizeof(line), pipe)) onLine(line);
+		const int code=_pclose(pipe);
+
+		char text[32];
+#ifdef _WIN32
+		sprintf(text, "exit code %d", code);
+#else
+		if (WIFSIGNALED(code))
+			sprintf(text, "signal %d", WTERMSIG(code));
+		else
+			sprintf(text, "exit code %d", WEXITSTATUS(code));
+#endif
+		ended=text;
+		return true;
+	}
+
+	static void runProbe(const tstring& self, const tstring& file, const int frames, RESULT& result)
+	{
+		_TCHAR count[16];
+#ifdef _UNICODE
+		swprintf(count, _countof(count), L"%d", frames);
+#else
+		sprintf(count, "%d", frames);
+#endif
+		std::vector<tstring> arguments;
+		arguments.push_back(_T("--probe"));
+		arguments.push_back(file);
+		arguments.push_back(count);
+
+		result.file=narrow(file.c_str());
+		result.status=CRASHED;
+		result.mapper=-1;
+		result.prgSize=result.chrSize=0;
+		result.crc32=0;
+		result.frames=0;
+		result.fps=0;
+
+		bool found=false;
+		std::string ended;
+		runSelf(self, arguments, [&](const char* line) {
+			if (!found) found=parse(line, result);
+		}, ended);
+		if (!found) result.detail=ended;
+	}
+
+	bool writeReport(const _TCHAR* report, const std::vector<RESULT>& results)
+	{
+		FILE* fp=nullptr;
+		_tfopen_s(&fp, report, _T("wb"));
+		if (fp==nullptr) return false;
+
+		const size_t length=_tcslen(report);
+		const bool json=length>5 && _tcsicmp(report+length-5, _T(".json"))==0;
+		if (json) fputs("[", fp);
+		else fputs("file,status,mapper,prg_kb,chr_kb,crc32,frames,fps,detail\n", fp);
+		for (size_t i=0; i<results.size(); i++)
+		{
+			const RESULT& r=results[i];
+			if (json)
+			{
+				fputs(i>0?",\n{\"file\":":"\n{\"file\":", fp);
+				writeQuoted(fp, r.file, true);
+				fprintf(fp, ",\"status\":\"%s\",\"mapper\":%d,\"prg_kb\":%d,\"chr_kb\":%d,\"crc32\":\"%08X\",\"frames\":%d,\"fps\":%.1f,\"detail\":",
+					NAMES[r.status], r.mapper, r.prgSize, r.chrSize, r.crc32, r.frames, r.fps);
+				writeQuoted(fp, r.detail, true);
+				fputs("}", fp);
+			}else
+			{
+				writeQuoted(fp, r.file, false);
+				fprintf(fp, ",%s,%d,%d,%d,%08X,%d,%.1f,", NAMES[r.status], r.mapper, r.prgSize, r.chrSize, r.crc32, r.frames, r.fps);
+				writeQuoted(fp, r.detail, false);
+				fputs("\n", fp);
+			}
+		}
+		if (json) fputs("\n]\n", fp);
+		const bool ok=!ferror(fp);
+		fclose(fp);
+		return ok;
+	}
+
+	bool run(const _TCHAR* self, const _TCHAR* dir, const _TCHAR* report, const int frames, const int threads)
+	{
+		std::vector<tstring> files;
+		findRoms(dir, files);
+		std::sort(files.begin(), files.end());
+		printf("[-] scanning %d roms...\n", (int)files.size());
+
+		std::vector<RESULT> results(files.size());
+		std::atomic<int> done(0);
+		{
+			KThreadPool pool(threads);
+			for (size_t i=0; i<files.size(); i++)
+			{
+				pool.submit([&, i]() {
+					runProbe(self, files[i], frames, results[i]);
+					printf("[ ] %d/%d %s: %s\n", ++done, (int)files.size(), results[i].file.c_str(), NAMES[results[i].status]);
+				});
+			}
+			pool.wait();
+		}
+
+		int counts[_STATUS_MAX]={0};
+		for (size_t i=0; i<results.size(); i++) counts[results[i].status]++;
+		for (int i=0; i<_STATUS_MAX; i++)
+		{
+			if (counts[i]) printf("[-] %s: %d\n", NAMES[i], counts[i]);
+		}
+		return writeReport(report, results);
+	}
+}
+
+// unit tests
+class ScanTest : public TestCase
+{
+public:
+	virtual const char* name()
+	{
+		return "Rom Scanner Test";
+	}
+
+	virtual bool parallel()
+	{
+		return true;
+	}
+
+	virtual TestResult run()
+	{
+		std::vector<scan::RESULT> results(2);
+		tassert(scan::parse("probe ok 4 256 128 1A2B3C4D 600 2500.0 -\n", results[0]));
+		tassert(results[0].status==scan::OK && results[0].mapper==4 && results[0].prgSize==256 && results[0].chrSize==128);
+		tassert(results[0].crc32==0x1A2B3C4D && results[0].frames==600 && results[0].detail.empty());
+		tassert(scan::parse("probe invalid-opcode 0 32 8 00000001 12 0.5 INVALID_OPCODE@C123\r\n", results[1]));
+		tassert(results[1].status==scan::INVALID_OPCODE && results[1].detail=="INVALID_OPCODE@C123");
+
+		scan::RESULT other;
+		tassert(!scan::parse("[ ] Mapper : #4", other));
+		tassert(!scan::parse("probe sideways 0 32 8 00000001 12 0.5 -", other));
+
+		results[0].file="a,b.nes";
+		results[1].file="dir\\\"q\".nes";
+		const std::basic_string<_TCHAR> csv=tempFile(_T("scan.csv"));
+		tassert(scan::writeReport(csv.c_str(), results));
+		tassert(fileIs(csv.c_str(),
+			"file,status,mapper,prg_kb,chr_kb,crc32,frames,fps,detail\n"
+			"\"a,b.nes\",ok,4,256,128,1A2B3C4D,600,2500.0,\"\"\n"
+			"\"dir\\\"\"q\"\".nes\",invalid-opcode,0,32,8,00000001,12,0.5,\"INVALID_OPCODE@C123\"\n"));
+		const std::basic_string<_TCHAR> json=tempFile(_T("scan.json"));
+		tassert(scan::writeReport(json.c_str(), results));
+		tassert(fileIs(json.c_str(),
+			"[\n{\"file\":\"a,b.nes\",\"status\":\"ok\",\"mapper\":4,\"prg_kb\":256,\"chr_kb\":128,\"crc32\":\"1A2B3C4D\",\"frames\":600,\"fps\":2500.0,\"detail\":\"\"},\n"
+			"{\"file\":\"dir\\\\\\\"q\\\".nes\",\"status\":\"invalid-opcode\",\"mapper\":0,\"prg_kb\":32,\"chr_kb\":8,\"crc32\":\"00000001\",\"frames\":12,\"fps\":0.5,\"detail\":\"INVALID_OPCODE@C123\"}\n]\n"));
+		return SUCCESS;
+	}
+};
+
+registerTestCase(ScanTest);
@@ -0,0 +1,72 @@
+// rom library scanner
+//
+// scan::run() finds every .nes file under a directory and boots each one
+// headless for a number of frames. The machine is global, so each rom runs
+// in a process of its own, started as "<self> --probe <rom> <frames>", a few
+// at a time on a thread pool. A rom that crashes its process is reported
+// rather than ending the scan.
+//
+// The probe prints a single line for the scanner:
+//   probe <status> <mapper> <PRG KB> <CHR KB> <crc32> <frames> <fps> <detail>
+// An error report ends the probe with the matching status; a game that
+// takes no interrupt for HANG_FRAMES frames while its program counter stays
+// within a few bytes is a hang.
+
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace scan
+{
+	typedef std::basic_string<_TCHAR> tstring;
+
+	enum STATUS
+	{
+		OK,
+		LOAD_FAILED,
+		UNSUPPORTED_MAPPER,
+		INVALID_OPCODE,
+		MEMORY_ERROR,
+		HANG,
+		STOPPED, // the cpu stopped running
+		FAILED, // other errors
+		CRASHED, // no result from the probe
+		_STATUS_MAX
+	};
+
+	const int DEFAULT_FRAMES=600;
+	const int HANG_FRAMES=120;
+
+	struct RESULT
+	{
+		std::string file;
+		STATUS status;
+		int mapper;
+		int prgSize, chrSize; // KB
+		uint32_t crc32;
+		int frames;
+		double fps;
+		std::string detail;
+	};
+
+	const char* name(const STATUS status);
+
+	// the child process, returns its exit code
+	int probe(const _TCHAR* rom, const int frames);
+	// false if the line is not a probe result
+	bool parse(const char* line, RESULT& result);
+
+	// a json report if the file name ends with .json, csv otherwise
+	bool writeReport(const _TCHAR* report, const std::vector<RESULT>& results);
+
+	// utf-8 for reports
+	std::string narrow(const _TCHAR* text);
+
+	// runs "<self> <arguments>" with its errors merged into its output and
+	// hands each line of the output to onLine. false if it couldn't start;
+	// ended tells how it ended ("exit code 1", "signal 11").
+	bool runSelf(const tstring& self, const std::vector<tstring>& arguments, const std::function<void (const char* line)>& onLine, std::string& ended);
+
+	// no threads: one per hardware thread
+	bool run(const _TCHAR* self, const _TCHAR* dir, const _TCHAR* report, const int frames=DEFAULT_FRAMES, const int threads=0);
+}
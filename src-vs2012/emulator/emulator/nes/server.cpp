@@ -0,0 +1,291 @@
+#include "../stdafx.h"
+
+// local header files
+#include "../macros.h"
+#include "../types/types.h"
+#include "../unittest/framework.h"
+
+#include "internals.h"
+#include "debug.h"
+#include "dirty.h"
+#include "state.h"
+#include "mmc.h"
+#include "ppu.h"
+#include "emu.h"
+#include "input.h"
+#include "server.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+namespace server
+{
+#ifndef _WIN32
+	const uint32_t JOB_SIGNATURE=STATE_TAG('N','E','S','J');
+	const uint32_t REPLY_SIGNATURE=STATE_TAG('N','E','S','R');
+	const size_t JOB_HEADER_SIZE=20;
+
+	const uint32_t CHUNK_HASH=STATE_TAG('H','A','S','H');
+	const uint32_t CHUNK_RAM=STATE_TAG('R','A','M',' ');
+	const uint32_t CHUNK_SCREENSHOT=STATE_TAG('S','C','R','N');
+
+	// job flags
+	const uint32_t JOB_RAM=1;
+	const uint32_t JOB_SCREENSHOT=2;
+
+	enum STATUS
+	{
+		STATUS_OK=0,
+		STATUS_BAD_JOB=1,
+		STATUS_STOPPED=2
+	};
+
+	// about 4.6 hours of emulated time
+	const uint32_t MAX_FRAMES=1<<20;
+
+	struct JOB
+	{
+		uint32_t frames;
+		uint32_t hashInterval;
+		uint32_t flags;
+		uint32_t inputCount;
+		uint8_t* inputs;
+	};
+
+	static bool readAll(const int fd, void* buffer, size_t size)
+	{
+		uint8_t* p=(uint8_t*)buffer;
+		while (size>0)
+		{
+			const ssize_t n=read(fd, p, size);
+			if (n<0 && errno==EINTR) continue;
+			if (n<=0) return false;
+			p+=n;
+			size-=n;
+		}
+		return true;
+	}
+
+	static bool writeAll(const int fd, const void* buffer, size_t size)
+	{
+		const uint8_t* p=(const uint8_t*)buffer;
+		while (size>0)
+		{
+			const ssize_t n=send(fd, p, size, MSG_NOSIGNAL);
+			if (n<0 && errno==EINTR) continue;
+			if (n<=0) return false;
+			p+=n;
+			size-=n;
+		}
+		return true;
+	}
+
+	// 64-bit FNV-1a over the pixels of the last presented frame
+	static uint64_t hashFrame()
+	{
+		const rgb32_t* pixels=ppu::frameBuffer();
+		uint64_t hash=14695981039346656037ULL;
+		for (int i=0; i<ppu::frameWidth()*ppu::frameHeight(); i++)
+		{
+			hash^=pixels[i];
+			hash*=1099511628211ULL;
+		}
+		return hash;
+	}
+
+	static bool readJob(const int fd, JOB& job)
+	{
+		uint8_t header[JOB_HEADER_SIZE];
+		if (!readAll(fd, header, sizeof(header))) return false;
+
+		state::Reader r(header, sizeof(header));
+		if (r.u32()!=JOB_SIGNATURE) return false;
+		job.frames=r.u32();
+		job.hashInterval=r.u32();
+		job.flags=r.u32();
+		job.inputCount=r.u32();
+		if (job.frames>MAX_FRAMES || job.inputCount>job.frames) return false;
+
+		job.inputs=new uint8_t[job.inputCount*2+1];
+		return readAll(fd, job.inputs, job.inputCount*2);
+	}
+
+	static size_t writeReply(state::Writer& w, const STATUS status, const uint32_t frames, const uint64_t hashes[], const uint32_t hashCount, const uint32_t flags)
+	{
+		w.u32(REPLY_SIGNATURE);
+		w.u32(status);
+		w.u32(frames);
+		if (hashCount>0)
+		{
+			w.beginChunk(CHUNK_HASH);
+			for (uint32_t i=0; i<hashCount; i++)
+			{
+				w.u64(hashes[i]);
+			}
+			w.endChunk();
+		}
+		if (flags&JOB_RAM)
+		{
+			w.beginChunk(CHUNK_RAM);
+			w.bytes(ram.bank0, sizeof(ram.bank0));
+			w.bytes(ram.bank6, sizeof(ram.bank6));
+			w.endChunk();
+		}
+		if (flags&JOB_SCREENSHOT)
+		{
+			w.beginChunk(CHUNK_SCREENSHOT);
+			w.u16(ppu::frameWidth());
+			w.u16(ppu::frameHeight());
+			const rgb32_t* pixels=ppu::frameBuffer();
+			for (int i=0; i<ppu::frameWidth()*ppu::frameHeight(); i++)
+			{
+				w.u32(pixels[i]);
+			}
+			w.endChunk();
+		}
+		return w.size();
+	}
+
+	// runs in the child process
+	static void serve(const int fd)
+	{
+		JOB job;
+		job.inputs=nullptr;
+		if (!readJob(fd, job))
+		{
+			uint8_t reply[12];
+			state::Writer w(reply, sizeof(reply));
+			writeReply(w, STATUS_BAD_JOB, 0, nullptr, 0, 0);
+			writeAll(fd, reply, w.size());
+			delete[] job.inputs;
+			return;
+		}
+
+		uint64_t* hashes=new uint64_t[job.hashInterval?job.frames/job.hashInterval+1:1];
+		uint32_t hashCount=0;
+		STATUS status=STATUS_OK;
+		input::FixedProvider joypads;
+		input::setProvider(&joypads);
+		uint32_t frame;
+		for (frame=0; frame<job.frames; frame++)
+		{
+			const bool hashed=(job.hashInterval!=0 && (frame+1)%job.hashInterval==0);
+			const bool last=(frame+1==job.frames);
+			if (frame<job.inputCount)
+			{
+				joypads.set(0, job.inputs[frame*2]);
+				joypads.set(1, job.inputs[frame*2+1]);
+			}else
+			{
+				joypads.set(0, 0);
+				joypads.set(1, 0);
+			}
+
+			// only convert the frames somebody looks at
+			ppu::enableOutput(hashed || (last && (job.flags&JOB_SCREENSHOT)));
+			if (!emu::nextFrame())
+			{
+				status=STATUS_STOPPED;
+				break;
+			}
+			if (hashed) hashes[hashCount++]=hashFrame();
+		}
+
+		// measure, then serialize
+		state::Writer dry(nullptr, 0);
+		const size_t size=writeReply(dry, status, frame, hashes, hashCount, job.flags);
+		uint8_t* reply=new uint8_t[size];
+		state::Writer w(reply, size);
+		writeReply(w, status, frame, hashes, hashCount, job.flags);
+		assert(w.ok());
+		writeAll(fd, reply, size);
+
+		input::setProvider(nullptr);
+		delete[] reply;
+		delete[] hashes;
+		delete[] job.inputs;
+	}
+
+	bool run(const _TCHAR* socketPath, const _TCHAR* romFile, const long long checkpoint)
+	{
+		emu::reset();
+		if (!emu::load(romFile) || !emu::setup())
+		{
+			puts("[X] Unable to load the rom.");
+			return false;
+		}
+
+		// warm up
+		ppu::enableOutput(false);
+		while (emu::frameCount()<checkpoint)
+		{
+			if (!emu::nextFrame())
+			{
+				puts("[X] Program stopped before the checkpoint.");
+				return false;
+			}
+		}
+
+		sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family=AF_UNIX;
+		if (strlen(socketPath)>=sizeof(addr.sun_path))
+		{
+			puts("[X] Socket path is too long.");
+			return false;
+		}
+		strcpy(addr.sun_path, socketPath);
+
+		const int listener=socket(AF_UNIX, SOCK_STREAM, 0);
+		unlink(socketPath);
+		if (listener<0 || bind(listener, (sockaddr*)&addr, sizeof(addr))<0 || listen(listener, SOMAXCONN)<0)
+		{
+			perror("[X] Unable to listen");
+			if (listener>=0) close(listener);
+			return false;
+		}
+
+		// children are reaped automatically
+		signal(SIGCHLD, SIG_IGN);
+
+		printf("[ ] Serving jobs on %s from frame %lld\n", socketPath, emu::frameCount());
+		for (;;)
+		{
+			// buffered output would be flushed by every child otherwise
+			fflush(stdout);
+
+			const int conn=accept(listener, nullptr, nullptr);
+			if (conn<0)
+			{
+				if (errno==EINTR) continue;
+				perror("[X] accept");
+				break;
+			}
+
+			const pid_t pid=fork();
+			if (pid==0)
+			{
+				close(listener);
+				serve(conn);
+				close(conn);
+				_exit(0);
+			}
+			if (pid<0) perror("[X] fork");
+			close(conn);
+		}
+		close(listener);
+		unlink(socketPath);
+		return false;
+	}
+#else
+	bool run(const _TCHAR* socketPath, const _TCHAR* romFile, const long long checkpoint)
+	{
+		puts("[X] Server mode requires fork() and is only available on POSIX systems.");
+		return false;
+	}
+#endif
+}
@@ -0,0 +1,25 @@
+// fork server
+//
+// Loads a rom, runs it up to a checkpoint frame and then serves jobs on a
+// Unix domain socket, one job per connection. Every job runs in a fork()ed
+// child that inherits the warmed-up machine copy-on-write, so rom loading,
+// table setup, unit tests and boot frames are paid only once per sweep.
+//
+// All integers are little-endian.
+//
+// job:   u32 'NESJ', u32 frames, u32 hash interval, u32 flags, u32 input count,
+//        then per frame of input u8 player 1 buttons, u8 player 2 buttons.
+//        buttons are bit masks of BUTTON_* as in input.h, frames past
+//        the end of the input have no button pressed.
+//        flags: 1 = return RAM, 2 = return a screenshot of the last frame.
+// reply: u32 'NESR', u32 status (0 ok, 1 bad job, 2 program stopped),
+//        u32 frames run, followed by chunks framed as in state.h:
+//        'HASH' u64 per hashed frame (every n-th frame of the job),
+//        'RAM ' CPU RAM and SRAM,
+//        'SCRN' u16 width, u16 height, 32-bit pixels.
+
+namespace server
+{
+	// runs until the process is killed, returns false on setup errors
+	bool run(const _TCHAR* socketPath, const _TCHAR* romFile, const long long checkpoint);
+}
@@ -0,0 +1,93 @@
+#include "../stdafx.h"
+
+// local header files
+#include "../macros.h"
+#include "../types/types.h"
+#include "../unittest/framework.h"
+
+#include "internals.h"
+#include "dirty.h"
+#include "state.h"
+
+// unit tests
+class StateTest : public TestCase
+{
+public:
+	virtual const char* name()
+	{
+		return "Save State Format Test";
+	}
+
+	virtual TestResult run()
+	{
+		uint8_t buffer[64];
+
+		puts("checking field encoding...");
+		{
+			state::Writer w(buffer, sizeof(buffer));
+			w.u8(0x1FF);
+			w.u16(0x1234);
+			w.u32(0x89ABCDEF);
+			w.u64(0x0102030405060708ULL);
+			tassert(w.ok() && w.size()==15);
+
+			static const uint8_t expected[]={0xFF, 0x34,0x12, 0xEF,0xCD,0xAB,0x89, 0x08,0x07,0x06,0x05,0x04,0x03,0x02,0x01};
+			tassert(memcmp(buffer, expected, sizeof(expected))==0);
+
+			state::Reader r(buffer, w.size());
+			tassert(r.u8()==0xFF);
+			tassert(r.u16()==0x1234);
+			tassert(r.u32()==0x89ABCDEF);
+			tassert(r.u64()==0x0102030405060708ULL);
+			tassert(r.ok() && r.remaining()==0);
+
+			// reading past the end
+			tassert(r.u8()==0 && !r.ok());
+		}
+
+		puts("checking overflow...");
+		{
+			state::Writer w(buffer, 4);
+			w.u32(1);
+			tassert(w.ok());
+			w.u8(2);
+			tassert(!w.ok() && w.size()==5);
+
+			state::Writer counter(nullptr, 0);
+			counter.u64(0);
+			tassert(!counter.ok() && counter.size()==8);
+		}
+
+		puts("checking chunks...");
+		{
+			state::Writer w(buffer, sizeof(buffer));
+			w.header();
+			w.beginChunk(STATE_TAG('T','E','S','T'));
+			w.u16(0xBEEF);
+			w.endChunk();
+			w.beginChunk(state::CHUNK_CPU);
+			w.u8(0x42);
+			w.endChunk();
+			const size_t size=w.finish();
+			tassert(w.ok() && size==state::HEADER_SIZE+2*state::CHUNK_HEADER_SIZE+3);
+
+			state::Reader image(buffer, size);
+			tassert(image.header());
+
+			state::Reader chunk;
+			tassert(image.findChunk(state::CHUNK_CPU, chunk));
+			tassert(chunk.remaining()==1 && chunk.u8()==0x42);
+			tassert(!image.findChunk(state::CHUNK_PPU, chunk));
+
+			// truncated or damaged images are rejected
+			state::Reader truncated(buffer, size-1);
+			tassert(!truncated.header());
+			buffer[0]^=1;
+			state::Reader damaged(buffer, size);
+			tassert(!damaged.header());
+		}
+		return SUCCESS;
+	}
+};
+
+registerTestCase(StateTest);
@@ -0,0 +1,304 @@
+// portable save state format
+//
+// A state image starts with a fixed header (signature, version, payload size)
+// followed by a sequence of chunks. Each chunk is a four-character tag and a
+// 32-bit payload length followed by the payload itself, so readers can skip
+// chunks they don't understand. All integers are stored little-endian with a
+// fixed width, independent of FAST_TYPE/EXACT_TYPE and of the host compiler.
+
+#include "../types/endian.h"
+
+#define STATE_TAG(a, b, c, d) ((uint32_t)(a)|((uint32_t)(b)<<8)|((uint32_t)(c)<<16)|((uint32_t)(d)<<24))
+
+namespace state
+{
+	const uint32_t SIGNATURE=STATE_TAG('N','E','S','S');
+	const uint32_t VERSION=2;
+
+	const size_t HEADER_SIZE=12;
+	const size_t CHUNK_HEADER_SIZE=8;
+
+	// chunk tags
+	const uint32_t CHUNK_CPU=STATE_TAG('C','P','U',' ');
+	const uint32_t CHUNK_PPU=STATE_TAG('P','P','U',' ');
+	const uint32_t CHUNK_VRAM=STATE_TAG('V','R','A','M'); // optional, pattern tables of CHR-RAM carts
+	const uint32_t CHUNK_MMC=STATE_TAG('M','M','C',' ');
+	const uint32_t CHUNK_MAPPER=STATE_TAG('M','A','P','R');
+	const uint32_t CHUNK_INPUT=STATE_TAG('J','O','Y','P'); // optional, joypad shift registers
+	const uint32_t CHUNK_APU=STATE_TAG('A','P','U',' '); // optional, sound channels and frame counter
+
+	// upper bound of the size of an image, SAVE_COMPLETE_MEMORY included
+	const size_t MAX_SIZE=0x10000;
+
+	// serializes into a caller-provided buffer, never allocates.
+	// a writer without buffer only counts the bytes that would be written.
+	// given the epoch of the image already in the buffer, only pages written
+	// since then are copied (see dirty.h).
+	class Writer
+	{
+	public:
+		Writer(void* buffer, size_t capacity, const dirty::epoch_t since=0):
+			_buffer((uint8_t*)buffer), _capacity(buffer?capacity:0), _pos(0), _chunkStart(INVALID), _overflow(false),
+			_since(since), _previousSize(0), _mismatch(false)
+		{
+			if (_since!=0)
+			{
+				// an incremental update needs a complete image to start from
+				if (_capacity<HEADER_SIZE || endian::load32(_buffer)!=SIGNATURE)
+					_since=0;
+				else
+					_previousSize=endian::load32(_buffer+8);
+			}
+		}
+
+		void header()
+		{
+			assert(_pos==0);
+			u32(SIGNATURE);
+			u32(VERSION);
+			u32(0); // payload size, patched by finish()
+		}
+
+		// returns the total size of the image
+		size_t finish()
+		{
+			assert(_chunkStart==(size_t)INVALID);
+			if (_since!=0 && _pos-HEADER_SIZE!=_previousSize)
+			{
+				// the layout has changed, skipped pages are garbage
+				_mismatch=true;
+			}
+			patch32(8, (uint32_t)(_pos-HEADER_SIZE));
+			return _pos;
+		}
+
+		void beginChunk(const uint32_t tag)
+		{
+			assert(_chunkStart==(size_t)INVALID); // no nesting
+			u32(tag);
+			u32(0); // length, patched by endChunk()
+			_chunkStart=_pos;
+		}
+
+		void endChunk()
+		{
+			assert(_chunkStart!=(size_t)INVALID);
+			patch32(_chunkStart-4, (uint32_t)(_pos-_chunkStart));
+			_chunkStart=INVALID;
+		}
+
+		void u8(const uint32_t v)
+		{
+			if (reserve(1))
+			{
+				_buffer[_pos]=(uint8_t)v;
+			}
+			_pos+=1;
+		}
+
+		void u16(const uint32_t v)
+		{
+			u8(v);
+			u8(v>>8);
+		}
+
+		void u32(const uint32_t v)
+		{
+			if (reserve(4))
+			{
+				endian::store32(_buffer+_pos, v);
+			}
+			_pos+=4;
+		}
+
+		void u64(const uint64_t v)
+		{
+			u32((uint32_t)v);
+			u32((uint32_t)(v>>32));
+		}
+
+		void bytes(const void* src, const size_t size)
+		{
+			if (reserve(size))
+			{
+				memcpy(_buffer+_pos, src, size);
+			}
+			_pos+=size;
+		}
+
+		// memory covered by dirty page tracking, starting at the given page.
+		// in incremental mode clean pages keep what the buffer already holds.
+		void pages(const dirty::REGION region, const void* src, const size_t size)
+		{
+			if (_since==0)
+			{
+				bytes(src, size);
+				return;
+			}
+			if (reserve(size))
+			{
+				for (size_t offset=0; offset<size; offset+=dirty::PAGE_SIZE)
+				{
+					if (dirty::changedSince(region+(int)(offset>>dirty::PAGE_SHIFT), _since))
+					{
+						memcpy(_buffer+_pos+offset, (const uint8_t*)src+offset, min(dirty::PAGE_SIZE, size-offset));
+					}
+				}
+			}
+			_pos+=size;
+		}
+
+		size_t size() const {return _pos;}
+		bool ok() const {return !_overflow && !_mismatch;}
+
+	private:
+		bool reserve(const size_t size)
+		{
+			if (_pos+size<=_capacity) return true;
+			_overflow=true;
+			return false;
+		}
+
+		void patch32(const size_t offset, const uint32_t v)
+		{
+			if (offset+4<=_capacity) endian::store32(_buffer+offset, v);
+		}
+
+		uint8_t* _buffer;
+		size_t _capacity;
+		size_t _pos;
+		size_t _chunkStart;
+		bool _overflow;
+
+		dirty::epoch_t _since;
+		size_t _previousSize;
+		bool _mismatch;
+	};
+
+	// deserializes from a caller-provided buffer.
+	// reading past the end yields zeros and clears ok().
+	// given the epoch at which the machine last matched the image, only pages
+	// written since then are restored.
+	class Reader
+	{
+	public:
+		Reader(): _data(nullptr), _size(0), _pos(0), _underrun(false), _since(0) {}
+		Reader(const void* data, size_t size, const dirty::epoch_t since=0):
+			_data((const uint8_t*)data), _size(size), _pos(0), _underrun(false), _since(since)
+		{
+		}
+
+		// validates the header and the chunk framing of a complete image
+		bool header()
+		{
+			assert(_pos==0);
+			if (u32()!=SIGNATURE) return false;
+			if (u32()!=VERSION) return false;
+			const uint32_t payload=u32();
+			if (!ok() || payload!=_size-HEADER_SIZE) return false;
+
+			// walk chunks
+			for (size_t pos=HEADER_SIZE; pos<_size;)
+			{
+				if (_size-pos<CHUNK_HEADER_SIZE) return false;
+				const uint32_t length=endian::load32(_data+pos+4);
+				if (_size-pos-CHUNK_HEADER_SIZE<length) return false;
+				pos+=CHUNK_HEADER_SIZE+length;
+			}
+			return true;
+		}
+
+		// looks up a chunk in an image validated by header()
+		bool findChunk(const uint32_t tag, Reader& chunk) const
+		{
+			for (size_t pos=HEADER_SIZE; pos+CHUNK_HEADER_SIZE<=_size;)
+			{
+				const uint32_t length=endian::load32(_data+pos+4);
+				if (endian::load32(_data+pos)==tag)
+				{
+					chunk=Reader(_data+pos+CHUNK_HEADER_SIZE, length, _since);
+					return true;
+				}
+				pos+=CHUNK_HEADER_SIZE+length;
+			}
+			return false;
+		}
+
+		uint32_t u8()
+		{
+			if (!available(1)) return 0;
+			return _data[_pos++];
+		}
+
+		uint32_t u16()
+		{
+			const uint32_t lo=u8();
+			return lo|(u8()<<8);
+		}
+
+		uint32_t u32()
+		{
+			if (!available(4)) return 0;
+			const uint32_t v=endian::load32(_data+_pos);
+			_pos+=4;
+			return v;
+		}
+
+		uint64_t u64()
+		{
+			const uint64_t lo=u32();
+			return lo|((uint64_t)u32()<<32);
+		}
+
+		void bytes(void* dest, const size_t size)
+		{
+			if (!available(size))
+			{
+				memset(dest, 0, size);
+				return;
+			}
+			memcpy(dest, _data+_pos, size);
+			_pos+=size;
+		}
+
+		// memory covered by dirty page tracking, starting at the given region.
+		// restored pages are marked as written.
+		void pages(const dirty::REGION region, void* dest, const size_t size)
+		{
+			if (_since==0)
+			{
+				bytes(dest, size);
+				return;
+			}
+			if (!available(size)) return;
+			for (size_t offset=0; offset<size; offset+=dirty::PAGE_SIZE)
+			{
+				if (dirty::changedSince(region+(int)(offset>>dirty::PAGE_SHIFT), _since))
+				{
+					memcpy((uint8_t*)dest+offset, _data+_pos+offset, min(dirty::PAGE_SIZE, size-offset));
+					dirty::mark(region, offset);
+				}
+			}
+			_pos+=size;
+		}
+
+		size_t remaining() const {return _size-_pos;}
+		bool ok() const {return !_underrun;}
+
+	private:
+		bool available(const size_t size)
+		{
+			if (_size-_pos>=size) return true;
+			_pos=_size;
+			_underrun=true;
+			return false;
+		}
+
+		const uint8_t* _data;
+		size_t _size;
+		size_t _pos;
+		bool _underrun;
+
+		dirty::epoch_t _since;
+	};
+}
@@ -0,0 +1,300 @@
+#include "../stdafx.h"
+
+// local header files
+#include "../macros.h"
+#include "../types/types.h"
+#include "../unittest/framework.h"
+
+#include "internals.h"
+#include "debug.h"
+#include "pacer.h"
+#include "telemetry.h"
+
+#include <atomic>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+namespace telemetry
+{
+	static const char SIGNATURE[8]={'N','E','S','T','E','L','E','M'};
+
+	struct Header
+	{
+		char signature[8];
+		uint32_t version;
+		uint32_t recordSize;
+		uint32_t capacity;
+		uint32_t reserved;
+		std::atomic<uint64_t> written;
+	};
+
+	struct Slot
+	{
+		std::atomic<uint32_t> sequence;
+		uint32_t reserved;
+		Record record;
+	};
+
+	enum
+	{
+		__RECORD_SIZE_CHECK=STATIC_ASSERT(sizeof(Record)==80),
+		__HEADER_SIZE_CHECK=STATIC_ASSERT(sizeof(Header)==32),
+		__SLOT_SIZE_CHECK=STATIC_ASSERT(sizeof(Slot)==88)
+	};
+
+	Counters counters;
+
+	static Counters previous;
+	static Record lastRecord;
+	// time stamp counter ticks
+	static uint64_t ticks[_PART_MAX];
+	static uint64_t lastTick;
+	static uint64_t frameStartTick;
+	static long long frameStart; // ns
+
+	// export file
+	static Header* header=nullptr;
+	static Slot* slots=nullptr;
+	static size_t mappedSize;
+#ifdef _WIN32
+	static HANDLE file=INVALID_HANDLE_VALUE;
+	static HANDLE mapping=nullptr;
+#endif
+
+	static void* map(const _TCHAR* name, const size_t size)
+	{
+#ifdef _WIN32
+		file=CreateFile(name, GENERIC_READ|GENERIC_WRITE, FILE_SHARE_READ|FILE_SHARE_WRITE, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file==INVALID_HANDLE_VALUE) return nullptr;
+		mapping=CreateFileMapping(file, nullptr, PAGE_READWRITE, 0, (DWORD)size, nullptr);
+		void* view=mapping?MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size):nullptr;
+		if (view==nullptr)
+		{
+			if (mapping) CloseHandle(mapping);
+			CloseHandle(file);
+			mapping=nullptr;
+			file=INVALID_HANDLE_VALUE;
+		}
+		return view;
+#else
+		const int fd=open(name, O_RDWR|O_CREAT|O_TRUNC, 0644);
+		if (fd<0) return nullptr;
+		void* view=nullptr;
+		if (ftruncate(fd, (off_t)size)==0)
+		{
+			view=mmap(nullptr, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+			if (view==MAP_FAILED) view=nullptr;
+		}
+		// the mapping keeps the file
+		close(fd);
+		return view;
+#endif
+	}
+
+	static void unmap(void* view, const size_t size)
+	{
+#ifdef _WIN32
+		UnmapViewOfFile(view);
+		CloseHandle(mapping);
+		CloseHandle(file);
+		mapping=nullptr;
+		file=INVALID_HANDLE_VALUE;
+#else
+		munmap(view, size);
+#endif
+	}
+
+	bool start(const _TCHAR* name, const int capacity)
+	{
+		assert(capacity>0);
+		stop();
+		const size_t size=sizeof(Header)+capacity*sizeof(Slot);
+		void* view=map(name, size);
+		if (view==nullptr) return false;
+
+		// the file is new and filled with zeros
+		header=(Header*)view;
+		slots=(Slot*)(header+1);
+		mappedSize=size;
+		header->version=VERSION;
+		header->recordSize=sizeof(Record);
+		header->capacity=capacity;
+		header->written.store(0);
+		// readers check the signature last
+		std::atomic_thread_fence(std::memory_order_release);
+		memcpy(header->signature, SIGNATURE, sizeof(SIGNATURE));
+
+		memset(ticks, 0, sizeof(ticks));
+		frameStart=0;
+		return true;
+	}
+
+	void stop()
+	{
+		if (header==nullptr) return;
+		unmap(header, mappedSize);
+		header=nullptr;
+		slots=nullptr;
+	}
+
+	bool active()
+	{
+		return header!=nullptr;
+	}
+
+	void beginFrame()
+	{
+		frameStart=pacer::now();
+		frameStartTick=lastTick=__rdtsc();
+	}
+
+	void lap(const PART part)
+	{
+		const uint64_t now=__rdtsc();
+		ticks[part]+=now-lastTick;
+		lastTick=now;
+	}
+
+	static void publish(const Record& record)
+	{
+		const uint64_t n=header->written.load(std::memory_order_relaxed);
+		Slot& slot=slots[n%header->capacity];
+		slot.sequence.store((uint32_t)(2*n+1), std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		slot.record=record;
+		slot.sequence.store((uint32_t)(2*n+2), std::memory_order_release);
+		header->written.store(n+1, std::memory_order_release);
+	}
+
+	void endFrame(const long long frame)
+	{
+		Record& r=lastRecord;
+		r.frame=frame;
+		r.cycles=(uint32_t)(counters.cycles-previous.cycles);
+		r.instructions=(uint32_t)(counters.instructions-previous.instructions);
+		r.nmis=(uint32_t)(counters.nmis-previous.nmis);
+		r.irqs=(uint32_t)(counters.irqs-previous.irqs);
+		r.prgSwitches=(uint32_t)(counters.prgSwitches-previous.prgSwitches);
+		r.chrSwitches=(uint32_t)(counters.chrSwitches-previous.chrSwitches);
+		r.visiblePPUWrites=(uint32_t)(counters.visiblePPUWrites-previous.visiblePPUWrites);
+		r.oamDMAs=(uint32_t)(counters.oamDMAs-previous.oamDMAs);
+		r.skippedScanlines=(uint32_t)(counters.skippedScanlines-previous.skippedScanlines);
+		r.reserved=0;
+		previous=counters;
+
+		if (frameStart!=0)
+		{
+			r.frameTime=pacer::now()-frameStart;
+			const uint64_t frameTicks=__rdtsc()-frameStartTick;
+			const double scale=frameTicks>0?(double)r.frameTime/frameTicks:0;
+			r.cpuTime=(uint64_t)(ticks[PART_CPU]*scale);
+			r.ppuTime=(uint64_t)(ticks[PART_PPU]*scale);
+			r.presentTime=(uint64_t)(ticks[PART_PRESENT]*scale);
+		}else
+		{
+			r.frameTime=r.cpuTime=r.ppuTime=r.presentTime=0;
+		}
+		memset(ticks, 0, sizeof(ticks));
+		frameStart=0;
+
+		if (header!=nullptr) publish(r);
+	}
+
+	const Record& last()
+	{
+		return lastRecord;
+	}
+
+	static const Header* validHeader(const void* view)
+	{
+		const Header* h=(const Header*)view;
+		if (memcmp(h->signature, SIGNATURE, sizeof(SIGNATURE))!=0) return nullptr;
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (h->version!=VERSION || h->recordSize!=sizeof(Record) || h->capacity==0) return nullptr;
+		return h;
+	}
+
+	uint64_t written(const void* view)
+	{
+		const Header* h=validHeader(view);
+		return h?h->written.load(std::memory_order_acquire):0;
+	}
+
+	bool read(const void* view, const uint64_t n, Record& record)
+	{
+		const Header* h=validHeader(view);
+		if (h==nullptr) return false;
+		const uint64_t count=h->written.load(std::memory_order_acquire);
+		if (n>=count || count-n>h->capacity) return false;
+
+		const Slot& slot=((const Slot*)(h+1))[n%h->capacity];
+		const uint32_t expected=(uint32_t)(2*n+2);
+		if (slot.sequence.load(std::memory_order_acquire)!=expected) return false;
+		record=slot.record;
+		std::atomic_thread_fence(std::memory_order_acquire);
+		// overwritten while copying
+		return slot.sequence.load(std::memory_order_relaxed)==expected;
+	}
+}
+
+// unit tests
+class TelemetryTest : public TestCase
+{
+public:
+	virtual const char* name()
+	{
+		return "Telemetry Export Test";
+	}
+
+	virtual TestResult run()
+	{
+		static const int CAPACITY=4;
+		const std::basic_string<_TCHAR> file=tempFile(_T("telemetry.test"));
+		tassert(telemetry::start(file.c_str(), CAPACITY));
+		tassert(telemetry::active());
+
+		// the file as another process sees it
+		FILE* fp=nullptr;
+		_tfopen_s(&fp, file.c_str(), _T("rb"));
+		tassert(fp!=nullptr);
+
+		for (int i=0; i<6; i++)
+		{
+			telemetry::counters.instructions+=100+i;
+			telemetry::counters.oamDMAs++;
+			telemetry::beginFrame();
+			telemetry::lap(telemetry::PART_CPU);
+			telemetry::lap(telemetry::PART_PPU);
+			telemetry::endFrame(i);
+		}
+		const telemetry::Record& last=telemetry::last();
+		tassert(last.instructions==105 && last.oamDMAs==1);
+		tassert(last.cpuTime+last.ppuTime<=last.frameTime && last.presentTime==0);
+
+		// the file has the header and the ring
+		uint64_t image[(32+CAPACITY*88)/8];
+		tassert(fread(image, 1, sizeof(image), fp)==sizeof(image));
+		fclose(fp);
+		tassert(telemetry::written(image)==6);
+		telemetry::Record record;
+		tassert(!telemetry::read(image, 1, record)); // overwritten
+		tassert(telemetry::read(image, 2, record) && record.frame==2 && record.instructions==102);
+		tassert(telemetry::read(image, 5, record) && record.frame==5);
+		tassert(!telemetry::read(image, 6, record)); // not written yet
+
+		telemetry::stop();
+		tassert(!telemetry::active());
+		_tremove(file.c_str());
+		return SUCCESS;
+	}
+};
+
+registerTestCase(TelemetryTest);
@@ -0,0 +1,89 @@
+// per-frame telemetry
+//
+// The modules count events in telemetry::counters all the time, with plain
+// increments. At the end of each frame the differences since the previous
+// frame form a Record. With an export file open, the records also go to a
+// ring in that file, mapped into memory, and the host time spent in the CPU,
+// PPU and presentation is measured as well. The parts are timed with the
+// time stamp counter, which is cheaper to read than the clock, and converted
+// to nanoseconds with the clock time of the whole frame.
+//
+// The file can be read by another process while the emulator runs:
+//   header  "NESTELEM", version, record size, capacity, reserved   (24 bytes)
+//           records written so far                                  (8 bytes)
+//   slots   capacity * (sequence, reserved, record)
+// Record n lives in slot n%capacity. Its sequence is odd while the slot is
+// being written and 2*n+2 once record n is complete. A reader copies the
+// record between two reads of the sequence and drops it when they differ or
+// the first one is odd (a seqlock), so the emulator never waits for readers.
+// All fields are little-endian.
+
+namespace telemetry
+{
+	const int VERSION=1;
+	const int DEFAULT_CAPACITY=1024; // frames, about 17 seconds
+
+	// cumulative, since the start of the program
+	struct Counters
+	{
+		uint64_t cycles;
+		uint64_t instructions;
+		uint64_t nmis; // taken by the cpu
+		uint64_t irqs;
+		uint64_t prgSwitches; // 8K banks copied
+		uint64_t chrSwitches; // 1K banks copied
+		uint64_t visiblePPUWrites; // to $2000-$2007 while rendering a visible scanline
+		uint64_t oamDMAs;
+		uint64_t skippedScanlines; // visible scanlines not drawn, see emu::setFastForward()
+	};
+
+	extern Counters counters;
+
+	struct Record
+	{
+		uint64_t frame;
+		uint32_t cycles;
+		uint32_t instructions;
+		uint32_t nmis;
+		uint32_t irqs;
+		uint32_t prgSwitches;
+		uint32_t chrSwitches;
+		uint32_t visiblePPUWrites;
+		uint32_t oamDMAs;
+		uint32_t skippedScanlines;
+		uint32_t reserved;
+		// host time, zero unless exporting
+		uint64_t frameTime; // ns
+		uint64_t cpuTime; // ns, with the APU it clocks
+		uint64_t ppuTime; // ns, without presentation
+		uint64_t presentTime; // ns
+	};
+
+	// creates the file and starts exporting
+	bool start(const _TCHAR* file, const int capacity=DEFAULT_CAPACITY);
+	void stop();
+	bool active();
+
+	// host time, measured by the emulation loop while exporting
+	enum PART
+	{
+		PART_CPU,
+		PART_PPU,
+		PART_PRESENT,
+		_PART_MAX
+	};
+	void beginFrame();
+	// charges the time since the previous lap to the part
+	void lap(const PART part);
+
+	// ends the frame: builds its record and exports it
+	void endFrame(const long long frame);
+
+	// the record of the last frame
+	const Record& last();
+
+	// reader side, on a mapped export file
+	// copies record n, false if it is not (or no longer) in the ring
+	bool read(const void* view, const uint64_t n, Record& record);
+	uint64_t written(const void* view);
+}
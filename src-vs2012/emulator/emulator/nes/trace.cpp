@@ -0,0 +1,480 @@
+#include "../stdafx.h"
+
+// local header files
+#include "../macros.h"
+#include "../types/types.h"
+#include "../types/endian.h"
+#include "../types/spsc.h"
+#include "../unittest/framework.h"
+
+#include "internals.h"
+#include "debug.h"
+#include "dirty.h"
+#include "state.h"
+#include "opcodes.h"
+#include "mmc.h"
+#include "ppu.h"
+#include "codec.h"
+#include "trace.h"
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <vector>
+
+namespace trace
+{
+	enum
+	{
+		__RECORD_SIZE_CHECK=STATIC_ASSERT(sizeof(Record)==24)
+	};
+
+	// records of one thread, about 5 frames of instructions
+	static const int RING_SIZE=1<<14;
+
+	static const size_t HEADER_SIZE=16;
+	static const size_t BLOCK_HEADER_SIZE=12;
+
+	struct Ring
+	{
+		spsc_queue<Record,RING_SIZE> queue;
+		uint32_t thread;
+		std::atomic<long long> count; // written by the owner only
+		std::atomic<bool> pushing; // the owner is inside push(), stop() waits
+	};
+
+	static std::mutex ringsLock;
+	static std::vector<Ring*> rings;
+	static std::thread writer;
+	static FILE* output=nullptr;
+	static bool ownsOutput=false;
+	static bool failed=false;
+	static long long total=0;
+
+	static std::atomic<bool> running(false);
+	static std::atomic<bool> stopping(false);
+	static std::atomic<unsigned> session(0);
+	static std::atomic<long long> flushRequested(0);
+	static std::atomic<long long> flushDone(0);
+
+	// the ring of this thread, valid while localSession is current
+	static __declspec(thread) Ring* localRing=nullptr;
+	static __declspec(thread) unsigned localSession=0;
+
+	// records are stored field by field, as the difference to the previous one
+	static void transpose(const Record records[], const size_t count, uint8_t* columns)
+	{
+		const uint8_t* bytes=(const uint8_t*)records;
+		for (size_t j=0; j<sizeof(Record); j++)
+		{
+			uint8_t* column=columns+j*count;
+			uint8_t prev=0;
+			for (size_t i=0; i<count; i++)
+			{
+				const uint8_t b=bytes[i*sizeof(Record)+j];
+				column[i]=b^prev;
+				prev=b;
+			}
+		}
+	}
+
+	static void untranspose(const uint8_t* columns, const size_t count, Record records[])
+	{
+		uint8_t* bytes=(uint8_t*)records;
+		for (size_t j=0; j<sizeof(Record); j++)
+		{
+			const uint8_t* column=columns+j*count;
+			uint8_t prev=0;
+			for (size_t i=0; i<count; i++)
+			{
+				prev^=column[i];
+				bytes[i*sizeof(Record)+j]=prev;
+			}
+		}
+	}
+
+	static void writeBlock(const uint32_t thread, const Record records[], const size_t count)
+	{
+		static uint8_t columns[BLOCK_SIZE*sizeof(Record)];
+		static std::vector<uint8_t> packed(codec::bound(sizeof(columns)));
+
+		transpose(records, count, columns);
+		const size_t size=codec::encode(columns, nullptr, count*sizeof(Record), packed.data(), packed.size());
+		assert(size>0);
+
+		uint8_t header[BLOCK_HEADER_SIZE];
+		endian::store32(header, thread);
+		endian::store32(header+4, (uint32_t)count);
+		endian::store32(header+8, (uint32_t)size);
+		failed|=fwrite(header, sizeof(header), 1, output)!=1;
+		failed|=fwrite(packed.data(), size, 1, output)!=1;
+	}
+
+	static void writeAll()
+	{
+		static Record block[BLOCK_SIZE];
+		for (;;)
+		{
+			const long long request=flushRequested.load();
+			const bool stop=stopping.load();
+
+			std::vector<Ring*> current;
+			{
+				std::lock_guard<std::mutex> guard(ringsLock);
+				current=rings;
+			}
+			size_t written=0;
+			for (size_t i=0; i<current.size(); i++)
+			{
+				const size_t n=current[i]->queue.pop(block, BLOCK_SIZE);
+				if (n>0) writeBlock(current[i]->thread, block, n);
+				written+=n;
+			}
+			if (written>0) continue;
+
+			// everything recorded before the request has been written
+			failed|=fflush(output)!=0;
+			flushDone.store(request);
+			if (stop) break;
+			std::this_thread::sleep_for(std::chrono::milliseconds(2));
+		}
+	}
+
+	void start(FILE* fp)
+	{
+		stop();
+		assert(fp!=nullptr);
+
+		uint8_t header[HEADER_SIZE];
+		memcpy(header, "NESTRACE", 8);
+		endian::store32(header+8, VERSION);
+		endian::store32(header+12, sizeof(Record));
+		failed=fwrite(header, sizeof(header), 1, fp)!=1;
+
+		output=fp;
+		ownsOutput=false;
+		total=0;
+		flushRequested=0;
+		flushDone=0;
+		stopping=false;
+		session++;
+		writer=std::thread(writeAll);
+		running=true;
+	}
+
+	bool start(const _TCHAR* file)
+	{
+		FILE* fp=nullptr;
+		_tfopen_s(&fp, file, _T("wb"));
+		if (fp==nullptr)
+		{
+			_tprintf(_T("Couldn't open %s (error code %d)\n"), file, errno);
+			return false;
+		}
+		start(fp);
+		ownsOutput=true;
+		return true;
+	}
+
+	void stop()
+	{
+		if (!running) return;
+		running=false;
+
+		// detach the recording threads before their rings go away. one
+		// waiting for room in its ring gets it from the writer, still running.
+		// no ring is attached from now on.
+		std::vector<Ring*> attached;
+		{
+			std::lock_guard<std::mutex> guard(ringsLock);
+			attached=rings;
+		}
+		for (size_t i=0; i<attached.size(); i++)
+		{
+			while (attached[i]->pushing.load())
+			{
+				std::this_thread::yield();
+			}
+		}
+		stopping=true;
+		writer.join();
+
+		std::lock_guard<std::mutex> guard(ringsLock);
+		for (size_t i=0; i<rings.size(); i++)
+		{
+			total+=rings[i]->count.load();
+			delete rings[i];
+		}
+		rings.clear();
+		if (ownsOutput) failed|=fclose(output)!=0;
+		if (failed) puts("[!] Unable to write the trace.");
+		output=nullptr;
+	}
+
+	bool active()
+	{
+		return running;
+	}
+
+	void flush()
+	{
+		if (!running) return;
+		const long long request=++flushRequested;
+		while (flushDone.load()<request)
+		{
+			std::this_thread::yield();
+		}
+	}
+
+	long long recorded()
+	{
+		std::lock_guard<std::mutex> guard(ringsLock);
+		long long n=total;
+		for (size_t i=0; i<rings.size(); i++)
+		{
+			n+=rings[i]->count.load();
+		}
+		return n;
+	}
+
+	static Ring* attach()
+	{
+		std::lock_guard<std::mutex> guard(ringsLock);
+		if (!running) return nullptr; // stopped meanwhile
+		Ring* ring=new Ring();
+		ring->count=0;
+		ring->pushing=false;
+		ring->thread=(uint32_t)rings.size();
+		rings.push_back(ring);
+		return ring;
+	}
+
+	static void push(const Record& rec)
+	{
+		if (localSession!=session.load(std::memory_order_relaxed))
+		{
+			// first record of this thread in the trace
+			localRing=attach();
+			if (localRing==nullptr) return;
+			localSession=session;
+		}
+		Ring* ring=localRing;
+		ring->pushing.store(true);
+		if (!running.load())
+		{
+			// stop() has begun and may free the ring once we leave
+			ring->pushing.store(false);
+			return;
+		}
+		// the trace is worthless with gaps, wait for the writer
+		while (!ring->queue.push(rec))
+		{
+			std::this_thread::yield();
+		}
+		ring->count.store(ring->count.load(std::memory_order_relaxed)+1, std::memory_order_relaxed);
+		ring->pushing.store(false, std::memory_order_release);
+	}
+
+	void fetch(Record& rec, const maddr_t pc, const opcode_t opcode, const maddr_t addr, const operand_t value)
+	{
+		rec.frame=(uint32_t)ppu::currentFrame();
+		rec.scanline=(int16_t)ppu::currentScanline();
+		rec.pc=valueOf(pc);
+		rec.addr=valueOf(addr);
+		rec.kind=KIND_INSTRUCTION;
+		rec.opcode=opcode;
+		const int size=opcode::decode(opcode).size;
+		rec.operands[0]=(size>=2)?ram.data(pc+1):0;
+		rec.operands[1]=(size>=3)?ram.data(pc+2):0;
+		rec.value=value;
+	}
+
+	void retire(Record& rec, const maddr_t next, const _reg8_t ra, const _reg8_t rx, const _reg8_t ry, const _reg8_t rp, const _reg8_t rsp, const int cycles)
+	{
+		if (!running.load(std::memory_order_relaxed)) return;
+		rec.next=valueOf(next);
+		rec.a=(uint8_t)ra;
+		rec.x=(uint8_t)rx;
+		rec.y=(uint8_t)ry;
+		rec.p=(uint8_t)rp;
+		rec.sp=(uint8_t)rsp;
+		rec.cycles=(uint8_t)cycles;
+		rec.flags=0;
+		push(rec);
+	}
+
+	void scanline(const long long frameNum, const int scanline, const bool vblank, const bool hit, const bool bgmsk, const bool sprmsk)
+	{
+		if (!running.load(std::memory_order_relaxed)) return;
+		Record rec;
+		memset(&rec, 0, sizeof(rec));
+		rec.kind=KIND_SCANLINE;
+		rec.frame=(uint32_t)frameNum;
+		rec.scanline=(int16_t)scanline;
+		rec.flags=(vblank?FLAG_VBLANK:0)|(hit?FLAG_HIT:0)|(bgmsk?FLAG_BG_VISIBLE:0)|(sprmsk?FLAG_SPR_VISIBLE:0);
+		push(rec);
+	}
+
+	static void print(const Record& rec)
+	{
+		switch (rec.kind)
+		{
+		case KIND_INSTRUCTION:
+			debug::printDisassembly(maddr_t(rec.pc), rec.opcode, rec.operands[0], rec.operands[1], maddr_t(rec.addr), rec.value);
+			debug::printCPUState(maddr_t(rec.next), rec.a, rec.x, rec.y, rec.p, rec.sp, rec.cycles);
+			break;
+		case KIND_SCANLINE:
+			debug::printPPUState(rec.frame, rec.scanline, (rec.flags&FLAG_VBLANK)!=0, (rec.flags&FLAG_HIT)!=0, (rec.flags&FLAG_BG_VISIBLE)!=0, (rec.flags&FLAG_SPR_VISIBLE)!=0);
+			break;
+		}
+	}
+
+	bool convert(FILE* in, FILE* out)
+	{
+		uint8_t header[HEADER_SIZE];
+		if (fread(header, sizeof(header), 1, in)!=1 || memcmp(header, "NESTRACE", 8)!=0)
+		{
+			puts("[X] Not a trace file.");
+			return false;
+		}
+		if (endian::load32(header+8)!=VERSION || endian::load32(header+12)!=sizeof(Record))
+		{
+			puts("[X] Unsupported trace version.");
+			return false;
+		}
+
+		std::vector<uint8_t> packed(codec::bound(BLOCK_SIZE*sizeof(Record)));
+		std::vector<uint8_t> columns(BLOCK_SIZE*sizeof(Record));
+		std::vector<Record> records(BLOCK_SIZE);
+		uint32_t lastThread=0;
+		debug::setOutputFile(out);
+		for (;;)
+		{
+			uint8_t block[BLOCK_HEADER_SIZE];
+			const size_t got=fread(block, 1, sizeof(block), in);
+			if (got==0) break;
+
+			const uint32_t thread=endian::load32(block);
+			const size_t count=endian::load32(block+4);
+			const size_t size=endian::load32(block+8);
+			if (got<sizeof(block) || count==0 || count>BLOCK_SIZE || size>packed.size() || fread(packed.data(), size, 1, in)!=1)
+			{
+				// written up to a crash
+				puts("[!] The trace ends with an incomplete block.");
+				break;
+			}
+			if (!codec::decode(packed.data(), size, columns.data(), nullptr, count*sizeof(Record)))
+			{
+				puts("[X] The trace is corrupted.");
+				debug::setOutputFile(stdout);
+				return false;
+			}
+			untranspose(columns.data(), count, records.data());
+
+			if (thread!=lastThread)
+			{
+				fprintf(out, "===== THREAD %u =====\n", thread);
+				lastThread=thread;
+			}
+			for (size_t i=0; i<count; i++)
+			{
+				print(records[i]);
+			}
+		}
+		debug::setOutputFile(stdout);
+		return true;
+	}
+}
+
+// unit tests
+class TraceTest : public TestCase
+{
+public:
+	virtual const char* name()
+	{
+		return "Binary Trace Test";
+	}
+
+	virtual TestResult run()
+	{
+		FILE* fp=tmpfile();
+		FILE* text=tmpfile();
+		if (fp==nullptr || text==nullptr)
+		{
+			puts("no temporary files, skipped");
+			if (fp) fclose(fp);
+			if (text) fclose(text);
+			return SUCCESS;
+		}
+
+		puts("checking records of two threads...");
+		static const int COUNT=3*trace::BLOCK_SIZE+5;
+		trace::start(fp);
+		tassert(trace::active());
+		std::thread other([]
+		{
+			for (int i=0; i<COUNT; i++)
+			{
+				trace::scanline(i, i%262-1, i%3==0, false, true, false);
+			}
+		});
+		for (int i=0; i<COUNT; i++)
+		{
+			trace::Record rec;
+			trace::fetch(rec, maddr_t(0x8000+i%0x100), 0xEA, maddr_t(0), 0);
+			trace::retire(rec, maddr_t(0x8001+i%0x100), i&0xFF, 1, 2, 0x24, 0xFD, 2);
+		}
+		trace::flush();
+		other.join();
+		trace::stop();
+		tassert(!trace::active() && trace::recorded()==2*COUNT);
+
+		puts("checking the text...");
+		rewind(fp);
+		tassert(trace::convert(fp, text));
+		rewind(text);
+		char line[256];
+		int instructions=0, scanlines=0;
+		bool intact=true;
+		while (fgets(line, sizeof(line), text))
+		{
+			if (strncmp(line, "8000  EA        NOP", 19)==0) instructions++;
+			else if (strncmp(line, "----- FR: ", 10)==0)
+			{
+				long long frame=0;
+				int sl=0;
+				intact&=sscanf(line, "----- FR: %lld SL: %d", &frame, &sl)==2 && sl==frame%262-1;
+				scanlines++;
+			}
+		}
+		tassert(intact && scanlines==COUNT);
+		tassert(instructions==(COUNT+0xFF)/0x100);
+		fclose(text);
+		fclose(fp);
+
+		puts("checking a stop while another thread records...");
+		fp=tmpfile();
+		if (fp!=nullptr)
+		{
+			trace::start(fp);
+			std::atomic<bool> done(false);
+			std::thread recorder([&done]
+			{
+				for (int i=0; !done; i++)
+				{
+					trace::scanline(i, i%262-1, false, false, true, false);
+				}
+			});
+			std::this_thread::sleep_for(std::chrono::milliseconds(5));
+			trace::stop();
+			tassert(!trace::active());
+			done=true;
+			recorder.join();
+			fclose(fp);
+		}
+		return SUCCESS;
+	}
+};
+
+registerTestCase(TraceTest);
@@ -0,0 +1,73 @@
+// binary execution trace
+//
+// With options::WATCH_CPU every instruction leaves a fixed size record, with
+// options::WATCH_RENDERING every scanline does. Records go to a ring
+// owned by the recording thread; a writer thread drains the rings and stores
+// them in blocks of up to BLOCK_SIZE records:
+//   header  "NESTRACE", version, record size          (16 bytes)
+//   block   thread, count, packed size, packed data   (12 bytes + data)
+// Within a block the records are stored field by field, each byte XORed with
+// the same byte of the previous record, and packed by the state codec. Blocks
+// are independent, so a trace cut short by a crash loses at most its last one.
+// convert() turns a trace back into the text of debug::print*().
+
+namespace trace
+{
+	const int VERSION=1;
+	const int BLOCK_SIZE=4096;
+
+	enum KIND
+	{
+		KIND_INSTRUCTION=1,
+		KIND_SCANLINE=2
+	};
+
+	// scanline flags
+	enum
+	{
+		FLAG_VBLANK=1,
+		FLAG_HIT=2,
+		FLAG_BG_VISIBLE=4,
+		FLAG_SPR_VISIBLE=8
+	};
+
+	struct Record
+	{
+		uint32_t frame;
+		int16_t scanline;
+		uint16_t pc; // address of the instruction
+		uint16_t addr; // effective address
+		uint16_t next; // PC after the instruction
+		uint8_t kind;
+		uint8_t opcode;
+		uint8_t operands[2]; // bytes following the opcode
+		uint8_t value; // operand
+		uint8_t a, x, y, p, sp;
+		uint8_t cycles;
+		uint8_t flags;
+	};
+
+	// starts the writer thread, takes over the file
+	void start(FILE* fp);
+	bool start(const _TCHAR* file);
+
+	// writes the remaining records and closes the file
+	void stop();
+
+	bool active();
+
+	// waits until everything recorded so far is in the file
+	void flush();
+
+	// recording threads
+	// fills in the part known before the instruction runs
+	void fetch(Record& rec, const maddr_t pc, const opcode_t opcode, const maddr_t addr, const operand_t value);
+	// completes and records it
+	void retire(Record& rec, const maddr_t next, const _reg8_t ra, const _reg8_t rx, const _reg8_t ry, const _reg8_t rp, const _reg8_t rsp, const int cycles);
+	void scanline(const long long frameNum, const int scanline, const bool vblank, const bool hit, const bool bgmsk, const bool sprmsk);
+
+	long long recorded();
+
+	// offline: prints a binary trace as text
+	bool convert(FILE* in, FILE* out);
+}
@@ -5,17 +5,76 @@
 
 #pragma once
 
+#ifdef _WIN32
 #include "targetver.h"
 
 #define _CRT_SECURE_NO_WARNINGS
+#endif
+
 #include <stdio.h>
-#include <tchar.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #include <stdarg.h>
 #include <assert.h>
 
+#ifdef _WIN32
+#include <tchar.h>
 #include <intrin.h>
+#else
+// POSIX build (gcc/clang): map the MSVC extensions used by the emulator core.
+// the user interface is headless on these platforms.
+#include <errno.h>
+#include <strings.h>
+#include <x86intrin.h>
+
+typedef char _TCHAR;
+#define _T(x) x
+#define _tmain main
+#define _tprintf printf
+#define _tcscmp strcmp
+#define _tcsncmp strncmp
+#define _tcschr strchr
+#define _tcslen strlen
+#define _tstoi atoi
+#define _tremove remove
+#define _tcsicmp strcasecmp
+#define _tcsrchr strrchr
+#define _tpopen popen
+#define _vsnprintf vsnprintf
+#define _pclose pclose
+#define _cdecl
+
+inline int _tfopen_s(FILE** fp, const char* name, const char* mode)
+{
+	*fp=fopen(name, mode);
+	return *fp?0:errno;
+}
+
+// also used on declarations of functions defined in other units,
+// where it is only a hint to MSVC
+#define __forceinline
+#define __declspec(x) __DECLSPEC_##x
+#define __DECLSPEC_align(n) __attribute__((aligned(n)))
+#define __DECLSPEC_noinline __attribute__((noinline))
+#define __DECLSPEC_noreturn __attribute__((noreturn))
+#define __DECLSPEC_thread __thread
+#define __debugbreak() __builtin_trap()
+
+#define _CRT_WIDE(x) L"" x
+#define _countof(a) (sizeof(a)/sizeof((a)[0]))
+
+// __FUNCTION__ is not a string literal and can't be widened by the
+// preprocessor, reports widen it when they are made
+inline const wchar_t* widenFunctionName(const char* name)
+{
+	static __thread wchar_t buffer[128];
+	size_t i=0;
+	for (; name[i]!=0 && i+1<_countof(buffer); i++) buffer[i]=(wchar_t)(unsigned char)name[i];
+	buffer[i]=0;
+	return buffer;
+}
+#define __FUNCTIONW__ widenFunctionName(__FUNCTION__)
+#endif
 
 // TODO: reference additional headers your program requires here
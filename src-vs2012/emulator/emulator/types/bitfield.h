@@ -15,6 +15,9 @@ public:
     };
 
 protected:
+	// dependent base member, for two-phase lookup
+	using value_object<T>::_value;
+
 	static inline bit_field _unchecked_wrapper(const T data)
     {
         bit_field ret;
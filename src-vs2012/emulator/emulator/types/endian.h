@@ -0,0 +1,39 @@
+#pragma once
+
+// fixed-width little-endian integers in byte buffers, independent of the host.
+// used by every file format the emulator writes (states, movies, traces, wav).
+namespace endian
+{
+	inline void store16(uint8_t* p, const uint32_t v)
+	{
+		p[0]=(uint8_t)v;
+		p[1]=(uint8_t)(v>>8);
+	}
+
+	inline void store32(uint8_t* p, const uint32_t v)
+	{
+		store16(p, v);
+		store16(p+2, v>>16);
+	}
+
+	inline void store64(uint8_t* p, const uint64_t v)
+	{
+		store32(p, (uint32_t)v);
+		store32(p+4, (uint32_t)(v>>32));
+	}
+
+	inline uint32_t load16(const uint8_t* p)
+	{
+		return p[0]|((uint32_t)p[1]<<8);
+	}
+
+	inline uint32_t load32(const uint8_t* p)
+	{
+		return load16(p)|(load16(p+2)<<16);
+	}
+
+	inline uint64_t load64(const uint8_t* p)
+	{
+		return load32(p)|((uint64_t)load32(p+4)<<32);
+	}
+}
@@ -7,9 +7,13 @@ public:
 		MASK=BIT_MASK(T,bits)
 	};
 
+protected:
+	// dependent base member, for two-phase lookup
+	using value_object<T>::_value;
+
 public:
 	// default ctor
-	flag_set():value_object(0) {} // value initialized to zero
+	flag_set():value_object<T>(0) {} // value initialized to zero
 
 	// bit field converter
 	bit_field<T,bits>& asBitField()
@@ -30,7 +34,7 @@ public:
 	}
 
 	// safe auto boxing
-	flag_set(const bit_field<T,bits>& rhs):value_object(0)
+	flag_set(const bit_field<T,bits>& rhs):value_object<T>(0)
 	{
 		_value=valueOf(rhs);
 	}
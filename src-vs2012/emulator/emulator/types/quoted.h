@@ -0,0 +1,25 @@
+#pragma once
+
+#include <string>
+
+// writes text as a quoted field of a csv file, or as a json string with the
+// quotes, backslashes and control characters escaped
+inline void writeQuoted(FILE* fp, const std::string& text, const bool json)
+{
+	fputc('"', fp);
+	for (size_t i=0; i<text.size(); i++)
+	{
+		const unsigned char c=(unsigned char)text[i];
+		if (!json)
+		{
+			if (c=='"') fputc('"', fp);
+			fputc(c, fp);
+		}else if (c=='"' || c=='\\')
+			fprintf(fp, "\\%c", c);
+		else if (c<0x20)
+			fprintf(fp, "\\u%04x", c);
+		else
+			fputc(c, fp);
+	}
+	fputc('"', fp);
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <atomic>
+
+template <typename T, int size>
+// lock-free ring buffer for exactly one producer thread and one consumer thread.
+// one slot stays free to tell a full queue from an empty one.
+class spsc_queue {
+public:
+	enum
+	{
+		CAPACITY=size-1,
+		__TYPE_CHECK=STATIC_ASSERT(size>=2 && (size&(size-1))==0)
+	};
+
+	spsc_queue(): _head(0), _tail(0)
+	{
+	}
+
+	// producer side, returns false when the queue is full
+	bool push(const T& item)
+	{
+		const unsigned tail=_tail.load(std::memory_order_relaxed);
+		const unsigned next=(tail+1)&(size-1);
+		if (next==_head.load(std::memory_order_acquire)) return false;
+		_items[tail]=item;
+		_tail.store(next, std::memory_order_release);
+		return true;
+	}
+
+	// producer side, returns the number of items written
+	size_t push(const T items[], const size_t count)
+	{
+		const unsigned tail=_tail.load(std::memory_order_relaxed);
+		const unsigned head=_head.load(std::memory_order_acquire);
+		const size_t n=min(count, (size_t)((head-tail-1)&(size-1)));
+		for (size_t i=0; i<n; i++)
+		{
+			_items[(tail+i)&(size-1)]=items[i];
+		}
+		_tail.store((unsigned)(tail+n)&(size-1), std::memory_order_release);
+		return n;
+	}
+
+	// consumer side
+	bool empty() const
+	{
+		return _head.load(std::memory_order_relaxed)==_tail.load(std::memory_order_acquire);
+	}
+
+	// the oldest item, stays in the queue
+	bool peek(T& item) const
+	{
+		const unsigned head=_head.load(std::memory_order_relaxed);
+		if (head==_tail.load(std::memory_order_acquire)) return false;
+		item=_items[head];
+		return true;
+	}
+
+	bool pop(T& item)
+	{
+		if (!peek(item)) return false;
+		_head.store((_head.load(std::memory_order_relaxed)+1)&(size-1), std::memory_order_release);
+		return true;
+	}
+
+	// returns the number of items read
+	size_t pop(T items[], const size_t count)
+	{
+		const unsigned head=_head.load(std::memory_order_relaxed);
+		const unsigned tail=_tail.load(std::memory_order_acquire);
+		const size_t n=min(count, (size_t)((tail-head)&(size-1)));
+		for (size_t i=0; i<n; i++)
+		{
+			items[i]=_items[(head+i)&(size-1)];
+		}
+		_head.store((unsigned)(head+n)&(size-1), std::memory_order_release);
+		return n;
+	}
+
+private:
+	T _items[size];
+
+	// each index is written by one side only, keep them on separate cache lines
+	std::atomic<unsigned> _head; // next item to read, owned by the consumer
+	char _padding[64];
+	std::atomic<unsigned> _tail; // next free slot, owned by the producer
+
+	spsc_queue(const spsc_queue&);
+	spsc_queue& operator=(const spsc_queue&);
+};
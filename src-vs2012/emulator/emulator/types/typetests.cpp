@@ -3,6 +3,11 @@
 #include "../macros.h"
 #include "../unittest/framework.h"
 #include "types.h"
+#include "spsc.h"
+#include "../../KFramework/KFrameQueue.h"
+#include "../../KFramework/KThreadPool.h"
+
+#include <thread>
 
 #include "../nes/internals.h"
 
@@ -31,6 +36,11 @@ public:
 		return "BitField Unit Test";
 	}
 
+	virtual bool parallel()
+	{
+		return true;
+	}
+
 	virtual TestResult run()
 	{
 		addr14_t videoAddr;
@@ -38,7 +48,7 @@ public:
 
 		static_assert(sizeof(_addr14_t)==sizeof(videoAddr),"BIT size error");
 
-		printf("videoAddr=%X\n",videoAddr);
+		message("videoAddr=%X\n",valueOf(videoAddr));
 		// out of range test
 		// videoAddr=0xFFFF;
 
@@ -55,12 +65,12 @@ public:
 
 		inc(videoAddr);
 		tassert(videoAddr==0 && videoAddr.zero());
-		printf("%X\n",videoAddr);
+		message("%X\n",valueOf(videoAddr));
 
 		dec(videoAddr);
 		tassert(videoAddr==0x3FFF && !videoAddr.zero());
 		tassert(videoAddr.reachMax());
-		printf("%X\n",valueOf(videoAddr));
+		message("%X\n",valueOf(videoAddr));
 		tassert(MSB(videoAddr) && LSB(videoAddr) && videoAddr.negative());
 		videoAddr.selfShr(2);
 		tassert(videoAddr==0xFFF);
@@ -134,11 +144,16 @@ public:
 		return "FlagSet Unit Test";
 	}
 
+	virtual bool parallel()
+	{
+		return true;
+	}
+
 	virtual TestResult run()
 	{
 		flag_set<_reg8_t,PSW,8> P;
 		static_assert(sizeof(_reg8_t)==sizeof(P),"FLAG size error");
-		printf("P=%X\n",valueOf(P));
+		message("P=%X\n",valueOf(P));
 		P.clearAll();
 		tassert(!P.any());
 
@@ -200,6 +215,11 @@ public:
 		return "BitField&FlagSet Interoperability Test";
 	}
 
+	virtual bool parallel()
+	{
+		return true;
+	}
+
 	virtual TestResult run()
 	{
 		maddr8_t bf;
@@ -219,6 +239,212 @@ public:
 	}
 };
 
+class SPSCQueueTest : public TestCase
+{
+public:
+	virtual const char* name()
+	{
+		return "SPSC Queue Test";
+	}
+
+	virtual bool parallel()
+	{
+		return true;
+	}
+
+	virtual TestResult run()
+	{
+		spsc_queue<int,8> q;
+		int item;
+
+		message("checking full and empty queue...\n");
+		tassert(q.empty() && !q.pop(item));
+		for (int i=0; i<q.CAPACITY; i++)
+		{
+			tassert(q.push(i));
+		}
+		tassert(!q.push(-1));
+		tassert(q.peek(item) && item==0);
+		for (int i=0; i<q.CAPACITY; i++)
+		{
+			tassert(q.pop(item) && item==i);
+		}
+		tassert(q.empty());
+
+		message("checking bulk transfers...\n");
+		const int items[10]={0,1,2,3,4,5,6,7,8,9};
+		int out[10];
+		tassert(q.push(items, 5)==5);
+		tassert(q.pop(out, 3)==3 && out[2]==2);
+		tassert(q.push(items, 10)==5); // wraps around
+		tassert(q.pop(out, 10)==7 && out[0]==3 && out[1]==4 && out[6]==4);
+		tassert(q.empty());
+
+		message("checking order across threads...\n");
+		static const int COUNT=100000;
+		static spsc_queue<int,64> shared;
+		std::thread producer([]
+		{
+			for (int i=0; i<COUNT; i++)
+			{
+				while (!shared.push(i)) std::this_thread::yield();
+			}
+		});
+		int expected=0;
+		while (expected<COUNT)
+		{
+			if (shared.pop(item))
+			{
+				if (item!=expected) break;
+				expected++;
+			}else
+				std::this_thread::yield();
+		}
+		producer.join();
+		tassert(expected==COUNT && shared.empty());
+
+		return SUCCESS;
+	}
+};
+
+class FrameQueueTest : public TestCase
+{
+public:
+	virtual const char* name()
+	{
+		return "Frame Queue Test";
+	}
+
+	virtual bool parallel()
+	{
+		return true;
+	}
+
+	virtual TestResult run()
+	{
+		static const size_t FRAME_SIZE=256;
+		uint8_t frame[FRAME_SIZE];
+
+		message("checking a full queue...\n");
+		KFrameQueue q(FRAME_SIZE, 3);
+		tassert(q.empty() && q.front()==NULL);
+		for (int i=0; i<3; i++)
+		{
+			memset(frame, i, FRAME_SIZE);
+			tassert(q.push(frame));
+		}
+		tassert(q.size()==3 && !q.push(frame)); // never waits
+		tassert(q.front()[0]==0 && q.front()[FRAME_SIZE-1]==0);
+		q.pop();
+		tassert(q.push(frame) && q.size()==3);
+		tassert(q.wait(0) && q.front()[0]==1);
+
+		message("checking wake-ups across threads...\n");
+		static const int COUNT=2000;
+		static KFrameQueue shared(FRAME_SIZE, 2);
+		static int dropped;
+		dropped=0;
+		std::thread producer([]
+		{
+			uint8_t frame[FRAME_SIZE];
+			for (int i=0; i<COUNT; i++)
+			{
+				memset(frame, i&0xFF, FRAME_SIZE);
+				if (!shared.push(frame)) dropped++;
+				if (i%100==0) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+			shared.cancel();
+		});
+		int received=0;
+		bool intact=true;
+		while (shared.wait(1000))
+		{
+			const uint8_t* f=shared.front();
+			intact&=(f[0]==f[FRAME_SIZE-1]);
+			shared.pop();
+			received++;
+		}
+		producer.join();
+		while (shared.front()) {shared.pop(); received++;}
+		tassert(intact && received+dropped==COUNT);
+
+		return SUCCESS;
+	}
+};
+
+class ThreadingTest : public TestCase
+{
+public:
+	virtual const char* name()
+	{
+		return "Threading Primitives Test";
+	}
+
+	virtual bool parallel()
+	{
+		return true;
+	}
+
+	virtual TestResult run()
+	{
+		message("checking events...\n");
+		KEvent manual(TRUE, FALSE), automatic;
+		tassert(!manual.wait(0) && !automatic.wait(1));
+		manual.set(); automatic.set();
+		tassert(manual.wait(0) && manual.wait(0)); // stays set
+		tassert(automatic.wait(0) && !automatic.wait(0)); // released one waiter
+		manual.reset();
+		tassert(!manual.wait(0));
+
+		message("checking a recursive mutex...\n");
+		KMutex mtx;
+		mtx.Enter();
+		tassert(mtx.tryEnter());
+		mtx.Leave();
+		mtx.Leave();
+
+		message("checking the thread pool...\n");
+		static const int COUNT=10000;
+		static volatile LONG total;
+		static KMutex sumLock;
+		static long long sum;
+		total=0; sum=0;
+		{
+			KThreadPool pool(4);
+			tassert(pool.getThreadCount()==4);
+			for (int i=0; i<COUNT/10; i++)
+			{
+				pool.submit([&pool, i]
+				{
+					// tasks spawned by a worker land in its own queue and get stolen
+					for (int j=0; j<10; j++)
+					{
+						const int value=i*10+j;
+						pool.submit([value]
+						{
+							InterlockedIncrement(&total);
+							AUTO_LOCK(sumLock);
+							sum+=value;
+						});
+					}
+				});
+			}
+			pool.wait();
+			tassert(total==COUNT && sum==(long long)COUNT*(COUNT-1)/2);
+
+			// the pool is reusable after a wait
+			pool.submit([]{InterlockedIncrement(&total);});
+			pool.wait();
+			tassert(total==COUNT+1);
+		}
+
+		return SUCCESS;
+	}
+};
+
 registerTestCase(BitFieldTest);
 registerTestCase(FlagSetTest);
-registerTestCase(BFFSInteropTest);
\ No newline at end of file
+registerTestCase(BFFSInteropTest);
+registerTestCase(SPSCQueueTest);
+registerTestCase(FrameQueueTest);
+registerTestCase(ThreadingTest);
\ No newline at end of file
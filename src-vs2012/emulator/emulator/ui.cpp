@@ -6,33 +6,94 @@
 #include "unittest/framework.h"
 
 #include "nes/internals.h"
+#include "nes/dirty.h"
+#include "nes/state.h"
+#include "nes/ppu.h"
 #include "nes/emu.h"
+#include "nes/input.h"
+#include "nes/pacer.h"
 #include "ui.h"
+
+#ifdef _WIN32
 #include "kfw.h"
 
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
 #include <mmsystem.h>
+#endif
 
 namespace ui
 {
 	static bool quitRequired = false;
 
+#ifdef _WIN32
 	// controller state
-	static bool joypadPresent[2] = {false};
-	static unsigned joypadPosition[2];
-	static int buttonState[2][BUTTON_COUNT];
 	static int buttonMapping[2][BUTTON_COUNT];
 
 	// render state
-	static const int MAX_FPS = 60;
-	static const int TIMER_RESOLUTION = 2;
+	static const int TIMER_RESOLUTION = 1; // for the sleeps of the pacer
 	static int fpsCounter=0;
-	static UINT frameTimer;
-	static HANDLE frameTickEvent;
 	static ULONGLONG frameStartTime;
 	static ULONGLONG lastSecond;
 
+	// frames rewound per frame while the rewind key is held
+	static const int REWIND_SPEED = 2;
+
+	// a real joypad can't press opposite directions at once
+	static int filterDirections(int buttons)
+	{
+		if (buttons&(1<<BUTTON_RIGHT)) buttons&=~(1<<BUTTON_LEFT);
+		if (buttons&(1<<BUTTON_DOWN)) buttons&=~(1<<BUTTON_UP);
+		return buttons;
+	}
+
+#ifdef WANT_DX9
+	// key events are posted by the window thread as they arrive
+	static input::QueueProvider keyboard;
+	static int keyboardButtons[2]; // owned by the window thread
+
+	static void onKey(void* context, const int key, const bool down)
+	{
+		for (int p=0;p<2;p++)
+		{
+			int buttons=keyboardButtons[p];
+			for (int i=0;i<BUTTON_COUNT;i++)
+			{
+				if (buttonMapping[p][i]==key)
+				{
+					if (down)
+						buttons|=1<<i;
+					else
+						buttons&=~(1<<i);
+				}
+			}
+			if (buttons!=keyboardButtons[p])
+			{
+				keyboardButtons[p]=buttons;
+				keyboard.post(p, filterDirections(buttons));
+			}
+		}
+	}
+#else
+	// the keyboard is polled whenever the game latches the joypads
+	class KeyboardProvider : public input::Provider
+	{
+	public:
+		virtual int sample(const int player)
+		{
+			int buttons=0;
+			for (int i=0;i<BUTTON_COUNT;i++)
+			{
+				if (GetAsyncKeyState(buttonMapping[player][i])&0x8000)
+					buttons|=1<<i;
+			}
+			return filterDirections(buttons);
+		}
+	};
+
+	static KeyboardProvider keyboard;
+#endif // WANT_DX9
+
 	void init()
 	{
 #ifdef WANT_DX9
@@ -48,22 +109,17 @@ namespace ui
 		buttonMapping[0][BUTTON_DOWN]=VK_DOWN;
 		buttonMapping[0][BUTTON_LEFT]=VK_LEFT;
 		buttonMapping[0][BUTTON_RIGHT]=VK_RIGHT;
-		joypadPresent[0]=true;
+		input::setProvider(&keyboard);
 	}
 
 	void deinit()
 	{
+		input::setProvider(nullptr);
 #ifdef WANT_DX9
 		dx9render::deinit();
 #endif
 	}
 
-	void reset()
-	{
-		// reset input state
-		resetInput();
-	}
-
 	void blt32(const uint32_t buffer[], const int width, const int height)
 	{
 #ifdef WANT_DX9
@@ -80,23 +136,16 @@ namespace ui
 #endif
 	}
 
-	void CALLBACK FrameTimerCallBack(UINT uID,UINT uMsg,DWORD_PTR dwUsers,DWORD_PTR dw1,DWORD_PTR dw2)
-	{
-		SetEvent(frameTickEvent);
-	}
-
 	void onGameStart()
 	{
 #ifdef WANT_DX9
-		dx9render::create(SCREEN_WIDTH, SCREEN_HEIGHT);
+		dx9render::create(ppu::frameWidth(), ppu::frameHeight());
+		dx9render::setKeyCallback(onKey, nullptr);
 #endif
 #ifdef FPS_LIMIT
 		timeBeginPeriod(TIMER_RESOLUTION);
-		frameTickEvent=CreateEvent(NULL, FALSE, TRUE, NULL);
-		frameTimer=timeSetEvent(1000/MAX_FPS, TIMER_RESOLUTION, FrameTimerCallBack, 0, TIME_PERIODIC);
-		assert(frameTickEvent && frameTimer!=0);
+		pacer::start();
 #endif // FPS_LIMIT
-
 	}
 
 	void onGameEnd()
@@ -105,8 +154,7 @@ namespace ui
 		dx9render::destroy();
 #endif
 #ifdef FPS_LIMIT
-		timeKillEvent(frameTimer);
-		CloseHandle(frameTickEvent);
+		pacer::stop();
 		timeEndPeriod(TIMER_RESOLUTION);
 #endif
 	}
@@ -126,56 +174,16 @@ namespace ui
 			{
 				// display status in window title
 				TCHAR caption[256];
-				wsprintf(caption, _T("FPS: %d"), fpsCounter);
+				pacer::STATISTICS s;
+				pacer::statistics(s);
+				wsprintf(caption, _T("FPS: %d, frame time p99: %d us, jitter p99: %d us"), fpsCounter, (int)s.p99, (int)s.jitterP99);
 				dx9render::setTitle(caption);
 			}
 			fpsCounter=0;
 			lastSecond=GetTickCount64();
 		}
 #endif // WANT_DX9
-		// printf("Frame %I64d\n", emu::frameCount());
-	}
-
-	void readKeyboardState()
-	{
-		for (int p=0;p<2;p++)
-		{
-			if (hasInput(p))
-			{
-				for (int i=0;i<BUTTON_COUNT;i++)
-				{
-#ifdef WANT_DX9
-					if (dx9render::keyDown(buttonMapping[p][i]))
-#else
-					const SHORT ret=GetAsyncKeyState(buttonMapping[p][i]);
-					if (ret&0x8000)
-#endif
-					{
-						buttonState[p][i]=0x41;
-						switch (i)
-						{
-						case BUTTON_RIGHT:
-							buttonState[p][BUTTON_LEFT]=0x40;
-							break;
-						case BUTTON_DOWN:
-							buttonState[p][BUTTON_UP]=0x40;
-							break;
-						}
-					}
-#ifdef WANT_DX9
-					else if (dx9render::keyUp(buttonMapping[p][i]))
-#else
-					else if (ret&1)
-#endif
-					{
-						buttonState[p][i]=0x40;
-					}else
-					{
-						buttonState[p][i]=0;
-					}
-				}
-			}
-		}
+		// printf("Frame %lld\n", emu::frameCount());
 	}
 
 	void doEvents()
@@ -187,9 +195,6 @@ namespace ui
 #endif
 #endif
 
-		// read keyboard state
-		readKeyboardState();
-
 		// hotkeys
 #ifdef WANT_DX9
 		if (dx9render::keyPressed(VK_ESCAPE))
@@ -205,7 +210,6 @@ namespace ui
 			else
 #endif
 			{
-				ui::reset();
 				emu::reset();
 				emu::setup();
 			}
@@ -218,23 +222,39 @@ namespace ui
 		if (dx9render::keyPressed('S'))
 		{
 			FILE *fp=fopen("default.sav","wb");
-			emu::saveState(fp);
-			fclose(fp);
-			puts("State saved");
+			if (fp!=nullptr && emu::saveState(fp))
+				puts("State saved");
+			else
+				puts("Failed to save state");
+			if (fp!=nullptr) fclose(fp);
 		}else if (dx9render::keyPressed('L'))
 		{
 			FILE *fp=fopen("default.sav","rb");
 			if (fp!=nullptr)
 			{
-				ui::reset(); // necessary
-				emu::loadState(fp);
-				puts("State loaded");
+				if (emu::loadState(fp))
+					puts("State loaded");
+				else
+					puts("Incompatible state file");
 				fclose(fp);
 			}else
 			{
 				puts("Previous state not found");
 			}
 		}
+
+		// hold R to rewind
+		if (dx9render::keyDown('R'))
+		{
+			emu::rewind(REWIND_SPEED+1);
+		}
+#endif
+
+		// hold Tab to fast-forward
+#ifdef WANT_DX9
+		emu::setFastForward(dx9render::keyDown(VK_TAB));
+#else
+		emu::setFastForward((GetAsyncKeyState(VK_TAB)&0x8000)!=0);
 #endif
 
 #ifdef WANT_DX9
@@ -246,48 +266,53 @@ namespace ui
 	void limitFPS()
 	{
 #ifdef FPS_LIMIT
-		WaitForSingleObject(frameTickEvent, 1000/MAX_FPS);
-		return;
-		
-		/*
-			long long msToWait = 1000/MAX_FPS-(GetTickCount64()-frameStartTime);
-			if (msToWait>0 && msToWait<1000)
-			{
-				Sleep((int)msToWait);
-			}
-		*/
+		pacer::wait();
 #endif
 	}
+#else
+	// headless: no window and no keyboard, frames are paced with FPS_LIMIT only.
+	// input comes from the provider set by the caller (see input.h).
+	void init()
+	{
+	}
 
-	void resetInput()
+	void deinit()
 	{
-		joypadPosition[0]=0;
-		joypadPosition[1]=0;
 	}
 
-	bool hasInput(const int player)
+	void blt32(const uint32_t buffer[], const int width, const int height)
 	{
-		vassert(player==0 || player==1);
-		return joypadPresent[player];
 	}
 
-	int readInput(const int player)
+	void onGameStart()
 	{
-		assert(hasInput(player));
-		return readInput(player, joypadPosition[player]++);
+#ifdef FPS_LIMIT
+		pacer::start();
+#endif
 	}
 
-	int readInput(const int player, const int button)
+	void onGameEnd()
 	{
-		assert(hasInput(player));
-		assert(button>=0 && button<BUTTON_COUNT);
-		if (hasInput(player))
-		{
-			if (button>=BUTTON_COUNT) return 1;
-			return buttonState[player%2][button%BUTTON_COUNT];
-		}else
-			return 0;
+		pacer::stop();
+	}
+
+	void onFrameBegin()
+	{
+	}
+
+	void onFrameEnd()
+	{
+	}
+
+	void doEvents()
+	{
+	}
+
+	void limitFPS()
+	{
+		pacer::wait();
 	}
+#endif // _WIN32
 
 	bool forceTerminate()
 	{
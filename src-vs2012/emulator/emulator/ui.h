@@ -13,15 +13,9 @@ namespace ui
 	// global functions
 	void init();
 	void deinit();
-	void reset();
 
 	void blt32(const uint32_t buffer[], const int width, const int height);
 
-	bool hasInput(const int player);
-	void resetInput();
-	int readInput(const int player);
-	int readInput(const int player, const int button);
-
 	bool isForeground();
 
 	bool forceTerminate();
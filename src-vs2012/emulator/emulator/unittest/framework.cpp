@@ -1,9 +1,20 @@
 #include "../stdafx.h"
 
 #include "../macros.h"
+#include "../types/quoted.h"
 #include "framework.h"
 
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
 #include <list>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
 using namespace std;
 
 class TestFrameworkImpl
@@ -17,11 +28,63 @@ TestFramework& TestCase::framework()
 	return TestFramework::instance();
 }
 
+// the output kept of the test running on this thread, see runSelected()
+static __declspec(thread) std::string *keptOutput = nullptr;
+
+void TestCase::message(const char * format, ...)
+{
+	char text[1024];
+	va_list args;
+	va_start(args, format);
+	_vsnprintf(text, sizeof(text), format, args);
+	va_end(args);
+	text[sizeof(text) - 1] = 0;
+	if (keptOutput) *keptOutput += text;
+	else fputs(text, stdout);
+}
+
+bool TestCase::fileIs(const _TCHAR * file, const char * expected)
+{
+	std::string text;
+	FILE *fp = nullptr;
+	_tfopen_s(&fp, file, _T("rb"));
+	if (fp == nullptr) return false;
+	char block[0x1000];
+	for (size_t n; (n = fread(block, 1, sizeof(block), fp)) > 0; )
+		text.append(block, n);
+	fclose(fp);
+	_tremove(file);
+	return text == expected;
+}
+
+std::basic_string<_TCHAR> TestCase::tempFile(const _TCHAR * name)
+{
+	static std::atomic<unsigned> calls(0);
+#ifdef _WIN32
+	const _TCHAR * dir = _tgetenv(_T("TEMP"));
+	const _TCHAR * fallback = _T(".");
+	const int pid = _getpid();
+#else
+	const char * dir = getenv("TMPDIR");
+	const char * fallback = "/tmp";
+	const int pid = (int)getpid();
+#endif
+	std::basic_string<_TCHAR> path = (dir != nullptr && dir[0] != 0) ? dir : fallback;
+	if (path.back() != _T('/') && path.back() != _T('\\')) path += _T('/');
+
+	// the digits are the same in both character sets
+	char unique[32];
+	sprintf(unique, "nes-%d-%u-", pid, calls++);
+	for (const char * p = unique; *p; p++) path += (_TCHAR)*p;
+	return path + name;
+}
+
 TestFramework* TestFramework::_singleton = NULL;
 
 TestFramework::TestFramework()
 {
 	_pImpl = new TestFrameworkImpl();
+	_breakOnFailure = true;
 }
 
 TestFramework::~TestFramework()
@@ -53,7 +116,9 @@ TestResult TestFramework::runTestCase(TestCase *obj)
 	obj->setUp();
 	// run
 	puts("[ ] running...");
-	const TestResult result = obj->run();
+	obj->_assertionFailed = false;
+	TestResult result = obj->run();
+	if (obj->_assertionFailed) result = FAILED;
 	// verify result and print error message
 	if (result != SUCCESS)
 	{
@@ -69,12 +134,16 @@ TestResult TestFramework::runTestCase(TestCase *obj)
 	return result;
 }
 
-void TestFramework::runAll()
+bool TestFramework::runAll(const bool ci)
 {
 	bool ok = true;
-	puts("[+] runAll()");
+	puts(ci ? "[+] runAll(ci)" : "[+] runAll()");
 	for (auto it : _pImpl->fTestCases)
 	{
+		if (it->ciOnly() && !ci)
+		{
+			continue;
+		}
 		auto result = runTestCase(it);
 		if (result != SUCCESS)
 		{
@@ -89,6 +158,114 @@ void TestFramework::runAll()
 		puts("[-] ALL TEST CASES PASSED!");
 	}
 	puts("");
+	return ok;
+}
+
+static bool selected(TestCase *obj, const char * filter, const bool ci)
+{
+	if (obj->ciOnly() && !ci) return false;
+	return filter == nullptr || strstr(obj->name(), filter) != nullptr;
+}
+
+bool TestFramework::runSelected(const char * filter, const bool ci, const int jobs, std::vector<TestRecord>& records)
+{
+	std::vector<TestCase*> tests;
+	for (auto it : _pImpl->fTestCases)
+	{
+		if (selected(it, filter, ci)) tests.push_back(it);
+	}
+	records.assign(tests.size(), TestRecord());
+
+	std::mutex outputLock;
+	auto runOne = [&](const size_t i) {
+		TestCase *obj = tests[i];
+		std::string output;
+		if (obj->parallel()) keptOutput = &output;
+		const auto start = std::chrono::high_resolution_clock::now();
+		obj->_assertionFailed = false;
+		obj->setUp();
+		TestResult result = obj->run();
+		obj->tearDown();
+		if (obj->_assertionFailed) result = FAILED;
+		const auto end = std::chrono::high_resolution_clock::now();
+
+		TestRecord& r = records[i];
+		r.name = obj->name();
+		r.result = result;
+		r.milliseconds = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / 1000.0;
+		r.parallel = obj->parallel();
+		if (result != SUCCESS) obj->displayError();
+		keptOutput = nullptr;
+
+		std::lock_guard<std::mutex> lock(outputLock);
+		fputs(output.c_str(), stdout);
+		printf("%s %9.1f ms  %s\n", (result == SUCCESS) ? "[-] passed" : "[X] FAILED", r.milliseconds, r.name.c_str());
+	};
+
+	// failures are recorded, the run goes on
+	_breakOnFailure = false;
+	const auto start = std::chrono::high_resolution_clock::now();
+	std::atomic<size_t> next(0);
+	std::vector<std::thread> workers;
+	const int hardware = (int)std::thread::hardware_concurrency();
+	const int threads = (jobs > 0) ? jobs : (hardware > 0) ? hardware : 1;
+	for (int t = 0; t < threads; t++)
+	{
+		workers.push_back(std::thread([&]() {
+			for (size_t i; (i = next++) < tests.size(); )
+			{
+				if (tests[i]->parallel()) runOne(i);
+			}
+		}));
+	}
+	for (auto& worker : workers) worker.join();
+	// the others print as they go, e.g. the emulator's own output
+	for (size_t i = 0; i < tests.size(); i++)
+	{
+		if (!tests[i]->parallel()) runOne(i);
+	}
+	const auto end = std::chrono::high_resolution_clock::now();
+	_breakOnFailure = true;
+
+	int failed = 0;
+	for (auto& r : records)
+	{
+		if (r.result != SUCCESS) failed++;
+	}
+	printf("[%s] %d of %d tests passed in %.1f ms\n", failed ? "X" : "-", (int)records.size() - failed, (int)records.size(),
+		std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / 1000.0);
+	return failed == 0;
+}
+
+bool TestFramework::writeResults(const _TCHAR * file, const std::vector<TestRecord>& records)
+{
+	FILE *fp = nullptr;
+	_tfopen_s(&fp, file, _T("wb"));
+	if (fp == nullptr) return false;
+
+	const size_t length = _tcslen(file);
+	const bool json = length > 5 && _tcsicmp(file + length - 5, _T(".json")) == 0;
+	if (json) fputs("[", fp);
+	else fputs("name,result,milliseconds,parallel\n", fp);
+	for (size_t i = 0; i < records.size(); i++)
+	{
+		const TestRecord& r = records[i];
+		const char *result = (r.result == SUCCESS) ? "passed" : "failed";
+		if (json)
+		{
+			fputs(i > 0 ? ",\n{\"name\":" : "\n{\"name\":", fp);
+			writeQuoted(fp, r.name, true);
+			fprintf(fp, ",\"result\":\"%s\",\"milliseconds\":%.3f,\"parallel\":%s}", result, r.milliseconds, r.parallel ? "true" : "false");
+		}else
+		{
+			writeQuoted(fp, r.name, false);
+			fprintf(fp, ",%s,%.3f,%d\n", result, r.milliseconds, r.parallel ? 1 : 0);
+		}
+	}
+	if (json) fputs("\n]\n", fp);
+	const bool ok = !ferror(fp);
+	fclose(fp);
+	return ok;
 }
 
 void TestFramework::deleteAll()
@@ -103,6 +280,51 @@ void TestFramework::deleteAll()
 
 void TestFramework::assertion(const wchar_t * expression, const wchar_t * file, unsigned long line_number, TestCase * obj)
 {
-	wprintf(L"[X] Assertion failed: %s\n[X] Location: %s: %ld\n", expression, file, line_number);
-	__debugbreak();
-}
\ No newline at end of file
+	TestCase::message("[X] Assertion failed: %ls\n[X] Location: %ls: %ld\n", expression, file, line_number);
+	if (obj) obj->_assertionFailed = true;
+	if (_breakOnFailure) __debugbreak();
+}
+
+// unit tests
+class TestResultsTest : public TestCase
+{
+public:
+	virtual const char * name()
+	{
+		return "Test Results Export Test";
+	}
+
+	virtual bool parallel()
+	{
+		return true;
+	}
+
+	virtual TestResult run()
+	{
+		std::vector<TestRecord> records(2);
+		records[0].name = "A \"quoted\" test";
+		records[0].result = SUCCESS;
+		records[0].milliseconds = 1.5;
+		records[0].parallel = true;
+		records[1].name = "B\t1";
+		records[1].result = FAILED;
+		records[1].milliseconds = 20;
+		records[1].parallel = false;
+
+		const std::basic_string<_TCHAR> csv = tempFile(_T("results.csv"));
+		tassert(TestFramework::writeResults(csv.c_str(), records));
+		tassert(fileIs(csv.c_str(),
+			"name,result,milliseconds,parallel\n"
+			"\"A \"\"quoted\"\" test\",passed,1.500,1\n"
+			"\"B\t1\",failed,20.000,0\n"));
+		// control characters are escaped in json
+		const std::basic_string<_TCHAR> json = tempFile(_T("results.json"));
+		tassert(TestFramework::writeResults(json.c_str(), records));
+		tassert(fileIs(json.c_str(),
+			"[\n{\"name\":\"A \\\"quoted\\\" test\",\"result\":\"passed\",\"milliseconds\":1.500,\"parallel\":true},\n"
+			"{\"name\":\"B\\u00091\",\"result\":\"failed\",\"milliseconds\":20.000,\"parallel\":false}\n]\n"));
+		return SUCCESS;
+	}
+};
+
+registerTestCase(TestResultsTest);
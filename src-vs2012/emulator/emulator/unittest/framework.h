@@ -1,5 +1,8 @@
 #pragma once
 
+#include <string>
+#include <vector>
+
 class TestFramework;
 class TestFrameworkImpl;
 
@@ -16,9 +19,30 @@ class TestCase
 public:
 	virtual const char * name() = 0;
 
+	TestCase() : _assertionFailed(false) {}
+	virtual ~TestCase() {}
+
+	// long-running tests, only run by runAll(true) in CI
+	virtual bool ciOnly() { return false; }
+
+	// tests that touch no global state, they may run on other threads
+	// alongside the rest
+	virtual bool parallel() { return false; }
+
 	// utility to retrieve the test framework
 	static TestFramework& framework();
 
+	// a path in the temporary directory, unique to the process and the call,
+	// ending with name. for files of tests that run in parallel.
+	static std::basic_string<_TCHAR> tempFile(const _TCHAR * name);
+
+	// true if the file holds exactly the expected text. the file is deleted.
+	static bool fileIs(const _TCHAR * file, const char * expected);
+
+	// prints like printf. runSelected() keeps the output of a parallel test
+	// and prints it with the test's result.
+	static void message(const char * format, ...);
+
 protected:
 	virtual void setUp() {}
 	
@@ -28,6 +52,18 @@ protected:
 	virtual void tearDown() {}
 
 	virtual void displayError() {}
+
+private:
+	bool _assertionFailed;
+};
+
+// the outcome of a test in runSelected()
+struct TestRecord
+{
+	std::string name;
+	TestResult result;
+	double milliseconds;
+	bool parallel;
 };
 
 template<class T>
@@ -36,7 +72,7 @@ class TestCaseAutoRegister
 public:
 	TestCaseAutoRegister()
 	{
-		TestFramework::instance().addTestCase(new T());
+		T::framework().addTestCase(new T());
 	}
 };
 
@@ -46,7 +82,16 @@ public:
 	// test case manager
 	template <class TC> TestResult runTestCase();
 	TestResult runTestCase(TestCase *);
-	void runAll();
+	bool runAll(const bool ci = false);
+
+	// runs the tests whose name contains filter, or all of them, without the
+	// setup/run/cleanup chatter: first the parallel tests on this many threads
+	// (0: one per hardware thread), then the others in turn on this one.
+	// a failed assertion fails its test instead of breaking into the debugger.
+	bool runSelected(const char * filter, const bool ci, const int jobs, std::vector<TestRecord>& records);
+
+	// a json file if the name ends with .json, csv otherwise
+	static bool writeResults(const _TCHAR * file, const std::vector<TestRecord>& records);
 
 	void addTestCase(TestCase *);
 	void deleteAll();
@@ -81,8 +126,10 @@ private:
 	static TestFramework *_singleton;
 
 	TestFrameworkImpl *_pImpl;
+	bool _breakOnFailure;
 };
 
 #define registerTestCase(C) static TestCaseAutoRegister<C> __ ## C ## _register
 
-#define tassert(E) if (!(E)) (framework().assertion(_CRT_WIDE(#E), _CRT_WIDE(__FILE__), __LINE__, this))
\ No newline at end of file
+// a failed assertion ends the test, the rest of it may depend on what failed
+#define tassert(E) if (!(E)) { framework().assertion(_CRT_WIDE(#E), _CRT_WIDE(__FILE__), __LINE__, this); return FAILED; } else (void)0
\ No newline at end of file